@@ -0,0 +1,94 @@
+#include "../inc/jmap.h"
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * A bump arena used as the allocator of a map: allocating is a pointer increment, free does nothing,
+ * and the whole map (table, keys, side tables) is released at once by resetting the arena.
+ */
+
+typedef struct ARENA {
+    char *base;
+    size_t size;
+    size_t used;
+    size_t allocations;
+} ARENA;
+
+static void *arena_aligned_alloc(size_t alignment, size_t size, void *ctx) {
+    ARENA *arena = ctx;
+    size_t start = (arena->used + alignment - 1) & ~(alignment - 1);
+    if (start + size > arena->size) return NULL;
+    arena->used = start + size;
+    arena->allocations++;
+    return arena->base + start;
+}
+
+static void *arena_alloc(size_t size, void *ctx) {
+    return arena_aligned_alloc(16, size, ctx);
+}
+
+static void *arena_realloc(void *ptr, size_t old_size, size_t new_size, void *ctx) {
+    ARENA *arena = ctx;
+    // The last block can grow in place
+    if (ptr && (char*)ptr + old_size == arena->base + arena->used
+        && (size_t)((char*)ptr - arena->base) + new_size <= arena->size) {
+        arena->used = (size_t)((char*)ptr - arena->base) + new_size;
+        return ptr;
+    }
+    void *copy = arena_alloc(new_size, ctx);
+    if (copy && ptr) memcpy(copy, ptr, old_size < new_size ? old_size : new_size);
+    return copy;
+}
+
+static void arena_free(void *ptr, size_t size, void *ctx) {
+    (void)ptr;
+    (void)size;
+    (void)ctx;
+}
+
+static void print_int(const void *x){
+    printf("%d", *(const int*)x);
+}
+
+int main(void){
+    ARENA arena = { .size = 1 << 20 };
+    arena.base = malloc(arena.size);
+    if (!arena.base) return 1;
+
+    JMAP_ALLOCATOR allocator = {
+        .alloc = arena_alloc,
+        .realloc = arena_realloc,
+        .free = arena_free,
+        .aligned_alloc = arena_aligned_alloc,
+        .ctx = &arena,
+    };
+    JMAP_USER_CALLBACK_IMPLEMENTATION imp = {0};
+    imp.print_element_callback = print_int;
+
+    // Each "request" builds a map in the arena, then drops it in O(1)
+    const char *words[] = { "get", "put", "get", "remove", "get", "put", "clear" };
+    for (int request = 1; request <= 3; request++) {
+        JMAP counts;
+        jmap.init_with_allocator(&counts, sizeof(int), JMAP_TYPE_VALUE, imp, allocator);
+        JMAP_CHECK_RET_RETURN;
+
+        for (int round = 0; round < request * 20; round++) {
+            for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+                char key[32];
+                snprintf(key, sizeof(key), "%s-%d", words[i], round);
+                int *count = jmap.get_or_insert_default(&counts, key);
+                JMAP_CHECK_RET_RETURN;
+                (*count)++;
+            }
+        }
+        printf("Request %d: %zu keys, capacity %zu, %zu arena allocations, %zu bytes used\n",
+               request, counts._length, counts._capacity, arena.allocations, arena.used);
+
+        // No jmap.free: every block of the map lives in the arena
+        arena.used = 0;
+        arena.allocations = 0;
+    }
+
+    free(arena.base);
+    return 0;
+}
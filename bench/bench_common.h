@@ -0,0 +1,74 @@
+#ifndef JMAP_BENCH_COMMON_H
+#define JMAP_BENCH_COMMON_H
+
+/*
+ * Helpers shared by the benchmark programs: preset names, values, the clock and latency percentiles.
+ */
+
+#include "../inc/jmap.h"
+#include <stdint.h>
+#include <time.h>
+
+typedef struct PRESET_NAME {
+    const char *name;
+    JMAP_TYPE_PRESET preset;
+} PRESET_NAME;
+
+static const PRESET_NAME PRESETS[] = {
+    { "int", JMAP_INT_PRESET },       { "string", JMAP_STRING_PRESET }, { "float", JMAP_FLOAT_PRESET },
+    { "char", JMAP_CHAR_PRESET },     { "double", JMAP_DOUBLE_PRESET }, { "long", JMAP_LONG_PRESET },
+    { "short", JMAP_SHORT_PRESET },   { "uint", JMAP_UINT_PRESET },     { "ulong", JMAP_ULONG_PRESET },
+    { "ushort", JMAP_USHORT_PRESET }, { "pooled_string", JMAP_POOLED_STRING_PRESET },
+};
+
+#define PRESET_COUNT (sizeof(PRESETS) / sizeof(PRESETS[0]))
+
+// Preset called name, NULL if there is none
+static inline const PRESET_NAME *preset_by_name(const char *name) {
+    for (size_t i = 0; i < PRESET_COUNT; i++) {
+        if (strcmp(PRESETS[i].name, name) == 0) return &PRESETS[i];
+    }
+    return NULL;
+}
+
+// A value of the map's type derived from i (strings share one literal, the map copies it)
+static inline const void *value_for(const JMAP *map, size_t i, uint64_t *buf, const char **str) {
+    if (map->_data_type == JMAP_TYPE_POINTER) return str;
+    *buf = i;
+    return buf;
+}
+
+static inline double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Median cost of one clock read, to subtract from every timed operation
+static inline double calibrate_clock(void) {
+    double samples[101];
+    for (size_t i = 0; i < 101; i++) {
+        double start = now_ns();
+        for (int j = 0; j < 100; j++) now_ns();
+        samples[i] = (now_ns() - start) / 101;
+    }
+    for (size_t i = 1; i < 101; i++) {
+        double x = samples[i];
+        size_t j = i;
+        while (j > 0 && samples[j - 1] > x) { samples[j] = samples[j - 1]; j--; }
+        samples[j] = x;
+    }
+    return samples[50];
+}
+
+static inline int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// p-th percentile of n sorted samples, 0 without samples
+static inline double percentile(const double *sorted, size_t n, double p) {
+    return n ? sorted[(size_t)(p * (n - 1) + 0.5)] : 0;
+}
+
+#endif
@@ -0,0 +1,471 @@
+#include "bench_common.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/resource.h>
+
+/*
+ * Microbenchmark suite: one row per (preset, key shape, size, workload, key distribution), written
+ * as CSV or JSON so that two builds can be compared with a diff or a spreadsheet.
+ *
+ * Per-operation workloads (put, get_hit, get_miss, remove) time every operation; the calibrated cost
+ * of reading the clock is subtracted, ns_per_op is the mean and the percentiles are exact.
+ * Bulk workloads (iterate, clone, sort, resize) are repeated and report nanoseconds per entry,
+ * their percentiles are taken over the repetitions.
+ *
+ * Usage: jmap_bench [options]
+ *   --sizes 1K,10K,100K,1M     map sizes, K/M suffixes allowed (up to 100M, memory permitting)
+ *   --presets int,string       int string float char double long short uint ulong ushort pooled_string, or all
+ *   --keys short,long          short: "k<n>" (up to 12 bytes), long: 64-byte keys sharing a 40-byte prefix
+ *   --dist uniform,zipf        key distribution of get_hit
+ *   --zipf-s 0.99              skew of the Zipf distribution
+ *   --workloads all            put get_hit get_miss iterate clone sort resize remove
+ *   --ops 1000000              lookups timed by get_hit and get_miss
+ *   --format csv|json          output format (default csv)
+ *   --output FILE              write the results to FILE instead of stdout
+ *   --seed N                   seed of the key streams
+ */
+
+#define MAX_LIST 16
+#define SHORT_KEY_STRIDE 16
+#define LONG_KEY_STRIDE 72
+#define LONG_KEY_PREFIX "tenant-0042/service-catalog/objects/id:"
+
+static const char *const ALL_WORKLOADS[] = { "put", "get_hit", "get_miss", "iterate", "clone", "sort", "resize", "remove" };
+
+typedef struct OPTIONS {
+    size_t sizes[MAX_LIST];
+    size_t size_count;
+    const char *presets[MAX_LIST];
+    size_t preset_count;
+    const char *keys[MAX_LIST];
+    size_t key_count;
+    const char *dists[MAX_LIST];
+    size_t dist_count;
+    const char *workloads[MAX_LIST];
+    size_t workload_count;
+    double zipf_s;
+    size_t ops;
+    bool json;
+    FILE *out;
+    uint64_t seed;
+} OPTIONS;
+
+// Key set of one run: hits are inserted, misses never are
+typedef struct KEYS {
+    char *hits;
+    char *misses;
+    size_t stride;
+    size_t count;
+    size_t miss_count;
+} KEYS;
+
+typedef struct RESULT {
+    const char *preset;
+    const char *keys;
+    const char *dist;
+    size_t size;
+    const char *workload;
+    size_t ops;
+    double ns_per_op;
+    double p50, p90, p99, p999, max;
+    size_t map_bytes;
+} RESULT;
+
+static double clock_overhead_ns;
+static size_t rows_written;
+
+static uint64_t rng_state;
+
+static inline uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double rng_unit(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (size_t)usage.ru_maxrss;
+}
+
+static bool in_list(const char *const *list, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(list[i], name) == 0) return true;
+    }
+    return false;
+}
+
+/* ---------- Keys ---------- */
+
+static inline const char *key_at(const char *blob, size_t stride, size_t i) {
+    return blob + i * stride;
+}
+
+static void write_key(char *dest, size_t stride, bool long_keys, char tag, size_t i) {
+    if (long_keys) snprintf(dest, stride, "%s%c%023zu", LONG_KEY_PREFIX, tag, i);
+    else snprintf(dest, stride, "%c%zu", tag, i);
+}
+
+static bool keys_create(KEYS *keys, size_t count, size_t miss_count, bool long_keys) {
+    keys->stride = long_keys ? LONG_KEY_STRIDE : SHORT_KEY_STRIDE;
+    keys->count = count;
+    keys->miss_count = miss_count;
+    keys->hits = malloc(count * keys->stride);
+    keys->misses = malloc(miss_count * keys->stride);
+    if (!keys->hits || !keys->misses) return false;
+    for (size_t i = 0; i < count; i++) write_key(keys->hits + i * keys->stride, keys->stride, long_keys, 'k', i);
+    for (size_t i = 0; i < miss_count; i++) write_key(keys->misses + i * keys->stride, keys->stride, long_keys, 'm', i);
+    return true;
+}
+
+static void keys_free(KEYS *keys) {
+    free(keys->hits);
+    free(keys->misses);
+}
+
+/* ---------- Access streams ---------- */
+
+static void stream_uniform(uint32_t *stream, size_t ops, size_t n) {
+    for (size_t i = 0; i < ops; i++) stream[i] = (uint32_t)(rng_next() % n);
+}
+
+// Zipf ranks 0..n-1 (Gray et al., "Quickly generating billion-record synthetic databases")
+static void stream_zipf(uint32_t *stream, size_t ops, size_t n, double s) {
+    double zetan = 0;
+    for (size_t i = 1; i <= n; i++) zetan += 1.0 / pow((double)i, s);
+    double zeta2 = 1.0 + 1.0 / pow(2.0, s);
+    double alpha = 1.0 / (1.0 - s);
+    double eta = (1.0 - pow(2.0 / n, 1.0 - s)) / (1.0 - zeta2 / zetan);
+    for (size_t i = 0; i < ops; i++) {
+        double u = rng_unit();
+        double uz = u * zetan;
+        size_t rank;
+        if (uz < 1.0) rank = 0;
+        else if (uz < 1.0 + pow(0.5, s)) rank = 1;
+        else rank = (size_t)(n * pow(eta * u - eta + 1.0, alpha));
+        // Scatter the hot ranks over the key space
+        stream[i] = (uint32_t)((rank < n ? rank : n - 1) * 2654435761u % n);
+    }
+}
+
+/* ---------- Results ---------- */
+
+// Fills the statistics of result from the per-operation (or per-repetition) samples
+static void summarize(RESULT *result, double *samples, size_t n, double per_sample_ops) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        samples[i] /= per_sample_ops;
+        total += samples[i];
+    }
+    qsort(samples, n, sizeof(double), compare_double);
+    result->ns_per_op = n ? total / n : 0;
+    result->p50 = percentile(samples, n, 0.50);
+    result->p90 = percentile(samples, n, 0.90);
+    result->p99 = percentile(samples, n, 0.99);
+    result->p999 = percentile(samples, n, 0.999);
+    result->max = n ? samples[n - 1] : 0;
+}
+
+static void emit(const OPTIONS *opt, const RESULT *r) {
+    double ops_per_s = r->ns_per_op > 0 ? 1e9 / r->ns_per_op : 0;
+    if (opt->json) {
+        fprintf(opt->out, "%s\n  {\"preset\": \"%s\", \"keys\": \"%s\", \"dist\": \"%s\", \"size\": %zu, \"workload\": \"%s\", "
+                "\"ops\": %zu, \"ns_per_op\": %.2f, \"ops_per_s\": %.0f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, "
+                "\"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f, \"map_bytes\": %zu, \"peak_rss_kb\": %zu}",
+                rows_written ? "," : "", r->preset, r->keys, r->dist, r->size, r->workload, r->ops, r->ns_per_op,
+                ops_per_s, r->p50, r->p90, r->p99, r->p999, r->max, r->map_bytes, peak_rss_kb());
+    } else {
+        fprintf(opt->out, "%s,%s,%s,%zu,%s,%zu,%.2f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%zu,%zu\n",
+                r->preset, r->keys, r->dist, r->size, r->workload, r->ops, r->ns_per_op, ops_per_s,
+                r->p50, r->p90, r->p99, r->p999, r->max, r->map_bytes, peak_rss_kb());
+    }
+    fflush(opt->out);
+    rows_written++;
+}
+
+/* ---------- Workloads ---------- */
+
+static void free_sorted_values(const JMAP *map, void *values, size_t count) {
+    if (map->_data_type == JMAP_TYPE_POINTER) {
+        for (size_t i = 0; i < count; i++) free(((void**)values)[i]);
+    }
+    free(values);
+}
+
+static void sum_first_byte(const char *key, void *value, const void *ctx) {
+    (void)key;
+    *(size_t*)ctx += *(unsigned char*)value;
+}
+
+static bool bench_put(JMAP *map, const KEYS *keys, double *samples) {
+    uint64_t buf;
+    const char *str = "value-string-of-average-length";
+    for (size_t i = 0; i < keys->count; i++) {
+        const char *key = key_at(keys->hits, keys->stride, i);
+        const void *value = value_for(map, i, &buf, &str);
+        double start = now_ns();
+        jmap.put(map, key, value);
+        samples[i] = now_ns() - start - clock_overhead_ns;
+        if (jmap_last_error_trace.has_error) return false;
+    }
+    return true;
+}
+
+static size_t bench_get(const JMAP *map, const char *blob, size_t stride, const uint32_t *stream, size_t ops, double *samples) {
+    size_t found = 0;
+    for (size_t i = 0; i < ops; i++) {
+        const char *key = key_at(blob, stride, stream[i]);
+        double start = now_ns();
+        void *value = jmap.get(map, key);
+        samples[i] = now_ns() - start - clock_overhead_ns;
+        found += value != NULL;
+    }
+    return found;
+}
+
+static void bench_remove(JMAP *map, const KEYS *keys, double *samples) {
+    for (size_t i = 0; i < keys->count; i++) {
+        const char *key = key_at(keys->hits, keys->stride, i);
+        double start = now_ns();
+        jmap.remove(map, key);
+        samples[i] = now_ns() - start - clock_overhead_ns;
+    }
+}
+
+// Repetitions of a bulk workload: enough to touch about 1M entries, at least 3, at most 20
+static size_t bulk_reps(size_t size) {
+    size_t reps = ((size_t)1 << 20) / size;
+    return reps < 3 ? 3 : reps > 20 ? 20 : reps;
+}
+
+static bool bench_bulk(const OPTIONS *opt, RESULT *result, JMAP *map, const char *workload) {
+    size_t reps = bulk_reps(map->_length);
+    double samples[20];
+    size_t sink = 0;
+    for (size_t r = 0; r < reps; r++) {
+        double start, elapsed = 0;
+        if (strcmp(workload, "iterate") == 0) {
+            start = now_ns();
+            jmap.for_each(map, sum_first_byte, &sink);
+            elapsed = now_ns() - start;
+        } else if (strcmp(workload, "clone") == 0) {
+            start = now_ns();
+            JMAP clone = jmap.clone(map);
+            elapsed = now_ns() - start;
+            if (jmap_last_error_trace.has_error) return false;
+            jmap.free(&clone);
+        } else if (strcmp(workload, "sort") == 0) {
+            char **sorted_keys = NULL;
+            void *sorted_values = NULL;
+            start = now_ns();
+            jmap.to_sort(map, &sorted_keys, &sorted_values);
+            elapsed = now_ns() - start;
+            if (jmap_last_error_trace.has_error) return false;
+            free(sorted_keys);
+            free_sorted_values(map, sorted_values, map->_length);
+        } else {
+            // resize only grows: each repetition rehashes a fresh clone into twice its capacity
+            JMAP clone = jmap.clone(map);
+            if (jmap_last_error_trace.has_error) return false;
+            start = now_ns();
+            jmap.resize(&clone, clone._capacity * 2);
+            elapsed = now_ns() - start;
+            bool failed = jmap_last_error_trace.has_error;
+            jmap.free(&clone);
+            if (failed) return false;
+        }
+        samples[r] = elapsed;
+    }
+    result->workload = workload;
+    result->ops = reps * map->_length;
+    summarize(result, samples, reps, (double)map->_length);
+    emit(opt, result);
+    return sink != SIZE_MAX;
+}
+
+static bool run_case(const OPTIONS *opt, const PRESET_NAME *preset, const char *key_shape, size_t size) {
+    size_t lookups = opt->ops;
+    size_t miss_count = lookups < size ? lookups : size;
+    KEYS keys = {0};
+    uint32_t *stream = malloc(lookups * sizeof(uint32_t));
+    double *samples = malloc((lookups > size ? lookups : size) * sizeof(double));
+    bool ok = stream && samples && keys_create(&keys, size, miss_count, strcmp(key_shape, "long") == 0);
+    JMAP map = jmap.init_preset(preset->preset);
+    ok = ok && !jmap_last_error_trace.has_error;
+
+    RESULT result = { .preset = preset->name, .keys = key_shape, .dist = "-", .size = size };
+    if (ok) {
+        ok = bench_put(&map, &keys, samples);
+        result.map_bytes = jmap.memory_usage(&map).total_bytes;
+        if (ok && in_list(opt->workloads, opt->workload_count, "put")) {
+            result.workload = "put";
+            result.ops = size;
+            summarize(&result, samples, size, 1);
+            emit(opt, &result);
+        }
+    }
+
+    if (ok && in_list(opt->workloads, opt->workload_count, "get_hit")) {
+        for (size_t d = 0; d < opt->dist_count; d++) {
+            bool zipf = strcmp(opt->dists[d], "zipf") == 0;
+            if (zipf) stream_zipf(stream, lookups, size, opt->zipf_s);
+            else stream_uniform(stream, lookups, size);
+            if (bench_get(&map, keys.hits, keys.stride, stream, lookups, samples) != lookups) ok = false;
+            result.workload = "get_hit";
+            result.dist = opt->dists[d];
+            result.ops = lookups;
+            summarize(&result, samples, lookups, 1);
+            emit(opt, &result);
+        }
+        result.dist = "-";
+    }
+
+    if (ok && in_list(opt->workloads, opt->workload_count, "get_miss")) {
+        stream_uniform(stream, lookups, miss_count);
+        if (bench_get(&map, keys.misses, keys.stride, stream, lookups, samples) != 0) ok = false;
+        result.workload = "get_miss";
+        result.ops = lookups;
+        summarize(&result, samples, lookups, 1);
+        emit(opt, &result);
+    }
+
+    static const char *const bulk[] = { "iterate", "clone", "sort", "resize" };
+    for (size_t w = 0; ok && w < sizeof(bulk) / sizeof(bulk[0]); w++) {
+        if (in_list(opt->workloads, opt->workload_count, bulk[w])) ok = bench_bulk(opt, &result, &map, bulk[w]);
+    }
+
+    if (ok && in_list(opt->workloads, opt->workload_count, "remove")) {
+        bench_remove(&map, &keys, samples);
+        ok = map._length == 0;
+        result.workload = "remove";
+        result.ops = size;
+        summarize(&result, samples, size, 1);
+        emit(opt, &result);
+    }
+
+    if (!ok) fprintf(stderr, "jmap_bench: %s/%s/%zu failed\n", preset->name, key_shape, size);
+    jmap.free(&map);
+    keys_free(&keys);
+    free(stream);
+    free(samples);
+    return ok;
+}
+
+/* ---------- Options ---------- */
+
+// Splits a comma-separated list in place
+static size_t split_list(char *arg, const char **items) {
+    size_t count = 0;
+    for (char *tok = strtok(arg, ","); tok && count < MAX_LIST; tok = strtok(NULL, ",")) items[count++] = tok;
+    return count;
+}
+
+static bool parse_size(const char *s, size_t *size) {
+    char *end;
+    double value = strtod(s, &end);
+    if (end == s || value <= 0) return false;
+    if (*end == 'K' || *end == 'k') value *= 1e3, end++;
+    else if (*end == 'M' || *end == 'm') value *= 1e6, end++;
+    if (*end || value > UINT32_MAX) return false;
+    *size = (size_t)value;
+    return true;
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: jmap_bench [--sizes 1K,1M] [--presets int,string|all] [--keys short,long] [--dist uniform,zipf]\n"
+                    "                  [--zipf-s 0.99] [--workloads put,get_hit,...|all] [--ops N] [--format csv|json]\n"
+                    "                  [--output FILE] [--seed N]\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    char default_sizes[] = "1K,10K,100K,1M";
+    char default_presets[] = "int,string";
+    char default_keys[] = "short,long";
+    char default_dists[] = "uniform,zipf";
+    const char *sizes = default_sizes;
+    OPTIONS opt = { .zipf_s = 0.99, .ops = 1000000, .out = stdout, .seed = 42 };
+    opt.preset_count = split_list(default_presets, opt.presets);
+    opt.key_count = split_list(default_keys, opt.keys);
+    opt.dist_count = split_list(default_dists, opt.dists);
+    opt.workload_count = sizeof(ALL_WORKLOADS) / sizeof(ALL_WORKLOADS[0]);
+    memcpy(opt.workloads, ALL_WORKLOADS, sizeof(ALL_WORKLOADS));
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return usage();
+        char *arg = argv[i + 1];
+        if (strcmp(argv[i], "--sizes") == 0) sizes = arg;
+        else if (strcmp(argv[i], "--presets") == 0) {
+            opt.preset_count = strcmp(arg, "all") == 0 ? 0 : split_list(arg, opt.presets);
+            if (opt.preset_count == 0) {
+                for (size_t p = 0; p < PRESET_COUNT; p++) opt.presets[opt.preset_count++] = PRESETS[p].name;
+            }
+        }
+        else if (strcmp(argv[i], "--keys") == 0) opt.key_count = split_list(arg, opt.keys);
+        else if (strcmp(argv[i], "--dist") == 0) opt.dist_count = split_list(arg, opt.dists);
+        else if (strcmp(argv[i], "--zipf-s") == 0) opt.zipf_s = strtod(arg, NULL);
+        else if (strcmp(argv[i], "--workloads") == 0) {
+            if (strcmp(arg, "all") != 0) opt.workload_count = split_list(arg, opt.workloads);
+        }
+        else if (strcmp(argv[i], "--ops") == 0) opt.ops = strtoull(arg, NULL, 10);
+        else if (strcmp(argv[i], "--format") == 0) opt.json = strcmp(arg, "json") == 0;
+        else if (strcmp(argv[i], "--output") == 0) output = arg;
+        else if (strcmp(argv[i], "--seed") == 0) opt.seed = strtoull(arg, NULL, 10);
+        else return usage();
+        i++;
+    }
+    if (!opt.ops || opt.zipf_s <= 0 || opt.zipf_s == 1.0) return usage();
+
+    char size_list[256];
+    snprintf(size_list, sizeof(size_list), "%s", sizes);
+    const char *size_items[MAX_LIST];
+    size_t size_count = split_list(size_list, size_items);
+    for (size_t i = 0; i < size_count; i++) {
+        if (!parse_size(size_items[i], &opt.sizes[opt.size_count++])) return usage();
+    }
+    for (size_t i = 0; i < opt.key_count; i++) {
+        if (strcmp(opt.keys[i], "short") != 0 && strcmp(opt.keys[i], "long") != 0) return usage();
+    }
+    for (size_t i = 0; i < opt.dist_count; i++) {
+        if (strcmp(opt.dists[i], "uniform") != 0 && strcmp(opt.dists[i], "zipf") != 0) return usage();
+    }
+    for (size_t i = 0; i < opt.workload_count; i++) {
+        if (!in_list(ALL_WORKLOADS, sizeof(ALL_WORKLOADS) / sizeof(ALL_WORKLOADS[0]), opt.workloads[i])) return usage();
+    }
+
+    if (output && !(opt.out = fopen(output, "w"))) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    rng_state = opt.seed ? opt.seed : 1;
+    clock_overhead_ns = calibrate_clock();
+
+    if (opt.json) fprintf(opt.out, "{\"clock_overhead_ns\": %.1f, \"results\": [", clock_overhead_ns);
+    else fprintf(opt.out, "preset,keys,dist,size,workload,ops,ns_per_op,ops_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,map_bytes,peak_rss_kb\n");
+
+    int status = EXIT_SUCCESS;
+    for (size_t p = 0; p < opt.preset_count; p++) {
+        const PRESET_NAME *preset = preset_by_name(opt.presets[p]);
+        if (!preset) {
+            fprintf(stderr, "jmap_bench: unknown preset %s\n", opt.presets[p]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        for (size_t k = 0; k < opt.key_count; k++) {
+            for (size_t s = 0; s < opt.size_count; s++) {
+                if (!run_case(&opt, preset, opt.keys[k], opt.sizes[s])) status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (opt.json) fprintf(opt.out, "\n]}\n");
+    if (opt.out != stdout) fclose(opt.out);
+    return status;
+}
@@ -0,0 +1,103 @@
+#include "bench_common.h"
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Random lookups in a map larger than the last level cache, with the tables on 4 KiB pages
+ * (default allocator) and on 2 MiB pages (jmap_huge_pages allocator).
+ *
+ * Usage: jmap_huge_pages_bench [entries] [lookups] [explicit]
+ *   entries   keys in the map (default 8M, about 300 MiB of tables and keys)
+ *   lookups   random lookups timed per run (default 10M)
+ *   explicit  also run with reserved huge pages (needs /proc/sys/vm/nr_hugepages > 0)
+ */
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// AnonHugePages of the process in KiB, 0 when unknown
+static size_t anon_huge_kib(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    char line[256];
+    size_t kib = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %zu kB", &kib) == 1) break;
+    }
+    fclose(f);
+    return kib;
+}
+
+static int run(const char *name, JMAP_ALLOCATOR allocator, char **keys, size_t entries, const uint32_t *order, size_t lookups) {
+    JMAP_USER_CALLBACK_IMPLEMENTATION imp = {0};
+    JMAP map;
+    jmap.init_with_allocator(&map, sizeof(uint32_t), JMAP_TYPE_VALUE, imp, allocator);
+    JMAP_CHECK_RET_RETURN;
+
+    double start = now_ns();
+    for (size_t i = 0; i < entries; i++) {
+        uint32_t value = (uint32_t)i;
+        jmap.put(&map, keys[i], &value);
+        JMAP_CHECK_RET_RETURN;
+    }
+    double build_ns = now_ns() - start;
+
+    // Warm-up pass so that both runs start with faulted tables
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < lookups / 10; i++) checksum += *(uint32_t*)jmap.get(&map, keys[order[i]]);
+
+    start = now_ns();
+    for (size_t i = 0; i < lookups; i++) checksum += *(uint32_t*)jmap.get(&map, keys[order[i]]);
+    double lookup_ns = now_ns() - start;
+
+    printf("%-12s capacity %-10zu build %7.1f ns/put   lookup %7.1f ns/op   AnonHugePages %6zu MiB   (checksum %llu)\n",
+           name, map._capacity, build_ns / entries, lookup_ns / lookups, anon_huge_kib() / 1024,
+           (unsigned long long)checksum);
+    jmap.free(&map);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t entries = argc > 1 ? strtoull(argv[1], NULL, 10) : 8u << 20;
+    size_t lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 10u << 20;
+    bool explicit_pages = argc > 3;
+    if (!entries || entries > UINT32_MAX || !lookups) return 1;
+
+    char **keys = malloc(entries * sizeof(char*));
+    uint32_t *order = malloc(lookups * sizeof(uint32_t));
+    if (!keys || !order) return 1;
+    for (size_t i = 0; i < entries; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key-%zu", i);
+        keys[i] = strdup(buf);
+        if (!keys[i]) return 1;
+    }
+    for (size_t i = 0; i < lookups; i++) order[i] = (uint32_t)(rng_next() % entries);
+
+    printf("%zu entries, %zu random lookups\n", entries, lookups);
+
+    JMAP_ALLOCATOR default_allocator = {0};
+    if (run("4K pages", default_allocator, keys, entries, order, lookups)) return 1;
+
+    JMAP_HUGE_PAGE_CONFIG thp = {0};
+    if (run("THP", jmap_huge_pages.allocator(&thp), keys, entries, order, lookups)) return 1;
+
+    JMAP_HUGE_PAGE_CONFIG prefaulted = { .prefault = true };
+    if (run("THP+prefault", jmap_huge_pages.allocator(&prefaulted), keys, entries, order, lookups)) return 1;
+
+    if (explicit_pages) {
+        JMAP_HUGE_PAGE_CONFIG reserved = { .explicit_pages = true, .prefault = true };
+        if (run("hugetlbfs", jmap_huge_pages.allocator(&reserved), keys, entries, order, lookups)) return 1;
+    }
+
+    for (size_t i = 0; i < entries; i++) free(keys[i]);
+    free(keys);
+    free(order);
+    return 0;
+}
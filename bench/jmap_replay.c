@@ -0,0 +1,298 @@
+#include "bench_common.h"
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Replays a trace recorded with jmap_trace.start against a map configuration of your choice and
+ * reports the throughput and latency distribution of each kind of operation.
+ *
+ * The trace is loaded and its keys are interned before the clock starts. Operations are replayed
+ * back to back (the recorded timestamps are not waited for). Keys read before their first put in
+ * the trace were already in the recorded map: they are inserted first unless --no-preload.
+ * Traces recorded without keys are replayed with synthetic keys of the recorded length, one per
+ * distinct (hash, length) pair. The shape of the table after the (last) replay, from jmap_stats,
+ * is repeated on every row.
+ *
+ * Usage: jmap_replay TRACE [options]
+ *   --preset NAME        value type: int string float char double long short uint ulong ushort pooled_string (default int)
+ *   --load-factor F      load factor of the map (default 0.75)
+ *   --huge-pages         back the table with transparent huge pages
+ *   --no-preload         start from an empty map
+ *   --repeat N           replay the trace N times on fresh maps, latencies are pooled (default 1)
+ *   --format csv|json    output format (default csv)
+ */
+
+// Index 0 aggregates every operation, the others are indexed by JMAP_TRACE_OP
+static const char *const OP_NAMES[] = { "all", "put", "get", "remove", "contains" };
+#define OP_KINDS 5
+
+// Trace loaded in memory, with one interned key per record
+typedef struct TRACE {
+    uint8_t *ops;
+    uint32_t *key_ids;
+    size_t count;
+    size_t capacity;
+    char **keys;            // Distinct keys
+    bool *preload;          // Key read before its first put
+    bool *put_seen;
+    size_t key_count;
+    size_t key_capacity;
+} TRACE;
+
+typedef struct OPTIONS {
+    const PRESET_NAME *preset;
+    float load_factor;
+    bool huge_pages;
+    bool preload;
+    size_t repeat;
+    bool json;
+} OPTIONS;
+
+static double clock_overhead_ns;
+
+/* ---------- Loading ---------- */
+
+static bool grow(void **array, size_t capacity, size_t elem_size) {
+    void *grown = realloc(*array, capacity * elem_size);
+    if (!grown) return false;
+    *array = grown;
+    return true;
+}
+
+// Same (hash, length) gives the same key: 8 hex digits of the hash, padded to the recorded length
+static char *synthetic_key(const JMAP_TRACE_RECORD *record) {
+    size_t length = record->key_length < 8 ? 8 : record->key_length;
+    char *key = malloc(length + 1);
+    if (!key) return NULL;
+    snprintf(key, 9, "%08x", record->key_hash);
+    memset(key + 8, '_', length - 8);
+    key[length] = '\0';
+    return key;
+}
+
+// Returns the id of key, interning it on first sight. ids maps keys to ids.
+static bool intern(TRACE *trace, JMAP *ids, const char *key, uint32_t *id) {
+    const unsigned int *found = jmap.get(ids, key);
+    if (found) {
+        *id = *found;
+        return true;
+    }
+    if (trace->key_count == trace->key_capacity) {
+        size_t capacity = trace->key_capacity ? trace->key_capacity * 2 : 1024;
+        if (!grow((void**)&trace->keys, capacity, sizeof(char*)) || !grow((void**)&trace->preload, capacity, sizeof(bool))
+            || !grow((void**)&trace->put_seen, capacity, sizeof(bool))) return false;
+        trace->key_capacity = capacity;
+    }
+    char *copy = strdup(key);
+    if (!copy) return false;
+    unsigned int new_id = (unsigned int)trace->key_count;
+    jmap.put(ids, key, &new_id);
+    if (jmap_last_error_trace.has_error) {
+        free(copy);
+        return false;
+    }
+    trace->keys[new_id] = copy;
+    trace->preload[new_id] = false;
+    trace->put_seen[new_id] = false;
+    trace->key_count++;
+    *id = new_id;
+    return true;
+}
+
+static bool trace_load(const char *path, TRACE *trace) {
+    JMAP_TRACE_READER *reader = jmap_trace.open(path);
+    if (!reader) return false;
+    JMAP ids = jmap.init_preset(JMAP_UINT_PRESET);
+    bool ok = !jmap_last_error_trace.has_error;
+
+    JMAP_TRACE_RECORD record;
+    while (ok && jmap_trace.next(reader, &record)) {
+        char *synthetic = record.key ? NULL : synthetic_key(&record);
+        const char *key = record.key ? record.key : synthetic;
+        uint32_t id;
+        ok = key && intern(trace, &ids, key, &id);
+        free(synthetic);
+        if (!ok) break;
+
+        if (trace->count == trace->capacity) {
+            size_t capacity = trace->capacity ? trace->capacity * 2 : 4096;
+            if (!grow((void**)&trace->ops, capacity, sizeof(uint8_t)) || !grow((void**)&trace->key_ids, capacity, sizeof(uint32_t))) {
+                ok = false;
+                break;
+            }
+            trace->capacity = capacity;
+        }
+        trace->ops[trace->count] = (uint8_t)record.op;
+        trace->key_ids[trace->count] = id;
+        trace->count++;
+
+        if (record.op == JMAP_TRACE_PUT) trace->put_seen[id] = true;
+        else if (!trace->put_seen[id]) trace->preload[id] = true;
+    }
+    // next reports a corrupted record through the error trace, kept across the cleanup
+    JMAP_RETURN error = jmap_last_error_trace;
+    if (error.has_error) ok = false;
+
+    jmap_trace.close(reader);
+    jmap.free(&ids);
+    if (!ok) jmap_last_error_trace = error;
+    return ok;
+}
+
+static void trace_free(TRACE *trace) {
+    for (size_t i = 0; i < trace->key_count; i++) free(trace->keys[i]);
+    free(trace->keys);
+    free(trace->preload);
+    free(trace->put_seen);
+    free(trace->ops);
+    free(trace->key_ids);
+}
+
+/* ---------- Replay ---------- */
+
+static bool map_create(const OPTIONS *opt, JMAP *map, const JMAP_HUGE_PAGE_CONFIG *huge) {
+    *map = jmap.init_preset(opt->preset->preset);
+    if (jmap_last_error_trace.has_error) return false;
+    if (opt->huge_pages) {
+        // Presets use the C library allocator: same callbacks, new table on huge pages
+        JMAP preset = *map;
+        jmap.init_with_allocator(map, preset._elem_size, preset._data_type, preset.user_callbacks, jmap_huge_pages.allocator(huge));
+        map->user_overrides = preset.user_overrides;
+        map->_preset = preset._preset;
+        jmap.free(&preset);
+        if (!map->data) return false;
+    }
+    jmap.set_load_factor(map, opt->load_factor);
+    return !jmap_last_error_trace.has_error;
+}
+
+// Replays the trace once, appending the latency of each operation to samples[op] and samples[0]
+static bool replay(const OPTIONS *opt, const TRACE *trace, double **samples, size_t *counts, JMAP_STATS *stats) {
+    JMAP_HUGE_PAGE_CONFIG huge = {0};
+    JMAP map;
+    if (!map_create(opt, &map, &huge)) return false;
+
+    uint64_t buf;
+    const char *str = "value-string-of-average-length";
+    for (size_t i = 0; opt->preload && i < trace->key_count; i++) {
+        if (!trace->preload[i]) continue;
+        jmap.put(&map, trace->keys[i], value_for(&map, i, &buf, &str));
+        if (jmap_last_error_trace.has_error) {
+            // Kept across the cleanup, without its source: the map is gone by the time it is printed
+            JMAP_RETURN error = jmap_last_error_trace;
+            error.ret_source = NULL;
+            jmap.free(&map);
+            jmap_last_error_trace = error;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < trace->count; i++) {
+        const char *key = trace->keys[trace->key_ids[i]];
+        uint8_t op = trace->ops[i];
+        const void *value = op == JMAP_TRACE_PUT ? value_for(&map, i, &buf, &str) : NULL;
+        double start = now_ns();
+        switch (op) {
+            case JMAP_TRACE_PUT: jmap.put(&map, key, value); break;
+            case JMAP_TRACE_GET: jmap.get(&map, key); break;
+            case JMAP_TRACE_REMOVE: jmap.remove(&map, key); break;
+            default: jmap.contains_key(&map, key); break;
+        }
+        double elapsed = now_ns() - start - clock_overhead_ns;
+        samples[op][counts[op]++] = elapsed;
+        samples[0][counts[0]++] = elapsed;
+    }
+
+    // Table shape at the end of the replay, outside of the timed loop
+    *stats = jmap_stats.collect(&map);
+    jmap.free(&map);
+    return true;
+}
+
+static void emit(const OPTIONS *opt, const char *op, double *samples, size_t n, const JMAP_STATS *stats, bool first) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) total += samples[i];
+    qsort(samples, n, sizeof(double), compare_double);
+    double ns_per_op = n ? total / n : 0;
+    double ops_per_s = ns_per_op > 0 ? 1e9 / ns_per_op : 0;
+    if (opt->json) {
+        printf("%s\n  {\"op\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.2f, \"ops_per_s\": %.0f, \"p50_ns\": %.1f, "
+               "\"p90_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f, "
+               "\"final_entries\": %zu, \"avg_probe_length\": %.3f, \"max_probe_length\": %zu, \"max_cluster_length\": %zu}",
+               first ? "" : ",", op, n, ns_per_op, ops_per_s, percentile(samples, n, 0.5), percentile(samples, n, 0.9),
+               percentile(samples, n, 0.99), percentile(samples, n, 0.999), n ? samples[n - 1] : 0,
+               stats->entries, stats->avg_probe_length, stats->max_probe_length, stats->max_cluster_length);
+    } else {
+        printf("%s,%zu,%.2f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%zu,%.3f,%zu,%zu\n",
+               op, n, ns_per_op, ops_per_s, percentile(samples, n, 0.5), percentile(samples, n, 0.9),
+               percentile(samples, n, 0.99), percentile(samples, n, 0.999), n ? samples[n - 1] : 0,
+               stats->entries, stats->avg_probe_length, stats->max_probe_length, stats->max_cluster_length);
+    }
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: jmap_replay TRACE [--preset NAME] [--load-factor F] [--huge-pages] [--no-preload]\n"
+                    "                         [--repeat N] [--format csv|json]\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) return usage();
+    const char *path = argv[1];
+    OPTIONS opt = { .preset = &PRESETS[0], .load_factor = 0.75f, .preload = true, .repeat = 1 };
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--huge-pages") == 0) { opt.huge_pages = true; continue; }
+        if (strcmp(argv[i], "--no-preload") == 0) { opt.preload = false; continue; }
+        if (i + 1 >= argc) return usage();
+        const char *arg = argv[++i];
+        if (strcmp(argv[i - 1], "--preset") == 0) {
+            opt.preset = preset_by_name(arg);
+            if (!opt.preset) return usage();
+        }
+        else if (strcmp(argv[i - 1], "--load-factor") == 0) opt.load_factor = strtof(arg, NULL);
+        else if (strcmp(argv[i - 1], "--repeat") == 0) opt.repeat = strtoull(arg, NULL, 10);
+        else if (strcmp(argv[i - 1], "--format") == 0) opt.json = strcmp(arg, "json") == 0;
+        else return usage();
+    }
+    // The value pool of pooled_string is set up by the preset, it cannot be moved to another allocator
+    if (!opt.repeat || (opt.huge_pages && opt.preset->preset == JMAP_POOLED_STRING_PRESET)) return usage();
+
+    TRACE trace = {0};
+    if (!trace_load(path, &trace)) {
+        jmap.print_array_err(__FILE__, __LINE__);
+        trace_free(&trace);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%zu operations on %zu distinct keys\n", trace.count, trace.key_count);
+
+    double *samples[OP_KINDS];
+    size_t counts[OP_KINDS] = {0};
+    for (size_t k = 0; k < OP_KINDS; k++) {
+        samples[k] = malloc((trace.count ? trace.count : 1) * opt.repeat * sizeof(double));
+        if (!samples[k]) return EXIT_FAILURE;
+    }
+
+    clock_overhead_ns = calibrate_clock();
+    JMAP_STATS stats = {0};
+    for (size_t r = 0; r < opt.repeat; r++) {
+        if (!replay(&opt, &trace, samples, counts, &stats)) {
+            jmap.print_array_err(__FILE__, __LINE__);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (opt.json) printf("{\"trace\": \"%s\", \"preset\": \"%s\", \"load_factor\": %.2f, \"huge_pages\": %s, \"results\": [",
+                         path, opt.preset->name, opt.load_factor, opt.huge_pages ? "true" : "false");
+    else printf("op,ops,ns_per_op,ops_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,final_entries,avg_probe_length,max_probe_length,max_cluster_length\n");
+    bool first = true;
+    for (size_t k = 0; k < OP_KINDS; k++) {
+        if (!counts[k]) continue;
+        emit(&opt, OP_NAMES[k], samples[k], counts[k], &stats, first);
+        first = false;
+    }
+    if (opt.json) printf("\n]}\n");
+
+    for (size_t k = 0; k < OP_KINDS; k++) free(samples[k]);
+    trace_free(&trace);
+    return EXIT_SUCCESS;
+}
@@ -4,11 +4,28 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #define MAX_ERR_MSG_LENGTH 100
 
 
 typedef struct JMAP JMAP;
+typedef struct JMAP_WAL JMAP_WAL;
+typedef struct JMAP_CACHE JMAP_CACHE;
+typedef struct JMAP_TTL JMAP_TTL;
+typedef struct JMAP_POOL JMAP_POOL;
+typedef struct JMAP_STATS_COUNTERS JMAP_STATS_COUNTERS;
+typedef struct JMAP_TRACE JMAP_TRACE;
+typedef struct JMAP_TRACE_READER JMAP_TRACE_READER;
+typedef struct JMAP_SNAPSHOT JMAP_SNAPSHOT;
+typedef struct JMAP_PERSISTENT JMAP_PERSISTENT;
+typedef struct JMAP_TRANSIENT JMAP_TRANSIENT;
+typedef struct JMAP_INTERN JMAP_INTERN;
+typedef struct JMAP_ORDERED_INDEX JMAP_ORDERED_INDEX;
+typedef struct JMAP_FILTER JMAP_FILTER;
+typedef struct JMAP_MULTIMAP JMAP_MULTIMAP;
+typedef struct JMAP_SET JMAP_SET;
+typedef struct JMAP_BGSAVE JMAP_BGSAVE;
 
 typedef enum {
     JMAP_NO_ERROR = 0,
@@ -19,9 +36,12 @@ typedef enum {
     JMAP_ELEMENT_NOT_FOUND,
     JMAP_INVALID_ARGUMENT,
     JMAP_UNIMPLEMENTED_FUNCTION,
+    JMAP_IO_ERROR,
+    JMAP_MEMORY_BUDGET_EXCEEDED,
 } JMAP_ERROR;
 
 typedef enum {
+    JMAP_NO_PRESET = -1, // Map created with jmap.init
     JMAP_INT_PRESET = 0,
     JMAP_STRING_PRESET,
     JMAP_FLOAT_PRESET,
@@ -32,6 +52,7 @@ typedef enum {
     JMAP_UINT_PRESET,
     JMAP_ULONG_PRESET,
     JMAP_USHORT_PRESET,
+    JMAP_POOLED_STRING_PRESET, // Same as JMAP_STRING_PRESET, with the value strings stored in the map's value pool
 } JMAP_TYPE_PRESET;
 
 typedef struct JMAP_RETURN {
@@ -71,166 +92,1421 @@ typedef enum JMAP_DATA_TYPE {
     JMAP_TYPE_POINTER
 }JMAP_DATA_TYPE;
 
+/**
+ * @brief Allocation hooks used for every block owned by a map (table, keys, pooled values, side tables).
+ *        Hooks left NULL fall back to the C library: a zeroed JMAP_ALLOCATOR is the default allocator.
+ * @note Blocks handed to the caller (get_keys, get_values, to_sort, take) still come from malloc.
+ *       Pointer values are allocated by copy_elem_callback unless the map uses a value pool.
+ */
+typedef struct JMAP_ALLOCATOR {
+    // Returns a block of size bytes, NULL on failure. Mandatory for a custom allocator.
+    void *(*alloc)(size_t size, void *ctx);
+    // Resizes a block of old_size bytes. NOT mandatory: alloc + copy + free otherwise.
+    void *(*realloc)(void *ptr, size_t old_size, size_t new_size, void *ctx);
+    // Gives back a block of size bytes. Mandatory for a custom allocator (it may do nothing).
+    void (*free)(void *ptr, size_t size, void *ctx);
+    // Returns a block aligned on alignment (a power of two). NOT mandatory: alloc is used otherwise.
+    void *(*aligned_alloc)(size_t alignment, size_t size, void *ctx);
+    // Context pointer passed to the hooks.
+    void *ctx;
+    // Set when alloc and aligned_alloc always return zero-filled blocks, so that jmap does not clear them again.
+    bool zeroed;
+} JMAP_ALLOCATOR;
+
+/**
+ * @brief Heap memory owned by a JMAP, kept up to date by every operation.
+ */
+typedef struct JMAP_MEMORY_USAGE {
+    size_t table_bytes;     // `keys` and `data` arrays
+    size_t key_bytes;       // Key strings
+    size_t value_bytes;     // Blocks pointed to by JMAP_TYPE_POINTER values
+    size_t overhead_bytes;  // Allocator headers and rounding
+    size_t total_bytes;     // Sum of the above (filled by jmap.memory_usage)
+} JMAP_MEMORY_USAGE;
+
 typedef struct JMAP {
     char ** keys;
     void * data;
+    uint64_t *_occupied; // One bit per slot, set when keys[i] is not NULL
     size_t _elem_size;
     size_t _length;
     size_t _capacity;
     float _load_factor; // Load factor for resizing
     size_t _key_max_length; // Maximum length of keys, used for memory allocation
     JMAP_DATA_TYPE _data_type;
+    JMAP_TYPE_PRESET _preset; // Preset the map was created with, JMAP_NO_PRESET otherwise
     JMAP_USER_CALLBACK_IMPLEMENTATION user_callbacks;
     JMAP_USER_OVERRIDE_IMPLEMENTATION user_overrides;
+    JMAP_WAL *_wal; // Write-ahead log attached with jmap_wal.open, NULL otherwise
+    JMAP_CACHE *_cache; // Recency list when cache mode is enabled with jmap_cache.enable, NULL otherwise
+    JMAP_TTL *_ttl; // Expiry side array and timer wheel, created by the first jmap.put_with_ttl
+    JMAP_POOL *_pool; // Storage of pointer values set up with jmap.use_value_pool, NULL otherwise
+    JMAP_STATS_COUNTERS *_stats; // Probe and resize counters enabled with jmap_stats.enable, NULL otherwise
+    JMAP_TRACE *_trace; // Operation recorder started with jmap_trace.start, NULL otherwise
+    JMAP_SNAPSHOT *_snapshot; // Live snapshots taken with jmap.snapshot, NULL if none
+    JMAP_INTERN *_intern; // Symbol table holding the keys, set with jmap.use_interned_keys. NULL: the map owns its keys.
+    JMAP_ORDERED_INDEX *_ordered; // Ordered key index, NULL unless enabled with jmap_ordered.enable
+    JMAP_FILTER *_filter; // Bloom filter of the keys, NULL unless enabled with jmap_filter.enable
+    JMAP_BGSAVE *_bgsave; // Background save started with jmap_bgsave.start and not reaped yet, NULL otherwise
+    JMAP_MEMORY_USAGE _memory; // Tracked incrementally, read it with jmap.memory_usage
+    size_t _memory_budget; // Maximum total bytes (0 = unlimited), set with jmap.set_memory_budget
+    JMAP_ALLOCATOR _allocator; // Set with jmap.init_with_allocator, zeroed for the C library allocator
 } JMAP;
 
+/**
+ * @brief Configuration of a write-ahead log.
+ */
+typedef struct JMAP_WAL_CONFIG {
+    // Maximum time (ms) records wait in memory before being written and fsync'ed together.
+    unsigned int group_commit_interval_ms;
+    // Pending bytes that trigger a write without waiting for the end of the interval.
+    size_t buffer_size;
+} JMAP_WAL_CONFIG;
+
+/**
+ * @brief Configuration of the cache mode (bounded map with least-recently-used eviction).
+ */
+typedef struct JMAP_CACHE_CONFIG {
+    // Maximum number of entries (0 = no limit).
+    size_t max_entries;
+    // Maximum memory in bytes as reported by jmap.memory_usage (0 = no limit).
+    size_t max_bytes;
+    // Called before an entry is evicted. NOT mandatory.
+    // For JMAP_TYPE_POINTER maps, set the value to NULL to take ownership of it, otherwise the map frees it.
+    // Values stored in a value pool cannot change owner: copy them instead.
+    void (*evict_callback)(const char *key, void *value, void *ctx);
+    // Context pointer passed to evict_callback.
+    void *evict_ctx;
+} JMAP_CACHE_CONFIG;
+
+typedef struct JMAP_CACHE_STATS {
+    size_t hits;        // get calls that found their key
+    size_t misses;      // get calls that did not
+    size_t evictions;   // entries evicted to respect the limits
+} JMAP_CACHE_STATS;
+
+typedef enum {
+    JMAP_CMP_LT = 0,    // value <  threshold
+    JMAP_CMP_LE,        // value <= threshold
+    JMAP_CMP_GT,        // value >  threshold
+    JMAP_CMP_GE,        // value >= threshold
+    JMAP_CMP_EQ,        // value == threshold
+    JMAP_CMP_NE,        // value != threshold
+} JMAP_COMPARISON;
+
+typedef enum {
+    JMAP_APPLY_SCALE = 0,   // value = value * a
+    JMAP_APPLY_ADD,         // value = value + a
+    JMAP_APPLY_CLAMP,       // value = min(max(value, a), b)
+} JMAP_APPLY_OP;
+
+typedef struct JMAP_NUMERIC_STATS {
+    size_t count;
+    double sum;
+    double min;     // 0 when count is 0
+    double max;     // 0 when count is 0
+    double mean;    // 0 when count is 0
+} JMAP_NUMERIC_STATS;
+
+#define JMAP_STATS_HISTOGRAM_SIZE 16
+
+/**
+ * @brief Statistics of a map, see jmap_stats.collect.
+ * A probe length is the number of slots a lookup inspects: 1 when the key sits in its home slot.
+ */
+typedef struct JMAP_STATS {
+    // Shape of the table, computed from its current content
+    size_t entries;
+    size_t capacity;
+    double avg_probe_length;        // Over the entries, for a lookup that finds them
+    size_t max_probe_length;
+    size_t probe_histogram[JMAP_STATS_HISTOGRAM_SIZE];   // [i]: entries found after i + 1 slots, the last bucket holds the longer ones
+    size_t clusters;                // Runs of consecutive occupied slots
+    double avg_cluster_length;
+    size_t max_cluster_length;
+    size_t cluster_histogram[JMAP_STATS_HISTOGRAM_SIZE]; // [i]: clusters of 2^i to 2^(i+1) - 1 slots
+    // Counters of the operations run since jmap_stats.enable or jmap_stats.reset (0 when disabled)
+    size_t lookups;                 // Probes by key, from any function (get, put, remove...)
+    size_t hits;                    // Lookups that found their key
+    size_t misses;                  // Lookups that did not
+    size_t probed_slots;            // Slots inspected by the lookups
+    size_t max_lookup_probe_length;
+    size_t key_comparisons;         // strcmp calls made by the lookups
+    size_t resizes;                 // Rehashes, growing or shrinking
+    uint64_t resize_ns;             // Time spent in them
+    // Bloom filter, see jmap_filter.enable (0 without one)
+    size_t filter_bytes;
+    double filter_expected_fp_rate; // From the bits currently set
+    size_t filter_rejected;         // get/contains answered by the filter alone, not counted in lookups (counted when enabled)
+    size_t filter_false_positives;  // get/contains that passed the filter and missed (counted when enabled)
+    double filter_fp_rate;          // Measured: false positives / (rejected + false positives)
+} JMAP_STATS;
+
+typedef enum {
+    JMAP_BGSAVE_NONE = 0,   // No save was running
+    JMAP_BGSAVE_RUNNING,
+    JMAP_BGSAVE_DONE,
+    JMAP_BGSAVE_FAILED,
+} JMAP_BGSAVE_STATE;
+
+typedef struct JMAP_BGSAVE_STATUS {
+    JMAP_BGSAVE_STATE state;
+    uint64_t bytes;         // Size of the file written (JMAP_BGSAVE_DONE)
+    uint64_t duration_ns;   // Since the save started
+} JMAP_BGSAVE_STATUS;
+
+typedef enum {
+    JMAP_TRACE_PUT = 1,     // put, put_move, put_if_absent, put_with_ttl, get_or_insert_default, compute, merge, increment
+    JMAP_TRACE_GET,
+    JMAP_TRACE_REMOVE,      // remove, take, remove_batch (one record per key)
+    JMAP_TRACE_CONTAINS,
+} JMAP_TRACE_OP;
+
+/**
+ * @brief Configuration of an operation trace, see jmap_trace.start.
+ */
+typedef struct JMAP_TRACE_CONFIG {
+    // Also record the key bytes. Without them a trace only holds key hashes and lengths,
+    // and replay uses synthetic keys of the same length.
+    bool record_keys;
+    // Bytes buffered in memory before each write (0 = 64 KiB).
+    size_t buffer_size;
+} JMAP_TRACE_CONFIG;
+
+/**
+ * @brief One operation read back from a trace.
+ */
+typedef struct JMAP_TRACE_RECORD {
+    JMAP_TRACE_OP op;
+    uint64_t timestamp_ns;  // Since the start of the recording
+    uint32_t key_hash;      // 32-bit MurmurHash3 of the key
+    uint32_t key_length;
+    const char *key;        // NUL-terminated key, NULL if the trace has no keys. Valid until the next read.
+} JMAP_TRACE_RECORD;
+
+typedef enum {
+    JMAP_NUMA_DEFAULT = 0,     // Pages go to the node of the thread that first touches them
+    JMAP_NUMA_BIND,            // Pages are restricted to the nodes of node_mask
+    JMAP_NUMA_INTERLEAVE,      // Pages are spread round-robin over the nodes of node_mask
+} JMAP_NUMA_POLICY;
+
+/**
+ * @brief Backing of large tables by huge pages, see jmap_huge_pages.allocator.
+ */
+typedef struct JMAP_HUGE_PAGE_CONFIG {
+    // Blocks of at least this many bytes are mapped with huge pages, smaller ones use malloc (0 = 2 MiB).
+    size_t min_bytes;
+    // Use reserved huge pages (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages) instead of transparent huge pages.
+    // Falls back to transparent huge pages when none are available.
+    bool explicit_pages;
+    // Fault every page in when the block is mapped (at init and on each resize) instead of on first access.
+    bool prefault;
+    // NUMA placement of the mapped blocks.
+    JMAP_NUMA_POLICY numa_policy;
+    // Nodes used by JMAP_NUMA_BIND and JMAP_NUMA_INTERLEAVE (bit n = node n).
+    unsigned long node_mask;
+} JMAP_HUGE_PAGE_CONFIG;
+
+#define JMAP_WAL_DEFAULT_CONFIG ((JMAP_WAL_CONFIG){.group_commit_interval_ms = 10, .buffer_size = 1 << 20})
+
+/**
+ * @brief Immutable lookup table built from a JMAP with `jmap.freeze`.
+ * Every key is placed with a minimal perfect hash (hash-and-displace), so a lookup costs exactly
+ * one hash, one probe and one key comparison, and the table holds exactly `_length` slots.
+ * Keys are packed contiguously in `key_blob`, values are stored densely in `data` in slot order.
+ */
+typedef struct JMAP_FROZEN {
+    char *key_blob;         // All keys, NUL-terminated, packed one after the other
+    uint32_t *key_offsets;  // Offset of the key of slot i in key_blob (_length + 1 entries)
+    uint32_t *pilots;       // Displacement chosen for each bucket
+    void *data;             // Values, slot i holds the value of the key at key_offsets[i]
+    size_t _elem_size;
+    size_t _length;
+    size_t _bucket_count;
+    uint32_t _seed;
+    JMAP_DATA_TYPE _data_type;
+    JMAP_USER_CALLBACK_IMPLEMENTATION user_callbacks;
+} JMAP_FROZEN;
+
 
 
 typedef struct JMAP_INTERFACE {
     void (*print_array_err)(const char *file, int line);
     /**
-     * @brief Prints all elements. How the element are printed and how the map is printed can be changed by implementing overrides at initialisation.
-     *
-     * @param hashmap Pointer to hasmap.
+     * @brief Prints all elements. How the element are printed and how the map is printed can be changed by implementing overrides at initialisation.
+     *
+     * @param hashmap Pointer to hasmap.
+     */
+    void (*print)(const JMAP *self);
+    /**
+     * @brief Initializes the JMAP structure.
+     * @param self Pointer to the JMAP structure to initialize.
+     * @param elem_size Size of the elements to be stored in the JMAP.
+     * @param imp structure that contains the pointer to the user function implementations.
+     */
+    void (*init)(JMAP *self, size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp);
+    /**
+     * @brief Initializes the JMAP structure with custom allocation hooks.
+     * @note With a bump allocator whose free does nothing, the whole map can be dropped by resetting the arena
+     *       instead of calling jmap.free (as long as no write-ahead log is attached).
+     * @param self Pointer to the JMAP structure to initialize.
+     * @param elem_size Size of the elements to be stored in the JMAP.
+     * @param imp structure that contains the pointer to the user function implementations.
+     * @param allocator Allocation hooks, copied into the map. alloc and free must both be set, or both be NULL.
+     */
+    void (*init_with_allocator)(JMAP *self, size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp, JMAP_ALLOCATOR allocator);
+    /**
+     * @brief Initializes the JMAP structure.
+     * @note By using this and using macro and not functions direcly, you do not have to use `JMAP_DIRECT_INPUT` (except for string preset)
+     * @param preset The type preset you want to store in JMAP.
+     */
+    JMAP (*init_preset)(JMAP_TYPE_PRESET preset);
+    /**
+     * @brief Inserts a key-value pair into the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     */
+    void (*put)(JMAP *self, const char *key, const void *value);
+    /**
+     * @brief Inserts a key-value pair, taking ownership of a pointer value instead of copying it.
+     * @note For JMAP_TYPE_POINTER maps the pointer must come from malloc: the map frees it later.
+     *       On success the pointer at value is set to NULL, on error the caller still owns it.
+     *       Maps with a value pool copy it into the pool and free it right away.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     */
+    void (*put_move)(JMAP *self, const char *key, void *value);
+    /**
+     * @brief Retrieves a value by its key from the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to retrieve.
+     * @return Pointer to element. Do NOT free.
+     */
+    void* (*get)(const JMAP *self, const char *key);
+    /**
+     * @brief Empties the JMAP, removing all key-value pairs.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*clear)(JMAP *self);
+    /**
+     * @brief Resizes the JMAP to a new length.
+     * @note The new length must be a power of 2 and greater than the current length.
+     *       This is to ensure that the hash table can be resized correctly.
+     * @param self Pointer to the JMAP structure.
+     * @param new_length The new length for the JMAP.
+     */
+    void (*resize)(JMAP *self, size_t new_length);
+    /**
+     * @brief Clones the JMAP structure. Entries keep their time to live in the clone.
+     * @param self Pointer to the JMAP structure to clone.
+     * @return Cloned JMAP
+     */
+    JMAP (*clone)(const JMAP *self);
+    /**
+     * @brief Checks if a key exists in the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to check.
+     * @return boolean: true if key exists, false otherwise.
+     */
+    bool (*contains_key)(const JMAP *self, const char *key);
+    /**
+     * @brief Returns an array of keys in the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @return Pointer to char*. The keys that are dynamically allocated and should be freed by the caller.
+     */
+    char** (*get_keys)(const JMAP *self);
+    /**
+     * @brief Checks if a value exists in the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @param value Pointer to the value to check.
+     * @return boolean: true if value exists, false otherwise.
+     */
+    bool (*contains_value)(const JMAP *self, const void *value);
+    /**
+     * @brief Returns an array of values in the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @return Pointer to the first value of a heap allocated array, containing all values.
+     */
+    void* (*get_values)(JMAP *self);
+    /**
+     * @brief Iterates over each key-value pair in the JMAP and applies a callback function.
+     * @param self Pointer to the JMAP structure.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(const JMAP *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+    /**
+     * @brief Checks if the JMAP is empty.
+     * @param self Pointer to the JMAP structure.
+     * @return boolea: true if JMAP empty, false otherwise.
+     */
+    bool (*is_empty)(const JMAP *self);
+    /**
+     * @brief Puts a key-value pair into the JMAP if the key does not already exist.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     */
+    void (*put_if_absent)(JMAP *self, const char *key, const void *value);
+    /**
+     * @brief Removes a key-value pair from the JMAP.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to remove.
+     */
+    void (*remove)(JMAP *self, const char *key);
+    /**
+     * @brief Removes a key-value pair from the JMAP if the value matches.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to check and remove.
+     * @param value The value to match for removal.
+     */
+    void (*remove_if_value_match)(JMAP *self, const char *key, const void *value);
+    /**
+     * @brief Removes a key-value pair from the JMAP if the value does not match.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to check and remove.
+     * @param value The value to not match for removal.
+     */
+    void (*remove_if_value_not_match)(JMAP *self, const char *key, const void *value);
+    /**
+     * @brief Removes all key-value pairs that match a predicate function.
+     * @param self Pointer to the JMAP structure.
+     * @param predicate Function to determine if a key-value pair should be removed.
+     * @param ctx Context pointer passed to the predicate function.
+     */
+    void (*remove_if)(JMAP *self, bool (*predicate)(const char *key, const void *value, const void *ctx), const void *ctx);
+    /**
+     * @brief Frees the JMAP structure and its resources.
+     * @param self Pointer to the JMAP structure to free.
+     */
+    void (*free)(JMAP *self);
+    /**
+     * @brief Sorts the JMAP based on a comparison function.
+     * @param self Pointer to the JMAP structure.
+     * @param keys Pointer to array of char*. Will point to keys.
+     * @param values Pointer to array of element. Will point to valius.
+     * @param compare Function to compare two key-value pairs.
+     * @param ctx Context pointer passed to the comparison function.
+     */
+    void (*to_sort)(JMAP *self, char ***keys, void **values);
+    /**
+     * @brief Builds an immutable minimal perfect hash table from the JMAP.
+     * @note The JMAP is left untouched. Values are copied (using `copy_elem_callback` for pointers).
+     * @param self Pointer to the JMAP structure.
+     * @return The frozen table. Must be freed with `jmap_frozen.free`.
+     */
+    JMAP_FROZEN (*freeze)(const JMAP *self);
+    /**
+     * @brief Returns the heap memory owned by the JMAP (table, keys, pointer values and allocator overhead).
+     * @note Tracked incrementally, this function does not scan the map.
+     * @param self Pointer to the JMAP structure.
+     * @return The memory usage breakdown.
+     */
+    JMAP_MEMORY_USAGE (*memory_usage)(const JMAP *self);
+    /**
+     * @brief Sets the maximum memory the JMAP may use. A put that would exceed it fails with JMAP_MEMORY_BUDGET_EXCEEDED.
+     * @param self Pointer to the JMAP structure.
+     * @param max_bytes Budget in bytes, 0 to remove it.
+     */
+    void (*set_memory_budget)(JMAP *self, size_t max_bytes);
+    /**
+     * @brief Inserts a key-value pair that expires after ttl_ms milliseconds.
+     * @note An expired entry is never returned by get or contains_key, which leave it in place. Its memory is
+     *       reclaimed by the next writes to the map or by `expire`. A plain put on the key removes the TTL.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     * @param ttl_ms Time to live in milliseconds (1 to INT32_MAX).
+     */
+    void (*put_with_ttl)(JMAP *self, const char *key, const void *value, uint64_t ttl_ms);
+    /**
+     * @brief Removes expired entries, at most max_work of them. Meant to be called periodically.
+     * @param self Pointer to the JMAP structure.
+     * @param max_work Maximum number of entries to remove in this call.
+     * @return The number of entries removed.
+     */
+    size_t (*expire)(JMAP *self, size_t max_work);
+    /**
+     * @brief Returns the value of key, inserting key with a zeroed value first if it is absent. One probe.
+     * @note The value can be modified in place until the next call modifying the map.
+     *       Such modifications are not written to the write-ahead log, use compute or merge for that.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to look up.
+     * @return Pointer to the value in the map, NULL on error.
+     */
+    void *(*get_or_insert_default)(JMAP *self, const char *key);
+    /**
+     * @brief Updates the value of key in place with fn, inserting key with a zeroed value first if it is absent. One probe.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to update.
+     * @param fn Called with the value in the map and whether the key existed. Returns false to remove the entry.
+     * @param ctx Context pointer passed to fn.
+     * @return Pointer to the value in the map, NULL if fn removed it or on error.
+     */
+    void *(*compute)(JMAP *self, const char *key, bool (*fn)(const char *key, void *value, bool exists, void *ctx), void *ctx);
+    /**
+     * @brief Inserts value if key is absent, otherwise combines it into the existing value with combine_fn. One probe.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to update.
+     * @param value Pointer to the value to insert or combine.
+     * @param combine_fn Updates the existing value in place from value.
+     * @return Pointer to the value in the map, NULL on error.
+     */
+    void *(*merge)(JMAP *self, const char *key, const void *value, void (*combine_fn)(void *existing, const void *value));
+    /**
+     * @brief Adds delta to the value of key, which starts at 0 if absent. One probe.
+     * @note Only for maps created with a numeric preset.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to update.
+     * @param delta Amount to add. Integer results saturate to the range of the value type.
+     * @return Pointer to the value in the map, NULL on error.
+     */
+    void *(*increment)(JMAP *self, const char *key, long long delta);
+    /**
+     * @brief Removes a key and hands its value to the caller, in a single probe.
+     * @note For JMAP_TYPE_POINTER maps the caller becomes the owner of the pointer and must free it.
+     * @param self Pointer to the JMAP structure.
+     * @param key The key to remove.
+     * @param out_value Receives the value (elem_size bytes). If NULL, the value is released like remove does.
+     */
+    void (*take)(JMAP *self, const char *key, void *out_value);
+    /**
+     * @brief Removes several keys, shrinking the table at most once at the end. Missing keys are skipped.
+     * @param self Pointer to the JMAP structure.
+     * @param keys Array of keys to remove.
+     * @param n Number of keys.
+     * @return The number of entries removed.
+     */
+    size_t (*remove_batch)(JMAP *self, const char *const *keys, size_t n);
+    /**
+     * @brief Stores the blocks pointed to by the values of a JMAP_TYPE_POINTER map in a pool owned by the map.
+     *        A put then copies value_size bytes into the pool (one bump allocation, no malloc in steady state)
+     *        instead of calling copy_elem_callback, and resizes move the pointers without copying them.
+     * @note Existing values are moved into the pool. Pointers handed out by get stay owned by the map: replace
+     *       a value with put, merge or compute only (a heap block left by their callback is moved into the pool).
+     *       take and get_values still return heap copies made with copy_elem_callback.
+     * @param self Pointer to the JMAP structure.
+     * @param value_size Returns the number of bytes to copy for the value pointed to by its argument (e.g. strlen + 1).
+     */
+    void (*use_value_pool)(JMAP *self, size_t (*value_size)(const void *value));
+    /**
+     * @brief Sets the fraction of slots that may be filled before the table grows (0.75 by default).
+     * @note The table grows right away if it is fuller than that.
+     * @param self Pointer to the JMAP structure.
+     * @param load_factor Between 0.1 and 0.95.
+     */
+    void (*set_load_factor)(JMAP *self, float load_factor);
+    /**
+     * @brief Puts every entry of src into dst, growing dst once for all the new keys.
+     * @note Keys are hashed once. With threads, large maps are hashed and looked up in parallel, the writes stay on the calling thread.
+     * @param dst Pointer to the JMAP receiving the entries.
+     * @param src Pointer to a JMAP with the same value type, left unchanged.
+     * @param conflict_fn Combines the value of src into the existing value of dst, as in merge. NULL to overwrite it.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     */
+    void (*merge_into)(JMAP *dst, const JMAP *src, void (*conflict_fn)(void *existing, const void *value), unsigned threads);
+    /**
+     * @brief Removes from dst the keys that are not in src, then shrinks dst once if needed.
+     * @param dst Pointer to the JMAP to filter, its values are kept.
+     * @param src Pointer to a JMAP of any value type, left unchanged.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     */
+    void (*intersect)(JMAP *dst, const JMAP *src, unsigned threads);
+    /**
+     * @brief Removes from dst the keys that are in src, then shrinks dst once if needed.
+     * @param dst Pointer to the JMAP to filter.
+     * @param src Pointer to a JMAP of any value type, left unchanged.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     */
+    void (*difference)(JMAP *dst, const JMAP *src, unsigned threads);
+    /**
+     * @brief Takes a read-only copy-on-write snapshot of the map, in time proportional to the number of 1024-slot chunks.
+     * @note The map keeps its table: the first write to a chunk after the snapshot copies that chunk (keys and values)
+     *       into the snapshot. A resize, clear or jmap_numeric apply copies every chunk left.
+     *       Values modified through the pointer returned by get are seen by the snapshot.
+     *       The snapshot can be read from another thread while the map is written, and outlives the map.
+     * @param self Pointer to the JMAP structure.
+     * @return The snapshot, to read with jmap_snapshot and free with jmap_snapshot.free. NULL on error.
+     */
+    JMAP_SNAPSHOT *(*snapshot)(JMAP *self);
+    /**
+     * @brief Stores the keys of the map as handles of a symbol table instead of owned copies.
+     *        Maps sharing a table hold each key once, resizes reuse the hashes cached in the table,
+     *        and lookups by handle (get_by_handle, contains_handle) neither hash nor compare strings.
+     * @note The existing keys are interned. Keys put afterwards are interned on insertion.
+     *       The table must outlive the map. It cannot be changed or removed once set.
+     * @param self Pointer to the JMAP structure.
+     * @param intern Symbol table created with jmap_intern.create.
+     */
+    void (*use_interned_keys)(JMAP *self, JMAP_INTERN *intern);
+    /**
+     * @brief Retrieves the value associated with a key, given its handle.
+     * @param self Pointer to the JMAP structure (with interned keys).
+     * @param handle Handle of the key, from the symbol table of the map.
+     * @return Pointer to the value, NULL if the key is absent.
+     */
+    void *(*get_by_handle)(const JMAP *self, const char *handle);
+    /**
+     * @brief Checks if a key exists in the JMAP, given its handle.
+     * @param self Pointer to the JMAP structure (with interned keys).
+     * @param handle Handle of the key, from the symbol table of the map.
+     * @return boolean: true if key exists, false otherwise.
+     */
+    bool (*contains_handle)(const JMAP *self, const char *handle);
+} JMAP_INTERFACE;
+
+typedef struct JMAP_FROZEN_INTERFACE {
+    /**
+     * @brief Retrieves a value by its key from the frozen table.
+     * @param self Pointer to the JMAP_FROZEN structure.
+     * @param key The key to retrieve.
+     * @return Pointer to element. Do NOT free.
+     */
+    void* (*get)(const JMAP_FROZEN *self, const char *key);
+    /**
+     * @brief Checks if a key exists in the frozen table.
+     * @param self Pointer to the JMAP_FROZEN structure.
+     * @param key The key to check.
+     * @return boolean: true if key exists, false otherwise.
+     */
+    bool (*contains_key)(const JMAP_FROZEN *self, const char *key);
+    /**
+     * @brief Iterates over each key-value pair in slot order and applies a callback function.
+     * @param self Pointer to the JMAP_FROZEN structure.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(const JMAP_FROZEN *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+    /**
+     * @brief Prints all elements (needs print_element_callback).
+     * @param self Pointer to the JMAP_FROZEN structure.
+     */
+    void (*print)(const JMAP_FROZEN *self);
+    /**
+     * @brief Writes the frozen table to disk.
+     * @note Only maps of type JMAP_TYPE_VALUE can be saved. The file uses the host byte order.
+     * @param self Pointer to the JMAP_FROZEN structure.
+     * @param path Path of the file to write.
+     */
+    void (*save)(const JMAP_FROZEN *self, const char *path);
+    /**
+     * @brief Loads a frozen table previously written with `save`.
+     * @param path Path of the file to read.
+     * @param imp structure that contains the pointer to the user function implementations.
+     * @return The frozen table. Must be freed with `jmap_frozen.free`.
+     */
+    JMAP_FROZEN (*load)(const char *path, JMAP_USER_CALLBACK_IMPLEMENTATION imp);
+    /**
+     * @brief Frees the frozen table and its resources.
+     * @param self Pointer to the JMAP_FROZEN structure to free.
+     */
+    void (*free)(JMAP_FROZEN *self);
+} JMAP_FROZEN_INTERFACE;
+
+typedef struct JMAP_WAL_INTERFACE {
+    /**
+     * @brief Attaches a write-ahead log to the JMAP. The snapshot (`<path>.snap`) and the log are replayed first.
+     * @note Only maps of type JMAP_TYPE_VALUE can be logged. put, put_if_absent, remove* and clear are recorded.
+     *       Entries with a TTL are recorded with their deadline (wall clock), expired ones are not replayed.
+     *       Records are written by a background thread, `sync` must be called to wait for durability.
+     * @param self Pointer to the JMAP structure.
+     * @param path Path of the log file.
+     * @param config Group commit configuration (JMAP_WAL_DEFAULT_CONFIG for defaults).
+     */
+    void (*open)(JMAP *self, const char *path, JMAP_WAL_CONFIG config);
+    /**
+     * @brief Blocks until every operation recorded so far is durable on disk.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*sync)(JMAP *self);
+    /**
+     * @brief Writes a snapshot of the map to `<path>.snap` and truncates the log.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*compact)(JMAP *self);
+    /**
+     * @brief Flushes the log and detaches it from the JMAP. `jmap.free` also closes the log.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*close)(JMAP *self);
+} JMAP_WAL_INTERFACE;
+
+typedef struct JMAP_CACHE_INTERFACE {
+    /**
+     * @brief Turns the JMAP into a bounded cache. `get` and `put` mark entries as recently used,
+     *        a `put` of a new key evicts the least recently used entries in O(1) to respect the limits.
+     * @note max_bytes replaces the memory budget of the map: instead of failing, put evicts.
+     * @param self Pointer to the JMAP structure.
+     * @param config Limits and eviction callback.
+     */
+    void (*enable)(JMAP *self, JMAP_CACHE_CONFIG config);
+    /**
+     * @brief Leaves cache mode. Entries are kept.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*disable)(JMAP *self);
+    /**
+     * @brief Returns the hit, miss and eviction counters of a map in cache mode.
+     * @param self Pointer to the JMAP structure.
+     * @return The counters.
+     */
+    JMAP_CACHE_STATS (*stats)(const JMAP *self);
+} JMAP_CACHE_INTERFACE;
+
+/**
+ * @brief Aggregations and in-place updates over the values of maps created with a numeric preset.
+ * They run vectorized loops over the dense data array instead of one callback per entry.
+ * Integer sums are computed exactly, then returned as double. count_if and apply compare and update integer
+ * values without rounding them through double, so values beyond 2^53 keep their precision.
+ */
+typedef struct JMAP_NUMERIC_INTERFACE {
+    /**
+     * @brief Computes count, sum, min, max and mean in one pass.
+     * @param self Pointer to the JMAP structure.
+     * @return The statistics.
+     */
+    JMAP_NUMERIC_STATS (*stats)(const JMAP *self);
+    /**
+     * @brief Sums the values.
+     * @param self Pointer to the JMAP structure.
+     * @return The sum, 0 for an empty map.
+     */
+    double (*sum)(const JMAP *self);
+    /**
+     * @brief Returns the smallest value. Error JMAP_EMPTY for an empty map.
+     * @param self Pointer to the JMAP structure.
+     */
+    double (*min)(const JMAP *self);
+    /**
+     * @brief Returns the largest value. Error JMAP_EMPTY for an empty map.
+     * @param self Pointer to the JMAP structure.
+     */
+    double (*max)(const JMAP *self);
+    /**
+     * @brief Returns the mean of the values. Error JMAP_EMPTY for an empty map.
+     * @param self Pointer to the JMAP structure.
+     */
+    double (*mean)(const JMAP *self);
+    /**
+     * @brief Counts the values satisfying `value cmp threshold`.
+     * @param self Pointer to the JMAP structure.
+     * @param cmp Comparison to apply.
+     * @param threshold Right-hand side of the comparison.
+     * @return The number of matching values.
+     */
+    size_t (*count_if)(const JMAP *self, JMAP_COMPARISON cmp, double threshold);
+    /**
+     * @brief Counts the values in bin_count equal-width bins over [lo, hi). Values out of range go to the first or last bin.
+     * @param self Pointer to the JMAP structure.
+     * @param lo Lower bound of the first bin.
+     * @param hi Upper bound of the last bin.
+     * @param bins Output array of bin_count counters (overwritten).
+     * @param bin_count Number of bins.
+     */
+    void (*histogram)(const JMAP *self, double lo, double hi, size_t *bins, size_t bin_count);
+    /**
+     * @brief Updates every value in place. Results are converted back to the value type (truncated for integers, saturated to the range of the type).
+     * @param self Pointer to the JMAP structure.
+     * @param op Operation to apply.
+     * @param a Factor, addend or lower bound.
+     * @param b Upper bound for JMAP_APPLY_CLAMP, ignored otherwise.
+     */
+    void (*apply)(JMAP *self, JMAP_APPLY_OP op, double a, double b);
+    /**
+     * @brief Same as stats, split across threads. Small maps are processed on the calling thread.
+     * @param self Pointer to the JMAP structure.
+     * @param threads Number of threads, 0 for one per online CPU.
+     * @return The statistics.
+     */
+    JMAP_NUMERIC_STATS (*stats_parallel)(const JMAP *self, unsigned threads);
+    /**
+     * @brief Same as apply, split across threads. Small maps are processed on the calling thread.
+     * @param self Pointer to the JMAP structure.
+     * @param op Operation to apply.
+     * @param a Factor, addend or lower bound.
+     * @param b Upper bound for JMAP_APPLY_CLAMP, ignored otherwise.
+     * @param threads Number of threads, 0 for one per online CPU.
+     */
+    void (*apply_parallel)(JMAP *self, JMAP_APPLY_OP op, double a, double b, unsigned threads);
+} JMAP_NUMERIC_INTERFACE;
+
+/**
+ * @brief Diagnostics of the hash table: probe lengths, clustering, resizes and lookup counters.
+ * Counting is enabled per map, a map that never enabled it only pays a NULL check per lookup.
+ */
+typedef struct JMAP_STATS_INTERFACE {
+    /**
+     * @brief Starts counting lookups, key comparisons and resizes.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*enable)(JMAP *self);
+    /**
+     * @brief Stops counting and drops the counters.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*disable)(JMAP *self);
+    /**
+     * @brief Sets the counters back to 0.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*reset)(JMAP *self);
+    /**
+     * @brief Returns the statistics of the map.
+     * @note The table shape is computed by scanning the table and hashing every key: O(capacity).
+     *       It is available whether counting is enabled or not.
+     * @param self Pointer to the JMAP structure.
+     * @return The statistics.
+     */
+    JMAP_STATS (*collect)(const JMAP *self);
+    /**
+     * @brief Prints statistics returned by collect.
+     * @param stats Pointer to the statistics.
+     */
+    void (*print)(const JMAP_STATS *stats);
+} JMAP_STATS_INTERFACE;
+
+/**
+ * @brief Recording of the operations run on a map into a compact binary file, to replay them offline
+ * against other configurations (see bench/jmap_replay.c).
+ * A record takes about 8 bytes (op, time delta, key hash and length), plus the key when keys are recorded.
+ */
+typedef struct JMAP_TRACE_INTERFACE {
+    /**
+     * @brief Starts recording the put, get, remove and contains operations of the map into path (truncated).
+     * @param self Pointer to the JMAP structure.
+     * @param path Path of the trace file.
+     * @param config Whether to record keys and buffer size.
+     */
+    void (*start)(JMAP *self, const char *path, JMAP_TRACE_CONFIG config);
+    /**
+     * @brief Writes the buffered records and closes the trace. `jmap.free` also stops the recording.
+     * @note Fails with JMAP_IO_ERROR if a write failed during the recording (the trace ends there).
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*stop)(JMAP *self);
+    /**
+     * @brief Opens a trace for reading.
+     * @param path Path of the trace file.
+     * @return The reader, NULL on error.
+     */
+    JMAP_TRACE_READER *(*open)(const char *path);
+    /**
+     * @brief Reads the next operation.
+     * @param reader The reader.
+     * @param record Filled with the operation.
+     * @return false at the end of the trace, or on a truncated record (JMAP_IO_ERROR is set then).
+     */
+    bool (*next)(JMAP_TRACE_READER *reader, JMAP_TRACE_RECORD *record);
+    /**
+     * @brief Closes a reader.
+     * @param reader The reader.
+     */
+    void (*close)(JMAP_TRACE_READER *reader);
+} JMAP_TRACE_INTERFACE;
+
+typedef struct JMAP_SNAPSHOT_INTERFACE {
+    /**
+     * @brief Copies the value of key in the snapshot into out.
+     * @note Pointer values are copied with copy_elem_callback when it is set: the caller then owns the copy.
+     * @param self Pointer to the snapshot.
+     * @param key The key to retrieve.
+     * @param out Receives the value (elem_size bytes).
+     * @return true if the key was in the map when the snapshot was taken.
+     */
+    bool (*get)(JMAP_SNAPSHOT *self, const char *key, void *out);
+    /**
+     * @brief Checks if a key was in the map when the snapshot was taken.
+     * @param self Pointer to the snapshot.
+     * @param key The key to check.
+     * @return boolean: true if key exists, false otherwise.
+     */
+    bool (*contains_key)(JMAP_SNAPSHOT *self, const char *key);
+    /**
+     * @brief Iterates over each key-value pair of the snapshot in slot order.
+     * @note key and value are only valid during the callback, which must not write to the map of the snapshot.
+     * @param self Pointer to the snapshot.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(JMAP_SNAPSHOT *self, void (*callback)(const char *key, const void *value, void *ctx), void *ctx);
+    /**
+     * @brief Number of entries of the map when the snapshot was taken.
+     * @param self Pointer to the snapshot.
+     */
+    size_t (*length)(const JMAP_SNAPSHOT *self);
+    /**
+     * @brief Releases the snapshot. The map stops copying chunks for it.
+     * @param self Pointer to the snapshot.
+     */
+    void (*free)(JMAP_SNAPSHOT *self);
+} JMAP_SNAPSHOT_INTERFACE;
+
+/**
+ * @brief Persistent map: every version is immutable, put and remove return a new version that shares
+ *        all but O(log32 n) nodes with the previous one. Keys and values follow the JMAP conventions.
+ * @note Versions are reference counted and can be read from any number of threads without locking.
+ */
+typedef struct JMAP_PERSISTENT_INTERFACE {
+    /**
+     * @brief Creates an empty version.
+     * @param elem_size Size of the elements to be stored.
+     * @param data_type JMAP_TYPE_POINTER values are owned by the versions and freed with the last one holding them.
+     * @param imp User callbacks, copy_elem_callback copies pointer values on put.
+     * @return The version, to release with jmap_persistent.release.
+     */
+    JMAP_PERSISTENT *(*empty)(size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp);
+    /**
+     * @brief Creates an empty version with the callbacks of a preset (value pools are not supported).
+     * @param preset The type preset you want to store.
+     * @return The version, to release with jmap_persistent.release.
+     */
+    JMAP_PERSISTENT *(*empty_preset)(JMAP_TYPE_PRESET preset);
+    /**
+     * @brief Retrieves the value associated with a key.
+     * @param self The version.
+     * @param key The key to retrieve.
+     * @return Pointer to the value, valid as long as the version is held. NULL if absent.
+     */
+    const void *(*get)(const JMAP_PERSISTENT *self, const char *key);
+    /**
+     * @brief Checks if a key exists in the version.
+     * @param self The version.
+     * @param key The key to check.
+     * @return boolean: true if key exists, false otherwise.
+     */
+    bool (*contains_key)(const JMAP_PERSISTENT *self, const char *key);
+    /**
+     * @brief Returns a new version with key set to value. self is left unchanged.
+     * @param self The version.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     * @return The new version, to release with jmap_persistent.release.
+     */
+    JMAP_PERSISTENT *(*put)(const JMAP_PERSISTENT *self, const char *key, const void *value);
+    /**
+     * @brief Returns a new version without key. self is left unchanged.
+     * @param self The version.
+     * @param key The key to remove.
+     * @return The new version, to release with jmap_persistent.release. NULL if key is absent.
+     */
+    JMAP_PERSISTENT *(*remove)(const JMAP_PERSISTENT *self, const char *key);
+    /**
+     * @brief Number of entries of the version.
+     * @param self The version.
+     */
+    size_t (*length)(const JMAP_PERSISTENT *self);
+    /**
+     * @brief Iterates over each key-value pair of the version in hash order.
+     * @param self The version.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(const JMAP_PERSISTENT *self, void (*callback)(const char *key, const void *value, void *ctx), void *ctx);
+    /**
+     * @brief Takes one more reference to the version, for example before handing it to another thread.
+     * @param self The version.
+     * @return self.
+     */
+    JMAP_PERSISTENT *(*retain)(JMAP_PERSISTENT *self);
+    /**
+     * @brief Drops a reference to the version. The nodes no other version shares are freed with the last one.
+     * @param self The version.
+     */
+    void (*release)(JMAP_PERSISTENT *self);
+    /**
+     * @brief Starts a batch of updates from a version. The transient updates the nodes it created in place,
+     *        so building a map with it costs about one allocation per put instead of one per level.
+     * @note A transient is meant for one thread. self is left unchanged.
+     * @param self The version to start from.
+     * @return The transient, to end with jmap_persistent.persistent or jmap_persistent.transient_free.
+     */
+    JMAP_TRANSIENT *(*transient)(const JMAP_PERSISTENT *self);
+    /**
+     * @brief Sets key to value in the transient.
+     * @param self The transient.
+     * @param key The key to insert.
+     * @param value Pointer to the value to insert.
+     */
+    void (*transient_put)(JMAP_TRANSIENT *self, const char *key, const void *value);
+    /**
+     * @brief Removes key from the transient.
+     * @param self The transient.
+     * @param key The key to remove.
+     */
+    void (*transient_remove)(JMAP_TRANSIENT *self, const char *key);
+    /**
+     * @brief Retrieves the value associated with a key in the transient.
+     * @param self The transient.
+     * @param key The key to retrieve.
+     * @return Pointer to the value, valid until the next update of the transient. NULL if absent.
+     */
+    const void *(*transient_get)(const JMAP_TRANSIENT *self, const char *key);
+    /**
+     * @brief Ends the transient and returns its content as a new version. The transient is freed.
+     * @param self The transient.
+     * @return The version, to release with jmap_persistent.release.
+     */
+    JMAP_PERSISTENT *(*persistent)(JMAP_TRANSIENT *self);
+    /**
+     * @brief Drops a transient and its updates.
+     * @param self The transient.
+     */
+    void (*transient_free)(JMAP_TRANSIENT *self);
+} JMAP_PERSISTENT_INTERFACE;
+
+/**
+ * @brief Ordered index of the keys of a map (B+-tree, strcmp order), kept up to date by every write.
+ *        Prefix and range queries visit only the matching keys instead of the whole table.
+ * @note Point lookups do not use it. Values are read through the hash table, expired entries are skipped.
+ *       Callbacks must not write to the map.
+ */
+typedef struct JMAP_ORDERED_INTERFACE {
+    /**
+     * @brief Builds the index from the current keys and keeps it up to date from then on.
+     * @note Costs about 8 bytes per key in the leaves, plus a copy of one key per leaf in the inner nodes.
+     *       Counted in memory_usage (table_bytes).
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*enable)(JMAP *self);
+    /**
+     * @brief Drops the index.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*disable)(JMAP *self);
+    /**
+     * @brief Iterates over each key-value pair in key order.
+     * @param self Pointer to the JMAP structure.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(const JMAP *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+    /**
+     * @brief Iterates in key order over the keys starting with prefix.
+     * @param self Pointer to the JMAP structure.
+     * @param prefix The prefix ("" for every key).
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     * @return The number of keys visited.
+     */
+    size_t (*prefix_scan)(const JMAP *self, const char *prefix, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+    /**
+     * @brief Iterates in key order over the keys k such that lo <= k < hi.
+     * @param self Pointer to the JMAP structure.
+     * @param lo Lower bound (inclusive), NULL for none.
+     * @param hi Upper bound (exclusive), NULL for none.
+     * @param callback Function to call for each key-value pair.
+     * @param ctx Context pointer passed to the callback function.
+     * @return The number of keys visited.
+     */
+    size_t (*range_scan)(const JMAP *self, const char *lo, const char *hi, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+} JMAP_ORDERED_INTERFACE;
+
+/**
+ * @brief Symbol table: stores each distinct key once and maps it to a stable handle with a cached hash.
+ * @note A handle is a NUL-terminated copy of the key that stays valid until the table is freed, so it can be
+ *       passed wherever a key is expected. Two handles of the same table are equal iff the keys are.
+ *       A table is not thread-safe and uses the C library allocator.
+ */
+typedef struct JMAP_INTERN_INTERFACE {
+    /**
+     * @brief Creates an empty symbol table.
+     * @return The table, to free with jmap_intern.free once no map uses it.
+     */
+    JMAP_INTERN *(*create)(void);
+    /**
+     * @brief Returns the handle of key, adding key to the table if needed.
+     * @param self The symbol table.
+     * @param key The key (not empty).
+     * @return The handle, NULL on error.
+     */
+    const char *(*intern)(JMAP_INTERN *self, const char *key);
+    /**
+     * @brief Returns the handle of key if key is in the table.
+     * @param self The symbol table.
+     * @param key The key.
+     * @return The handle, NULL if key was never interned.
+     */
+    const char *(*find)(const JMAP_INTERN *self, const char *key);
+    /**
+     * @brief Cached hash of a handle (the 32-bit MurmurHash3 used by the maps).
+     * @param handle A handle returned by the table.
+     */
+    uint32_t (*hash)(const char *handle);
+    /**
+     * @brief Number of distinct keys in the table.
+     * @param self The symbol table.
+     */
+    size_t (*length)(const JMAP_INTERN *self);
+    /**
+     * @brief Heap memory owned by the table, in bytes.
+     * @param self The symbol table.
+     */
+    size_t (*memory_usage)(const JMAP_INTERN *self);
+    /**
+     * @brief Frees the table and all its handles.
+     * @param self The symbol table.
+     */
+    void (*free)(JMAP_INTERN *self);
+} JMAP_INTERN_INTERFACE;
+
+/**
+ * @brief Blocked Bloom filter of keys: one 64-byte block per key, so that a query reads a single cache line.
+ *        Attached to a map, it answers get and contains_key for most absent keys without probing the table.
+ *        Standalone, it can front any other key store, such as a frozen map read from disk.
+ * @note A filter never gives false negatives. Removed keys leave their bits behind until the map rebuilds
+ *       the filter (on resize, or once a quarter of the keys it was sized for are gone): meanwhile they only
+ *       add false positives. Filters are not thread-safe.
+ */
+typedef struct JMAP_FILTER_INTERFACE {
+    /**
+     * @brief Builds a filter from the current keys of the map and keeps it up to date from then on.
+     *        get, contains_key and their handle variants consult it before probing.
+     * @note Costs bits_per_key bits per key the table holds before its next resize, counted in memory_usage (table_bytes).
+     *       With 10 bits per key, about 1% of the lookups of absent keys still probe the table.
+     * @param self Pointer to the JMAP structure.
+     * @param bits_per_key Bits per key, at most 64 (0 for the default of 10).
+     */
+    void (*enable)(JMAP *self, unsigned bits_per_key);
+    /**
+     * @brief Drops the filter of the map.
+     * @param self Pointer to the JMAP structure.
+     */
+    void (*disable)(JMAP *self);
+    /**
+     * @brief Filter of the map, to read its memory usage or false positive rate. It must not be modified or freed.
+     * @param self Pointer to the JMAP structure.
+     * @return The filter, NULL if none is enabled.
+     */
+    const JMAP_FILTER *(*of)(const JMAP *self);
+    /**
+     * @brief Creates an empty standalone filter.
+     * @param expected_keys Number of keys it will hold, for sizing.
+     * @param bits_per_key Bits per key, at most 64 (0 for the default of 10).
+     * @return The filter, to free with jmap_filter.free. NULL on error.
+     */
+    JMAP_FILTER *(*create)(size_t expected_keys, unsigned bits_per_key);
+    /**
+     * @brief Hash of a key as used by the filters and the maps (32-bit MurmurHash3), to store next to on-disk keys.
+     * @param key The key.
+     */
+    uint32_t (*hash)(const char *key);
+    /**
+     * @brief Adds a key.
+     * @param self The filter.
+     * @param key The key.
+     */
+    void (*add)(JMAP_FILTER *self, const char *key);
+    /**
+     * @brief Adds a key by its hash (see hash).
+     * @param self The filter.
+     * @param hash Hash of the key.
+     */
+    void (*add_hash)(JMAP_FILTER *self, uint32_t hash);
+    /**
+     * @brief Tests a key.
+     * @param self The filter.
+     * @param key The key.
+     * @return false if key was never added, true if it may have been.
+     */
+    bool (*may_contain)(const JMAP_FILTER *self, const char *key);
+    /**
+     * @brief Tests a key by its hash (see hash).
+     * @param self The filter.
+     * @param hash Hash of the key.
+     * @return false if the key was never added, true if it may have been.
+     */
+    bool (*may_contain_hash)(const JMAP_FILTER *self, uint32_t hash);
+    /**
+     * @brief Removes every key.
+     * @param self The filter.
+     */
+    void (*clear)(JMAP_FILTER *self);
+    /**
+     * @brief Number of keys added since the filter was created or cleared.
+     * @param self The filter.
+     */
+    size_t (*length)(const JMAP_FILTER *self);
+    /**
+     * @brief Heap memory of the filter, in bytes.
+     * @param self The filter.
+     */
+    size_t (*memory_usage)(const JMAP_FILTER *self);
+    /**
+     * @brief Probability that an absent key passes the filter, estimated from the bits set. O(size of the filter).
+     * @param self The filter.
+     */
+    double (*false_positive_rate)(const JMAP_FILTER *self);
+    /**
+     * @brief Frees a standalone filter.
+     * @param self The filter.
+     */
+    void (*free)(JMAP_FILTER *self);
+} JMAP_FILTER_INTERFACE;
+
+/**
+ * @brief Values of one key of a multimap, stored contiguously.
+ */
+typedef struct JMAP_SPAN {
+    void *values;           // count values of elem_size bytes, in insertion order. NULL if count is 0.
+    size_t count;
+} JMAP_SPAN;
+
+/**
+ * @brief Multimap: each key owns a contiguous array of values, in insertion order.
+ *        The first values (up to 32 bytes of them) are stored in the table slot itself, the following
+ *        ones in an array from the multimap's pool, so small keys cost no allocation and no indirection.
+ * @note Spans are valid until the next write to the multimap. A multimap is not thread-safe and uses
+ *       the C library allocator.
+ */
+typedef struct JMAP_MULTIMAP_INTERFACE {
+    /**
+     * @brief Creates an empty multimap.
+     * @param elem_size Size of the values to be stored.
+     * @param data_type JMAP_TYPE_POINTER values are owned by the multimap and freed when removed.
+     * @param imp User callbacks: copy_elem_callback copies pointer values on put_append,
+     *            is_equal_callback compares values in remove_value (memcmp otherwise).
+     * @return The multimap, to free with jmap_multimap.free. NULL on error.
      */
-    void (*print)(const JMAP *self);
+    JMAP_MULTIMAP *(*create)(size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp);
     /**
-     * @brief Initializes the JMAP structure.
-     * @param self Pointer to the JMAP structure to initialize.
-     * @param elem_size Size of the elements to be stored in the JMAP.
-     * @param imp structure that contains the pointer to the user function implementations.
+     * @brief Creates an empty multimap with the callbacks of a preset (value pools are not supported).
+     * @param preset The type preset you want to store.
+     * @return The multimap, to free with jmap_multimap.free. NULL on error.
      */
-    void (*init)(JMAP *self, size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp);
+    JMAP_MULTIMAP *(*create_preset)(JMAP_TYPE_PRESET preset);
     /**
-     * @brief Initializes the JMAP structure.
-     * @note By using this and using macro and not functions direcly, you do not have to use `JMAP_DIRECT_INPUT` (except for string preset)
-     * @param preset The type preset you want to store in JMAP.
+     * @brief Appends a value to the values of key, adding key if needed.
+     * @param self The multimap.
+     * @param key The key.
+     * @param value Pointer to the value to append.
      */
-    JMAP (*init_preset)(JMAP_TYPE_PRESET preset);
+    void (*put_append)(JMAP_MULTIMAP *self, const char *key, const void *value);
     /**
-     * @brief Inserts a key-value pair into the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @param key The key to insert.
-     * @param value Pointer to the value to insert.
+     * @brief Returns the values of key.
+     * @param self The multimap.
+     * @param key The key.
+     * @return The values, valid until the next write. count is 0 if key is absent.
      */
-    void (*put)(JMAP *self, const char *key, const void *value);
+    JMAP_SPAN (*get_all)(const JMAP_MULTIMAP *self, const char *key);
     /**
-     * @brief Retrieves a value by its key from the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @param key The key to retrieve.
-     * @return Pointer to element. Do NOT free.
+     * @brief Number of values of key.
+     * @param self The multimap.
+     * @param key The key.
+     * @return The count, 0 if key is absent.
      */
-    void* (*get)(const JMAP *self, const char *key);
+    size_t (*count)(const JMAP_MULTIMAP *self, const char *key);
     /**
-     * @brief Empties the JMAP, removing all key-value pairs.
-     * @param self Pointer to the JMAP structure.
+     * @brief Checks if a key has values.
+     * @param self The multimap.
+     * @param key The key to check.
+     * @return boolean: true if key exists, false otherwise.
      */
-    void (*clear)(JMAP *self);
+    bool (*contains_key)(const JMAP_MULTIMAP *self, const char *key);
     /**
-     * @brief Resizes the JMAP to a new length.
-     * @note The new length must be a power of 2 and greater than the current length.
-     *       This is to ensure that the hash table can be resized correctly.
-     * @param self Pointer to the JMAP structure.
-     * @param new_length The new length for the JMAP.
+     * @brief Removes the first value of key equal to value. The key goes away with its last value.
+     * @param self The multimap.
+     * @param key The key.
+     * @param value Pointer to the value to remove.
+     * @return true if a value was removed.
      */
-    void (*resize)(JMAP *self, size_t new_length);
+    bool (*remove_value)(JMAP_MULTIMAP *self, const char *key, const void *value);
     /**
-     * @brief Clones the JMAP structure.
-     * @param self Pointer to the JMAP structure to clone.
-     * @return Cloned JMAP
+     * @brief Removes key and all its values.
+     * @param self The multimap.
+     * @param key The key to remove.
      */
-    JMAP (*clone)(const JMAP *self);
+    void (*remove)(JMAP_MULTIMAP *self, const char *key);
     /**
-     * @brief Checks if a key exists in the JMAP.
-     * @param self Pointer to the JMAP structure.
+     * @brief Number of keys.
+     * @param self The multimap.
+     */
+    size_t (*length)(const JMAP_MULTIMAP *self);
+    /**
+     * @brief Number of values of all the keys.
+     * @param self The multimap.
+     */
+    size_t (*value_count)(const JMAP_MULTIMAP *self);
+    /**
+     * @brief Iterates over the keys, with the values of each key as one span.
+     * @param self The multimap.
+     * @param callback Function to call for each key. It must not write to the multimap.
+     * @param ctx Context pointer passed to the callback function.
+     */
+    void (*for_each)(const JMAP_MULTIMAP *self, void (*callback)(const char *key, JMAP_SPAN values, void *ctx), void *ctx);
+    /**
+     * @brief Removes every key and value.
+     * @param self The multimap.
+     */
+    void (*clear)(JMAP_MULTIMAP *self);
+    /**
+     * @brief Frees the multimap and its values.
+     * @param self The multimap.
+     */
+    void (*free)(JMAP_MULTIMAP *self);
+} JMAP_MULTIMAP_INTERFACE;
+
+/**
+ * @brief Set of string keys: the table of a JMAP without the value array. Each slot holds the key and its hash,
+ *        about 12 bytes per slot plus the key string, and lookups compare the hashes before the keys.
+ * @note Set operations modify their first set in place. They look up every key of one set in the other,
+ *       split across threads for large sets, and resize the table at most once.
+ *       A set is not thread-safe and uses the C library allocator.
+ */
+typedef struct JMAP_SET_INTERFACE {
+    /**
+     * @brief Creates an empty set.
+     * @return The set, to free with jmap_set.free. NULL on error.
+     */
+    JMAP_SET *(*create)(void);
+    /**
+     * @brief Adds a copy of key.
+     * @param self The set.
+     * @param key The key (not empty).
+     * @return true if key was added, false if it was already there or on error.
+     */
+    bool (*add)(JMAP_SET *self, const char *key);
+    /**
+     * @brief Checks if key is in the set.
+     * @param self The set.
      * @param key The key to check.
      * @return boolean: true if key exists, false otherwise.
      */
-    bool (*contains_key)(const JMAP *self, const char *key);
+    bool (*contains)(const JMAP_SET *self, const char *key);
     /**
-     * @brief Returns an array of keys in the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @return Pointer to char*. The keys that are dynamically allocated and should be freed by the caller.
+     * @brief Removes key.
+     * @param self The set.
+     * @param key The key to remove.
+     * @return true if key was removed, false if it was absent.
      */
-    char** (*get_keys)(const JMAP *self);
+    bool (*remove)(JMAP_SET *self, const char *key);
     /**
-     * @brief Checks if a value exists in the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @param value Pointer to the value to check.
-     * @return boolean: true if value exists, false otherwise.
+     * @brief Number of keys.
+     * @param self The set.
      */
-    bool (*contains_value)(const JMAP *self, const void *value);
+    size_t (*length)(const JMAP_SET *self);
     /**
-     * @brief Returns an array of values in the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @return Pointer to the first value of a heap allocated array, containing all values.
+     * @brief Iterates over the keys, in no particular order.
+     * @param self The set.
+     * @param callback Function to call for each key. It must not write to the set.
+     * @param ctx Context pointer passed to the callback function.
      */
-    void* (*get_values)(JMAP *self);
+    void (*for_each)(const JMAP_SET *self, void (*callback)(const char *key, void *ctx), void *ctx);
     /**
-     * @brief Iterates over each key-value pair in the JMAP and applies a callback function.
-     * @param self Pointer to the JMAP structure.
-     * @param callback Function to call for each key-value pair.
-     * @param ctx Context pointer passed to the callback function.
+     * @brief Removes every key.
+     * @param self The set.
      */
-    void (*for_each)(const JMAP *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx);
+    void (*clear)(JMAP_SET *self);
     /**
-     * @brief Checks if the JMAP is empty.
-     * @param self Pointer to the JMAP structure.
-     * @return boolea: true if JMAP empty, false otherwise.
+     * @brief Heap memory of the set (table and keys), in bytes. O(capacity).
+     * @param self The set.
      */
-    bool (*is_empty)(const JMAP *self);
+    size_t (*memory_usage)(const JMAP_SET *self);
     /**
-     * @brief Puts a key-value pair into the JMAP if the key does not already exist.
-     * @param self Pointer to the JMAP structure.
-     * @param key The key to insert.
-     * @param value Pointer to the value to insert.
+     * @brief Frees the set and its keys.
+     * @param self The set.
      */
-    void (*put_if_absent)(JMAP *self, const char *key, const void *value);
+    void (*free)(JMAP_SET *self);
     /**
-     * @brief Removes a key-value pair from the JMAP.
-     * @param self Pointer to the JMAP structure.
-     * @param key The key to remove.
+     * @brief Adds to dst the keys of src.
+     * @param dst The set to extend.
+     * @param src The set to add, left unchanged.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
      */
-    void (*remove)(JMAP *self, const char *key);
+    void (*union_into)(JMAP_SET *dst, const JMAP_SET *src, unsigned threads);
     /**
-     * @brief Removes a key-value pair from the JMAP if the value matches.
+     * @brief Removes from dst the keys that are not in src, then shrinks dst once if needed.
+     * @param dst The set to filter.
+     * @param src The other set, left unchanged.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     */
+    void (*intersect)(JMAP_SET *dst, const JMAP_SET *src, unsigned threads);
+    /**
+     * @brief Removes from dst the keys that are in src, then shrinks dst once if needed.
+     * @param dst The set to filter.
+     * @param src The other set, left unchanged.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     */
+    void (*difference)(JMAP_SET *dst, const JMAP_SET *src, unsigned threads);
+    /**
+     * @brief Checks if every key of self is in other. Stops at the first missing key.
+     * @param self The candidate subset.
+     * @param other The other set.
+     * @param threads Number of threads, 0 for one per online CPU, 1 for the calling thread only.
+     * @return boolean: true if self is a subset of other.
+     */
+    bool (*is_subset)(const JMAP_SET *self, const JMAP_SET *other, unsigned threads);
+} JMAP_SET_INTERFACE;
+
+/**
+ * @brief Background save: a forked child writes the map to a file while the parent keeps reading and writing it.
+ *        The child sees the map as it was when the save started, through copy-on-write pages.
+ * @note Until the save is reaped by poll or wait, lookups do not write to the map, so that only the pages the
+ *       parent modifies get copied: cache hits leave the recency order unchanged and expired entries are
+ *       reported as absent without being removed. Only maps of type JMAP_TYPE_VALUE can be saved.
+ *       The file has the snapshot format of the write-ahead log (`<path>.snap`). jmap.free waits for a running save.
+ */
+typedef struct JMAP_BGSAVE_INTERFACE {
+    /**
+     * @brief Forks a child that writes the map to path (through a temporary file, renamed once synced).
      * @param self Pointer to the JMAP structure.
-     * @param key The key to check and remove.
-     * @param value The value to match for removal.
+     * @param path Path of the file to write.
+     * @return true if the child was started, false on error or if a save is already running.
      */
-    void (*remove_if_value_match)(JMAP *self, const char *key, const void *value);
+    bool (*start)(JMAP *self, const char *path);
     /**
-     * @brief Removes a key-value pair from the JMAP if the value does not match.
+     * @brief Checks on the save without blocking. A finished save is reported once, then the map leaves save mode.
      * @param self Pointer to the JMAP structure.
-     * @param key The key to check and remove.
-     * @param value The value to not match for removal.
+     * @return The status: JMAP_BGSAVE_RUNNING, JMAP_BGSAVE_DONE with the bytes written, JMAP_BGSAVE_FAILED,
+     *         or JMAP_BGSAVE_NONE if no save was running.
      */
-    void (*remove_if_value_not_match)(JMAP *self, const char *key, const void *value);
+    JMAP_BGSAVE_STATUS (*poll)(JMAP *self);
     /**
-     * @brief Removes all key-value pairs that match a predicate function.
+     * @brief Blocks until the save finishes, and reports it as poll does.
      * @param self Pointer to the JMAP structure.
-     * @param predicate Function to determine if a key-value pair should be removed.
-     * @param ctx Context pointer passed to the predicate function.
+     * @return The status, JMAP_BGSAVE_NONE if no save was running.
      */
-    void (*remove_if)(JMAP *self, bool (*predicate)(const char *key, const void *value, const void *ctx), const void *ctx);
+    JMAP_BGSAVE_STATUS (*wait)(JMAP *self);
     /**
-     * @brief Frees the JMAP structure and its resources.
-     * @param self Pointer to the JMAP structure to free.
+     * @brief Puts the entries of a file written by a save into the map.
+     * @note The entries are merged into the map: its other keys are kept, saved keys overwrite their current value.
+     *       Call `jmap.clear` first to restore the map as it was saved.
+     * @param self Pointer to the JMAP structure, with the value size of the saved map.
+     * @param path Path of the file.
      */
-    void (*free)(JMAP *self);
+    void (*load)(JMAP *self, const char *path);
+} JMAP_BGSAVE_INTERFACE;
+
+typedef struct JMAP_HUGE_PAGE_INTERFACE {
     /**
-     * @brief Sorts the JMAP based on a comparison function.
-     * @param self Pointer to the JMAP structure.
-     * @param keys Pointer to array of char*. Will point to keys.
-     * @param values Pointer to array of element. Will point to valius.
-     * @param compare Function to compare two key-value pairs.
-     * @param ctx Context pointer passed to the comparison function.
+     * @brief Builds an allocator that maps large blocks (tables, side tables, pool chunks) with huge pages.
+     *        Random probes in tables larger than the last level cache then miss the TLB far less often.
+     * @note Pass it to jmap.init_with_allocator. The config is referenced, not copied: it must outlive the maps.
+     *       On systems without mmap every block comes from malloc.
+     * @param config Huge page and NUMA settings.
+     * @return The allocator.
      */
-    void (*to_sort)(JMAP *self, char ***keys, void **values);
-} JMAP_INTERFACE;
+    JMAP_ALLOCATOR (*allocator)(const JMAP_HUGE_PAGE_CONFIG *config);
+} JMAP_HUGE_PAGE_INTERFACE;
 
 extern JMAP_INTERFACE jmap;
-extern JMAP_RETURN jmap_last_error_trace;
+extern JMAP_FROZEN_INTERFACE jmap_frozen;
+extern JMAP_WAL_INTERFACE jmap_wal;
+extern JMAP_CACHE_INTERFACE jmap_cache;
+extern JMAP_NUMERIC_INTERFACE jmap_numeric;
+extern JMAP_STATS_INTERFACE jmap_stats;
+extern JMAP_TRACE_INTERFACE jmap_trace;
+extern JMAP_SNAPSHOT_INTERFACE jmap_snapshot;
+extern JMAP_PERSISTENT_INTERFACE jmap_persistent;
+extern JMAP_INTERN_INTERFACE jmap_intern;
+extern JMAP_ORDERED_INTERFACE jmap_ordered;
+extern JMAP_FILTER_INTERFACE jmap_filter;
+extern JMAP_MULTIMAP_INTERFACE jmap_multimap;
+extern JMAP_SET_INTERFACE jmap_set;
+extern JMAP_BGSAVE_INTERFACE jmap_bgsave;
+extern JMAP_HUGE_PAGE_INTERFACE jmap_huge_pages;
+extern _Thread_local JMAP_RETURN jmap_last_error_trace; // Error of the last call made by the calling thread
 
 
 /* ----- MACROS ----- */
@@ -263,7 +1539,7 @@ extern JMAP_RETURN jmap_last_error_trace;
 
 
 /**
- * @brief Checks if global error trace contains error.
+ * @brief Checks if the error trace of the calling thread contains error.
  *
  * @return true if error, false otherwise.
  */
@@ -338,6 +1614,14 @@ extern JMAP_RETURN jmap_last_error_trace;
  * @param imp structure that contains the pointer to the user function implementations.
  */
 #define jmap_init(hashmap, elem_size, data_type, imp) jmap.init(hashmap, elem_size, data_type, imp)
+/**
+ * @brief Initializes the JMAP structure with custom allocation hooks.
+ * @param hashmap Pointer to the JMAP structure to initialize.
+ * @param elem_size Size of the elements to be stored in the JMAP.
+ * @param imp structure that contains the pointer to the user function implementations.
+ * @param allocator Allocation hooks (JMAP_ALLOCATOR).
+ */
+#define jmap_init_with_allocator(hashmap, elem_size, data_type, imp, allocator) jmap.init_with_allocator(hashmap, elem_size, data_type, imp, allocator)
 /**
  * @brief Initializes the JMAP structure.
  * @note By using this and using macro and not functions direcly, you do not have to use `JMAP_DIRECT_INPUT` (except for string preset)
@@ -351,6 +1635,13 @@ extern JMAP_RETURN jmap_last_error_trace;
  * @param value Pointer to the value to insert.
  */
 #define jmap_put(hashmap, key, value) jmap.put(hashmap, key, JMAP_GENERIC_DECLARE(hashmap, value))
+/**
+ * @brief Inserts a key-value pair, taking ownership of the pointer held by value (set to NULL on success).
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to insert.
+ * @param value Variable holding the pointer to hand over.
+ */
+#define jmap_put_move(hashmap, key, value) jmap.put_move(hashmap, key, &(value))
 /**
  * @brief Retrieves a value by its key from the JMAP.
  * @param hashmap Pointer to the JMAP structure.
@@ -464,6 +1755,264 @@ extern JMAP_RETURN jmap_last_error_trace;
  * @param ctx Context pointer passed to the comparison function.
  */
 #define jmap_to_sort(hashmap, keys, values) jmap.to_sort(hashmap, keys, values)
+/**
+ * @brief Builds an immutable minimal perfect hash table from the JMAP.
+ * @param hashmap Pointer to the JMAP structure.
+ * @return The frozen table. Must be freed with `jmap_frozen_free`.
+ */
+#define jmap_freeze(hashmap) jmap.freeze(hashmap)
+/**
+ * @brief Returns the heap memory owned by the JMAP.
+ * @param hashmap Pointer to the JMAP structure.
+ * @return The memory usage breakdown.
+ */
+#define jmap_memory_usage(hashmap) jmap.memory_usage(hashmap)
+/**
+ * @brief Sets the maximum memory the JMAP may use (0 = unlimited).
+ * @param hashmap Pointer to the JMAP structure.
+ * @param max_bytes Budget in bytes.
+ */
+#define jmap_set_memory_budget(hashmap, max_bytes) jmap.set_memory_budget(hashmap, max_bytes)
+/**
+ * @brief Inserts a key-value pair that expires after ttl_ms milliseconds.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to insert.
+ * @param value The value to insert.
+ * @param ttl_ms Time to live in milliseconds.
+ */
+#define jmap_put_with_ttl(hashmap, key, value, ttl_ms) jmap.put_with_ttl(hashmap, key, JMAP_GENERIC_DECLARE(hashmap, value), ttl_ms)
+/**
+ * @brief Removes at most max_work expired entries.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param max_work Maximum number of entries to remove.
+ * @return The number of entries removed.
+ */
+#define jmap_expire(hashmap, max_work) jmap.expire(hashmap, max_work)
+/**
+ * @brief Returns the value of key, inserting key with a zeroed value first if it is absent.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to look up.
+ * @return Pointer to the value in the map.
+ */
+#define jmap_get_or_insert_default(hashmap, key) jmap.get_or_insert_default(hashmap, key)
+/**
+ * @brief Updates the value of key in place with fn, inserting key with a zeroed value first if it is absent.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to update.
+ * @param fn Update function, returns false to remove the entry.
+ * @param ctx Context pointer passed to fn.
+ * @return Pointer to the value in the map, NULL if removed.
+ */
+#define jmap_compute(hashmap, key, fn, ctx) jmap.compute(hashmap, key, fn, ctx)
+/**
+ * @brief Inserts value if key is absent, otherwise combines it into the existing value.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to update.
+ * @param value The value to insert or combine.
+ * @param combine_fn Updates the existing value in place.
+ * @return Pointer to the value in the map.
+ */
+#define jmap_merge(hashmap, key, value, combine_fn) jmap.merge(hashmap, key, JMAP_GENERIC_DECLARE(hashmap, value), combine_fn)
+/**
+ * @brief Adds delta to the value of key, which starts at 0 if absent (numeric presets only).
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to update.
+ * @param delta Amount to add.
+ * @return Pointer to the value in the map.
+ */
+#define jmap_increment(hashmap, key, delta) jmap.increment(hashmap, key, delta)
+/**
+ * @brief Removes a key and hands its value to the caller (who then owns pointer values).
+ * @param hashmap Pointer to the JMAP structure.
+ * @param key The key to remove.
+ * @param out_value Receives the value.
+ */
+#define jmap_take(hashmap, key, out_value) jmap.take(hashmap, key, out_value)
+/**
+ * @brief Removes several keys, shrinking the table at most once.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param keys Array of keys to remove.
+ * @param n Number of keys.
+ * @return The number of entries removed.
+ */
+#define jmap_remove_batch(hashmap, keys, n) jmap.remove_batch(hashmap, keys, n)
+/**
+ * @brief Stores the pointer values of the map in a pool owned by the map.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param value_size Returns the number of bytes of the value pointed to by its argument.
+ */
+#define jmap_use_value_pool(hashmap, value_size) jmap.use_value_pool(hashmap, value_size)
+/**
+ * @brief Sets the fraction of slots that may be filled before the table grows.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param load_factor Between 0.1 and 0.95.
+ */
+#define jmap_set_load_factor(hashmap, load_factor) jmap.set_load_factor(hashmap, load_factor)
+/**
+ * @brief Puts every entry of src into dst, growing dst once.
+ * @param dst Pointer to the destination JMAP.
+ * @param src Pointer to the source JMAP.
+ * @param conflict_fn Combines a value of src into an existing value of dst, NULL to overwrite.
+ * @param threads Number of threads, 0 for one per online CPU.
+ */
+#define jmap_merge_into(dst, src, conflict_fn, threads) jmap.merge_into(dst, src, conflict_fn, threads)
+/**
+ * @brief Keeps in dst only the keys that are also in src.
+ * @param dst Pointer to the destination JMAP.
+ * @param src Pointer to the source JMAP.
+ * @param threads Number of threads, 0 for one per online CPU.
+ */
+#define jmap_intersect(dst, src, threads) jmap.intersect(dst, src, threads)
+/**
+ * @brief Removes from dst the keys that are in src.
+ * @param dst Pointer to the destination JMAP.
+ * @param src Pointer to the source JMAP.
+ * @param threads Number of threads, 0 for one per online CPU.
+ */
+#define jmap_difference(dst, src, threads) jmap.difference(dst, src, threads)
+/**
+ * @brief Stores the keys of the map as handles of a symbol table instead of owned copies.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param intern Symbol table created with jmap_intern.create, which must outlive the map.
+ */
+#define jmap_use_interned_keys(hashmap, intern) jmap.use_interned_keys(hashmap, intern)
+/**
+ * @brief Retrieves the value associated with a key, given its handle.
+ * @param hashmap Pointer to the JMAP structure (with interned keys).
+ * @param handle Handle of the key, from the symbol table of the map.
+ * @return Pointer to element. Do NOT free.
+ */
+#define jmap_get_by_handle(hashmap, handle) jmap.get_by_handle(hashmap, handle)
+/**
+ * @brief Checks if a key exists in the JMAP, given its handle.
+ * @param hashmap Pointer to the JMAP structure (with interned keys).
+ * @param handle Handle of the key, from the symbol table of the map.
+ * @return boolean: true if key exists, false otherwise.
+ */
+#define jmap_contains_handle(hashmap, handle) jmap.contains_handle(hashmap, handle)
+/**
+ * @brief Retrieves a value by its key from a frozen table.
+ * @param frozen Pointer to the JMAP_FROZEN structure.
+ * @param key The key to retrieve.
+ * @return Pointer to element. Do NOT free.
+ */
+#define jmap_frozen_get(frozen, key) jmap_frozen.get(frozen, key)
+/**
+ * @brief Checks if a key exists in a frozen table.
+ * @param frozen Pointer to the JMAP_FROZEN structure.
+ * @param key The key to check.
+ * @return boolean: true if key exists, false otherwise.
+ */
+#define jmap_frozen_contains_key(frozen, key) jmap_frozen.contains_key(frozen, key)
+/**
+ * @brief Iterates over each key-value pair of a frozen table.
+ * @param frozen Pointer to the JMAP_FROZEN structure.
+ * @param callback Function to call for each key-value pair.
+ * @param ctx Context pointer passed to the callback function.
+ */
+#define jmap_frozen_for_each(frozen, callback, ctx) jmap_frozen.for_each(frozen, callback, ctx)
+/**
+ * @brief Writes a frozen table to disk.
+ * @param frozen Pointer to the JMAP_FROZEN structure.
+ * @param path Path of the file to write.
+ */
+#define jmap_frozen_save(frozen, path) jmap_frozen.save(frozen, path)
+/**
+ * @brief Loads a frozen table from disk.
+ * @param path Path of the file to read.
+ * @param imp structure that contains the pointer to the user function implementations.
+ */
+#define jmap_frozen_load(path, imp) jmap_frozen.load(path, imp)
+/**
+ * @brief Frees a frozen table.
+ * @param frozen Pointer to the JMAP_FROZEN structure to free.
+ */
+#define jmap_frozen_free(frozen) jmap_frozen.free(frozen)
+/**
+ * @brief Attaches a write-ahead log to the JMAP after replaying it.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param path Path of the log file.
+ * @param config Group commit configuration.
+ */
+#define jmap_wal_open(hashmap, path, config) jmap_wal.open(hashmap, path, config)
+/**
+ * @brief Blocks until every operation recorded so far is durable on disk.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_wal_sync(hashmap) jmap_wal.sync(hashmap)
+/**
+ * @brief Writes a snapshot of the map and truncates the log.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_wal_compact(hashmap) jmap_wal.compact(hashmap)
+/**
+ * @brief Flushes the log and detaches it from the JMAP.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_wal_close(hashmap) jmap_wal.close(hashmap)
+/**
+ * @brief Turns the JMAP into a bounded LRU cache.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param config Limits and eviction callback.
+ */
+#define jmap_cache_enable(hashmap, config) jmap_cache.enable(hashmap, config)
+/**
+ * @brief Leaves cache mode.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_cache_disable(hashmap) jmap_cache.disable(hashmap)
+/**
+ * @brief Returns the hit, miss and eviction counters of a map in cache mode.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_cache_stats(hashmap) jmap_cache.stats(hashmap)
+/**
+ * @brief Computes count, sum, min, max and mean of a numeric preset map.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_numeric_stats(hashmap) jmap_numeric.stats(hashmap)
+/**
+ * @brief Counts the values satisfying `value cmp threshold`.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param cmp Comparison to apply.
+ * @param threshold Right-hand side of the comparison.
+ */
+#define jmap_numeric_count_if(hashmap, cmp, threshold) jmap_numeric.count_if(hashmap, cmp, threshold)
+/**
+ * @brief Updates every value of a numeric preset map in place.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param op Operation to apply.
+ * @param a Factor, addend or lower bound.
+ * @param b Upper bound for JMAP_APPLY_CLAMP.
+ */
+#define jmap_numeric_apply(hashmap, op, a, b) jmap_numeric.apply(hashmap, op, a, b)
+/**
+ * @brief Starts counting lookups, key comparisons and resizes.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_stats_enable(hashmap) jmap_stats.enable(hashmap)
+/**
+ * @brief Stops counting and drops the counters.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_stats_disable(hashmap) jmap_stats.disable(hashmap)
+/**
+ * @brief Returns probe length and cluster statistics, plus the counters if enabled.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_stats_collect(hashmap) jmap_stats.collect(hashmap)
+/**
+ * @brief Starts recording the operations of the map into a trace file.
+ * @param hashmap Pointer to the JMAP structure.
+ * @param path Path of the trace file.
+ * @param config Whether to record keys and buffer size.
+ */
+#define jmap_trace_start(hashmap, path, config) jmap_trace.start(hashmap, path, config)
+/**
+ * @brief Writes the buffered records and closes the trace.
+ * @param hashmap Pointer to the JMAP structure.
+ */
+#define jmap_trace_stop(hashmap) jmap_trace.stop(hashmap)
 
 
 #endif
\ No newline at end of file
@@ -1,9 +1,34 @@
 #include "../inc/jmap.h"
+#include "jmap_internal.h"
 #include <stdio.h>
 #include <stdarg.h>
-#include "third_party/murmur3-master/murmur3.h"
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #define NEXT_INDEX(index) ((index + 1) & (self->_capacity - 1))
+#define OCCUPANCY_SET(map, index) ((map)->_occupied[(index) / 64] |= (uint64_t)1 << ((index) % 64))
+#define OCCUPANCY_CLEAR(map, index) ((map)->_occupied[(index) / 64] &= ~((uint64_t)1 << ((index) % 64)))
+
+// Size really reserved by the allocator for a block, used for memory accounting
+#if defined(__GLIBC__)
+#define HEAP_USABLE_SIZE(ptr, requested) ((ptr) ? malloc_usable_size((void*)(ptr)) : 0)
+#else
+#define HEAP_USABLE_SIZE(ptr, requested) ((ptr) ? (requested) : 0)
+#endif
+#define HEAP_HEADER_SIZE sizeof(size_t)
+
+// Expired entries reclaimed by each put when TTLs are in use
+#define TTL_WORK_PER_PUT 4
+
+// Entries below which merge_into, intersect and difference stay on the calling thread
+#define BULK_PARALLEL_MIN_ENTRIES ((size_t)1 << 16)
+
+// Zero value inserted by map_entry, larger elements get a zeroed heap block
+static const unsigned char ZERO_ELEM[64];
 
 static const char *enum_to_string[] = {
     [JMAP_NO_ERROR]                         = "JMAP no error",
@@ -14,46 +39,14 @@ static const char *enum_to_string[] = {
     [JMAP_INVALID_ARGUMENT]                      = "Invalid argument",
     [JMAP_ELEMENT_NOT_FOUND]                     = "Element not found",
     [JMAP_UNIMPLEMENTED_FUNCTION]                = "Function not implemented",
+    [JMAP_IO_ERROR]                              = "I/O error",
+    [JMAP_MEMORY_BUDGET_EXCEEDED]                = "Memory budget exceeded",
 };
 
 
 static inline size_t max_size_t(size_t a, size_t b) {return (a > b ? a : b);}
 
-static inline void* memcpy_elem(JMAP *self, void *__restrict__ __dest, const void *__restrict__ __elem, size_t __count){
-    void *ret = __dest;
-
-    if (self->_data_type == JMAP_TYPE_VALUE) {
-        ret = memcpy(__dest, __elem, self->_elem_size * __count);
-    } else if (self->_data_type == JMAP_TYPE_POINTER) {
-        for (size_t i = 0; i < __count; i++) {
-            const void *src_elem = (const char*)__elem + i * self->_elem_size;
-            void *dest_elem = (char *)__dest + i * self->_elem_size;
-
-            if (!src_elem || !(*(void**)src_elem)) {
-                memset(dest_elem, 0, self->_elem_size);
-                continue;
-            }
-
-            if (!self->user_callbacks.copy_elem_callback) {
-                memcpy(dest_elem, src_elem, self->_elem_size);
-                continue;
-            }
-
-            const void *tmp = self->user_callbacks.copy_elem_callback(src_elem);
-            if (!tmp) {
-                memset(dest_elem, 0, self->_elem_size);
-                continue;
-            }
-
-            memcpy(dest_elem, tmp, self->_elem_size);
-            free((void*)tmp);
-        }
-    }
-    return ret;
-}
-
-
-static void create_return_error(const JMAP* ret_source, JMAP_ERROR error_code, const char* fmt, ...) {
+void create_return_error(const JMAP* ret_source, JMAP_ERROR error_code, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     jmap_last_error_trace.has_error = true;
@@ -64,7 +57,7 @@ static void create_return_error(const JMAP* ret_source, JMAP_ERROR error_code, c
 }
 
 static void print_array_err(const char *file, int line) {
-    if (jmap_last_error_trace.ret_source->user_overrides.print_error_override) {
+    if (jmap_last_error_trace.ret_source && jmap_last_error_trace.ret_source->user_overrides.print_error_override) {
         jmap_last_error_trace.ret_source->user_overrides.print_error_override(jmap_last_error_trace);
         return;
     }
@@ -77,7 +70,7 @@ static void print_array_err(const char *file, int line) {
     fprintf(stderr, "%s\n", jmap_last_error_trace.error_msg);
 }
 
-static void reset_error_trace(){
+void reset_error_trace(void){
     jmap_last_error_trace.has_error = false;
     jmap_last_error_trace.ret_source = NULL;
     jmap_last_error_trace.error_code = JMAP_NO_ERROR;
@@ -85,30 +78,180 @@ static void reset_error_trace(){
 }
 
 
+// Bytes of the per-slot arrays (occupancy bitmap, cache links, expiry) for a given capacity
+static size_t side_table_bytes(const JMAP *self, size_t capacity) {
+    size_t size = OCCUPANCY_WORDS(capacity) * sizeof(uint64_t);
+    if (self->_cache) size += capacity * cache_bytes_per_slot();
+    if (self->_ttl) size += ttl_table_bytes(capacity);
+    return size;
+}
+
+// Only the C library allocator can be asked what it really reserved, custom allocators are taken at their word
+static size_t usable_size(const JMAP *self, const void *ptr, size_t requested) {
+    if (!allocator_is_default(&self->_allocator)) return ptr ? requested : 0;
+    return HEAP_USABLE_SIZE(ptr, requested);
+}
+
+static size_t header_size(const JMAP *self) {
+    return allocator_is_default(&self->_allocator) ? HEAP_HEADER_SIZE : 0;
+}
+
+void track_table(JMAP *self, bool add) {
+    size_t keys_size = self->_capacity * sizeof(char*);
+    size_t data_size = self->_capacity * self->_elem_size;
+    size_t side_size = side_table_bytes(self, self->_capacity);
+    size_t overhead = usable_size(self, self->keys, keys_size) - keys_size
+                    + usable_size(self, self->data, data_size) - data_size
+                    + 2 * header_size(self);
+    if (add) {
+        self->_memory.table_bytes += keys_size + data_size + side_size;
+        self->_memory.overhead_bytes += overhead;
+    } else {
+        self->_memory.table_bytes -= keys_size + data_size + side_size;
+        self->_memory.overhead_bytes -= overhead;
+    }
+}
+
+static void track_key(JMAP *self, const char *key, bool add) {
+    // Interned keys belong to the symbol table
+    if (self->_intern) return;
+    size_t size = strlen(key) + 1;
+    size_t overhead = usable_size(self, key, size) - size + header_size(self);
+    if (add) {
+        self->_memory.key_bytes += size;
+        self->_memory.overhead_bytes += overhead;
+    } else {
+        self->_memory.key_bytes -= size;
+        self->_memory.overhead_bytes -= overhead;
+    }
+}
+
+// Usable size of the block pointed to by a JMAP_TYPE_POINTER element, from the pool or the heap
+static size_t value_block_size(const JMAP *self, const void *ptr) {
+    return self->_pool ? pool_block_size(ptr) : HEAP_USABLE_SIZE(ptr, 0);
+}
+
+// Heap block owned by a JMAP_TYPE_POINTER element (0 for JMAP_TYPE_VALUE)
+static size_t value_heap_size(const JMAP *self, const void *elem) {
+    if (self->_data_type != JMAP_TYPE_POINTER) return 0;
+    void *ptr = *(void**)elem;
+    return ptr ? value_block_size(self, ptr) + HEAP_HEADER_SIZE : 0;
+}
+
+static void track_value(JMAP *self, const void *elem, bool add) {
+    if (self->_data_type != JMAP_TYPE_POINTER || !*(void**)elem) return;
+    size_t size = value_block_size(self, *(void**)elem);
+    if (add) {
+        self->_memory.value_bytes += size;
+        self->_memory.overhead_bytes += HEAP_HEADER_SIZE;
+    } else {
+        self->_memory.value_bytes -= size;
+        self->_memory.overhead_bytes -= HEAP_HEADER_SIZE;
+    }
+}
+
+static void free_value_block(JMAP *self, void *ptr) {
+    if (self->_pool) pool_free(self->_pool, ptr);
+    else free(ptr);
+}
+
+static char *key_dup(const JMAP *self, const char *key) {
+    if (self->_intern) return (char*)intern_key(self->_intern, key);
+    return allocator_strdup(&self->_allocator, key);
+}
+
+static void key_free(const JMAP *self, char *key) {
+    if (key && !self->_intern) allocator_free(&self->_allocator, key, strlen(key) + 1);
+}
+
+// Zeroed value array of a table. Custom allocators are asked for cache line alignment, for the numeric kernels.
+static void *data_alloc(const JMAP *self, size_t capacity) {
+    // calloc gets fresh zero pages for large tables without touching them
+    if (allocator_is_default(&self->_allocator)) return calloc(capacity, self->_elem_size);
+    void *data = allocator_aligned(&self->_allocator, JMAP_DATA_ALIGNMENT, capacity * self->_elem_size);
+    if (data && !self->_allocator.zeroed) memset(data, 0, capacity * self->_elem_size);
+    return data;
+}
+
+// Frees the arrays of a table of the given capacity (the keys themselves are not freed)
+static void table_free(const JMAP *self, char **keys, void *data, uint64_t *occupied, size_t capacity) {
+    allocator_free(&self->_allocator, keys, capacity * sizeof(char*));
+    allocator_free(&self->_allocator, data, capacity * self->_elem_size);
+    allocator_free(&self->_allocator, occupied, OCCUPANCY_WORDS(capacity) * sizeof(uint64_t));
+}
+
+// Frees the heap block owned by a JMAP_TYPE_POINTER element and zeroes the element
+static void release_value(JMAP *self, void *elem) {
+    if (self->_data_type == JMAP_TYPE_POINTER && *(void**)elem) {
+        track_value(self, elem, false);
+        free_value_block(self, *(void**)elem);
+    }
+    memset(elem, 0, self->_elem_size);
+}
+
+// Copies the value to be stored into dest: into the value pool if there is one, with copy_elem_callback otherwise
+static bool copy_value_in(JMAP *self, void *dest, const void *value) {
+    if (self->_pool) return pool_copy(self->_pool, dest, value);
+    memcpy_elem(self, dest, value, 1);
+    return true;
+}
+
+/*
+ * A callback left a different pointer in a pooled slot: that block comes from the heap, so it is
+ * copied into the pool and freed, and the pool block it replaced is given back.
+ */
+static void pool_adopt(JMAP *self, void *slot, void *before) {
+    if (!self->_pool) return;
+    void *after = *(void**)slot;
+    if (after == before) return;
+    pool_free(self->_pool, before);
+    if (!after) return;
+    if (!pool_copy(self->_pool, slot, slot)) {
+        *(void**)slot = NULL;
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for pooled value failed");
+    }
+    free(after);
+}
+
+size_t memory_total(const JMAP *self) {
+    return self->_memory.table_bytes + self->_memory.key_bytes + self->_memory.value_bytes + self->_memory.overhead_bytes;
+}
+
 static void map_free(JMAP *self) {
-    if (self->_data_type == JMAP_TYPE_POINTER) {
+    // Live snapshots take a copy of what they still read from the table
+    if (self->_snapshot) snapshot_detach_all(self);
+    bgsave_release(self);
+    wal_release(self);
+    cache_release(self);
+    ttl_release(self);
+    stats_release(self);
+    trace_release(self);
+    ordered_release(self);
+    filter_release(self);
+    if (self->_data_type == JMAP_TYPE_POINTER && !self->_pool) {
         for (size_t i = 0; i < self->_capacity; i++){
             void **ptr = self->data + i*self->_elem_size;
             if (*ptr) free(*ptr);
             
         }
     }
-    if (self->data != NULL) {
-        free(self->data);
-        self->data = NULL;
-    }
+    // Pooled values go away with their pool
+    pool_release(self);
     if (self->keys != NULL) {
         for (size_t i = 0; i < self->_capacity; i++) {
             if (self->keys[i])
-                free(self->keys[i]);
+                key_free(self, self->keys[i]);
         }
-        free(self->keys);
-        self->keys = NULL;
     }
+    table_free(self, self->keys, self->data, self->_occupied, self->_capacity);
+    self->keys = NULL;
+    self->data = NULL;
+    self->_occupied = NULL;
     self->_length = 0;
     self->_capacity = 0;
     self->_elem_size = 0;
     self->_key_max_length = 0;
+    memset(&self->_memory, 0, sizeof(self->_memory));
     reset_error_trace();
 }
 
@@ -133,27 +276,54 @@ static void map_print(const JMAP *self) {
     reset_error_trace();
 }
 
-static void map_init(JMAP *map, size_t _elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+static void map_init_with_allocator(JMAP *map, size_t _elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp, JMAP_ALLOCATOR allocator) {
+    if (!allocator.alloc != !allocator.free) {
+        map->data = NULL;
+        map->keys = NULL;
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "Allocator needs both alloc and free, or neither");
+    }
+    map->_allocator = allocator;
     map->_capacity = 16;
     map->_load_factor = 0.75f;
     map->_elem_size = _elem_size;
     map->_length = 0;
     map->_key_max_length = 50;
     map->_data_type = data_type;
-    map->data = malloc(map->_capacity * map->_elem_size);
+    map->_wal = NULL;
+    map->_cache = NULL;
+    map->_ttl = NULL;
+    map->_pool = NULL;
+    map->_stats = NULL;
+    map->_trace = NULL;
+    map->_snapshot = NULL;
+    map->_intern = NULL;
+    map->_ordered = NULL;
+    map->_filter = NULL;
+    map->_bgsave = NULL;
+    map->_preset = JMAP_NO_PRESET;
+    map->data = data_alloc(map, map->_capacity);
     if (map->data == NULL) {
         return create_return_error(map, JMAP_UNINITIALIZED, "Memory allocation for data failed");
     }
-    memset(map->data, 0, map->_capacity * map->_elem_size);
-    map->keys = malloc(map->_capacity * sizeof(char*));
+    map->keys = allocator_alloc(&map->_allocator, map->_capacity * sizeof(char*));
     if (map->keys == NULL) {
-        free(map->data);
+        table_free(map, NULL, map->data, NULL, map->_capacity);
+        map->data = NULL;
         return create_return_error(map, JMAP_UNINITIALIZED, "Memory allocation for keys failed");
     }
     for (size_t i = 0; i < map->_capacity; i++) {
         map->keys[i] = NULL;
     }
-    
+    map->_occupied = allocator_calloc(&map->_allocator, OCCUPANCY_WORDS(map->_capacity), sizeof(uint64_t));
+    if (map->_occupied == NULL) {
+        table_free(map, map->keys, map->data, NULL, map->_capacity);
+        map->data = NULL;
+        map->keys = NULL;
+        return create_return_error(map, JMAP_UNINITIALIZED, "Memory allocation for occupancy bitmap failed");
+    }
+    memset(&map->_memory, 0, sizeof(map->_memory));
+    map->_memory_budget = 0;
+    track_table(map, true);
 
     map->user_callbacks.print_element_callback = NULL;
     map->user_callbacks.is_equal_callback = NULL;
@@ -167,41 +337,161 @@ static void map_init(JMAP *map, size_t _elem_size, JMAP_DATA_TYPE data_type, JMA
     reset_error_trace();
 }
 
-static size_t map_key_to_index(const JMAP *self, const char *key) {
+static void map_init(JMAP *map, size_t _elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+    JMAP_ALLOCATOR libc = {0};
+    map_init_with_allocator(map, _elem_size, data_type, imp, libc);
+}
+
+size_t map_key_to_index(const JMAP *self, const char *key) {
     if (key == NULL) create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL");
     if (strlen(key) == 0) create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be empty");
-    size_t output;
-    uint32_t hash;
-    MurmurHash3_x86_32(key, strlen(key), 42, &hash);
-    output = hash & (self->_capacity - 1);
+    size_t output = key_hash(key) & (self->_capacity - 1);
     reset_error_trace();
     return output;
 }
 
-static void map_resize(JMAP *self, size_t new_length) {
-    if ((new_length & (new_length - 1)) != 0) {
-        return create_return_error(self, JMAP_INVALID_ARGUMENT, "new_length must be power of two");
+// Full hash of a key stored in the map: interned keys carry theirs
+static inline uint32_t stored_key_hash(const JMAP *self, const char *key) {
+    return self->_intern ? intern_hash(key) : key_hash(key);
+}
+
+uint32_t map_stored_key_hash(const JMAP *self, const char *key) {
+    return stored_key_hash(self, key);
+}
+
+// Home slot of a key stored in the map, without rehashing interned keys
+size_t map_stored_key_index(const JMAP *self, const char *key) {
+    return stored_key_hash(self, key) & (self->_capacity - 1);
+}
+
+static void map_move_slot(JMAP *self, size_t from, size_t to) {
+    if (self->_snapshot) {
+        snapshot_before_write(self, from);
+        snapshot_before_write(self, to);
     }
+    self->keys[to] = self->keys[from];
+    self->keys[from] = NULL;
+    OCCUPANCY_SET(self, to);
+    OCCUPANCY_CLEAR(self, from);
+    memcpy((char*)self->data + to * self->_elem_size, (char*)self->data + from * self->_elem_size, self->_elem_size);
+    memset((char*)self->data + from * self->_elem_size, 0, self->_elem_size);
+    if (self->_cache) cache_on_move(self->_cache, from, to);
+    if (self->_ttl) ttl_on_move(self->_ttl, from, to);
+}
 
-    if (new_length <= self->_capacity) {
-        return create_return_error(self, JMAP_INVALID_ARGUMENT, "new_length must be greater than current capacity");
+// Logs the value of slot idx to the write-ahead log, with the time it has left to live if it has a TTL
+void map_log_put(JMAP *self, size_t idx) {
+    if (!self->_wal) return;
+    uint64_t ttl_ms = self->_ttl ? ttl_remaining_ms(self->_ttl, idx) : 0;
+    wal_log_put(self->_wal, self->keys[idx], (char*)self->data + idx * self->_elem_size, ttl_ms);
+}
+
+/*
+ * Removes the entry stored in slot idx, then shifts back the following entries of the cluster
+ * (backward shift deletion) so that no probe chain goes through an empty slot.
+ */
+void map_erase_at(JMAP *self, size_t idx) {
+    if (self->_snapshot) snapshot_before_write(self, idx);
+    if (self->_wal) wal_log_remove(self->_wal, self->keys[idx]);
+    if (self->_cache) cache_on_erase(self->_cache, idx);
+    if (self->_ttl) ttl_on_erase(self->_ttl, idx);
+    if (self->_ordered) ordered_remove(self, self->keys[idx]);
+    release_value(self, (char*)self->data + idx * self->_elem_size);
+    track_key(self, self->keys[idx], false);
+    key_free(self, self->keys[idx]);
+    self->keys[idx] = NULL;
+    OCCUPANCY_CLEAR(self, idx);
+    self->_length--;
+
+    size_t mask = self->_capacity - 1;
+    size_t hole = idx;
+    for (size_t j = NEXT_INDEX(idx); self->keys[j] != NULL; j = NEXT_INDEX(j)) {
+        size_t home = map_stored_key_index(self, self->keys[j]);
+        if (((hole - home) & mask) < ((j - home) & mask)) {
+            map_move_slot(self, j, hole);
+            hole = j;
+        }
     }
+    if (self->_filter) filter_on_remove(self);
+}
+
+// Evicts the least recently used entry of a map in cache mode. Returns false if there is none.
+bool map_evict_lru(JMAP *self) {
+    if (!self->_cache || self->_length == 0) return false;
+    size_t idx = cache_lru_slot(self->_cache);
+    const JMAP_CACHE_CONFIG *config = cache_config(self->_cache);
+    void *elem = (char*)self->data + idx * self->_elem_size;
+    if (config->evict_callback) {
+        // The callback may take ownership of a pointer value by setting it to NULL, unless it is pooled
+        void *before = self->_pool ? *(void**)elem : NULL;
+        track_value(self, elem, false);
+        config->evict_callback(self->keys[idx], elem, config->evict_ctx);
+        if (before) *(void**)elem = before;
+        track_value(self, elem, true);
+    }
+    cache_count_eviction(self->_cache);
+    map_erase_at(self, idx);
+    return true;
+}
+
+// Moves every entry to a table of new_length slots, which may be smaller than the current one
+static void map_rehash(JMAP *self, size_t new_length) {
+    if (self->_length > new_length * self->_load_factor) {
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "new_length is too small for %zu entries", self->_length);
+    }
+    uint64_t start_ns = self->_stats || JMAP_USDT_ENABLED ? stats_clock_ns() : 0;
 
     char **old_keys   = self->keys;
     void  *old_data   = self->data;
     size_t old_length = self->_capacity;
+    size_t *remap = NULL;
+    size_t remap_size = old_length * sizeof(size_t);
+    if (self->_cache || self->_ttl) {
+        remap = allocator_alloc(&self->_allocator, remap_size);
+        if (!remap) return create_return_error(self, JMAP_UNINITIALIZED, "alloc slot remap failed");
+    }
+    track_table(self, false);
 
-    char **new_keys = calloc(new_length, sizeof(char*));
-    if (!new_keys) return create_return_error(self, JMAP_UNINITIALIZED, "alloc keys failed");
-    void *new_data = calloc(new_length, self->_elem_size);
+    char **new_keys = allocator_calloc(&self->_allocator, new_length, sizeof(char*));
+    if (!new_keys) {
+        allocator_free(&self->_allocator, remap, remap_size);
+        track_table(self, true);
+        return create_return_error(self, JMAP_UNINITIALIZED, "alloc keys failed");
+    }
+    void *new_data = data_alloc(self, new_length);
     if (!new_data) {
-        free(new_keys);
+        allocator_free(&self->_allocator, remap, remap_size);
+        table_free(self, new_keys, NULL, NULL, new_length);
+        track_table(self, true);
         return create_return_error(self, JMAP_UNINITIALIZED, "alloc data failed");
     }
+    if (self->_ttl && !ttl_reserve(self->_ttl, new_length)) {
+        allocator_free(&self->_allocator, remap, remap_size);
+        table_free(self, new_keys, new_data, NULL, new_length);
+        track_table(self, true);
+        return create_return_error(self, JMAP_UNINITIALIZED, "alloc expiry table failed");
+    }
+    // Resized last: the old bitmap is left untouched if this fails, and it is rebuilt below anyway
+    uint64_t *new_occupied = allocator_realloc(&self->_allocator, self->_occupied,
+                                               OCCUPANCY_WORDS(old_length) * sizeof(uint64_t),
+                                               OCCUPANCY_WORDS(new_length) * sizeof(uint64_t));
+    if (!new_occupied) {
+        allocator_free(&self->_allocator, remap, remap_size);
+        table_free(self, new_keys, new_data, NULL, new_length);
+        track_table(self, true);
+        return create_return_error(self, JMAP_UNINITIALIZED, "alloc occupancy bitmap failed");
+    }
+    memset(new_occupied, 0, OCCUPANCY_WORDS(new_length) * sizeof(uint64_t));
+    // Snapshots copy the old table only now: a failed resize leaves them sharing it
+    if (self->_snapshot) snapshot_detach_all(self);
+    // Fired once the allocations succeeded, so that every resize_start is followed by a resize_end
+    JMAP_PROBE4(resize_start, self, old_length, new_length, self->_length);
 
     self->keys    = new_keys;
     self->data    = new_data;
+    self->_occupied = new_occupied;
     self->_capacity = new_length;
+    track_table(self, true);
 
     self->_length   = 0;
 
@@ -209,93 +499,757 @@ static void map_resize(JMAP *self, size_t new_length) {
         char *k = old_keys[i];
         if (!k) continue;
 
-        size_t idx = map_key_to_index(self, k);
+        size_t idx = map_stored_key_index(self, k);
         while (self->keys[idx] != NULL) {
             idx = NEXT_INDEX(idx);
         }
 
         self->keys[idx] = k;
-        memcpy_elem(self, (char*)self->data + idx * self->_elem_size,
-               (char*)old_data    + i   * self->_elem_size,
-               1);
+        OCCUPANCY_SET(self, idx);
+        if (remap) remap[i] = idx;
+        // The map keeps owning the value, only its bytes move
+        memcpy((char*)self->data + idx * self->_elem_size, (char*)old_data + i * self->_elem_size, self->_elem_size);
         self->_length++;
     }
 
-    free(old_keys);
-    free(old_data);
+    table_free(self, old_keys, old_data, NULL, old_length);
+    if (self->_filter) filter_rebuild(self);
+    if (self->_ttl) ttl_on_resize(self->_ttl, remap, new_length);
+    if (self->_cache) {
+        bool relinked = cache_on_resize(self->_cache, remap, new_length);
+        // Losing the recency order is not fatal, fall back to slot order
+        if (!relinked) {
+            JMAP_CACHE_CONFIG config = *cache_config(self->_cache);
+            track_table(self, false);
+            cache_release(self);
+            self->_cache = cache_create(self, config);
+            track_table(self, true);
+            if (!self->_cache) {
+                allocator_free(&self->_allocator, remap, remap_size);
+                JMAP_PROBE4(resize_end, self, old_length, new_length, stats_clock_ns() - start_ns);
+                return create_return_error(self, JMAP_UNINITIALIZED, "alloc cache links failed");
+            }
+        }
+    }
+    allocator_free(&self->_allocator, remap, remap_size);
+    if (self->_stats) stats_on_resize(self->_stats, start_ns);
+    JMAP_PROBE4(resize_end, self, old_length, new_length, stats_clock_ns() - start_ns);
     reset_error_trace();
 }
 
+static void map_resize(JMAP *self, size_t new_length) {
+    if ((new_length & (new_length - 1)) != 0) {
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "new_length must be power of two");
+    }
 
-static void map_put(JMAP *self, const char *key, const void *value) {
-    if (!self->data || !self->keys)
-        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
-    if (!key || key[0] == '\0')
-        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+    if (new_length <= self->_capacity) {
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "new_length must be greater than current capacity");
+    }
+    map_rehash(self, new_length);
+}
 
-    if (self->_length + 1 > (self->_capacity * self->_load_factor)) {
-        map_resize(self, self->_capacity * 2);
-        if (jmap_last_error_trace.has_error) return;
+// Shrinks the table once removals left it less than a quarter full, in a single rehash however many halvings it takes
+static void map_shrink_if_sparse(JMAP *self) {
+    size_t new_length = self->_capacity;
+    while (new_length > 16 && self->_length < new_length * self->_load_factor / 4) new_length /= 2;
+    if (new_length == self->_capacity) return;
+    JMAP_PROBE4(shrink, self, self->_capacity, new_length, self->_length);
+    map_rehash(self, new_length);
+}
+
+// Fires the long_probe probe for a lookup of key that went from slot home to slot idx
+static inline void probe_long_lookup(const JMAP *self, const char *key, size_t home, size_t idx) {
+#if JMAP_USDT_ENABLED
+    size_t probe_length = ((idx - home) & (self->_capacity - 1)) + 1;
+    if (probe_length > JMAP_USDT_LONG_PROBE) JMAP_PROBE3(long_probe, self, key, probe_length);
+#else
+    (void)self; (void)key; (void)home; (void)idx;
+#endif
+}
+
+
+// map_probe with statistics enabled: same walk, counting the key comparisons
+static size_t map_probe_counted(const JMAP *self, const char *key, size_t home) {
+    size_t idx = home;
+    size_t compares = 0;
+    while (self->keys[idx] != NULL) {
+        compares++;
+        if (strcmp(self->keys[idx], key) == 0) break;
+        idx = NEXT_INDEX(idx);
     }
+    stats_on_lookup(self->_stats, compares, self->keys[idx] != NULL);
+    probe_long_lookup(self, key, home, idx);
+    return idx;
+}
 
-    size_t idx = map_key_to_index(self, key);
+// Walk of map_probe from the home slot of key
+static size_t map_probe_from(const JMAP *self, const char *key, size_t home) {
+    if (self->_stats) return map_probe_counted(self, key, home);
+    size_t idx = home;
     while (self->keys[idx] != NULL && strcmp(self->keys[idx], key) != 0) {
         idx = NEXT_INDEX(idx);
     }
+    probe_long_lookup(self, key, home, idx);
+    return idx;
+}
+
+// Returns the slot holding key, or the empty slot where it would be inserted
+static size_t map_probe(const JMAP *self, const char *key) {
+    return map_probe_from(self, key, map_key_to_index(self, key));
+}
 
-    if (self->keys[idx] == NULL) {
-        self->keys[idx] = strdup(key);
-        if (!self->keys[idx])
-            return create_return_error(self, JMAP_UNINITIALIZED, "strdup failed for key");
+// map_probe for reads: SIZE_MAX when the filter rules key out, without touching the table
+static size_t map_lookup(const JMAP *self, const char *key) {
+    if (!self->_filter) return map_probe(self, key);
+    uint32_t hash = key_hash(key);
+    if (!filter_may_contain(self->_filter, hash)) {
+        if (self->_stats) stats_on_filter(self->_stats, false, false);
+        return SIZE_MAX;
+    }
+    size_t idx = map_probe_from(self, key, hash & (self->_capacity - 1));
+    if (self->_stats) stats_on_filter(self->_stats, true, self->keys[idx] != NULL);
+    return idx;
+}
+
+// map_probe for a handle of the map's symbol table: cached hash and pointer comparisons. SIZE_MAX when the filter rules it out.
+static size_t map_probe_handle(const JMAP *self, const char *handle) {
+    uint32_t hash = intern_hash(handle);
+    if (self->_filter && !filter_may_contain(self->_filter, hash)) {
+        if (self->_stats) stats_on_filter(self->_stats, false, false);
+        return SIZE_MAX;
+    }
+    size_t home = hash & (self->_capacity - 1);
+    size_t idx = home;
+    size_t compares = 0;
+    while (self->keys[idx] != NULL && self->keys[idx] != handle) {
+        compares++;
+        idx = NEXT_INDEX(idx);
+    }
+    if (self->_stats) {
+        stats_on_lookup(self->_stats, compares + (self->keys[idx] != NULL), self->keys[idx] != NULL);
+        if (self->_filter) stats_on_filter(self->_stats, true, self->keys[idx] != NULL);
+    }
+    probe_long_lookup(self, handle, home, idx);
+    return idx;
+}
+
+// Same as map_probe, but an expired entry is removed and reported as absent
+static size_t map_probe_live(JMAP *self, const char *key) {
+    size_t idx = map_probe(self, key);
+    if (self->keys[idx] && self->_ttl && ttl_is_expired(self->_ttl, idx)) {
+        map_erase_at(self, idx);
+        idx = map_probe(self, key);
+    }
+    return idx;
+}
+
+// Checks shared by the writing functions, then reclaims a few expired entries
+static bool map_prepare_write(JMAP *self, const char *key) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return false;
+    }
+    if (!key || key[0] == '\0') {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+        return false;
+    }
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_PUT, key);
+    if (self->_ttl) ttl_expire(self, TTL_WORK_PER_PUT);
+    return true;
+}
+
+/*
+ * Stores value for key in slot idx, as returned by map_probe (inserting key if the slot is empty).
+ * Evictions and resizes may move the entry: the final slot is returned, or SIZE_MAX on error.
+ * With adopt, a pointer value is stored as is and the map becomes its owner once the call succeeds.
+ */
+static size_t map_store(JMAP *self, const char *key, const void *value, size_t idx, bool adopt, uint32_t ttl_ms) {
+    bool is_new = self->keys[idx] == NULL;
+    bool grow = is_new && self->_length + 1 > (self->_capacity * self->_load_factor);
+
+    // Pointer values are copied first so their size is known before the budget check
+    void *new_elem = NULL;
+    const void *elem = value;
+    if (self->_data_type == JMAP_TYPE_POINTER && (!adopt || self->_pool)) {
+        if (!copy_value_in(self, &new_elem, value)) {
+            create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for value failed");
+            return SIZE_MAX;
+        }
+        elem = &new_elem;
+    }
+
+    // In cache mode, make room by evicting the least recently used entries
+    bool evicted = false;
+    if (is_new && self->_cache) {
+        size_t max_entries = cache_config(self->_cache)->max_entries;
+        while (max_entries && self->_length >= max_entries && map_evict_lru(self)) evicted = true;
+    }
+
+    if (self->_memory_budget) {
+        size_t freed = is_new ? 0 : value_heap_size(self, (char*)self->data + idx * self->_elem_size);
+        // The entry being updated becomes the most recently used, so that it is evicted last
+        if (!is_new && self->_cache) cache_touch(self->_cache, idx);
+        for (;;) {
+            // Each eviction may bring the length back under the resize threshold
+            size_t growth = value_heap_size(self, elem);
+            if (is_new && !self->_intern) growth += strlen(key) + 1 + header_size(self);
+            if (is_new && self->_length + 1 > (self->_capacity * self->_load_factor))
+                growth += self->_capacity * (sizeof(char*) + self->_elem_size)
+                        + side_table_bytes(self, self->_capacity * 2) - side_table_bytes(self, self->_capacity);
+            if (memory_total(self) + growth - freed <= self->_memory_budget) break;
+            bool evictable = self->_cache && self->_length > (is_new ? 0 : 1);
+            if (!evictable) {
+                if (elem == &new_elem) free_value_block(self, new_elem);
+                create_return_error(self, JMAP_MEMORY_BUDGET_EXCEEDED, "Putting \"%s\" exceeds the budget of %zu bytes", key, self->_memory_budget);
+                return SIZE_MAX;
+            }
+            map_evict_lru(self);
+            evicted = true;
+            if (!is_new) {
+                idx = map_key_to_index(self, key);
+                while (strcmp(self->keys[idx], key) != 0) idx = NEXT_INDEX(idx);
+            }
+        }
+    }
+
+    if (evicted && is_new) {
+        idx = map_key_to_index(self, key);
+        while (self->keys[idx] != NULL) idx = NEXT_INDEX(idx);
+    }
+    grow = is_new && self->_length + 1 > (self->_capacity * self->_load_factor);
+
+    if (grow) {
+        map_resize(self, self->_capacity * 2);
+        if (jmap_last_error_trace.has_error) {
+            if (elem == &new_elem) free_value_block(self, new_elem);
+            return SIZE_MAX;
+        }
+        idx = map_key_to_index(self, key);
+        while (self->keys[idx] != NULL) {
+            idx = NEXT_INDEX(idx);
+        }
+    }
+
+    if (self->_snapshot) snapshot_before_write(self, idx);
+    char *slot = (char*)self->data + idx * self->_elem_size;
+    if (is_new) {
+        self->keys[idx] = key_dup(self, key);
+        if (!self->keys[idx]) {
+            if (elem == &new_elem) free_value_block(self, new_elem);
+            create_return_error(self, JMAP_UNINITIALIZED, "strdup failed for key");
+            return SIZE_MAX;
+        }
+        if (self->_ordered && !ordered_insert(self, self->keys[idx])) {
+            key_free(self, self->keys[idx]);
+            self->keys[idx] = NULL;
+            if (elem == &new_elem) free_value_block(self, new_elem);
+            create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for ordered index failed");
+            return SIZE_MAX;
+        }
+        if (self->_filter) filter_on_insert(self, self->keys[idx]);
+        track_key(self, self->keys[idx], true);
+        OCCUPANCY_SET(self, idx);
         self->_length++;
+        if (self->_cache) cache_on_insert(self->_cache, idx);
+    } else if (adopt && memcmp(slot, elem, self->_elem_size) == 0) {
+        // Moving in the pointer the slot already owns must not free it
+        track_value(self, slot, false);
+        if (self->_cache) cache_touch(self->_cache, idx);
+    } else {
+        release_value(self, slot);
+        if (self->_cache) cache_touch(self->_cache, idx);
     }
 
-    memcpy_elem(self, (char*)self->data + idx * self->_elem_size, value, 1);
+    memcpy(slot, elem, self->_elem_size);
+    track_value(self, slot, true);
+    // The stored value gets the given TTL, or none: a plain put makes the entry persistent again
+    if (ttl_ms) ttl_schedule(self->_ttl, idx, ttl_ms);
+    else if (self->_ttl) ttl_on_erase(self->_ttl, idx);
+    map_log_put(self, idx);
+    // An adopted block was copied into the pool, the original is no longer needed
+    if (adopt && elem == &new_elem) free(*(void**)value);
 
     reset_error_trace();
+    return idx;
 }
 
-static void* map_get(const JMAP *self, const char *key) {
+// Inserts or updates key and returns its slot, or SIZE_MAX on error
+static size_t map_insert(JMAP *self, const char *key, const void *value, bool adopt, uint32_t ttl_ms) {
+    if (!map_prepare_write(self, key)) return SIZE_MAX;
+    return map_store(self, key, value, map_probe(self, key), adopt, ttl_ms);
+}
+
+static void map_put(JMAP *self, const char *key, const void *value) {
+    map_insert(self, key, value, false, 0);
+}
+
+static void map_put_move(JMAP *self, const char *key, void *value) {
+    if (!value)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Value cannot be NULL");
+    if (map_insert(self, key, value, true, 0) == SIZE_MAX) return;
+    // The map owns the value now, leave nothing to free behind
+    if (self->_data_type == JMAP_TYPE_POINTER) memset(value, 0, self->_elem_size);
+}
+
+static void map_put_with_ttl(JMAP *self, const char *key, const void *value, uint64_t ttl_ms) {
+    if (ttl_ms == 0 || ttl_ms > INT32_MAX)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "TTL must be between 1 and %d ms", INT32_MAX);
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!self->_ttl) {
+        track_table(self, false);
+        self->_ttl = ttl_create(self);
+        track_table(self, true);
+        if (!self->_ttl) return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for expiry table failed");
+    }
+
+    map_insert(self, key, value, false, (uint32_t)ttl_ms);
+}
+
+static size_t map_expire(JMAP *self, size_t max_work) {
     if (!self->data || !self->keys) {
         create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return 0;
+    }
+    size_t removed = self->_ttl ? ttl_expire(self, max_work) : 0;
+    reset_error_trace();
+    return removed;
+}
+
+
+
+// Returns the slot of key, inserting it with a zeroed value if it is absent. SIZE_MAX on error.
+static size_t map_entry(JMAP *self, const char *key, bool *inserted) {
+    if (!map_prepare_write(self, key)) return SIZE_MAX;
+    size_t idx = map_probe_live(self, key);
+    *inserted = self->keys[idx] == NULL;
+    if (!*inserted) {
+        // The caller gets the slot to write to
+        if (self->_snapshot) snapshot_before_write(self, idx);
+        if (self->_cache) cache_touch(self->_cache, idx);
+        return idx;
+    }
+    void *heap_zero = NULL;
+    if (self->_elem_size > sizeof(ZERO_ELEM) && !(heap_zero = calloc(1, self->_elem_size))) {
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for value failed");
+        return SIZE_MAX;
+    }
+    idx = map_store(self, key, heap_zero ? heap_zero : ZERO_ELEM, idx, false, 0);
+    free(heap_zero);
+    return idx;
+}
+
+static void *map_get_or_insert_default(JMAP *self, const char *key) {
+    bool inserted;
+    size_t idx = map_entry(self, key, &inserted);
+    if (idx == SIZE_MAX) return NULL;
+    reset_error_trace();
+    return (char*)self->data + idx * self->_elem_size;
+}
+
+static void *map_compute(JMAP *self, const char *key, bool (*fn)(const char *key, void *value, bool exists, void *ctx), void *ctx) {
+    if (!fn) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Compute function cannot be NULL");
         return NULL;
     }
-    if (!key || key[0] == '\0') {
-        create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+    bool inserted;
+    size_t idx = map_entry(self, key, &inserted);
+    if (idx == SIZE_MAX) return NULL;
+
+    void *slot = (char*)self->data + idx * self->_elem_size;
+    // fn may replace a pointer value, account for whatever it leaves in the slot
+    void *before = self->_data_type == JMAP_TYPE_POINTER ? *(void**)slot : NULL;
+    track_value(self, slot, false);
+    bool keep = fn(self->keys[idx], slot, !inserted, ctx);
+    pool_adopt(self, slot, before);
+    track_value(self, slot, true);
+    if (!keep) {
+        map_erase_at(self, idx);
+        reset_error_trace();
         return NULL;
     }
+    map_log_put(self, idx);
+    reset_error_trace();
+    return slot;
+}
 
-    size_t idx = map_key_to_index(self, key);
-    size_t probes = 0;
+// Combines value into the entry of slot idx with combine_fn and returns the slot
+static void *map_combine_at(JMAP *self, size_t idx, const void *value, void (*combine_fn)(void *existing, const void *value)) {
+    if (self->_snapshot) snapshot_before_write(self, idx);
+    void *slot = (char*)self->data + idx * self->_elem_size;
+    if (self->_cache) cache_touch(self->_cache, idx);
+    void *before = self->_data_type == JMAP_TYPE_POINTER ? *(void**)slot : NULL;
+    track_value(self, slot, false);
+    combine_fn(slot, value);
+    pool_adopt(self, slot, before);
+    track_value(self, slot, true);
+    map_log_put(self, idx);
+    return slot;
+}
 
-    while (probes < self->_capacity) {
-        char *k = self->keys[idx];
-        if (!k) {
-            create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found" , key);
-            return NULL;
+static void *map_merge(JMAP *self, const char *key, const void *value, void (*combine_fn)(void *existing, const void *value)) {
+    if (!combine_fn) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Combine function cannot be NULL");
+        return NULL;
+    }
+    if (!map_prepare_write(self, key)) return NULL;
+
+    size_t idx = map_probe_live(self, key);
+    if (!self->keys[idx]) {
+        idx = map_store(self, key, value, idx, false, 0);
+        return idx == SIZE_MAX ? NULL : (char*)self->data + idx * self->_elem_size;
+    }
+
+    void *slot = map_combine_at(self, idx, value, combine_fn);
+    reset_error_trace();
+    return slot;
+}
+
+/* ---------- Bulk operations between maps ---------- */
+
+/*
+ * merge_into, intersect and difference first hash every key of the map they iterate and look it up
+ * in the other map, both read-only, which is split across threads for large maps. The keys are
+ * taken in slot order, following the occupancy bitmap. Each key is hashed once: the slot index in
+ * either table is the low bits of the same hash.
+ */
+
+typedef struct BULK_TASK {
+    const JMAP *iterated;
+    const JMAP *looked_up;
+    const size_t *slots;        // Occupied slots of iterated
+    uint32_t *hashes;
+    size_t *found;              // Slot of the key in looked_up, SIZE_MAX if absent
+} BULK_TASK;
+
+// Slot of key in self from its full hash, SIZE_MAX if absent. Safe to call from several threads.
+static size_t map_find_hashed(const JMAP *self, const char *key, uint32_t hash) {
+    size_t mask = self->_capacity - 1;
+    for (size_t idx = hash & mask; self->keys[idx] != NULL; idx = (idx + 1) & mask) {
+        if (strcmp(self->keys[idx], key) == 0) return idx;
+    }
+    return SIZE_MAX;
+}
+
+// map_find_hashed for a handle of the symbol table of self: keys are compared by pointer
+static size_t map_find_handle(const JMAP *self, const char *handle, uint32_t hash) {
+    size_t mask = self->_capacity - 1;
+    for (size_t idx = hash & mask; self->keys[idx] != NULL; idx = (idx + 1) & mask) {
+        if (self->keys[idx] == handle) return idx;
+    }
+    return SIZE_MAX;
+}
+
+static void bulk_task(void *ctx, size_t begin, size_t end) {
+    BULK_TASK *task = ctx;
+    for (size_t i = begin; i < end; i++) {
+        const char *key = task->iterated->keys[task->slots[i]];
+        task->hashes[i] = stored_key_hash(task->iterated, key);
+        if (task->iterated->_intern && task->iterated->_intern == task->looked_up->_intern)
+            task->found[i] = map_find_handle(task->looked_up, key, task->hashes[i]);
+        else
+            task->found[i] = map_find_hashed(task->looked_up, key, task->hashes[i]);
+    }
+}
+
+// Threads to use for a request of threads (0: one per online CPU), never more than the online CPUs
+unsigned parallel_threads(unsigned threads) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned cpus = online > 0 ? (unsigned)online : 1;
+    return threads == 0 || threads > cpus ? cpus : threads;
+}
+
+typedef struct PARALLEL_RANGE {
+    void (*fn)(void *ctx, size_t begin, size_t end);
+    void *ctx;
+    size_t begin;
+    size_t end;
+} PARALLEL_RANGE;
+
+static void *parallel_range(void *arg) {
+    PARALLEL_RANGE *range = arg;
+    range->fn(range->ctx, range->begin, range->end);
+    return NULL;
+}
+
+/*
+ * Splits [0, count) in contiguous ranges, one per thread, and calls fn on each, the calling thread
+ * taking the first one. Ranges whose thread could not be started run on the calling thread.
+ */
+void parallel_for(size_t count, unsigned threads, void (*fn)(void *ctx, size_t begin, size_t end), void *ctx) {
+    threads = parallel_threads(threads);
+    PARALLEL_RANGE ranges[threads];
+    pthread_t ids[threads];
+    bool started[threads];
+    for (unsigned t = 0; t < threads; t++) {
+        ranges[t] = (PARALLEL_RANGE){ fn, ctx, count * t / threads, count * (t + 1) / threads };
+        started[t] = t > 0 && pthread_create(&ids[t], NULL, parallel_range, &ranges[t]) == 0;
+    }
+    parallel_range(&ranges[0]);
+    for (unsigned t = 1; t < threads; t++) {
+        if (started[t]) pthread_join(ids[t], NULL);
+        else parallel_range(&ranges[t]);
+    }
+}
+
+// Fills slots, hashes and found for the entries of iterated
+static void bulk_lookup(const JMAP *iterated, const JMAP *looked_up, size_t *slots, uint32_t *hashes, size_t *found, unsigned threads) {
+    size_t count = 0;
+    for (size_t w = 0; w < OCCUPANCY_WORDS(iterated->_capacity); w++) {
+        for (uint64_t bits = iterated->_occupied[w]; bits; bits &= bits - 1) {
+            slots[count++] = w * 64 + (size_t)__builtin_ctzll(bits);
         }
-        if (strcmp(k, key) == 0) {
-            reset_error_trace();
-            return (char*)self->data + idx * self->_elem_size;
+    }
+
+    BULK_TASK task = { iterated, looked_up, slots, hashes, found };
+    parallel_for(count, count < BULK_PARALLEL_MIN_ENTRIES ? 1 : threads, bulk_task, &task);
+}
+
+typedef struct BULK_SCRATCH {
+    size_t *slots;
+    uint32_t *hashes;
+    size_t *found;
+} BULK_SCRATCH;
+
+static bool bulk_alloc(BULK_SCRATCH *scratch, size_t count) {
+    scratch->slots = malloc(count * sizeof(size_t));
+    scratch->hashes = malloc(count * sizeof(uint32_t));
+    scratch->found = malloc(count * sizeof(size_t));
+    return scratch->slots && scratch->hashes && scratch->found;
+}
+
+static void bulk_free(BULK_SCRATCH *scratch) {
+    free(scratch->slots);
+    free(scratch->hashes);
+    free(scratch->found);
+}
+
+static bool bulk_check(JMAP *dst, const JMAP *src) {
+    if (!dst->data || !dst->keys || !src->data || !src->keys) {
+        create_return_error(dst, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return false;
+    }
+    if (dst == src) {
+        create_return_error(dst, JMAP_INVALID_ARGUMENT, "Source and destination must be different maps");
+        return false;
+    }
+    return true;
+}
+
+static void map_merge_into(JMAP *dst, const JMAP *src, void (*conflict_fn)(void *existing, const void *value), unsigned threads) {
+    if (!bulk_check(dst, src)) return;
+    if (dst->_elem_size != src->_elem_size || dst->_data_type != src->_data_type)
+        return create_return_error(dst, JMAP_INVALID_ARGUMENT, "Maps have different value types");
+    size_t count = src->_length;
+    if (count == 0) return reset_error_trace();
+
+    BULK_SCRATCH scratch = {0};
+    if (!bulk_alloc(&scratch, count)) {
+        bulk_free(&scratch);
+        return create_return_error(dst, JMAP_UNINITIALIZED, "Memory allocation for merge failed");
+    }
+    bulk_lookup(src, dst, scratch.slots, scratch.hashes, scratch.found, threads);
+
+    // Grow once for all the new keys
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) added += scratch.found[i] == SIZE_MAX;
+    size_t capacity = dst->_capacity;
+    while (dst->_length + added > capacity * dst->_load_factor) capacity *= 2;
+    bool rehashed = capacity != dst->_capacity;
+    if (rehashed) {
+        map_rehash(dst, capacity);
+        if (jmap_last_error_trace.has_error) return bulk_free(&scratch);
+    }
+
+    /*
+     * Expiration, eviction and budgets decide per put: such maps take the put and merge paths.
+     * Otherwise existing keys are updated in their slot and new ones go to the first empty slot
+     * of their probe chain, as they are known to be absent. Inserting never moves other entries.
+     */
+    bool plain = !dst->_ttl && !dst->_cache && !dst->_memory_budget;
+    for (size_t i = 0; i < count; i++) {
+        const char *key = src->keys[scratch.slots[i]];
+        const void *value = (const char*)src->data + scratch.slots[i] * src->_elem_size;
+        size_t idx = scratch.found[i];
+        if (!plain) {
+            if (conflict_fn) map_merge(dst, key, value, conflict_fn);
+            else map_put(dst, key, value);
+        } else if (idx == SIZE_MAX) {
+            if (dst->_trace) trace_log(dst->_trace, JMAP_TRACE_PUT, key);
+            idx = scratch.hashes[i] & (dst->_capacity - 1);
+            while (dst->keys[idx] != NULL) idx = (idx + 1) & (dst->_capacity - 1);
+            map_store(dst, key, value, idx, false, 0);
+        } else {
+            if (dst->_trace) trace_log(dst->_trace, JMAP_TRACE_PUT, key);
+            if (rehashed) idx = map_find_hashed(dst, key, scratch.hashes[i]);
+            if (conflict_fn) map_combine_at(dst, idx, value, conflict_fn);
+            else map_store(dst, key, value, idx, false, 0);
         }
-        idx = NEXT_INDEX(idx);
-        probes++;
+        if (jmap_last_error_trace.has_error) return bulk_free(&scratch);
     }
+    bulk_free(&scratch);
+    reset_error_trace();
+}
 
-    create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found after full probe", key);
-    return NULL;
+// Erases from dst the keys listed in erased (addresses of dst's own key strings), then shrinks once
+static void bulk_erase(JMAP *dst, char **erased, const uint32_t *hashes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        size_t idx = hashes[i] & (dst->_capacity - 1);
+        while (dst->keys[idx] != erased[i]) idx = (idx + 1) & (dst->_capacity - 1);
+        if (dst->_trace) trace_log(dst->_trace, JMAP_TRACE_REMOVE, erased[i]);
+        map_erase_at(dst, idx);
+    }
+    map_shrink_if_sparse(dst);
+}
+
+static void map_intersect(JMAP *dst, const JMAP *src, unsigned threads) {
+    if (!bulk_check(dst, src)) return;
+    size_t count = dst->_length;
+    if (count == 0) return reset_error_trace();
+
+    BULK_SCRATCH scratch = {0};
+    char **erased = malloc(count * sizeof(char*));
+    if (!erased || !bulk_alloc(&scratch, count)) {
+        free(erased);
+        bulk_free(&scratch);
+        return create_return_error(dst, JMAP_UNINITIALIZED, "Memory allocation for intersect failed");
+    }
+    bulk_lookup(dst, src, scratch.slots, scratch.hashes, scratch.found, threads);
+
+    // Key strings do not move when entries are shifted back: they identify the entries to erase
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (scratch.found[i] != SIZE_MAX) continue;
+        erased[n] = dst->keys[scratch.slots[i]];
+        scratch.hashes[n++] = scratch.hashes[i];
+    }
+    bulk_erase(dst, erased, scratch.hashes, n);
+    free(erased);
+    bulk_free(&scratch);
+    if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
+}
+
+static void map_difference(JMAP *dst, const JMAP *src, unsigned threads) {
+    if (!bulk_check(dst, src)) return;
+    size_t count = src->_length;
+    if (count == 0 || dst->_length == 0) return reset_error_trace();
+
+    BULK_SCRATCH scratch = {0};
+    char **erased = malloc(count * sizeof(char*));
+    if (!erased || !bulk_alloc(&scratch, count)) {
+        free(erased);
+        bulk_free(&scratch);
+        return create_return_error(dst, JMAP_UNINITIALIZED, "Memory allocation for difference failed");
+    }
+    bulk_lookup(src, dst, scratch.slots, scratch.hashes, scratch.found, threads);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (scratch.found[i] == SIZE_MAX) continue;
+        erased[n] = dst->keys[scratch.found[i]];
+        scratch.hashes[n++] = scratch.hashes[i];
+    }
+    bulk_erase(dst, erased, scratch.hashes, n);
+    free(erased);
+    bulk_free(&scratch);
+    if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
+}
+
+// *(T*)slot += delta, saturated to [T_MIN, T_MAX] (an overflow can only go the way of delta)
+#define SATURATING_ADD(T, slot, delta, T_MIN, T_MAX) \
+    do { if (__builtin_add_overflow(*(T*)(slot), (delta), (T*)(slot))) *(T*)(slot) = (delta) < 0 ? (T_MIN) : (T_MAX); } while (0)
+
+static void *map_increment(JMAP *self, const char *key, long long delta) {
+    switch (self->_preset) {
+        case JMAP_INT_PRESET: case JMAP_LONG_PRESET: case JMAP_SHORT_PRESET: case JMAP_CHAR_PRESET:
+        case JMAP_UINT_PRESET: case JMAP_ULONG_PRESET: case JMAP_USHORT_PRESET:
+        case JMAP_FLOAT_PRESET: case JMAP_DOUBLE_PRESET:
+            break;
+        default:
+            create_return_error(self, JMAP_INVALID_ARGUMENT, "increment needs a map created with a numeric preset");
+            return NULL;
+    }
+    bool inserted;
+    size_t idx = map_entry(self, key, &inserted);
+    if (idx == SIZE_MAX) return NULL;
+
+    if (self->_snapshot) snapshot_before_write(self, idx);
+    void *slot = (char*)self->data + idx * self->_elem_size;
+    switch (self->_preset) {
+        case JMAP_INT_PRESET:    SATURATING_ADD(int, slot, delta, INT_MIN, INT_MAX); break;
+        case JMAP_LONG_PRESET:   SATURATING_ADD(long, slot, delta, LONG_MIN, LONG_MAX); break;
+        case JMAP_SHORT_PRESET:  SATURATING_ADD(short, slot, delta, SHRT_MIN, SHRT_MAX); break;
+        case JMAP_CHAR_PRESET:   SATURATING_ADD(char, slot, delta, CHAR_MIN, CHAR_MAX); break;
+        case JMAP_UINT_PRESET:   SATURATING_ADD(unsigned int, slot, delta, 0, UINT_MAX); break;
+        case JMAP_ULONG_PRESET:  SATURATING_ADD(unsigned long, slot, delta, 0, ULONG_MAX); break;
+        case JMAP_USHORT_PRESET: SATURATING_ADD(unsigned short, slot, delta, 0, USHRT_MAX); break;
+        case JMAP_FLOAT_PRESET:  *(float*)slot += (float)delta; break;
+        case JMAP_DOUBLE_PRESET: *(double*)slot += (double)delta; break;
+        default: break;
+    }
+    map_log_put(self, idx);
+    reset_error_trace();
+    return slot;
+}
+
+// Value of slot idx, where a lookup of key ended (SIZE_MAX: ruled out by the filter): misses, expired entries and cache hits are handled here
+static void *map_found(const JMAP *self, const char *key, size_t idx) {
+    if (idx == SIZE_MAX || !self->keys[idx]) {
+        if (self->_cache) cache_on_miss(self->_cache);
+        create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found" , key);
+        return NULL;
+    }
+    // Lazy expiration: an entry past its deadline reads as absent, writes and expire reclaim it
+    if (self->_ttl && ttl_is_expired(self->_ttl, idx)) {
+        if (self->_cache) cache_on_miss(self->_cache);
+        create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" has expired", key);
+        return NULL;
+    }
+    // A background save shares the table pages with its child: reads leave the recency links alone
+    if (self->_cache) {
+        cache_count_hit(self->_cache);
+        if (!self->_bgsave) cache_touch(self->_cache, idx);
+    }
+    reset_error_trace();
+    return (char*)self->data + idx * self->_elem_size;
+}
+
+static void* map_get(const JMAP *self, const char *key) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return NULL;
+    }
+    if (!key || key[0] == '\0') {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+        return NULL;
+    }
+
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_GET, key);
+    // The load factor keeps an empty slot in every table, the probe always ends
+    return map_found(self, key, map_lookup(self, key));
 }
 
 static void map_clear(JMAP *self) {
     if (!self->data || !self->keys)
         return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_snapshot) snapshot_detach_all(self);
 
     for (size_t i = 0; i < self->_capacity; i++) {
-        free(self->keys[i]);
+        if (!self->keys[i]) continue;
+        track_key(self, self->keys[i], false);
+        key_free(self, self->keys[i]);
         self->keys[i] = NULL;
+        release_value(self, (char*)self->data + i * self->_elem_size);
     }
-    memset(self->data, 0, self->_capacity * self->_elem_size);
     self->_length = 0;
+    memset(self->_occupied, 0, OCCUPANCY_WORDS(self->_capacity) * sizeof(uint64_t));
+    if (self->_cache) cache_on_clear(self->_cache);
+    if (self->_ttl) ttl_on_clear(self->_ttl);
+    if (self->_ordered) ordered_clear(self);
+    if (self->_filter) filter_on_clear(self);
+    if (self->_wal) wal_log_clear(self->_wal);
 
     reset_error_trace();
 }
@@ -313,33 +1267,63 @@ static JMAP map_clone(const JMAP *self) {
     clone._key_max_length = self->_key_max_length;
     clone._load_factor = self->_load_factor;
     clone._data_type = self->_data_type;
+    clone._preset = self->_preset;
     clone.user_callbacks = self->user_callbacks;
     clone.user_overrides = self->user_overrides;
-
-    clone.data = malloc(clone._capacity * clone._elem_size);
+    clone._wal = NULL;
+    clone._cache = NULL;
+    clone._ttl = NULL;
+    clone._pool = NULL;
+    clone._stats = NULL;
+    clone._trace = NULL;
+    clone._snapshot = NULL;
+    // Both maps share the symbol table
+    clone._intern = self->_intern;
+    clone._ordered = NULL;
+    clone._filter = NULL;
+    clone._bgsave = NULL;
+    clone._allocator = self->_allocator;
+
+    clone.data = data_alloc(&clone, clone._capacity);
     if (!clone.data) {
-        free(clone.data);
         create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for clone data failed");
         return *self;
     }
-    memcpy_elem(&clone, clone.data, self->data, clone._capacity);
+    if (self->_pool) {
+        // The clone gets its own pool, so that both maps can be freed independently
+        clone._pool = pool_create_like(self->_pool);
+        size_t copied = 0;
+        while (clone._pool && copied < clone._capacity
+               && pool_copy(clone._pool, (char*)clone.data + copied * clone._elem_size, (char*)self->data + copied * self->_elem_size)) {
+            copied++;
+        }
+        if (copied < clone._capacity) {
+            pool_release(&clone);
+            table_free(&clone, NULL, clone.data, NULL, clone._capacity);
+            create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for clone values failed");
+            return *self;
+        }
+    } else {
+        memcpy_elem(&clone, clone.data, self->data, clone._capacity);
+    }
 
-    clone.keys = malloc(clone._capacity * sizeof(char*));
+    clone.keys = allocator_alloc(&clone._allocator, clone._capacity * sizeof(char*));
     if (!clone.keys) {
-        free(clone.data);
+        table_free(&clone, NULL, clone.data, NULL, clone._capacity);
+        pool_release(&clone);
         create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for clone keys failed");
         return *self;
     }
     
     for (size_t i = 0; i < clone._capacity; i++) {
         if (self->keys[i]) {
-            clone.keys[i] = strdup(self->keys[i]);
+            clone.keys[i] = key_dup(&clone, self->keys[i]);
             if (!clone.keys[i]) {
                 for (size_t j = 0; j < i; j++) {
-                    free(clone.keys[j]);
+                    key_free(&clone, clone.keys[j]);
                 }
-                free(clone.keys);
-                free(clone.data);
+                table_free(&clone, clone.keys, clone.data, NULL, clone._capacity);
+                pool_release(&clone);
                 create_return_error(self, JMAP_UNINITIALIZED, "strdup failed for key in clone");
                 return *self;
             }
@@ -348,6 +1332,34 @@ static JMAP map_clone(const JMAP *self) {
         }
     }
 
+    clone._occupied = allocator_alloc(&clone._allocator, OCCUPANCY_WORDS(clone._capacity) * sizeof(uint64_t));
+    if (!clone._occupied) {
+        for (size_t i = 0; i < clone._capacity; i++) key_free(&clone, clone.keys[i]);
+        table_free(&clone, clone.keys, clone.data, NULL, clone._capacity);
+        pool_release(&clone);
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for clone occupancy bitmap failed");
+        return *self;
+    }
+    memcpy(clone._occupied, self->_occupied, OCCUPANCY_WORDS(clone._capacity) * sizeof(uint64_t));
+
+    // Same slots, so the clone keeps the deadlines of the entries
+    if (self->_ttl && !(clone._ttl = ttl_clone(self->_ttl))) {
+        for (size_t i = 0; i < clone._capacity; i++) key_free(&clone, clone.keys[i]);
+        table_free(&clone, clone.keys, clone.data, clone._occupied, clone._capacity);
+        pool_release(&clone);
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for clone TTLs failed");
+        return *self;
+    }
+
+    memset(&clone._memory, 0, sizeof(clone._memory));
+    clone._memory_budget = self->_memory_budget;
+    track_table(&clone, true);
+    for (size_t i = 0; i < clone._capacity; i++) {
+        if (!clone.keys[i]) continue;
+        track_key(&clone, clone.keys[i], true);
+        track_value(&clone, (char*)clone.data + i * clone._elem_size, true);
+    }
+
     reset_error_trace();
     return clone;
 }
@@ -362,24 +1374,11 @@ static bool map_contains_key(const JMAP *self, const char *key) {
         return false;
     }
 
-    size_t idx = map_key_to_index(self, key);
-    size_t probes = 0;
-
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_CONTAINS, key);
+    size_t idx = map_lookup(self, key);
     reset_error_trace();
-
-    while (probes < self->_capacity) {
-        char *k = self->keys[idx];
-        if (!k) {
-            return false;
-        }
-        if (strcmp(k, key) == 0) {
-            return true;
-        }
-        idx = (idx + 1) & (self->_capacity - 1);
-        probes++;
-    }
-
-    return false;
+    if (idx == SIZE_MAX || !self->keys[idx]) return false;
+    return !(self->_ttl && ttl_is_expired(self->_ttl, idx));
 }
 
 static bool map_contains_value(const JMAP *self, const void *value) {
@@ -494,20 +1493,13 @@ static bool map_is_empty(const JMAP *self) {
 }
 
 static void map_put_if_absent(JMAP *self, const char *key, const void *value) {
-    if (!self->data || !self->keys)
-        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
-    if (!key || key[0] == '\0')
-        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
-
-    bool contains = map_contains_key(self, key);
-    if (jmap_last_error_trace.has_error) return;
+    if (!map_prepare_write(self, key)) return;
 
-    if (contains) {
+    size_t idx = map_probe_live(self, key);
+    if (self->keys[idx]) {
         return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" already exists", key);
     }
-
-    reset_error_trace();
-    map_put(self, key, value);
+    map_store(self, key, value, idx, false, 0);
 }
 
 static void map_remove(JMAP *self, const char *key){
@@ -517,35 +1509,72 @@ static void map_remove(JMAP *self, const char *key){
         return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
     if (self->_length == 0)
         return create_return_error(self, JMAP_EMPTY, "JMAP is empty => no keys to remove");
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_REMOVE, key);
+
+    size_t index = map_probe_live(self, key);
+    if (!self->keys[index])
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
 
-    bool contains = map_contains_key(self, key);
+    map_erase_at(self, index);
+    map_shrink_if_sparse(self);
     if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
+}
 
-    if (contains) {
-        map_get(self, key);
-        if (jmap_last_error_trace.has_error) return;
-        memset((char*)self->data + map_key_to_index(self, key) * self->_elem_size, 0, self->_elem_size); // Efface la valeur
-        size_t index = map_key_to_index(self, key);
-        size_t start_index = index;
-        while (strcmp(self->keys[index], key) != 0) {
-            index = NEXT_INDEX(index);
-            if (index == start_index) {
-                return create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
-            }
-        }
-        free(self->keys[index]);
-        self->keys[index] = NULL;
-        self->_length--;
-        // Réduire la taille si nécessaire
-        if (self->_length < self->_capacity * self->_load_factor / 4 && self->_capacity > 16) {
-            map_resize(self, self->_capacity / 2);
-            if (jmap_last_error_trace.has_error) return;
-        }
-        reset_error_trace();
-        return; 
+static void map_take(JMAP *self, const char *key, void *out_value) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!key || key[0] == '\0')
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_REMOVE, key);
+
+    size_t index = map_probe_live(self, key);
+    if (!self->keys[index])
+        return create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+
+    // The value leaves the map as is: a pointer value is now owned by the caller
+    if (self->_snapshot) snapshot_before_write(self, index);
+    void *slot = (char*)self->data + index * self->_elem_size;
+    if (out_value && self->_pool) {
+        // Pooled blocks stay with the map, the caller gets a heap copy
+        if (!pool_copy_out(self->_pool, out_value, slot))
+            return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for taken value failed");
+    } else if (out_value) {
+        memcpy(out_value, slot, self->_elem_size);
+        track_value(self, slot, false);
+        memset(slot, 0, self->_elem_size);
     }
+    map_erase_at(self, index);
+    map_shrink_if_sparse(self);
+    if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
+}
 
-    return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
+static size_t map_remove_batch(JMAP *self, const char *const *keys, size_t n) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return 0;
+    }
+    if (!keys && n > 0) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Keys cannot be NULL");
+        return 0;
+    }
+
+    size_t removed = 0;
+    for (size_t i = 0; i < n && self->_length > 0; i++) {
+        if (!keys[i] || keys[i][0] == '\0') continue;
+        if (self->_trace) trace_log(self->_trace, JMAP_TRACE_REMOVE, keys[i]);
+        size_t index = map_probe(self, keys[i]);
+        if (!self->keys[index]) continue;
+        map_erase_at(self, index);
+        removed++;
+    }
+
+    // Shrink once for the whole batch
+    map_shrink_if_sparse(self);
+    if (jmap_last_error_trace.has_error) return removed;
+    reset_error_trace();
+    return removed;
 }
 
 static void map_remove_if_value_match(JMAP *self, const char *key, const void *value) {
@@ -554,36 +1583,18 @@ static void map_remove_if_value_match(JMAP *self, const char *key, const void *v
     if (!key || key[0] == '\0')
         return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
 
-    bool exists = map_contains_key(self, key);
-    if (jmap_last_error_trace.has_error) return;
+    size_t index = map_probe_live(self, key);
+    if (!self->keys[index])
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
 
-    if (exists) {
-        void *get = map_get(self, key);
-        if (jmap_last_error_trace.has_error) return;
-        if ((bool)self->user_callbacks.is_equal_callback ? !self->user_callbacks.is_equal_callback(get, value) : (memcmp(get, value, self->_elem_size) != 0)) {
-            return create_return_error(self, JMAP_INVALID_ARGUMENT, "Values does not match for key \"%s\"", key);
-        }
-        memset((char*)self->data + map_key_to_index(self, key) * self->_elem_size, 0, self->_elem_size);
-        size_t index = map_key_to_index(self, key);
-        size_t start_index = index;
-        while (strcmp(self->keys[index], key) != 0) {
-            index = NEXT_INDEX(index);
-            if (index == start_index) {
-                return create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
-            }
-        }
-        free(self->keys[index]);
-        self->keys[index] = NULL;
-        self->_length--;
- 
-        if (self->_length < self->_capacity * self->_load_factor / 4 && self->_capacity > 16) {
-            map_resize(self, self->_capacity / 2);
-            if (jmap_last_error_trace.has_error) return;
-        }
-        reset_error_trace();
-        return;
+    const void *get = (char*)self->data + index * self->_elem_size;
+    if ((bool)self->user_callbacks.is_equal_callback ? !self->user_callbacks.is_equal_callback(get, value) : (memcmp(get, value, self->_elem_size) != 0)) {
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Values does not match for key \"%s\"", key);
     }
-    return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
+    map_erase_at(self, index);
+    map_shrink_if_sparse(self);
+    if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
 }
 
 static void map_remove_if_value_not_match(JMAP *self, const char *key, const void *value) {
@@ -592,36 +1603,18 @@ static void map_remove_if_value_not_match(JMAP *self, const char *key, const voi
     if (!key || key[0] == '\0')
         return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
 
-    bool exists = map_contains_key(self, key);
-    if (jmap_last_error_trace.has_error) return;
-
-    if (exists) {
-        void *get = map_get(self, key);
-        if (jmap_last_error_trace.has_error) return;
-        if ((bool)self->user_callbacks.is_equal_callback ? self->user_callbacks.is_equal_callback(get, value) : (memcmp(get, value, self->_elem_size) == 0)) {
-            return create_return_error(self, JMAP_INVALID_ARGUMENT, "Values match for key \"%s\"", key);
-        }
-        memset((char*)self->data + map_key_to_index(self, key) * self->_elem_size, 0, self->_elem_size);
-        size_t index = map_key_to_index(self, key);
-        size_t start_index = index;
-        while (strcmp(self->keys[index], key) != 0) {
-            index = NEXT_INDEX(index);
-            if (index == start_index) {
-                return create_return_error(self, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
-            }
-        }
-        free(self->keys[index]);
-        self->keys[index] = NULL;
-        self->_length--;
+    size_t index = map_probe_live(self, key);
+    if (!self->keys[index])
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
 
-        if (self->_length < self->_capacity * self->_load_factor / 4 && self->_capacity > 16) {
-            map_resize(self, self->_capacity / 2);
-            if (jmap_last_error_trace.has_error) return;
-        }
-        reset_error_trace();
-        return;
+    const void *get = (char*)self->data + index * self->_elem_size;
+    if ((bool)self->user_callbacks.is_equal_callback ? self->user_callbacks.is_equal_callback(get, value) : (memcmp(get, value, self->_elem_size) == 0)) {
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Values match for key \"%s\"", key);
     }
-    return create_return_error(self, JMAP_INVALID_ARGUMENT, "Key \"%s\" does not exist", key);
+    map_erase_at(self, index);
+    map_shrink_if_sparse(self);
+    if (jmap_last_error_trace.has_error) return;
+    reset_error_trace();
 }
 
 static void map_remove_if(JMAP *self, bool (*predicate)(const char *key, const void *value, const void *ctx), const void *ctx) {
@@ -630,19 +1623,22 @@ static void map_remove_if(JMAP *self, bool (*predicate)(const char *key, const v
     if (!predicate)
         return create_return_error(self, JMAP_INVALID_ARGUMENT, "Predicate function cannot be NULL");
 
-    for (size_t i = 0; i < self->_capacity; i++) {
+    // Start right after an empty slot: backward shifts then only move entries that were not visited yet
+    size_t start = 0;
+    while (start < self->_capacity && self->keys[start] != NULL) start++;
+    size_t i = NEXT_INDEX(start), visited = 0;
+    while (visited < self->_capacity) {
         if (self->keys[i] != NULL && predicate(self->keys[i], (char*)self->data + i * self->_elem_size, ctx)) {
-            free(self->keys[i]);
-            self->keys[i] = NULL;
-            memset((char*)self->data + i * self->_elem_size, 0, self->_elem_size);
-            self->_length--;
+            map_erase_at(self, i);
+            // Slot i may now hold the next entry of the cluster
+            if (self->keys[i] != NULL) continue;
         }
+        i = NEXT_INDEX(i);
+        visited++;
     }
 
-    if (self->_length < self->_capacity * self->_load_factor / 4 && self->_capacity > 16) {
-        map_resize(self, self->_capacity / 2);
-        if (jmap_last_error_trace.has_error) return;
-    }
+    map_shrink_if_sparse(self);
+    if (jmap_last_error_trace.has_error) return;
 
     reset_error_trace();
 }
@@ -652,6 +1648,7 @@ static void map_quick_sort(
     void *values, 
     JMAP *map, 
     int (*compare)(const char *key_a, const void *value_a, const char *key_b, const void *value_b),
+    unsigned char *scratch,
     int left, 
     int right
 ) {
@@ -660,8 +1657,10 @@ static void map_quick_sort(
     int i = left, j = right;
     char *pivot_key = keys[(left + right) / 2];
     size_t elem_size = map->_elem_size;
-    void *pivot_value = malloc(elem_size);
-    memcpy_elem(map, pivot_value, (char*)values + ((left + right) / 2) * elem_size, 1);
+    // Values are moved bitwise: the array keeps owning whatever pointer values refer to.
+    // The scratch buffer is only used before recursing, so every frame shares it.
+    unsigned char *pivot_value = scratch, *tmp_value = scratch + elem_size;
+    memcpy(pivot_value, (char*)values + ((left + right) / 2) * elem_size, elem_size);
 
     while (i <= j) {
         while (compare(keys[i], (char*)values + i * elem_size, pivot_key, pivot_value) < 0) i++;
@@ -674,21 +1673,17 @@ static void map_quick_sort(
             keys[j] = tmp_key;
 
             // swap values
-            void *tmp_value = malloc(map->_elem_size);
-            memcpy_elem(map, tmp_value, (char*)values + i * elem_size, 1);
-            memcpy_elem(map, (char*)values + i * elem_size, (char*)values + j * elem_size, 1);
-            memcpy_elem(map, (char*)values + j * elem_size, tmp_value, 1);
-            free(tmp_value);
+            memcpy(tmp_value, (char*)values + i * elem_size, elem_size);
+            memcpy((char*)values + i * elem_size, (char*)values + j * elem_size, elem_size);
+            memcpy((char*)values + j * elem_size, tmp_value, elem_size);
 
             i++;
             j--;
         }
     }
 
-    free(pivot_value);
-
-    if (left < j) map_quick_sort(keys, values, map, compare, left, j);
-    if (i < right) map_quick_sort(keys, values, map, compare, i, right);
+    if (left < j) map_quick_sort(keys, values, map, compare, scratch, left, j);
+    if (i < right) map_quick_sort(keys, values, map, compare, scratch, i, right);
 }
 
 static int compare_keys(const char *key_a, const void *value_a, const char *key_b, const void *value_b) {
@@ -706,9 +1701,12 @@ static void map_to_sort(JMAP *self, char ***keys, void **values) {
     size_t count = self->_length;
     char **keys_array = malloc(count * sizeof(char*));
     void *values_array = malloc(count * self->_elem_size);
-    if (!keys_array || !values_array) {
+    // Pivot and swap space for map_quick_sort
+    unsigned char *scratch = malloc(2 * self->_elem_size + 1);
+    if (!keys_array || !values_array || !scratch) {
         free(keys_array);
         free(values_array);
+        free(scratch);
         return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for sorting failed");
     }
 
@@ -723,7 +1721,8 @@ static void map_to_sort(JMAP *self, char ***keys, void **values) {
         }
     }
 
-    map_quick_sort(keys_array, values_array, self, compare_func, 0, (int)count - 1);
+    map_quick_sort(keys_array, values_array, self, compare_func, scratch, 0, (int)count - 1);
+    free(scratch);
 
     *keys = keys_array;
     *values = values_array;
@@ -731,8 +1730,124 @@ static void map_to_sort(JMAP *self, char ***keys, void **values) {
     reset_error_trace();
 }
 
+static JMAP_MEMORY_USAGE map_memory_usage(const JMAP *self) {
+    JMAP_MEMORY_USAGE usage = self->_memory;
+    usage.total_bytes = memory_total(self);
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return usage;
+    }
+    reset_error_trace();
+    return usage;
+}
+
+static void map_set_memory_budget(JMAP *self, size_t max_bytes) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (max_bytes && max_bytes < memory_total(self))
+        return create_return_error(self, JMAP_MEMORY_BUDGET_EXCEEDED, "JMAP already uses %zu bytes", memory_total(self));
+    self->_memory_budget = max_bytes;
+    reset_error_trace();
+}
+
+static void map_use_value_pool(JMAP *self, size_t (*value_size)(const void *value)) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_data_type != JMAP_TYPE_POINTER)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Value pool needs a JMAP_TYPE_POINTER map");
+    if (!value_size)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "value_size cannot be NULL");
+    if (self->_pool)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Value pool is already in use");
+
+    JMAP_POOL *pool = pool_create(value_size, self->_allocator);
+    void **copies = allocator_calloc(&self->_allocator, self->_capacity, sizeof(void*));
+    if (!pool || !copies) {
+        if (pool) pool_destroy(pool);
+        allocator_free(&self->_allocator, copies, self->_capacity * sizeof(void*));
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for value pool failed");
+    }
+    if (self->_snapshot) snapshot_detach_all(self);
+    // Existing values are copied first, so that the map is left untouched if the pool runs out of memory
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (!self->keys[i] || pool_copy(pool, &copies[i], (char*)self->data + i * self->_elem_size)) continue;
+        allocator_free(&self->_allocator, copies, self->_capacity * sizeof(void*));
+        pool_destroy(pool);
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for pooled value failed");
+    }
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (!self->keys[i]) continue;
+        release_value(self, (char*)self->data + i * self->_elem_size);
+        memcpy((char*)self->data + i * self->_elem_size, &copies[i], sizeof(void*));
+    }
+    allocator_free(&self->_allocator, copies, self->_capacity * sizeof(void*));
+    self->_pool = pool;
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (self->keys[i]) track_value(self, (char*)self->data + i * self->_elem_size, true);
+    }
+    reset_error_trace();
+}
+
+static void map_use_interned_keys(JMAP *self, JMAP_INTERN *intern) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!intern)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Symbol table cannot be NULL");
+    if (self->_intern)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Keys are already interned");
+
+    // Existing keys are interned first, so that the map is left untouched if the table runs out of memory
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (self->keys[i] && !intern_key(intern, self->keys[i]))
+            return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for symbol \"%s\" failed", self->keys[i]);
+    }
+    if (self->_snapshot) snapshot_detach_all(self);
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (!self->keys[i]) continue;
+        char *handle = (char*)intern_key(intern, self->keys[i]);
+        if (self->_ordered) ordered_replace_key(self, self->keys[i], handle);
+        track_key(self, self->keys[i], false);
+        key_free(self, self->keys[i]);
+        self->keys[i] = handle;
+    }
+    self->_intern = intern;
+    reset_error_trace();
+}
+
+static bool handle_check(const JMAP *self, const char *handle) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return false;
+    }
+    if (!self->_intern) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Keys are not interned, see jmap.use_interned_keys");
+        return false;
+    }
+    if (!handle) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Handle cannot be NULL");
+        return false;
+    }
+    return true;
+}
+
+static void *map_get_by_handle(const JMAP *self, const char *handle) {
+    if (!handle_check(self, handle)) return NULL;
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_GET, handle);
+    return map_found(self, handle, map_probe_handle(self, handle));
+}
+
+static bool map_contains_handle(const JMAP *self, const char *handle) {
+    if (!handle_check(self, handle)) return false;
+    if (self->_trace) trace_log(self->_trace, JMAP_TRACE_CONTAINS, handle);
+    size_t idx = map_probe_handle(self, handle);
+    reset_error_trace();
+    if (idx == SIZE_MAX || !self->keys[idx]) return false;
+    return !(self->_ttl && ttl_is_expired(self->_ttl, idx));
+}
+
 extern JMAP create_map_int(void);
 extern JMAP create_map_string(void);
+extern JMAP create_map_pooled_string(void);
 extern JMAP create_map_float(void);
 extern JMAP create_map_char(void);
 extern JMAP create_map_double(void);
@@ -742,6 +1857,27 @@ extern JMAP create_map_ulong(void);
 extern JMAP create_map_ushort(void);
 extern JMAP create_map_uint(void);
 
+static void map_set_load_factor(JMAP *self, float load_factor) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    // An empty slot must always be left to end the probes
+    if (!(load_factor >= 0.1f && load_factor <= 0.95f))
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Load factor must be between 0.1 and 0.95");
+
+    size_t new_length = self->_capacity;
+    while (self->_length > new_length * load_factor) new_length *= 2;
+    float old_load_factor = self->_load_factor;
+    self->_load_factor = load_factor;
+    if (new_length != self->_capacity) {
+        map_rehash(self, new_length);
+        if (jmap_last_error_trace.has_error) {
+            self->_load_factor = old_load_factor;
+            return;
+        }
+    }
+    reset_error_trace();
+}
+
 static JMAP map_init_preset(JMAP_TYPE_PRESET preset){
     JMAP (*ret_func)(void) = NULL;
     switch (preset){
@@ -751,6 +1887,9 @@ static JMAP map_init_preset(JMAP_TYPE_PRESET preset){
         case JMAP_STRING_PRESET:
             ret_func = create_map_string;
             break;
+        case JMAP_POOLED_STRING_PRESET:
+            ret_func = create_map_pooled_string;
+            break;
         case JMAP_FLOAT_PRESET:
             ret_func = create_map_float;
             break;
@@ -775,18 +1914,27 @@ static JMAP map_init_preset(JMAP_TYPE_PRESET preset){
         case JMAP_ULONG_PRESET:
             ret_func = create_map_ulong;
             break;
+        case JMAP_NO_PRESET:
+        default: {
+            JMAP empty = {0};
+            create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Unknown preset %d", (int)preset);
+            return empty;
+        }
     }
     JMAP map = ret_func();
+    map._preset = preset;
     return map;
 }
 
-JMAP_RETURN jmap_last_error_trace;
+_Thread_local JMAP_RETURN jmap_last_error_trace;
 JMAP_INTERFACE jmap = {
     .init = map_init,
+    .init_with_allocator = map_init_with_allocator,
     .init_preset = map_init_preset,
     .print_array_err = print_array_err,
     .print = map_print,
     .put = map_put,
+    .put_move = map_put_move,
     .get = map_get,
     .resize = map_resize,
     .clear = map_clear,
@@ -804,4 +1952,24 @@ JMAP_INTERFACE jmap = {
     .remove_if_value_not_match = map_remove_if_value_not_match,
     .remove_if = map_remove_if,
     .to_sort = map_to_sort,
+    .freeze = map_freeze,
+    .memory_usage = map_memory_usage,
+    .set_memory_budget = map_set_memory_budget,
+    .put_with_ttl = map_put_with_ttl,
+    .expire = map_expire,
+    .get_or_insert_default = map_get_or_insert_default,
+    .compute = map_compute,
+    .merge = map_merge,
+    .increment = map_increment,
+    .take = map_take,
+    .remove_batch = map_remove_batch,
+    .use_value_pool = map_use_value_pool,
+    .set_load_factor = map_set_load_factor,
+    .merge_into = map_merge_into,
+    .intersect = map_intersect,
+    .difference = map_difference,
+    .snapshot = map_snapshot,
+    .use_interned_keys = map_use_interned_keys,
+    .get_by_handle = map_get_by_handle,
+    .contains_handle = map_contains_handle,
 };
\ No newline at end of file
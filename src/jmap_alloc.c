@@ -0,0 +1,63 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Every block owned by a map goes through its JMAP_ALLOCATOR. Hooks left NULL fall back to the C
+ * library, so a zeroed allocator is the default one. The size of a block is passed back when it is
+ * freed or resized, which lets sized and bump allocators do without headers.
+ */
+
+bool allocator_is_default(const JMAP_ALLOCATOR *a) {
+    return a->alloc == NULL;
+}
+
+// Reports a failed allocation to the alloc_failed probe
+static inline void *checked(void *ptr, size_t size) {
+    if (!ptr) JMAP_PROBE1(alloc_failed, size);
+    (void)size;
+    return ptr;
+}
+
+void *allocator_alloc(const JMAP_ALLOCATOR *a, size_t size) {
+    return checked(a->alloc ? a->alloc(size, a->ctx) : malloc(size), size);
+}
+
+void *allocator_calloc(const JMAP_ALLOCATOR *a, size_t count, size_t size) {
+    if (!a->alloc) return checked(calloc(count, size), count * size);
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = checked(a->alloc(count * size, a->ctx), count * size);
+    if (ptr && !a->zeroed) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+// Without an aligned_alloc hook, a custom allocator gives the alignment of its alloc hook
+void *allocator_aligned(const JMAP_ALLOCATOR *a, size_t alignment, size_t size) {
+    if (a->alloc) return checked(a->aligned_alloc ? a->aligned_alloc(alignment, size, a->ctx) : a->alloc(size, a->ctx), size);
+    // C11 aligned_alloc wants a multiple of the alignment
+    return checked(aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment), size);
+}
+
+void *allocator_realloc(const JMAP_ALLOCATOR *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!a->alloc) return checked(realloc(ptr, new_size), new_size);
+    if (a->realloc) return checked(a->realloc(ptr, old_size, new_size, a->ctx), new_size);
+    void *copy = checked(a->alloc(new_size, a->ctx), new_size);
+    if (!copy) return NULL;
+    if (ptr) {
+        memcpy(copy, ptr, old_size < new_size ? old_size : new_size);
+        a->free(ptr, old_size, a->ctx);
+    }
+    return copy;
+}
+
+void allocator_free(const JMAP_ALLOCATOR *a, void *ptr, size_t size) {
+    if (!ptr) return;
+    if (a->free) a->free(ptr, size, a->ctx);
+    else free(ptr);
+}
+
+char *allocator_strdup(const JMAP_ALLOCATOR *a, const char *s) {
+    size_t size = strlen(s) + 1;
+    char *copy = allocator_alloc(a, size);
+    if (copy) memcpy(copy, s, size);
+    return copy;
+}
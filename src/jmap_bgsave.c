@@ -0,0 +1,145 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * Background save. fork() gives the child a copy-on-write view of the whole process, frozen at the
+ * moment of the call: the child writes the map in the snapshot format of the write-ahead log and
+ * exits, while the parent keeps reading and writing the map. Pages are only duplicated when the
+ * parent writes them, so reads must not write: until the save is reaped, lookups leave the cache
+ * recency links alone and report expired entries as absent without removing them.
+ */
+
+struct JMAP_BGSAVE {
+    pid_t pid;
+    char *path;
+    uint64_t start_ns;
+};
+
+// Status of a finished child, and the save reaped
+static JMAP_BGSAVE_STATUS bgsave_finish(JMAP *map, int wait_status) {
+    JMAP_BGSAVE *save = map->_bgsave;
+    JMAP_BGSAVE_STATUS status = {0};
+    status.duration_ns = stats_clock_ns() - save->start_ns;
+    struct stat st;
+    bool ok = WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0 && stat(save->path, &st) == 0;
+    status.state = ok ? JMAP_BGSAVE_DONE : JMAP_BGSAVE_FAILED;
+    if (ok) status.bytes = (uint64_t)st.st_size;
+    map->_bgsave = NULL;
+    free(save->path);
+    free(save);
+    return status;
+}
+
+void bgsave_release(JMAP *map) {
+    JMAP_BGSAVE *save = map->_bgsave;
+    if (!save) return;
+    // The child holds its own copy of the map, it only has to be reaped
+    int wait_status = 0;
+    while (waitpid(save->pid, &wait_status, 0) < 0 && errno == EINTR) {}
+    bgsave_finish(map, wait_status);
+}
+
+static bool bgsave_start(JMAP *self, const char *path) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return false;
+    }
+    if (!path) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Path cannot be NULL");
+        return false;
+    }
+    if (self->_data_type != JMAP_TYPE_VALUE) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Only maps of type JMAP_TYPE_VALUE can be saved");
+        return false;
+    }
+    if (self->_bgsave) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "A background save is already running");
+        return false;
+    }
+    JMAP_BGSAVE *save = malloc(sizeof(JMAP_BGSAVE));
+    char *copy = strdup(path);
+    if (!save || !copy) {
+        free(save);
+        free(copy);
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for background save failed");
+        return false;
+    }
+    save->path = copy;
+    save->start_ns = stats_clock_ns();
+    save->pid = fork();
+    if (save->pid < 0) {
+        int err = errno;
+        free(copy);
+        free(save);
+        create_return_error(self, JMAP_IO_ERROR, "fork failed: %s", strerror(err));
+        return false;
+    }
+    if (save->pid == 0) {
+        // Child: no atexit handlers or stdio buffers of the parent must run here
+        _exit(wal_write_snapshot(self, path) ? 0 : 1);
+    }
+    self->_bgsave = save;
+    reset_error_trace();
+    return true;
+}
+
+static JMAP_BGSAVE_STATUS bgsave_poll(JMAP *self) {
+    JMAP_BGSAVE_STATUS status = {0};
+    JMAP_BGSAVE *save = self->_bgsave;
+    if (!save) {
+        reset_error_trace();
+        return status;
+    }
+    int wait_status = 0;
+    pid_t done = waitpid(save->pid, &wait_status, WNOHANG);
+    if (done == 0 || (done < 0 && errno == EINTR)) {
+        status.state = JMAP_BGSAVE_RUNNING;
+        status.duration_ns = stats_clock_ns() - save->start_ns;
+        reset_error_trace();
+        return status;
+    }
+    status = bgsave_finish(self, wait_status);
+    if (status.state == JMAP_BGSAVE_FAILED) create_return_error(self, JMAP_IO_ERROR, "Background save failed");
+    else reset_error_trace();
+    return status;
+}
+
+static JMAP_BGSAVE_STATUS bgsave_wait(JMAP *self) {
+    JMAP_BGSAVE_STATUS status = {0};
+    JMAP_BGSAVE *save = self->_bgsave;
+    if (!save) {
+        reset_error_trace();
+        return status;
+    }
+    int wait_status = 0;
+    while (waitpid(save->pid, &wait_status, 0) < 0 && errno == EINTR) {}
+    status = bgsave_finish(self, wait_status);
+    if (status.state == JMAP_BGSAVE_FAILED) create_return_error(self, JMAP_IO_ERROR, "Background save failed");
+    else reset_error_trace();
+    return status;
+}
+
+static void bgsave_load(JMAP *self, const char *path) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!path)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Path cannot be NULL");
+    if (access(path, R_OK) != 0)
+        return create_return_error(self, JMAP_IO_ERROR, "Cannot read \"%s\": %s", path, strerror(errno));
+    if (!wal_load_snapshot(self, path)) {
+        if (jmap_last_error_trace.has_error) return;
+        return create_return_error(self, JMAP_IO_ERROR, "\"%s\" is not a valid snapshot for this map", path);
+    }
+    reset_error_trace();
+}
+
+JMAP_BGSAVE_INTERFACE jmap_bgsave = {
+    .start = bgsave_start,
+    .poll = bgsave_poll,
+    .wait = bgsave_wait,
+    .load = bgsave_load,
+};
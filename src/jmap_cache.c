@@ -0,0 +1,200 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Cache mode: slots are chained in an intrusive doubly linked list ordered by recency.
+ * The links live in side arrays indexed by slot, so touching, unlinking and evicting are O(1).
+ * jmap.c calls the cache_on_* hooks whenever a slot is filled, read, emptied or relocated.
+ */
+
+#define CACHE_NONE SIZE_MAX
+
+struct JMAP_CACHE {
+    JMAP_CACHE_CONFIG config;
+    JMAP_ALLOCATOR allocator;
+    size_t capacity;    // Slots of the link arrays
+    size_t *prev;       // Towards the most recently used slot
+    size_t *next;       // Towards the least recently used slot
+    size_t head;        // Most recently used slot
+    size_t tail;        // Least recently used slot
+    JMAP_CACHE_STATS stats;
+};
+
+static void cache_unlink(JMAP_CACHE *cache, size_t idx) {
+    size_t prev = cache->prev[idx], next = cache->next[idx];
+    if (prev != CACHE_NONE) cache->next[prev] = next;
+    else cache->head = next;
+    if (next != CACHE_NONE) cache->prev[next] = prev;
+    else cache->tail = prev;
+}
+
+static void cache_push_front(JMAP_CACHE *cache, size_t idx) {
+    cache->prev[idx] = CACHE_NONE;
+    cache->next[idx] = cache->head;
+    if (cache->head != CACHE_NONE) cache->prev[cache->head] = idx;
+    cache->head = idx;
+    if (cache->tail == CACHE_NONE) cache->tail = idx;
+}
+
+void cache_on_insert(JMAP_CACHE *cache, size_t idx) {
+    cache_push_front(cache, idx);
+}
+
+// Makes slot idx the most recently used, without counting a hit
+void cache_touch(JMAP_CACHE *cache, size_t idx) {
+    if (cache->head == idx) return;
+    cache_unlink(cache, idx);
+    cache_push_front(cache, idx);
+}
+
+void cache_on_miss(JMAP_CACHE *cache) {
+    cache->stats.misses++;
+}
+
+void cache_on_erase(JMAP_CACHE *cache, size_t idx) {
+    cache_unlink(cache, idx);
+}
+
+void cache_on_move(JMAP_CACHE *cache, size_t from, size_t to) {
+    size_t prev = cache->prev[from], next = cache->next[from];
+    cache->prev[to] = prev;
+    cache->next[to] = next;
+    if (prev != CACHE_NONE) cache->next[prev] = to;
+    else cache->head = to;
+    if (next != CACHE_NONE) cache->prev[next] = to;
+    else cache->tail = to;
+}
+
+void cache_on_clear(JMAP_CACHE *cache) {
+    cache->head = cache->tail = CACHE_NONE;
+}
+
+// `remap[old_slot]` is the new slot of every occupied old slot
+bool cache_on_resize(JMAP_CACHE *cache, const size_t *remap, size_t new_capacity) {
+    size_t *prev = allocator_alloc(&cache->allocator, new_capacity * sizeof(size_t));
+    size_t *next = allocator_alloc(&cache->allocator, new_capacity * sizeof(size_t));
+    if (!prev || !next) {
+        allocator_free(&cache->allocator, prev, new_capacity * sizeof(size_t));
+        allocator_free(&cache->allocator, next, new_capacity * sizeof(size_t));
+        return false;
+    }
+
+    size_t new_prev = CACHE_NONE;
+    size_t head = cache->head == CACHE_NONE ? CACHE_NONE : remap[cache->head];
+    for (size_t old = cache->head; old != CACHE_NONE; old = cache->next[old]) {
+        size_t idx = remap[old];
+        prev[idx] = new_prev;
+        next[idx] = CACHE_NONE;
+        if (new_prev != CACHE_NONE) next[new_prev] = idx;
+        new_prev = idx;
+    }
+
+    allocator_free(&cache->allocator, cache->prev, cache->capacity * sizeof(size_t));
+    allocator_free(&cache->allocator, cache->next, cache->capacity * sizeof(size_t));
+    cache->prev = prev;
+    cache->next = next;
+    cache->capacity = new_capacity;
+    cache->head = head;
+    cache->tail = new_prev;
+    return true;
+}
+
+size_t cache_lru_slot(const JMAP_CACHE *cache) {
+    return cache->tail;
+}
+
+const JMAP_CACHE_CONFIG *cache_config(const JMAP_CACHE *cache) {
+    return &cache->config;
+}
+
+void cache_count_eviction(JMAP_CACHE *cache) {
+    cache->stats.evictions++;
+}
+
+// Counts a get that found its key, cache_touch updates the recency order
+void cache_count_hit(JMAP_CACHE *cache) {
+    cache->stats.hits++;
+}
+
+size_t cache_bytes_per_slot(void) {
+    return 2 * sizeof(size_t);
+}
+
+void cache_release(JMAP *map) {
+    JMAP_CACHE *cache = map->_cache;
+    if (!cache) return;
+    map->_cache = NULL;
+    JMAP_ALLOCATOR allocator = cache->allocator;
+    allocator_free(&allocator, cache->prev, cache->capacity * sizeof(size_t));
+    allocator_free(&allocator, cache->next, cache->capacity * sizeof(size_t));
+    allocator_free(&allocator, cache, sizeof(JMAP_CACHE));
+}
+
+JMAP_CACHE *cache_create(const JMAP *map, JMAP_CACHE_CONFIG config) {
+    JMAP_CACHE *cache = allocator_calloc(&map->_allocator, 1, sizeof(JMAP_CACHE));
+    if (!cache) return NULL;
+    cache->config = config;
+    cache->allocator = map->_allocator;
+    cache->capacity = map->_capacity;
+    cache->prev = allocator_alloc(&cache->allocator, map->_capacity * sizeof(size_t));
+    cache->next = allocator_alloc(&cache->allocator, map->_capacity * sizeof(size_t));
+    if (!cache->prev || !cache->next) {
+        allocator_free(&cache->allocator, cache->prev, map->_capacity * sizeof(size_t));
+        allocator_free(&cache->allocator, cache->next, map->_capacity * sizeof(size_t));
+        allocator_free(&map->_allocator, cache, sizeof(JMAP_CACHE));
+        return NULL;
+    }
+
+    // Existing entries start in slot order, the first one being the most recent
+    cache->head = cache->tail = CACHE_NONE;
+    for (size_t i = map->_capacity; i-- > 0;) {
+        if (map->keys[i]) cache_push_front(cache, i);
+    }
+    return cache;
+}
+
+static void cache_enable(JMAP *self, JMAP_CACHE_CONFIG config) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_cache)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Cache mode is already enabled");
+    if (config.max_entries == 0 && config.max_bytes == 0)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Cache needs max_entries or max_bytes");
+
+    track_table(self, false);
+    self->_cache = cache_create(self, config);
+    track_table(self, true);
+    if (!self->_cache)
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for cache failed");
+
+    if (config.max_bytes) self->_memory_budget = config.max_bytes;
+    while (config.max_entries && self->_length > config.max_entries && map_evict_lru(self));
+    while (config.max_bytes && memory_total(self) > config.max_bytes && map_evict_lru(self));
+    reset_error_trace();
+}
+
+static void cache_disable(JMAP *self) {
+    if (!self->_cache)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Cache mode is not enabled");
+    if (self->_cache->config.max_bytes) self->_memory_budget = 0;
+    track_table(self, false);
+    cache_release(self);
+    track_table(self, true);
+    reset_error_trace();
+}
+
+static JMAP_CACHE_STATS cache_get_stats(const JMAP *self) {
+    JMAP_CACHE_STATS stats = {0};
+    if (!self->_cache) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Cache mode is not enabled");
+        return stats;
+    }
+    reset_error_trace();
+    return self->_cache->stats;
+}
+
+JMAP_CACHE_INTERFACE jmap_cache = {
+    .enable = cache_enable,
+    .disable = cache_disable,
+    .stats = cache_get_stats,
+};
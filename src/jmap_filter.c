@@ -0,0 +1,281 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Blocked Bloom filter. A key sets and tests its bits in a single 64-byte block chosen by its hash,
+ * so a query touches one cache line whatever the number of hash functions. The block comes from the
+ * high bits of the 32-bit MurmurHash3 of the key (the map's own hash), the bits inside the block from
+ * a 64-bit mix of it, 9 bits per hash function.
+ *
+ * Bits cannot be taken back: a filter attached to a map keeps the bits of the keys removed since it
+ * was last built, which only costs false positives. It is rebuilt from the keys of the map when the
+ * table is resized, and once the removed keys reach a quarter of what the filter was sized for.
+ */
+
+#define FILTER_BLOCK_BITS 512
+#define FILTER_MAX_HASHES 7                      // 7 x 9 bits of the 64-bit mix
+#define FILTER_DEFAULT_BITS_PER_KEY 10
+
+typedef struct FILTER_BLOCK {
+    _Alignas(64) uint64_t words[FILTER_BLOCK_BITS / 64];
+} FILTER_BLOCK;
+
+struct JMAP_FILTER {
+    FILTER_BLOCK *blocks;
+    size_t block_count;
+    unsigned bits_per_key;
+    unsigned hash_count;
+    size_t length;                               // Keys added since the last clear, removed ones included
+    size_t sized_for;                            // Keys the blocks were sized for
+    size_t stale;                                // Keys removed from the map since the last rebuild
+    JMAP_ALLOCATOR allocator;
+};
+
+static inline uint64_t filter_mix(uint32_t hash) {
+    uint64_t x = hash;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline FILTER_BLOCK *filter_block(const JMAP_FILTER *filter, uint32_t hash) {
+    return &filter->blocks[((uint64_t)hash * filter->block_count) >> 32];
+}
+
+static inline size_t filter_bytes(size_t block_count) {
+    return block_count * sizeof(FILTER_BLOCK);
+}
+
+static void filter_add_hash_unchecked(JMAP_FILTER *filter, uint32_t hash) {
+    uint64_t *words = filter_block(filter, hash)->words;
+    uint64_t mix = filter_mix(hash);
+    for (unsigned i = 0; i < filter->hash_count; i++, mix >>= 9) {
+        unsigned bit = (unsigned)(mix & (FILTER_BLOCK_BITS - 1));
+        words[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    filter->length++;
+}
+
+bool filter_may_contain(const JMAP_FILTER *filter, uint32_t hash) {
+    const uint64_t *words = filter_block(filter, hash)->words;
+    uint64_t mix = filter_mix(hash);
+    for (unsigned i = 0; i < filter->hash_count; i++, mix >>= 9) {
+        unsigned bit = (unsigned)(mix & (FILTER_BLOCK_BITS - 1));
+        if (!((words[bit / 64] >> (bit % 64)) & 1)) return false;
+    }
+    return true;
+}
+
+static size_t blocks_for(size_t keys, unsigned bits_per_key) {
+    if (keys == 0) keys = 1;
+    size_t blocks = (keys * bits_per_key + FILTER_BLOCK_BITS - 1) / FILTER_BLOCK_BITS;
+    return blocks ? blocks : 1;
+}
+
+// Filter sized for `keys` keys, with its blocks zeroed. NULL if out of memory.
+static JMAP_FILTER *filter_new(const JMAP_ALLOCATOR *allocator, size_t keys, unsigned bits_per_key) {
+    if (bits_per_key == 0) bits_per_key = FILTER_DEFAULT_BITS_PER_KEY;
+    JMAP_FILTER *filter = allocator_alloc(allocator, sizeof(JMAP_FILTER));
+    if (!filter) return NULL;
+    filter->block_count = blocks_for(keys, bits_per_key);
+    filter->blocks = allocator_aligned(allocator, _Alignof(FILTER_BLOCK), filter_bytes(filter->block_count));
+    if (!filter->blocks) {
+        allocator_free(allocator, filter, sizeof(JMAP_FILTER));
+        return NULL;
+    }
+    memset(filter->blocks, 0, filter_bytes(filter->block_count));
+    // k = bits_per_key * ln 2 minimizes the false positives
+    unsigned hash_count = (bits_per_key * 693 + 500) / 1000;
+    filter->hash_count = hash_count < 1 ? 1 : hash_count > FILTER_MAX_HASHES ? FILTER_MAX_HASHES : hash_count;
+    filter->bits_per_key = bits_per_key;
+    filter->length = 0;
+    filter->sized_for = keys;
+    filter->stale = 0;
+    filter->allocator = *allocator;
+    return filter;
+}
+
+static void filter_destroy(JMAP_FILTER *filter) {
+    JMAP_ALLOCATOR allocator = filter->allocator;
+    allocator_free(&allocator, filter->blocks, filter_bytes(filter->block_count));
+    allocator_free(&allocator, filter, sizeof(JMAP_FILTER));
+}
+
+static void filter_reset(JMAP_FILTER *filter) {
+    memset(filter->blocks, 0, filter_bytes(filter->block_count));
+    filter->length = 0;
+    filter->stale = 0;
+}
+
+/* ---------- Filter of a map ---------- */
+
+// Keys the map holds before its next resize
+static inline size_t map_filter_keys(const JMAP *map) {
+    return (size_t)(map->_capacity * map->_load_factor) + 1;
+}
+
+static void filter_fill(JMAP *map) {
+    JMAP_FILTER *filter = map->_filter;
+    filter_reset(filter);
+    for (size_t i = 0; i < map->_capacity; i++) {
+        if (map->keys[i]) filter_add_hash_unchecked(filter, map_stored_key_hash(map, map->keys[i]));
+    }
+}
+
+void filter_on_insert(JMAP *map, const char *key) {
+    filter_add_hash_unchecked(map->_filter, map_stored_key_hash(map, key));
+}
+
+void filter_on_remove(JMAP *map) {
+    JMAP_FILTER *filter = map->_filter;
+    if (++filter->stale * 4 >= filter->sized_for) filter_fill(map);
+}
+
+void filter_on_clear(JMAP *map) {
+    filter_reset(map->_filter);
+}
+
+// Resizes the blocks to the new capacity of the map and adds its keys again. Out of memory, the current blocks are reused.
+void filter_rebuild(JMAP *map) {
+    JMAP_FILTER *filter = map->_filter;
+    size_t keys = map_filter_keys(map);
+    size_t block_count = blocks_for(keys, filter->bits_per_key);
+    if (block_count != filter->block_count) {
+        FILTER_BLOCK *blocks = allocator_aligned(&map->_allocator, _Alignof(FILTER_BLOCK), filter_bytes(block_count));
+        if (blocks) {
+            allocator_free(&map->_allocator, filter->blocks, filter_bytes(filter->block_count));
+            map->_memory.table_bytes += filter_bytes(block_count) - filter_bytes(filter->block_count);
+            filter->blocks = blocks;
+            filter->block_count = block_count;
+            filter->sized_for = keys;
+        }
+    }
+    filter_fill(map);
+}
+
+void filter_release(JMAP *map) {
+    JMAP_FILTER *filter = map->_filter;
+    if (!filter) return;
+    map->_filter = NULL;
+    map->_memory.table_bytes -= sizeof(JMAP_FILTER) + filter_bytes(filter->block_count);
+    filter_destroy(filter);
+}
+
+static void filter_enable(JMAP *self, unsigned bits_per_key) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_filter)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Filter is already enabled");
+    if (bits_per_key > 64)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "bits_per_key must be at most 64, got %u", bits_per_key);
+    JMAP_FILTER *filter = filter_new(&self->_allocator, map_filter_keys(self), bits_per_key);
+    if (!filter)
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for filter failed");
+    self->_filter = filter;
+    self->_memory.table_bytes += sizeof(JMAP_FILTER) + filter_bytes(filter->block_count);
+    filter_fill(self);
+    reset_error_trace();
+}
+
+static void filter_disable(JMAP *self) {
+    if (!self->_filter)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Filter is not enabled");
+    filter_release(self);
+    reset_error_trace();
+}
+
+/* ---------- Standalone filters ---------- */
+
+static JMAP_FILTER *filter_create(size_t expected_keys, unsigned bits_per_key) {
+    if (bits_per_key > 64) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "bits_per_key must be at most 64, got %u", bits_per_key);
+        return NULL;
+    }
+    JMAP_ALLOCATOR allocator = {0};
+    JMAP_FILTER *filter = filter_new(&allocator, expected_keys, bits_per_key);
+    if (!filter) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for filter failed");
+        return NULL;
+    }
+    reset_error_trace();
+    return filter;
+}
+
+static uint32_t filter_hash(const char *key) {
+    return key ? key_hash(key) : 0;
+}
+
+static void filter_add_hash(JMAP_FILTER *self, uint32_t hash) {
+    if (!self)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Filter cannot be NULL");
+    filter_add_hash_unchecked(self, hash);
+    reset_error_trace();
+}
+
+static void filter_add(JMAP_FILTER *self, const char *key) {
+    if (!self || !key)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Filter and key cannot be NULL");
+    filter_add_hash_unchecked(self, filter_hash(key));
+    reset_error_trace();
+}
+
+static bool filter_may_contain_hash(const JMAP_FILTER *self, uint32_t hash) {
+    // Without a filter nothing can be ruled out
+    return !self || filter_may_contain(self, hash);
+}
+
+static bool filter_may_contain_key(const JMAP_FILTER *self, const char *key) {
+    return !self || !key || filter_may_contain(self, filter_hash(key));
+}
+
+static void filter_clear(JMAP_FILTER *self) {
+    if (self) filter_reset(self);
+}
+
+static size_t filter_length(const JMAP_FILTER *self) {
+    return self ? self->length : 0;
+}
+
+static size_t filter_memory_usage(const JMAP_FILTER *self) {
+    return self ? sizeof(JMAP_FILTER) + filter_bytes(self->block_count) : 0;
+}
+
+// (fraction of the bits set)^k: a query for an absent key tests k bits that are each set with that probability
+static double filter_false_positive_rate(const JMAP_FILTER *self) {
+    if (!self || self->length == 0) return 0;
+    size_t set = 0;
+    const uint64_t *words = self->blocks->words;
+    for (size_t i = 0; i < self->block_count * (FILTER_BLOCK_BITS / 64); i++) set += (size_t)__builtin_popcountll(words[i]);
+    double fill = (double)set / ((double)self->block_count * FILTER_BLOCK_BITS);
+    double rate = 1;
+    for (unsigned i = 0; i < self->hash_count; i++) rate *= fill;
+    return rate;
+}
+
+static const JMAP_FILTER *filter_of(const JMAP *self) {
+    return self ? self->_filter : NULL;
+}
+
+static void filter_free(JMAP_FILTER *self) {
+    if (self) filter_destroy(self);
+}
+
+JMAP_FILTER_INTERFACE jmap_filter = {
+    .enable = filter_enable,
+    .disable = filter_disable,
+    .of = filter_of,
+    .create = filter_create,
+    .hash = filter_hash,
+    .add = filter_add,
+    .add_hash = filter_add_hash,
+    .may_contain = filter_may_contain_key,
+    .may_contain_hash = filter_may_contain_hash,
+    .clear = filter_clear,
+    .length = filter_length,
+    .memory_usage = filter_memory_usage,
+    .false_positive_rate = filter_false_positive_rate,
+    .free = filter_free,
+};
@@ -0,0 +1,431 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdio.h>
+#include "third_party/murmur3-master/murmur3.h"
+
+/*
+ * Minimal perfect hashing in the spirit of PTHash / CHD (hash-and-displace):
+ * keys are spread into buckets of ~FROZEN_BUCKET_SIZE keys, then buckets are placed from
+ * the largest to the smallest, each one searching a "pilot" value that sends all of its
+ * keys to free slots. A lookup only needs the pilot of its bucket to know the exact slot.
+ */
+
+#define FROZEN_BUCKET_SIZE 3
+#define FROZEN_MAX_PILOT (1u << 24)
+#define FROZEN_MAX_SEEDS 16
+#define FROZEN_MAGIC "JMAPFRZ1"
+#define FROZEN_BYTE_ORDER 0x01020304u
+
+static inline uint64_t frozen_mix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Maps a 64-bit hash to [0, n) without a division
+static inline size_t frozen_range(uint64_t hash, size_t n) {
+    return (size_t)(((unsigned __int128)hash * n) >> 64);
+}
+
+static inline size_t frozen_position(uint64_t h2, uint32_t pilot, size_t n) {
+    return frozen_range(frozen_mix(h2 ^ ((uint64_t)pilot * 0x9E3779B97F4A7C15ULL)), n);
+}
+
+static inline void frozen_hash(const char *key, size_t len, uint32_t seed, uint64_t out[2]) {
+    MurmurHash3_x64_128(key, (int)len, seed, out);
+}
+
+static bool frozen_find(const JMAP_FROZEN *self, const char *key, size_t *slot) {
+    if (self->_length == 0) return false;
+    size_t len = strlen(key);
+    uint64_t h[2];
+    frozen_hash(key, len, self->_seed, h);
+    size_t bucket = frozen_range(h[0], self->_bucket_count);
+    size_t pos = frozen_position(h[1], self->pilots[bucket], self->_length);
+    uint32_t start = self->key_offsets[pos];
+    if (self->key_offsets[pos + 1] - start - 1 != len || memcmp(self->key_blob + start, key, len) != 0)
+        return false;
+    *slot = pos;
+    return true;
+}
+
+/*
+ * Tries to place every key with the given seed.
+ * On success, `slot_entry[slot]` holds the index (in `entries`) of the key stored in `slot`.
+ */
+static bool frozen_place(JMAP_FROZEN *frozen, char **entries, const size_t *lengths, size_t *slot_entry) {
+    size_t n = frozen->_length;
+    size_t nb = frozen->_bucket_count;
+    bool ok = false;
+
+    uint64_t *h2 = malloc(n * sizeof(uint64_t));
+    size_t *bucket_of = malloc(n * sizeof(size_t));
+    size_t *bucket_start = calloc(nb + 1, sizeof(size_t));
+    size_t *sorted = malloc(n * sizeof(size_t));
+    size_t *order = malloc(nb * sizeof(size_t));
+    uint64_t *taken = calloc((n + 63) / 64, sizeof(uint64_t));
+    size_t *positions = NULL;
+    size_t *size_start = NULL;
+    if (!h2 || !bucket_of || !bucket_start || !sorted || !order || !taken) goto end;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t h[2];
+        frozen_hash(entries[i], lengths[i], frozen->_seed, h);
+        bucket_of[i] = frozen_range(h[0], nb);
+        h2[i] = h[1];
+        bucket_start[bucket_of[i] + 1]++;
+    }
+
+    size_t max_bucket = 0;
+    for (size_t b = 0; b < nb; b++) {
+        if (bucket_start[b + 1] > max_bucket) max_bucket = bucket_start[b + 1];
+        bucket_start[b + 1] += bucket_start[b];
+    }
+
+    // Counting sort of the keys by bucket
+    size_t *fill = malloc(nb * sizeof(size_t));
+    if (!fill) goto end;
+    memcpy(fill, bucket_start, nb * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) sorted[fill[bucket_of[i]]++] = i;
+    free(fill);
+
+    // Counting sort of the buckets by decreasing size
+    size_start = calloc(max_bucket + 2, sizeof(size_t));
+    positions = malloc(max_bucket * sizeof(size_t));
+    if (!size_start || !positions) goto end;
+    for (size_t b = 0; b < nb; b++) size_start[max_bucket - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+    for (size_t s = 0; s <= max_bucket; s++) size_start[s + 1] += size_start[s];
+    for (size_t b = 0; b < nb; b++) order[size_start[max_bucket - (bucket_start[b + 1] - bucket_start[b])]++] = b;
+
+    for (size_t o = 0; o < nb; o++) {
+        size_t b = order[o];
+        size_t count = bucket_start[b + 1] - bucket_start[b];
+        if (count == 0) break;
+        const size_t *members = sorted + bucket_start[b];
+
+        uint32_t pilot = 0;
+        for (; pilot < FROZEN_MAX_PILOT; pilot++) {
+            size_t j = 0;
+            for (; j < count; j++) {
+                size_t pos = frozen_position(h2[members[j]], pilot, n);
+                if (taken[pos / 64] & (1ULL << (pos % 64))) break;
+                size_t k = 0;
+                while (k < j && positions[k] != pos) k++;
+                if (k < j) break;
+                positions[j] = pos;
+            }
+            if (j == count) break;
+        }
+        if (pilot == FROZEN_MAX_PILOT) goto end;
+
+        frozen->pilots[b] = pilot;
+        for (size_t j = 0; j < count; j++) {
+            taken[positions[j] / 64] |= 1ULL << (positions[j] % 64);
+            slot_entry[positions[j]] = members[j];
+        }
+    }
+    ok = true;
+
+end:
+    free(h2);
+    free(bucket_of);
+    free(bucket_start);
+    free(sorted);
+    free(order);
+    free(taken);
+    free(positions);
+    free(size_start);
+    return ok;
+}
+
+static void frozen_free(JMAP_FROZEN *self) {
+    if (self->_data_type == JMAP_TYPE_POINTER && self->data) {
+        for (size_t i = 0; i < self->_length; i++) {
+            void **ptr = (void**)((char*)self->data + i * self->_elem_size);
+            if (*ptr) free(*ptr);
+        }
+    }
+    free(self->data);
+    free(self->key_blob);
+    free(self->key_offsets);
+    free(self->pilots);
+    memset(self, 0, sizeof(*self));
+    reset_error_trace();
+}
+
+JMAP_FROZEN map_freeze(const JMAP *self) {
+    JMAP_FROZEN frozen;
+    memset(&frozen, 0, sizeof(frozen));
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return frozen;
+    }
+
+    size_t n = self->_length;
+    frozen._elem_size = self->_elem_size;
+    frozen._data_type = self->_data_type;
+    frozen.user_callbacks = self->user_callbacks;
+    frozen._length = n;
+    frozen._bucket_count = n / FROZEN_BUCKET_SIZE + 1;
+
+    char **entries = malloc((n ? n : 1) * sizeof(char*));
+    size_t *lengths = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *source_slot = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *slot_entry = malloc((n ? n : 1) * sizeof(size_t));
+    frozen.pilots = calloc(frozen._bucket_count, sizeof(uint32_t));
+    frozen.key_offsets = malloc((n + 1) * sizeof(uint32_t));
+    frozen.data = calloc(n ? n : 1, self->_elem_size ? self->_elem_size : 1);
+    if (!entries || !lengths || !source_slot || !slot_entry || !frozen.pilots || !frozen.key_offsets || !frozen.data) {
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for frozen table failed");
+        goto fail;
+    }
+
+    size_t blob_size = 0, count = 0;
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (self->keys[i] == NULL) continue;
+        entries[count] = self->keys[i];
+        lengths[count] = strlen(self->keys[i]);
+        source_slot[count] = i;
+        blob_size += lengths[count] + 1;
+        count++;
+    }
+    if (blob_size > UINT32_MAX) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Keys are too large to be frozen (> 4GB)");
+        goto fail;
+    }
+
+    bool placed = (n == 0);
+    for (uint32_t attempt = 0; attempt < FROZEN_MAX_SEEDS && !placed; attempt++) {
+        frozen._seed = 42 + attempt * 0x9E3779B9u;
+        memset(frozen.pilots, 0, frozen._bucket_count * sizeof(uint32_t));
+        placed = frozen_place(&frozen, entries, lengths, slot_entry);
+    }
+    if (!placed) {
+        create_return_error(self, JMAP_UNINITIALIZED, "No perfect hash function found for the keys");
+        goto fail;
+    }
+
+    frozen.key_blob = malloc(blob_size ? blob_size : 1);
+    if (!frozen.key_blob) {
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for frozen keys failed");
+        goto fail;
+    }
+
+    uint32_t offset = 0;
+    for (size_t slot = 0; slot < n; slot++) {
+        size_t e = slot_entry[slot];
+        frozen.key_offsets[slot] = offset;
+        memcpy(frozen.key_blob + offset, entries[e], lengths[e] + 1);
+        offset += (uint32_t)lengths[e] + 1;
+        memcpy_elem(self, (char*)frozen.data + slot * self->_elem_size,
+                    (char*)self->data + source_slot[e] * self->_elem_size, 1);
+    }
+    frozen.key_offsets[n] = offset;
+
+    free(entries);
+    free(lengths);
+    free(source_slot);
+    free(slot_entry);
+    reset_error_trace();
+    return frozen;
+
+fail:
+    free(entries);
+    free(lengths);
+    free(source_slot);
+    free(slot_entry);
+    free(frozen.pilots);
+    free(frozen.key_offsets);
+    free(frozen.data);
+    free(frozen.key_blob);
+    memset(&frozen, 0, sizeof(frozen));
+    return frozen;
+}
+
+static void* frozen_get(const JMAP_FROZEN *self, const char *key) {
+    if (!self->key_offsets) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "JMAP_FROZEN is uninitialized");
+        return NULL;
+    }
+    if (!key || key[0] == '\0') {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+        return NULL;
+    }
+
+    size_t slot;
+    if (!frozen_find(self, key, &slot)) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+        return NULL;
+    }
+    reset_error_trace();
+    return (char*)self->data + slot * self->_elem_size;
+}
+
+static bool frozen_contains_key(const JMAP_FROZEN *self, const char *key) {
+    if (!self->key_offsets) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "JMAP_FROZEN is uninitialized");
+        return false;
+    }
+    if (!key || key[0] == '\0') {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Key cannot be NULL or empty");
+        return false;
+    }
+
+    size_t slot;
+    reset_error_trace();
+    return frozen_find(self, key, &slot);
+}
+
+static void frozen_for_each(const JMAP_FROZEN *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx) {
+    if (!self->key_offsets)
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "JMAP_FROZEN is uninitialized");
+    if (!callback)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Callback function cannot be NULL");
+
+    for (size_t i = 0; i < self->_length; i++) {
+        callback(self->key_blob + self->key_offsets[i], (char*)self->data + i * self->_elem_size, ctx);
+    }
+
+    reset_error_trace();
+}
+
+static void frozen_print(const JMAP_FROZEN *self) {
+    if (!self->key_offsets)
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "JMAP_FROZEN is uninitialized");
+    if (self->user_callbacks.print_element_callback == NULL)
+        return create_return_error(NULL, JMAP_PRINT_ELEMENT_CALLBACK_UNINTIALIZED, "Print element callback not set");
+    if (self->_length == 0)
+        return create_return_error(NULL, JMAP_EMPTY, "JMAP_FROZEN is empty => no print\n");
+
+    printf("JMAP_FROZEN [size: %zu, buckets: %zu] =>\n", self->_length, self->_bucket_count);
+    for (size_t i = 0; i < self->_length; i++) {
+        printf("{%zu, %s -> ", i, self->key_blob + self->key_offsets[i]);
+        self->user_callbacks.print_element_callback((char*)self->data + i * self->_elem_size);
+        printf("}\n");
+    }
+    reset_error_trace();
+}
+
+static void frozen_save(const JMAP_FROZEN *self, const char *path) {
+    if (!self->key_offsets)
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "JMAP_FROZEN is uninitialized");
+    if (!path)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Path cannot be NULL");
+    if (self->_data_type != JMAP_TYPE_VALUE)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Only JMAP_TYPE_VALUE tables can be saved");
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return create_return_error(NULL, JMAP_IO_ERROR, "Cannot open \"%s\" for writing", path);
+
+    uint32_t byte_order = FROZEN_BYTE_ORDER;
+    uint64_t length = self->_length, bucket_count = self->_bucket_count, elem_size = self->_elem_size;
+    uint64_t blob_size = self->key_offsets[self->_length];
+    bool ok = fwrite(FROZEN_MAGIC, 1, 8, file) == 8
+        && fwrite(&byte_order, sizeof(byte_order), 1, file) == 1
+        && fwrite(&self->_seed, sizeof(self->_seed), 1, file) == 1
+        && fwrite(&length, sizeof(length), 1, file) == 1
+        && fwrite(&bucket_count, sizeof(bucket_count), 1, file) == 1
+        && fwrite(&elem_size, sizeof(elem_size), 1, file) == 1
+        && fwrite(&blob_size, sizeof(blob_size), 1, file) == 1
+        && fwrite(self->pilots, sizeof(uint32_t), self->_bucket_count, file) == self->_bucket_count
+        && fwrite(self->key_offsets, sizeof(uint32_t), self->_length + 1, file) == self->_length + 1
+        && fwrite(self->key_blob, 1, blob_size, file) == blob_size
+        && fwrite(self->data, self->_elem_size, self->_length, file) == self->_length;
+
+    if (fclose(file) != 0) ok = false;
+    if (!ok)
+        return create_return_error(NULL, JMAP_IO_ERROR, "Write to \"%s\" failed", path);
+    reset_error_trace();
+}
+
+// Every key must lie inside the blob and end with its terminator, lookups and for_each rely on it
+static bool frozen_keys_valid(const JMAP_FROZEN *frozen, uint64_t blob_size) {
+    const uint32_t *offsets = frozen->key_offsets;
+    if (offsets[frozen->_length] != blob_size) return false;
+    for (size_t i = 0; i < frozen->_length; i++) {
+        if (offsets[i] >= offsets[i + 1] || offsets[i + 1] > blob_size || frozen->key_blob[offsets[i + 1] - 1] != '\0') return false;
+    }
+    return true;
+}
+
+static JMAP_FROZEN frozen_load(const char *path, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+    JMAP_FROZEN frozen;
+    memset(&frozen, 0, sizeof(frozen));
+    if (!path) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Path cannot be NULL");
+        return frozen;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        create_return_error(NULL, JMAP_IO_ERROR, "Cannot open \"%s\" for reading", path);
+        return frozen;
+    }
+
+    char magic[8];
+    uint32_t byte_order = 0;
+    uint64_t length = 0, bucket_count = 0, elem_size = 0, blob_size = 0;
+    bool ok = fread(magic, 1, 8, file) == 8
+        && memcmp(magic, FROZEN_MAGIC, 8) == 0
+        && fread(&byte_order, sizeof(byte_order), 1, file) == 1
+        && byte_order == FROZEN_BYTE_ORDER
+        && fread(&frozen._seed, sizeof(frozen._seed), 1, file) == 1
+        && fread(&length, sizeof(length), 1, file) == 1
+        && fread(&bucket_count, sizeof(bucket_count), 1, file) == 1
+        && fread(&elem_size, sizeof(elem_size), 1, file) == 1
+        && fread(&blob_size, sizeof(blob_size), 1, file) == 1
+        && bucket_count > 0 && bucket_count <= SIZE_MAX / sizeof(uint32_t)
+        && length < SIZE_MAX / sizeof(uint32_t)
+        && (length == 0 || (elem_size > 0 && elem_size <= SIZE_MAX / length))
+        && blob_size <= UINT32_MAX;
+    if (!ok) {
+        fclose(file);
+        create_return_error(NULL, JMAP_IO_ERROR, "\"%s\" is not a valid frozen table", path);
+        return frozen;
+    }
+
+    frozen._length = length;
+    frozen._bucket_count = bucket_count;
+    frozen._elem_size = elem_size;
+    frozen._data_type = JMAP_TYPE_VALUE;
+    frozen.user_callbacks = imp;
+    frozen.pilots = malloc(bucket_count * sizeof(uint32_t));
+    frozen.key_offsets = malloc((length + 1) * sizeof(uint32_t));
+    frozen.key_blob = malloc(blob_size ? blob_size : 1);
+    frozen.data = malloc(length && elem_size ? length * elem_size : 1);
+    if (!frozen.pilots || !frozen.key_offsets || !frozen.key_blob || !frozen.data) {
+        fclose(file);
+        frozen_free(&frozen);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for frozen table failed");
+        return frozen;
+    }
+
+    ok = fread(frozen.pilots, sizeof(uint32_t), bucket_count, file) == bucket_count
+        && fread(frozen.key_offsets, sizeof(uint32_t), length + 1, file) == length + 1
+        && fread(frozen.key_blob, 1, blob_size, file) == blob_size
+        && fread(frozen.data, elem_size, length, file) == length
+        && frozen_keys_valid(&frozen, blob_size);
+    fclose(file);
+    if (!ok) {
+        frozen_free(&frozen);
+        create_return_error(NULL, JMAP_IO_ERROR, "\"%s\" is truncated or corrupted", path);
+        return frozen;
+    }
+
+    reset_error_trace();
+    return frozen;
+}
+
+JMAP_FROZEN_INTERFACE jmap_frozen = {
+    .get = frozen_get,
+    .contains_key = frozen_contains_key,
+    .for_each = frozen_for_each,
+    .print = frozen_print,
+    .save = frozen_save,
+    .load = frozen_load,
+    .free = frozen_free,
+};
@@ -0,0 +1,129 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Allocator backing the large blocks of a map with 2 MiB pages. A random probe in a table much
+ * larger than the last level cache costs a cache miss plus, with 4 KiB pages, a TLB miss and a page
+ * walk that misses too; one huge page entry covers 512 times more of the table.
+ * Large blocks are mmap'ed on a 2 MiB boundary, either from the reserved huge page pool
+ * (MAP_HUGETLB) or as transparent huge pages (MADV_HUGEPAGE), optionally placed on NUMA nodes and
+ * faulted in at once. Small blocks (keys, pool chunks, side tables of small maps) stay on the heap.
+ * Every block is zero-filled, so the map does not clear fresh tables itself.
+ */
+
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+
+static inline size_t huge_round(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+static inline size_t huge_min_bytes(const JMAP_HUGE_PAGE_CONFIG *config) {
+    return config->min_bytes ? config->min_bytes : HUGE_PAGE_SIZE;
+}
+
+// Best effort: without NUMA support in the kernel the pages simply follow the default policy
+static void huge_bind(void *ptr, size_t size, const JMAP_HUGE_PAGE_CONFIG *config) {
+#ifdef SYS_mbind
+    if (config->numa_policy == JMAP_NUMA_DEFAULT || !config->node_mask) return;
+    int mode = config->numa_policy == JMAP_NUMA_BIND ? MPOL_BIND : MPOL_INTERLEAVE;
+    unsigned long mask = config->node_mask;
+    syscall(SYS_mbind, ptr, size, mode, &mask, sizeof(mask) * 8, 0);
+#else
+    (void)ptr;
+    (void)size;
+    (void)config;
+#endif
+}
+
+static void huge_prefault(void *ptr, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    // Older kernels: one write per page, a huge page is faulted in by its first write
+    for (size_t off = 0; off < size; off += 4096) ((volatile char*)ptr)[off] = 0;
+}
+
+// Reserved huge pages come 2 MiB aligned. NULL when the pool is empty or not configured.
+static void *huge_map_explicit(size_t size) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Over-maps by one huge page and trims both ends, so that the kernel can back the block with huge pages
+static void *huge_map_transparent(size_t size) {
+    char *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    char *ptr = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    size_t head = (size_t)(ptr - raw);
+    if (head) munmap(raw, head);
+    if (HUGE_PAGE_SIZE - head) munmap(ptr + size, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+static void *huge_alloc(size_t size, void *ctx) {
+    const JMAP_HUGE_PAGE_CONFIG *config = ctx;
+    if (size < huge_min_bytes(config)) return calloc(1, size);
+
+    size_t mapped = huge_round(size);
+    void *ptr = config->explicit_pages ? huge_map_explicit(mapped) : NULL;
+    if (!ptr) ptr = huge_map_transparent(mapped);
+    if (!ptr) return NULL;
+    // The policy must be set before the first touch
+    huge_bind(ptr, mapped, config);
+    if (config->prefault) huge_prefault(ptr, mapped);
+    return ptr;
+}
+
+static void *huge_aligned_alloc(size_t alignment, size_t size, void *ctx) {
+    const JMAP_HUGE_PAGE_CONFIG *config = ctx;
+    if (size >= huge_min_bytes(config)) return huge_alloc(size, ctx);
+    void *ptr = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+static void huge_free(void *ptr, size_t size, void *ctx) {
+    const JMAP_HUGE_PAGE_CONFIG *config = ctx;
+    if (size < huge_min_bytes(config)) free(ptr);
+    else munmap(ptr, huge_round(size));
+}
+
+static JMAP_ALLOCATOR huge_page_allocator(const JMAP_HUGE_PAGE_CONFIG *config) {
+    return (JMAP_ALLOCATOR){
+        .alloc = huge_alloc,
+        .free = huge_free,
+        .aligned_alloc = huge_aligned_alloc,
+        .ctx = (void*)config,
+        .zeroed = true,
+    };
+}
+
+#else
+
+// Without mmap the default allocator is kept
+static JMAP_ALLOCATOR huge_page_allocator(const JMAP_HUGE_PAGE_CONFIG *config) {
+    (void)config;
+    return (JMAP_ALLOCATOR){0};
+}
+
+#endif
+
+JMAP_HUGE_PAGE_INTERFACE jmap_huge_pages = {
+    .allocator = huge_page_allocator,
+};
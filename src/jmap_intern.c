@@ -0,0 +1,198 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stddef.h>
+
+/*
+ * Symbol table. Every distinct key is stored once, behind a header holding its hash, and the
+ * pointer to its characters is its handle: a handle is a regular NUL-terminated string, so the
+ * maps keep comparing and printing keys as before, and two handles of the same table are equal
+ * exactly when they are the same pointer.
+ * Symbols are bumped out of large chunks and live as long as the table. The index is an open
+ * addressing table of handles, probed with the cached hashes.
+ */
+
+#define INTERN_CHUNK_SIZE ((size_t)64 * 1024)
+#define INTERN_INITIAL_CAPACITY 64
+
+typedef struct INTERN_HEADER {
+    uint32_t hash;
+    uint32_t length;
+} INTERN_HEADER;
+
+typedef struct INTERN_CHUNK {
+    struct INTERN_CHUNK *next;
+    size_t size;
+    _Alignas(INTERN_HEADER) char bytes[];
+} INTERN_CHUNK;
+
+struct JMAP_INTERN {
+    const char **slots;                          // Handles, NULL for empty slots
+    size_t capacity;
+    size_t length;
+    INTERN_CHUNK *chunks;                        // Current chunk first
+    size_t used;                                 // Bytes used in the current chunk
+    size_t bytes;                                // Bytes of all the chunks
+};
+
+static inline const INTERN_HEADER *handle_header(const char *handle) {
+    return (const INTERN_HEADER*)handle - 1;
+}
+
+uint32_t intern_hash(const char *handle) {
+    return handle_header(handle)->hash;
+}
+
+static size_t intern_find_slot(const JMAP_INTERN *self, const char *key, size_t length, uint32_t hash) {
+    size_t mask = self->capacity - 1;
+    size_t idx = hash & mask;
+    for (const char *handle; (handle = self->slots[idx]) != NULL; idx = (idx + 1) & mask) {
+        const INTERN_HEADER *header = handle_header(handle);
+        if (header->hash == hash && header->length == length && memcmp(handle, key, length) == 0) break;
+    }
+    return idx;
+}
+
+static bool intern_grow(JMAP_INTERN *self) {
+    size_t capacity = self->capacity * 2;
+    const char **slots = calloc(capacity, sizeof(char*));
+    if (!slots) return false;
+    for (size_t i = 0; i < self->capacity; i++) {
+        const char *handle = self->slots[i];
+        if (!handle) continue;
+        size_t idx = intern_hash(handle) & (capacity - 1);
+        while (slots[idx]) idx = (idx + 1) & (capacity - 1);
+        slots[idx] = handle;
+    }
+    free(self->slots);
+    self->slots = slots;
+    self->capacity = capacity;
+    return true;
+}
+
+// Room for a symbol of `size` bytes (header included), from the current chunk or a new one
+static char *intern_bump(JMAP_INTERN *self, size_t size) {
+    size = (size + _Alignof(INTERN_HEADER) - 1) & ~(_Alignof(INTERN_HEADER) - 1);
+    INTERN_CHUNK *chunk = self->chunks;
+    if (!chunk || chunk->size - self->used < size) {
+        size_t chunk_size = size > INTERN_CHUNK_SIZE ? size : INTERN_CHUNK_SIZE;
+        INTERN_CHUNK *fresh = malloc(sizeof(INTERN_CHUNK) + chunk_size);
+        if (!fresh) return NULL;
+        fresh->size = chunk_size;
+        self->bytes += chunk_size;
+        if (chunk && chunk_size > INTERN_CHUNK_SIZE) {
+            // A symbol larger than a chunk gets its own, the current chunk stays in use
+            fresh->next = chunk->next;
+            chunk->next = fresh;
+            return fresh->bytes;
+        }
+        fresh->next = chunk;
+        self->chunks = fresh;
+        self->used = 0;
+        chunk = fresh;
+    }
+    char *out = chunk->bytes + self->used;
+    self->used += size;
+    return out;
+}
+
+// Handle of key, added to the table if needed. NULL if out of memory.
+const char *intern_key(JMAP_INTERN *self, const char *key) {
+    size_t length = strlen(key);
+    uint32_t hash = key_hash_length(key, length);
+    size_t idx = intern_find_slot(self, key, length, hash);
+    if (self->slots[idx]) return self->slots[idx];
+    if (length > UINT32_MAX) return NULL;
+
+    if ((self->length + 1) * 4 > self->capacity * 3) {
+        if (!intern_grow(self)) return NULL;
+        idx = intern_find_slot(self, key, length, hash);
+    }
+    char *block = intern_bump(self, sizeof(INTERN_HEADER) + length + 1);
+    if (!block) return NULL;
+    INTERN_HEADER *header = (INTERN_HEADER*)block;
+    header->hash = hash;
+    header->length = (uint32_t)length;
+    char *handle = block + sizeof(INTERN_HEADER);
+    memcpy(handle, key, length + 1);
+    self->slots[idx] = handle;
+    self->length++;
+    return handle;
+}
+
+static JMAP_INTERN *intern_create(void) {
+    JMAP_INTERN *self = calloc(1, sizeof(JMAP_INTERN));
+    const char **slots = calloc(INTERN_INITIAL_CAPACITY, sizeof(char*));
+    if (!self || !slots) {
+        free(self);
+        free(slots);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for symbol table failed");
+        return NULL;
+    }
+    self->slots = slots;
+    self->capacity = INTERN_INITIAL_CAPACITY;
+    reset_error_trace();
+    return self;
+}
+
+static const char *intern_intern(JMAP_INTERN *self, const char *key) {
+    if (!self || !key || key[0] == '\0') {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Symbol table and key cannot be NULL, key cannot be empty");
+        return NULL;
+    }
+    const char *handle = intern_key(self, key);
+    if (!handle) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for symbol \"%s\" failed", key);
+        return NULL;
+    }
+    reset_error_trace();
+    return handle;
+}
+
+static const char *intern_find(const JMAP_INTERN *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Symbol table and key cannot be NULL");
+        return NULL;
+    }
+    size_t length = strlen(key);
+    uint32_t hash = key_hash_length(key, length);
+    const char *handle = self->slots[intern_find_slot(self, key, length, hash)];
+    if (!handle) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" is not interned", key);
+        return NULL;
+    }
+    reset_error_trace();
+    return handle;
+}
+
+static uint32_t intern_handle_hash(const char *handle) {
+    return handle ? intern_hash(handle) : 0;
+}
+
+static size_t intern_length(const JMAP_INTERN *self) {
+    return self ? self->length : 0;
+}
+
+static size_t intern_memory_usage(const JMAP_INTERN *self) {
+    if (!self) return 0;
+    return sizeof(JMAP_INTERN) + self->capacity * sizeof(char*) + self->bytes;
+}
+
+static void intern_free(JMAP_INTERN *self) {
+    if (!self) return;
+    for (INTERN_CHUNK *chunk = self->chunks, *next; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(self->slots);
+    free(self);
+}
+
+JMAP_INTERN_INTERFACE jmap_intern = {
+    .create = intern_create,
+    .intern = intern_intern,
+    .find = intern_find,
+    .hash = intern_handle_hash,
+    .length = intern_length,
+    .memory_usage = intern_memory_usage,
+    .free = intern_free,
+};
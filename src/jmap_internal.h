@@ -0,0 +1,206 @@
+#ifndef JMAP_INTERNAL_H
+#define JMAP_INTERNAL_H
+
+/*
+ * Helpers shared between the translation units of the library.
+ * This header is NOT installed, user code should only include jmap.h.
+ */
+
+#include "../inc/jmap.h"
+#include <stdint.h>
+#include <string.h>
+#include "third_party/murmur3-master/murmur3.h"
+
+// Number of 64-bit words of the occupancy bitmap of a table
+#define OCCUPANCY_WORDS(capacity) (((capacity) + 63) / 64)
+
+/*
+ * Hash of a key in every table of the library (maps, sets, filters, symbol tables, persistent maps,
+ * snapshots, traces), so that a hash computed by one of them can be reused by the others.
+ * The slot index of a map is its low bits.
+ */
+static inline uint32_t key_hash_length(const char *key, size_t length) {
+    uint32_t hash;
+    MurmurHash3_x86_32(key, (int)length, 42, &hash);
+    return hash;
+}
+
+static inline uint32_t key_hash(const char *key) {
+    return key_hash_length(key, strlen(key));
+}
+
+void create_return_error(const JMAP* ret_source, JMAP_ERROR error_code, const char* fmt, ...);
+void reset_error_trace(void);
+void track_table(JMAP *self, bool add);
+size_t memory_total(const JMAP *self);
+bool map_evict_lru(JMAP *self);
+void map_erase_at(JMAP *self, size_t idx);
+void map_log_put(JMAP *self, size_t idx);
+size_t map_key_to_index(const JMAP *self, const char *key);
+size_t map_stored_key_index(const JMAP *self, const char *key);
+uint32_t map_stored_key_hash(const JMAP *self, const char *key);
+unsigned parallel_threads(unsigned threads);
+void parallel_for(size_t count, unsigned threads, void (*fn)(void *ctx, size_t begin, size_t end), void *ctx);
+
+/*
+ * USDT probes, compiled in with -DJMAP_USDT (sys/sdt.h from systemtap). Each one is a nop in the
+ * code and a note in the ELF until a tracer attaches. Provider "jmap":
+ *   resize_start (map, old_capacity, new_capacity, length)
+ *   resize_end   (map, old_capacity, new_capacity, duration_ns)
+ *   shrink       (map, old_capacity, new_capacity, length)
+ *   long_probe   (map, key, probe_length)      lookups of more than JMAP_USDT_LONG_PROBE slots
+ *   alloc_failed (size)
+ */
+#ifdef JMAP_USDT
+#include <sys/sdt.h>
+#define JMAP_USDT_ENABLED 1
+#define JMAP_PROBE1(name, a) DTRACE_PROBE1(jmap, name, a)
+#define JMAP_PROBE3(name, a, b, c) DTRACE_PROBE3(jmap, name, a, b, c)
+#define JMAP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(jmap, name, a, b, c, d)
+#else
+#define JMAP_USDT_ENABLED 0
+#define JMAP_PROBE1(name, a) ((void)0)
+#define JMAP_PROBE3(name, a, b, c) ((void)0)
+#define JMAP_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+#ifndef JMAP_USDT_LONG_PROBE
+#define JMAP_USDT_LONG_PROBE 16
+#endif
+
+// Alignment of the value array, so that numeric kernels start on a cache line
+#define JMAP_DATA_ALIGNMENT 64
+
+// jmap_alloc.c
+bool allocator_is_default(const JMAP_ALLOCATOR *a);
+void *allocator_alloc(const JMAP_ALLOCATOR *a, size_t size);
+void *allocator_calloc(const JMAP_ALLOCATOR *a, size_t count, size_t size);
+void *allocator_aligned(const JMAP_ALLOCATOR *a, size_t alignment, size_t size);
+void *allocator_realloc(const JMAP_ALLOCATOR *a, void *ptr, size_t old_size, size_t new_size);
+void allocator_free(const JMAP_ALLOCATOR *a, void *ptr, size_t size);
+char *allocator_strdup(const JMAP_ALLOCATOR *a, const char *s);
+
+// jmap_frozen.c
+JMAP_FROZEN map_freeze(const JMAP *self);
+
+// jmap_wal.c
+void wal_log_put(JMAP_WAL *wal, const char *key, const void *value, uint64_t ttl_ms);
+void wal_log_remove(JMAP_WAL *wal, const char *key);
+void wal_log_clear(JMAP_WAL *wal);
+void wal_release(JMAP *map);
+bool wal_write_snapshot(const JMAP *map, const char *path);
+bool wal_load_snapshot(JMAP *map, const char *path);
+
+// jmap_cache.c
+JMAP_CACHE *cache_create(const JMAP *map, JMAP_CACHE_CONFIG config);
+void cache_release(JMAP *map);
+void cache_on_insert(JMAP_CACHE *cache, size_t idx);
+void cache_touch(JMAP_CACHE *cache, size_t idx);
+void cache_on_miss(JMAP_CACHE *cache);
+void cache_on_erase(JMAP_CACHE *cache, size_t idx);
+void cache_on_move(JMAP_CACHE *cache, size_t from, size_t to);
+void cache_on_clear(JMAP_CACHE *cache);
+bool cache_on_resize(JMAP_CACHE *cache, const size_t *remap, size_t new_capacity);
+size_t cache_lru_slot(const JMAP_CACHE *cache);
+const JMAP_CACHE_CONFIG *cache_config(const JMAP_CACHE *cache);
+void cache_count_eviction(JMAP_CACHE *cache);
+void cache_count_hit(JMAP_CACHE *cache);
+size_t cache_bytes_per_slot(void);
+
+// jmap_ttl.c
+JMAP_TTL *ttl_create(const JMAP *map);
+JMAP_TTL *ttl_clone(const JMAP_TTL *ttl);
+void ttl_release(JMAP *map);
+size_t ttl_table_bytes(size_t capacity);
+void ttl_schedule(JMAP_TTL *ttl, size_t idx, uint32_t ttl_ms);
+bool ttl_is_expired(const JMAP_TTL *ttl, size_t idx);
+uint64_t ttl_remaining_ms(const JMAP_TTL *ttl, size_t idx);
+void ttl_on_erase(JMAP_TTL *ttl, size_t idx);
+void ttl_on_move(JMAP_TTL *ttl, size_t from, size_t to);
+void ttl_on_clear(JMAP_TTL *ttl);
+bool ttl_reserve(JMAP_TTL *ttl, size_t new_capacity);
+void ttl_on_resize(JMAP_TTL *ttl, const size_t *remap, size_t new_capacity);
+size_t ttl_expire(JMAP *self, size_t max_work);
+
+// jmap_stats.c
+uint64_t stats_clock_ns(void);
+void stats_on_lookup(JMAP_STATS_COUNTERS *stats, size_t compares, bool found);
+void stats_on_resize(JMAP_STATS_COUNTERS *stats, uint64_t start_ns);
+void stats_on_filter(JMAP_STATS_COUNTERS *stats, bool passed, bool found);
+void stats_release(JMAP *map);
+
+// jmap_trace.c
+void trace_log(JMAP_TRACE *trace, JMAP_TRACE_OP op, const char *key);
+void trace_release(JMAP *map);
+
+// jmap_snapshot.c
+JMAP_SNAPSHOT *map_snapshot(JMAP *self);
+void snapshot_before_write(JMAP *map, size_t idx);
+void snapshot_detach_all(JMAP *map);
+
+// jmap_intern.c
+uint32_t intern_hash(const char *handle);
+const char *intern_key(JMAP_INTERN *self, const char *key);
+
+// jmap_ordered.c
+bool ordered_insert(JMAP *map, char *key);
+void ordered_remove(JMAP *map, const char *key);
+void ordered_replace_key(JMAP *map, const char *old_key, char *new_key);
+void ordered_clear(JMAP *map);
+void ordered_release(JMAP *map);
+
+// jmap_filter.c
+bool filter_may_contain(const JMAP_FILTER *filter, uint32_t hash);
+void filter_on_insert(JMAP *map, const char *key);
+void filter_on_remove(JMAP *map);
+void filter_on_clear(JMAP *map);
+void filter_rebuild(JMAP *map);
+void filter_release(JMAP *map);
+
+// jmap_bgsave.c
+void bgsave_release(JMAP *map);
+
+// jmap_pool.c
+JMAP_POOL *pool_create(size_t (*value_size)(const void *value), JMAP_ALLOCATOR allocator);
+void pool_destroy(JMAP_POOL *pool);
+void pool_release(JMAP *map);
+JMAP_POOL *pool_create_like(const JMAP_POOL *pool);
+void *pool_alloc(JMAP_POOL *pool, size_t size);
+bool pool_copy(JMAP_POOL *pool, void *dest, const void *src);
+bool pool_copy_out(const JMAP_POOL *pool, void *dest, const void *src);
+void pool_free(JMAP_POOL *pool, void *block);
+size_t pool_block_size(const void *block);
+
+static inline void* memcpy_elem(const JMAP *self, void *__restrict__ __dest, const void *__restrict__ __elem, size_t __count){
+    void *ret = __dest;
+
+    if (self->_data_type == JMAP_TYPE_VALUE) {
+        ret = memcpy(__dest, __elem, self->_elem_size * __count);
+    } else if (self->_data_type == JMAP_TYPE_POINTER) {
+        for (size_t i = 0; i < __count; i++) {
+            const void *src_elem = (const char*)__elem + i * self->_elem_size;
+            void *dest_elem = (char *)__dest + i * self->_elem_size;
+
+            if (!src_elem || !(*(void**)src_elem)) {
+                memset(dest_elem, 0, self->_elem_size);
+                continue;
+            }
+
+            if (!self->user_callbacks.copy_elem_callback) {
+                memcpy(dest_elem, src_elem, self->_elem_size);
+                continue;
+            }
+
+            const void *tmp = self->user_callbacks.copy_elem_callback(src_elem);
+            if (!tmp) {
+                memset(dest_elem, 0, self->_elem_size);
+                continue;
+            }
+
+            memcpy(dest_elem, tmp, self->_elem_size);
+            free((void*)tmp);
+        }
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,299 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Multimap: a regular JMAP whose value slots each hold the values of one key, contiguously.
+ *
+ * A slot starts with a header (count, capacity) followed by room for a few values. While the values
+ * fit, they are stored in the slot itself; past that they are moved to an array taken from the
+ * multimap's pool and the slot keeps a pointer to it. Arrays double when full and move back into
+ * the slot once enough values are removed. The table engine only sees fixed-size plain values:
+ * the multimap copies and frees the values itself, with the callbacks of the value type.
+ */
+
+#define MULTI_INLINE_BYTES 32                    // Room for the values stored in the slot
+
+typedef struct MULTI_HEADER {
+    uint32_t count;
+    uint32_t capacity;                           // Above inline_count: values are in a pool array
+} MULTI_HEADER;
+
+struct JMAP_MULTIMAP {
+    JMAP map;                                    // Key to slot, JMAP_TYPE_VALUE
+    JMAP layout;                                 // Value type and callbacks, for memcpy_elem
+    JMAP_POOL *spill;                            // Arrays of the keys with more values than inline_count
+    size_t inline_count;
+    size_t values;                               // Values of all the keys
+};
+
+static inline MULTI_HEADER *slot_header(void *slot) {
+    return slot;
+}
+
+static inline bool slot_spilled(const JMAP_MULTIMAP *self, const MULTI_HEADER *header) {
+    return header->capacity > self->inline_count;
+}
+
+static inline char *slot_values(const JMAP_MULTIMAP *self, void *slot) {
+    char *inline_values = (char*)slot + sizeof(MULTI_HEADER);
+    return slot_spilled(self, slot_header(slot)) ? *(char**)inline_values : inline_values;
+}
+
+static inline void *value_at(const JMAP_MULTIMAP *self, char *values, size_t i) {
+    return values + i * self->layout._elem_size;
+}
+
+// Frees what a value owns: pointer values are heap blocks handed over to the multimap
+static void value_release(const JMAP_MULTIMAP *self, void *value) {
+    if (self->layout._data_type == JMAP_TYPE_POINTER) free(*(void**)value);
+}
+
+// Frees the values of a slot and its array, the slot itself stays in the table
+static void slot_release(JMAP_MULTIMAP *self, void *slot) {
+    MULTI_HEADER *header = slot_header(slot);
+    char *values = slot_values(self, slot);
+    for (size_t i = 0; i < header->count; i++) value_release(self, value_at(self, values, i));
+    self->values -= header->count;
+    if (slot_spilled(self, header)) pool_free(self->spill, values);
+    header->count = 0;
+    header->capacity = (uint32_t)self->inline_count;
+}
+
+// Room for one more value in a full slot: the values move to a pool array twice as large
+static bool slot_grow(JMAP_MULTIMAP *self, void *slot) {
+    MULTI_HEADER *header = slot_header(slot);
+    size_t elem_size = self->layout._elem_size;
+    size_t capacity = (size_t)header->capacity * 2;
+    if (capacity > UINT32_MAX) return false;
+    char *array = pool_alloc(self->spill, capacity * elem_size);
+    if (!array) return false;
+    char *values = slot_values(self, slot);
+    memcpy(array, values, header->count * elem_size);
+    if (slot_spilled(self, header)) pool_free(self->spill, values);
+    // Pool blocks are rounded up to their size class, all of it is usable
+    capacity = pool_block_size(array) / elem_size;
+    header->capacity = capacity > UINT32_MAX ? UINT32_MAX : (uint32_t)capacity;
+    *(char**)((char*)slot + sizeof(MULTI_HEADER)) = array;
+    return true;
+}
+
+// Moves the values of a spilled slot back into it once they fit
+static void slot_shrink(JMAP_MULTIMAP *self, void *slot) {
+    MULTI_HEADER *header = slot_header(slot);
+    if (!slot_spilled(self, header) || header->count > self->inline_count) return;
+    char *array = slot_values(self, slot);
+    memcpy((char*)slot + sizeof(MULTI_HEADER), array, header->count * self->layout._elem_size);
+    pool_free(self->spill, array);
+    header->capacity = (uint32_t)self->inline_count;
+}
+
+static JMAP_MULTIMAP *multimap_create(size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+    if (elem_size == 0) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Element size cannot be 0");
+        return NULL;
+    }
+    if (data_type == JMAP_TYPE_POINTER && elem_size != sizeof(void*)) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Pointer elements must be %zu bytes", sizeof(void*));
+        return NULL;
+    }
+    JMAP_MULTIMAP *self = calloc(1, sizeof(JMAP_MULTIMAP));
+    JMAP_ALLOCATOR libc = {0};
+    JMAP_POOL *spill = pool_create(NULL, libc);
+    if (!self || !spill) {
+        free(self);
+        if (spill) pool_destroy(spill);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for multimap failed");
+        return NULL;
+    }
+    self->layout._elem_size = elem_size;
+    self->layout._data_type = data_type;
+    self->layout.user_callbacks = imp;
+    self->spill = spill;
+    self->inline_count = elem_size <= MULTI_INLINE_BYTES ? MULTI_INLINE_BYTES / elem_size : 1;
+    // The inline room also holds the array pointer once spilled, and keeps the slots 8-byte aligned
+    size_t room = self->inline_count * elem_size;
+    if (room < sizeof(char*)) room = sizeof(char*);
+    room = (room + 7) & ~(size_t)7;
+    JMAP_USER_CALLBACK_IMPLEMENTATION none = {0};
+    jmap.init(&self->map, sizeof(MULTI_HEADER) + room, JMAP_TYPE_VALUE, none);
+    if (jmap_last_error_trace.has_error) {
+        pool_destroy(spill);
+        free(self);
+        return NULL;
+    }
+    reset_error_trace();
+    return self;
+}
+
+static JMAP_MULTIMAP *multimap_create_preset(JMAP_TYPE_PRESET preset) {
+    if (preset == JMAP_POOLED_STRING_PRESET) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Multimaps do not support value pools, use JMAP_STRING_PRESET");
+        return NULL;
+    }
+    // The presets of jmap.init_preset, without their table
+    JMAP map = jmap.init_preset(preset);
+    if (jmap_last_error_trace.has_error) return NULL;
+    size_t elem_size = map._elem_size;
+    JMAP_DATA_TYPE data_type = map._data_type;
+    JMAP_USER_CALLBACK_IMPLEMENTATION imp = map.user_callbacks;
+    jmap.free(&map);
+    return multimap_create(elem_size, data_type, imp);
+}
+
+static bool multimap_check(const JMAP_MULTIMAP *self, const char *key) {
+    if (!self || !key || key[0] == '\0') {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Multimap and key cannot be NULL, key cannot be empty");
+        return false;
+    }
+    return true;
+}
+
+static void multimap_put_append(JMAP_MULTIMAP *self, const char *key, const void *value) {
+    if (!multimap_check(self, key)) return;
+    if (!value) return create_return_error(&self->map, JMAP_INVALID_ARGUMENT, "Value cannot be NULL");
+    void *slot = jmap.get(&self->map, key);
+    if (!slot) {
+        unsigned char fresh[self->map._elem_size];
+        memset(fresh, 0, sizeof(fresh));
+        MULTI_HEADER *header = slot_header(fresh);
+        header->count = 1;
+        header->capacity = (uint32_t)self->inline_count;
+        void *copy = fresh + sizeof(MULTI_HEADER);
+        memcpy_elem(&self->layout, copy, value, 1);
+        jmap.put(&self->map, key, fresh);
+        if (jmap_last_error_trace.has_error) {
+            // Without copy_elem_callback the value was not copied, it is still the caller's
+            if (self->layout.user_callbacks.copy_elem_callback) value_release(self, copy);
+            return;
+        }
+        self->values++;
+        return;
+    }
+    MULTI_HEADER *header = slot_header(slot);
+    if (header->count == header->capacity && !slot_grow(self, slot))
+        return create_return_error(&self->map, JMAP_UNINITIALIZED, "Memory allocation for the values of \"%s\" failed", key);
+    memcpy_elem(&self->layout, value_at(self, slot_values(self, slot), header->count), value, 1);
+    header->count++;
+    self->values++;
+    reset_error_trace();
+}
+
+static JMAP_SPAN multimap_get_all(const JMAP_MULTIMAP *self, const char *key) {
+    JMAP_SPAN span = {NULL, 0};
+    if (!multimap_check(self, key)) return span;
+    void *slot = jmap.get(&self->map, key);
+    if (!slot) return span;
+    span.values = slot_values(self, slot);
+    span.count = slot_header(slot)->count;
+    return span;
+}
+
+static size_t multimap_count(const JMAP_MULTIMAP *self, const char *key) {
+    if (!multimap_check(self, key)) return 0;
+    void *slot = jmap.get(&self->map, key);
+    reset_error_trace();
+    return slot ? slot_header(slot)->count : 0;
+}
+
+static bool multimap_contains_key(const JMAP_MULTIMAP *self, const char *key) {
+    if (!multimap_check(self, key)) return false;
+    return jmap.contains_key(&self->map, key);
+}
+
+static bool multimap_remove_value(JMAP_MULTIMAP *self, const char *key, const void *value) {
+    if (!multimap_check(self, key)) return false;
+    if (!value) {
+        create_return_error(&self->map, JMAP_INVALID_ARGUMENT, "Value cannot be NULL");
+        return false;
+    }
+    void *slot = jmap.get(&self->map, key);
+    if (!slot) return false;
+    MULTI_HEADER *header = slot_header(slot);
+    char *values = slot_values(self, slot);
+    size_t elem_size = self->layout._elem_size;
+    bool (*is_equal)(const void*, const void*) = self->layout.user_callbacks.is_equal_callback;
+    size_t i = 0;
+    while (i < header->count && !(is_equal ? is_equal(value_at(self, values, i), value) : memcmp(value_at(self, values, i), value, elem_size) == 0)) i++;
+    if (i == header->count) {
+        create_return_error(&self->map, JMAP_ELEMENT_NOT_FOUND, "Value not found for key \"%s\"", key);
+        return false;
+    }
+    if (header->count == 1) {
+        slot_release(self, slot);
+        jmap.remove(&self->map, key);
+        return true;
+    }
+    // The remaining values keep their order
+    value_release(self, value_at(self, values, i));
+    memmove(value_at(self, values, i), value_at(self, values, i + 1), (header->count - i - 1) * elem_size);
+    header->count--;
+    self->values--;
+    slot_shrink(self, slot);
+    reset_error_trace();
+    return true;
+}
+
+static void multimap_remove(JMAP_MULTIMAP *self, const char *key) {
+    if (!multimap_check(self, key)) return;
+    void *slot = jmap.get(&self->map, key);
+    if (!slot) return;
+    slot_release(self, slot);
+    jmap.remove(&self->map, key);
+}
+
+static size_t multimap_length(const JMAP_MULTIMAP *self) {
+    return self ? self->map._length : 0;
+}
+
+static size_t multimap_value_count(const JMAP_MULTIMAP *self) {
+    return self ? self->values : 0;
+}
+
+static void multimap_for_each(const JMAP_MULTIMAP *self, void (*callback)(const char *key, JMAP_SPAN values, void *ctx), void *ctx) {
+    if (!self || !callback)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Multimap and callback cannot be NULL");
+    const JMAP *map = &self->map;
+    for (size_t i = 0; i < map->_capacity; i++) {
+        if (!map->keys[i]) continue;
+        void *slot = (char*)map->data + i * map->_elem_size;
+        JMAP_SPAN span = {slot_values(self, slot), slot_header(slot)->count};
+        callback(map->keys[i], span, ctx);
+    }
+}
+
+static void release_slots(JMAP_MULTIMAP *self) {
+    JMAP *map = &self->map;
+    for (size_t i = 0; i < map->_capacity; i++) {
+        if (map->keys[i]) slot_release(self, (char*)map->data + i * map->_elem_size);
+    }
+}
+
+static void multimap_clear(JMAP_MULTIMAP *self) {
+    if (!self) return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Multimap cannot be NULL");
+    release_slots(self);
+    jmap.clear(&self->map);
+}
+
+static void multimap_free(JMAP_MULTIMAP *self) {
+    if (!self) return;
+    release_slots(self);
+    jmap.free(&self->map);
+    pool_destroy(self->spill);
+    free(self);
+}
+
+JMAP_MULTIMAP_INTERFACE jmap_multimap = {
+    .create = multimap_create,
+    .create_preset = multimap_create_preset,
+    .put_append = multimap_put_append,
+    .get_all = multimap_get_all,
+    .count = multimap_count,
+    .contains_key = multimap_contains_key,
+    .remove_value = multimap_remove_value,
+    .remove = multimap_remove,
+    .length = multimap_length,
+    .value_count = multimap_value_count,
+    .for_each = multimap_for_each,
+    .clear = multimap_clear,
+    .free = multimap_free,
+};
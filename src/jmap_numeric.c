@@ -0,0 +1,428 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+/*
+ * Reductions and in-place updates over the values of maps created with a numeric preset.
+ * Slots are processed by blocks of 64 following the occupancy bitmap: empty blocks are skipped,
+ * sums and updates run over whole blocks (empty slots always hold zeroes) and are masked by the
+ * bitmap where needed. The loops do not branch on the data, so the compiler vectorizes them.
+ * Min and max only visit the set bits. One set of kernels is generated per value type.
+ */
+
+#define BLOCK_SLOTS 64
+#define FULL_BLOCK (~(uint64_t)0)
+// Below this capacity the parallel variants run on the calling thread
+#define PARALLEL_MIN_CAPACITY ((size_t)1 << 16)
+
+typedef struct NUMERIC_PARTIAL {
+    size_t count;
+    double sum;
+    double min;
+    double max;
+} NUMERIC_PARTIAL;
+
+typedef struct NUMERIC_KERNELS {
+    void (*reduce)(const JMAP *self, size_t first_word, size_t last_word, NUMERIC_PARTIAL *out);
+    size_t (*count_if)(const JMAP *self, JMAP_COMPARISON cmp, double threshold);
+    void (*histogram)(const JMAP *self, double lo, double scale, size_t *bins, size_t bin_count);
+    void (*apply)(JMAP *self, size_t first_word, size_t last_word, JMAP_APPLY_OP op, double a, double b);
+} NUMERIC_KERNELS;
+
+// Independent accumulators, so that floating point sums can be vectorized without reassociation
+#define LANES 8
+
+static inline size_t block_slots(const JMAP *self, size_t word) {
+    size_t left = self->_capacity - word * BLOCK_SLOTS;
+    return left < BLOCK_SLOTS ? left : BLOCK_SLOTS;
+}
+
+// Counts the set slots whose value satisfies `(CAST)v[j] OP rhs`
+#define COUNT_IF_LOOP(T, CAST, OP, RHS)                                             \
+    for (size_t w = 0; w < words; w++) {                                            \
+        uint64_t bits = self->_occupied[w];                                         \
+        if (!bits) continue;                                                        \
+        const T *v = values + w * BLOCK_SLOTS;                                      \
+        size_t n = block_slots(self, w);                                            \
+        for (size_t j = 0; j < n; j++)                                              \
+            count += ((bits >> j) & 1) & ((CAST)v[j] OP (RHS));                     \
+    }
+
+#define APPLY_LOOP(T, EXPR)                                                         \
+    for (size_t w = first_word; w < last_word; w++) {                               \
+        uint64_t bits = self->_occupied[w];                                         \
+        if (!bits) continue;                                                        \
+        T *v = values + w * BLOCK_SLOTS;                                            \
+        if (bits == FULL_BLOCK) {                                                   \
+            for (size_t j = 0; j < BLOCK_SLOTS; j++) { T x = v[j]; v[j] = (EXPR); } \
+        } else {                                                                    \
+            size_t n = block_slots(self, w);                                        \
+            for (size_t j = 0; j < n; j++) {                                        \
+                T x = v[j];                                                         \
+                v[j] = ((bits >> j) & 1) ? (EXPR) : x;                              \
+            }                                                                       \
+        }                                                                           \
+    }
+
+// Sum, min and max, and histogram, shared by the integer and floating point kernels
+#define NUMERIC_COMMON_KERNELS(NAME, T, ACC, T_MIN, T_MAX)                                      \
+static void reduce_##NAME(const JMAP *self, size_t first_word, size_t last_word, NUMERIC_PARTIAL *out) { \
+    const T *values = self->data;                                                               \
+    ACC sum[LANES] = {0};                                                                       \
+    T lo = T_MAX, hi = T_MIN;                                                                   \
+    size_t count = 0;                                                                           \
+    for (size_t w = first_word; w < last_word; w++) {                                           \
+        uint64_t bits = self->_occupied[w];                                                     \
+        if (!bits) continue;                                                                    \
+        const T *v = values + w * BLOCK_SLOTS;                                                  \
+        count += (size_t)__builtin_popcountll(bits);                                            \
+        if (block_slots(self, w) == BLOCK_SLOTS) {                                              \
+            /* Empty slots hold zeroes, so the whole block can be summed */                     \
+            for (size_t j = 0; j < BLOCK_SLOTS; j += LANES)                                     \
+                for (size_t l = 0; l < LANES; l++) sum[l] += v[j + l];                          \
+        } else {                                                                                \
+            for (uint64_t rest = bits; rest; rest &= rest - 1) sum[0] += v[__builtin_ctzll(rest)]; \
+        }                                                                                       \
+        for (; bits; bits &= bits - 1) {                                                        \
+            T x = v[__builtin_ctzll(bits)];                                                     \
+            lo = x < lo ? x : lo;                                                               \
+            hi = x > hi ? x : hi;                                                               \
+        }                                                                                       \
+    }                                                                                           \
+    for (size_t l = 1; l < LANES; l++) sum[0] += sum[l];                                        \
+    out->count = count;                                                                         \
+    out->sum = (double)sum[0];                                                                  \
+    out->min = (double)lo;                                                                      \
+    out->max = (double)hi;                                                                      \
+}                                                                                               \
+static void histogram_##NAME(const JMAP *self, double lo, double scale, size_t *bins, size_t bin_count) { \
+    const T *values = self->data;                                                               \
+    size_t words = OCCUPANCY_WORDS(self->_capacity);                                            \
+    for (size_t w = 0; w < words; w++) {                                                        \
+        for (uint64_t bits = self->_occupied[w]; bits; bits &= bits - 1) {                      \
+            double pos = ((double)values[w * BLOCK_SLOTS + __builtin_ctzll(bits)] - lo) * scale; \
+            size_t bin = pos <= 0 ? 0 : pos >= (double)bin_count ? bin_count - 1 : (size_t)pos;  \
+            bins[bin]++;                                                                        \
+        }                                                                                       \
+    }                                                                                           \
+}
+
+#define FLOAT_KERNELS_FOR(NAME, T)                                                              \
+NUMERIC_COMMON_KERNELS(NAME, T, double, -INFINITY, INFINITY)                                    \
+static size_t count_if_##NAME(const JMAP *self, JMAP_COMPARISON cmp, double threshold) {        \
+    const T *values = self->data;                                                               \
+    size_t words = OCCUPANCY_WORDS(self->_capacity), count = 0;                                 \
+    switch (cmp) {                                                                              \
+        case JMAP_CMP_LT: COUNT_IF_LOOP(T, double, <, threshold) break;                         \
+        case JMAP_CMP_LE: COUNT_IF_LOOP(T, double, <=, threshold) break;                        \
+        case JMAP_CMP_GT: COUNT_IF_LOOP(T, double, >, threshold) break;                         \
+        case JMAP_CMP_GE: COUNT_IF_LOOP(T, double, >=, threshold) break;                        \
+        case JMAP_CMP_EQ: COUNT_IF_LOOP(T, double, ==, threshold) break;                        \
+        case JMAP_CMP_NE: COUNT_IF_LOOP(T, double, !=, threshold) break;                        \
+    }                                                                                           \
+    return count;                                                                               \
+}                                                                                               \
+static void apply_##NAME(JMAP *self, size_t first_word, size_t last_word, JMAP_APPLY_OP op, double a, double b) { \
+    T *values = self->data;                                                                     \
+    switch (op) {                                                                               \
+        case JMAP_APPLY_SCALE: APPLY_LOOP(T, (T)(x * a)) break;                                 \
+        case JMAP_APPLY_ADD:   APPLY_LOOP(T, (T)(x + a)) break;                                 \
+        case JMAP_APPLY_CLAMP: APPLY_LOOP(T, (T)(x < a ? a : x > b ? b : x)) break;             \
+    }                                                                                           \
+}                                                                                               \
+static const NUMERIC_KERNELS kernels_##NAME = {                                                 \
+    reduce_##NAME, count_if_##NAME, histogram_##NAME, apply_##NAME                              \
+};
+
+/*
+ * Integer kernels never round the values through double: the arguments are converted once to WIDE,
+ * a signed type wider than T (saturated to +-BOUND, far outside the range of T), the arithmetic is
+ * done in WIDE and the result saturated to the range of T. Only a fractional factor goes through
+ * long double, and non-integral addends and bounds are applied exactly with floor and ceil.
+ */
+#define INTEGER_KERNELS_FOR(NAME, T, ACC, WIDE, BOUND, T_MIN, T_MAX)                            \
+NUMERIC_COMMON_KERNELS(NAME, T, ACC, T_MIN, T_MAX)                                              \
+static inline WIDE wide_##NAME(double d) {                                                      \
+    return d <= -(BOUND) ? -(WIDE)(BOUND) : d >= (BOUND) ? (WIDE)(BOUND) : (WIDE)d;             \
+}                                                                                               \
+static inline T saturate_##NAME(WIDE r) {                                                       \
+    return r < (WIDE)(T_MIN) ? (T)(T_MIN) : r > (WIDE)(T_MAX) ? (T)(T_MAX) : (T)r;              \
+}                                                                                               \
+static inline T scale_##NAME(T x, WIDE factor) {                                                \
+    WIDE r;                                                                                     \
+    if (!__builtin_mul_overflow((WIDE)x, factor, &r)) return saturate_##NAME(r);                \
+    return (((WIDE)x ^ factor) < 0) ? (T)(T_MIN) : (T)(T_MAX);                              \
+}                                                                                               \
+static inline T scale_fraction_##NAME(T x, double factor) {                                     \
+    long double r = (long double)x * factor;                                                    \
+    return r <= (long double)(T_MIN) ? (T)(T_MIN) : r >= (long double)(T_MAX) ? (T)(T_MAX) : (T)r; \
+}                                                                                               \
+static size_t count_if_##NAME(const JMAP *self, JMAP_COMPARISON cmp, double threshold) {        \
+    const T *values = self->data;                                                               \
+    size_t words = OCCUPANCY_WORDS(self->_capacity), count = 0;                                 \
+    if (isnan(threshold)) return cmp == JMAP_CMP_NE ? self->_length : 0;                        \
+    /* x < t <=> x < ceil(t) and x <= t <=> x <= floor(t) for an integer x */                   \
+    WIDE lo = wide_##NAME(floor(threshold)), hi = wide_##NAME(ceil(threshold));                 \
+    bool integral = lo == hi;                                                                   \
+    switch (cmp) {                                                                              \
+        case JMAP_CMP_LT: COUNT_IF_LOOP(T, WIDE, <, hi) break;                                  \
+        case JMAP_CMP_LE: COUNT_IF_LOOP(T, WIDE, <=, lo) break;                                 \
+        case JMAP_CMP_GT: COUNT_IF_LOOP(T, WIDE, >, lo) break;                                  \
+        case JMAP_CMP_GE: COUNT_IF_LOOP(T, WIDE, >=, hi) break;                                 \
+        case JMAP_CMP_EQ: if (integral) COUNT_IF_LOOP(T, WIDE, ==, lo) break;                   \
+        case JMAP_CMP_NE: if (integral) COUNT_IF_LOOP(T, WIDE, !=, lo) else count = self->_length; break; \
+    }                                                                                           \
+    return count;                                                                               \
+}                                                                                               \
+static void apply_##NAME(JMAP *self, size_t first_word, size_t last_word, JMAP_APPLY_OP op, double a, double b) { \
+    T *values = self->data;                                                                     \
+    WIDE whole = wide_##NAME(floor(a));                                                         \
+    bool integral = floor(a) == a;                                                              \
+    switch (op) {                                                                               \
+        case JMAP_APPLY_SCALE:                                                                  \
+            if (integral) APPLY_LOOP(T, scale_##NAME(x, whole))                                 \
+            else APPLY_LOOP(T, scale_fraction_##NAME(x, a))                                     \
+            break;                                                                              \
+        case JMAP_APPLY_ADD:                                                                    \
+            if (integral) APPLY_LOOP(T, saturate_##NAME((WIDE)x + whole))                       \
+            /* x + a lies between x + floor(a) and the next integer, truncation rounds toward zero */ \
+            else APPLY_LOOP(T, saturate_##NAME((WIDE)x + whole + ((WIDE)x + whole < 0)))        \
+            break;                                                                              \
+        case JMAP_APPLY_CLAMP: {                                                                \
+            /* The integers in [a, b], or a truncated when there are none */                    \
+            T lo = saturate_##NAME(wide_##NAME(ceil(a))), hi = saturate_##NAME(wide_##NAME(floor(b))); \
+            if (lo > hi) lo = hi = saturate_##NAME(wide_##NAME(trunc(a)));                      \
+            APPLY_LOOP(T, x < lo ? lo : x > hi ? hi : x)                                        \
+            break;                                                                              \
+        }                                                                                       \
+    }                                                                                           \
+}                                                                                               \
+static const NUMERIC_KERNELS kernels_##NAME = {                                                 \
+    reduce_##NAME, count_if_##NAME, histogram_##NAME, apply_##NAME                              \
+};
+
+#define WIDE_BOUND 0x1p62                   // Beyond any value up to 32 bits, sums of two stay in long long
+#define WIDE128_BOUND 0x1p100               // Same for 64-bit values in __int128
+
+INTEGER_KERNELS_FOR(int, int, long long, long long, WIDE_BOUND, INT_MIN, INT_MAX)
+INTEGER_KERNELS_FOR(long, long, __int128, __int128, WIDE128_BOUND, LONG_MIN, LONG_MAX)
+INTEGER_KERNELS_FOR(short, short, long long, long long, WIDE_BOUND, SHRT_MIN, SHRT_MAX)
+INTEGER_KERNELS_FOR(char, char, long long, long long, WIDE_BOUND, CHAR_MIN, CHAR_MAX)
+INTEGER_KERNELS_FOR(uint, unsigned int, unsigned long long, long long, WIDE_BOUND, 0, UINT_MAX)
+INTEGER_KERNELS_FOR(ulong, unsigned long, unsigned __int128, __int128, WIDE128_BOUND, 0, ULONG_MAX)
+INTEGER_KERNELS_FOR(ushort, unsigned short, unsigned long long, long long, WIDE_BOUND, 0, USHRT_MAX)
+FLOAT_KERNELS_FOR(float, float)
+FLOAT_KERNELS_FOR(double, double)
+
+static const NUMERIC_KERNELS *kernels_for(const JMAP *self) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return NULL;
+    }
+    switch (self->_preset) {
+        case JMAP_INT_PRESET:    return &kernels_int;
+        case JMAP_LONG_PRESET:   return &kernels_long;
+        case JMAP_SHORT_PRESET:  return &kernels_short;
+        case JMAP_CHAR_PRESET:   return &kernels_char;
+        case JMAP_UINT_PRESET:   return &kernels_uint;
+        case JMAP_ULONG_PRESET:  return &kernels_ulong;
+        case JMAP_USHORT_PRESET: return &kernels_ushort;
+        case JMAP_FLOAT_PRESET:  return &kernels_float;
+        case JMAP_DOUBLE_PRESET: return &kernels_double;
+        default:
+            create_return_error(self, JMAP_INVALID_ARGUMENT, "Numeric functions need a map created with a numeric preset");
+            return NULL;
+    }
+}
+
+static void merge_partial(NUMERIC_PARTIAL *into, const NUMERIC_PARTIAL *part) {
+    if (part->count == 0) return;
+    if (into->count == 0) {
+        *into = *part;
+        return;
+    }
+    into->count += part->count;
+    into->sum += part->sum;
+    if (part->min < into->min) into->min = part->min;
+    if (part->max > into->max) into->max = part->max;
+}
+
+static JMAP_NUMERIC_STATS partial_to_stats(const NUMERIC_PARTIAL *part) {
+    JMAP_NUMERIC_STATS stats = {0};
+    if (part->count == 0) return stats;
+    stats.count = part->count;
+    stats.sum = part->sum;
+    stats.min = part->min;
+    stats.max = part->max;
+    stats.mean = part->sum / (double)part->count;
+    return stats;
+}
+
+// After an in-place update the write-ahead log gets the new value of every entry
+static void log_all_values(JMAP *self) {
+    if (!self->_wal) return;
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (self->keys[i]) map_log_put(self, i);
+    }
+}
+
+static JMAP_NUMERIC_STATS numeric_stats(const JMAP *self) {
+    JMAP_NUMERIC_STATS stats = {0};
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels) return stats;
+
+    NUMERIC_PARTIAL part = {0};
+    kernels->reduce(self, 0, OCCUPANCY_WORDS(self->_capacity), &part);
+    reset_error_trace();
+    return partial_to_stats(&part);
+}
+
+static double numeric_sum(const JMAP *self) {
+    return numeric_stats(self).sum;
+}
+
+static double numeric_min(const JMAP *self) {
+    JMAP_NUMERIC_STATS stats = numeric_stats(self);
+    if (!jmap_last_error_trace.has_error && stats.count == 0)
+        create_return_error(self, JMAP_EMPTY, "JMAP is empty => no minimum");
+    return stats.min;
+}
+
+static double numeric_max(const JMAP *self) {
+    JMAP_NUMERIC_STATS stats = numeric_stats(self);
+    if (!jmap_last_error_trace.has_error && stats.count == 0)
+        create_return_error(self, JMAP_EMPTY, "JMAP is empty => no maximum");
+    return stats.max;
+}
+
+static double numeric_mean(const JMAP *self) {
+    JMAP_NUMERIC_STATS stats = numeric_stats(self);
+    if (!jmap_last_error_trace.has_error && stats.count == 0)
+        create_return_error(self, JMAP_EMPTY, "JMAP is empty => no mean");
+    return stats.mean;
+}
+
+static size_t numeric_count_if(const JMAP *self, JMAP_COMPARISON cmp, double threshold) {
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels) return 0;
+    if (cmp < JMAP_CMP_LT || cmp > JMAP_CMP_NE) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Unknown comparison %d", (int)cmp);
+        return 0;
+    }
+    size_t count = kernels->count_if(self, cmp, threshold);
+    reset_error_trace();
+    return count;
+}
+
+static void numeric_histogram(const JMAP *self, double lo, double hi, size_t *bins, size_t bin_count) {
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels) return;
+    if (!bins || bin_count == 0)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Histogram needs at least one bin");
+    if (!(hi > lo))
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Histogram range must satisfy lo < hi");
+
+    memset(bins, 0, bin_count * sizeof(size_t));
+    kernels->histogram(self, lo, (double)bin_count / (hi - lo), bins, bin_count);
+    reset_error_trace();
+}
+
+static bool check_apply(const JMAP *self, JMAP_APPLY_OP op, double a, double b) {
+    if (op < JMAP_APPLY_SCALE || op > JMAP_APPLY_CLAMP) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Unknown apply operation %d", (int)op);
+        return false;
+    }
+    if (isnan(a) || (op == JMAP_APPLY_CLAMP && isnan(b))) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Apply arguments cannot be NaN");
+        return false;
+    }
+    if (op == JMAP_APPLY_CLAMP && a > b) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Clamp bounds must satisfy a <= b");
+        return false;
+    }
+    return true;
+}
+
+static void numeric_apply(JMAP *self, JMAP_APPLY_OP op, double a, double b) {
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels || !check_apply(self, op, a, b)) return;
+    if (self->_snapshot) snapshot_detach_all(self);
+    kernels->apply(self, 0, OCCUPANCY_WORDS(self->_capacity), op, a, b);
+    log_all_values(self);
+    reset_error_trace();
+}
+
+typedef struct NUMERIC_TASK {
+    JMAP *map;
+    const NUMERIC_KERNELS *kernels;
+    JMAP_APPLY_OP op;
+    double a;
+    double b;
+    pthread_mutex_t lock;           // Guards total
+    NUMERIC_PARTIAL total;
+} NUMERIC_TASK;
+
+// Reduces a range of bitmap words, then merges it into the total
+static void reduce_task(void *ctx, size_t first_word, size_t last_word) {
+    NUMERIC_TASK *task = ctx;
+    NUMERIC_PARTIAL part = {0};
+    task->kernels->reduce(task->map, first_word, last_word, &part);
+    pthread_mutex_lock(&task->lock);
+    merge_partial(&task->total, &part);
+    pthread_mutex_unlock(&task->lock);
+}
+
+static void apply_task(void *ctx, size_t first_word, size_t last_word) {
+    NUMERIC_TASK *task = ctx;
+    task->kernels->apply(task->map, first_word, last_word, task->op, task->a, task->b);
+}
+
+static unsigned thread_count(const JMAP *self, unsigned threads) {
+    threads = parallel_threads(threads);
+    if (self->_capacity < PARALLEL_MIN_CAPACITY) return 1;
+    size_t words = OCCUPANCY_WORDS(self->_capacity);
+    return threads > words ? (unsigned)words : threads;
+}
+
+static JMAP_NUMERIC_STATS numeric_stats_parallel(const JMAP *self, unsigned threads) {
+    JMAP_NUMERIC_STATS stats = {0};
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels) return stats;
+    threads = thread_count(self, threads);
+    if (threads <= 1) return numeric_stats(self);
+
+    // The reduce kernels only read the map
+    NUMERIC_TASK task = { .map = (JMAP*)self, .kernels = kernels, .lock = PTHREAD_MUTEX_INITIALIZER };
+    parallel_for(OCCUPANCY_WORDS(self->_capacity), threads, reduce_task, &task);
+    pthread_mutex_destroy(&task.lock);
+    reset_error_trace();
+    return partial_to_stats(&task.total);
+}
+
+static void numeric_apply_parallel(JMAP *self, JMAP_APPLY_OP op, double a, double b, unsigned threads) {
+    const NUMERIC_KERNELS *kernels = kernels_for(self);
+    if (!kernels || !check_apply(self, op, a, b)) return;
+    if (self->_snapshot) snapshot_detach_all(self);
+    threads = thread_count(self, threads);
+    if (threads <= 1) return numeric_apply(self, op, a, b);
+
+    NUMERIC_TASK task = { .map = self, .kernels = kernels, .op = op, .a = a, .b = b };
+    parallel_for(OCCUPANCY_WORDS(self->_capacity), threads, apply_task, &task);
+    log_all_values(self);
+    reset_error_trace();
+}
+
+JMAP_NUMERIC_INTERFACE jmap_numeric = {
+    .stats = numeric_stats,
+    .sum = numeric_sum,
+    .min = numeric_min,
+    .max = numeric_max,
+    .mean = numeric_mean,
+    .count_if = numeric_count_if,
+    .histogram = numeric_histogram,
+    .apply = numeric_apply,
+    .stats_parallel = numeric_stats_parallel,
+    .apply_parallel = numeric_apply_parallel,
+};
@@ -0,0 +1,430 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Ordered key index: a B+-tree over the keys of the map, in strcmp order.
+ *
+ * Leaves hold pointers to the map's own key strings and are chained in key order, so a scan is one
+ * descent followed by a walk along the leaves. Inner nodes hold copies of their separators, as the
+ * key a separator came from may be removed from the map while the separator stays valid.
+ * Full nodes are split on the way down, so an insertion either fails before changing anything or
+ * succeeds. Removal frees leaves once empty and merges a small leaf into a neighbour when both fit
+ * in half a leaf. Values are found through the hash table: the index only knows the keys.
+ */
+
+#define ORDERED_FANOUT 32                    // Keys per leaf, children per inner node
+
+typedef struct ORDERED_NODE {
+    bool leaf;
+    unsigned count;                          // Keys of a leaf, children of an inner node
+} ORDERED_NODE;
+
+typedef struct ORDERED_LEAF {
+    ORDERED_NODE node;
+    struct ORDERED_LEAF *prev;
+    struct ORDERED_LEAF *next;
+    char *keys[ORDERED_FANOUT];              // Keys of the map, not owned
+} ORDERED_LEAF;
+
+typedef struct ORDERED_INNER {
+    ORDERED_NODE node;
+    char *separators[ORDERED_FANOUT - 1];    // separators[i]: smallest key allowed in children[i + 1]
+    ORDERED_NODE *children[ORDERED_FANOUT];
+} ORDERED_INNER;
+
+struct JMAP_ORDERED_INDEX {
+    ORDERED_NODE *root;                      // An empty leaf when the map is empty
+    ORDERED_LEAF *first;
+};
+
+/* ---------- Memory ---------- */
+
+static void *ordered_alloc(JMAP *map, size_t size) {
+    void *block = allocator_alloc(&map->_allocator, size);
+    if (block) map->_memory.table_bytes += size;
+    return block;
+}
+
+static void ordered_free(JMAP *map, void *block, size_t size) {
+    allocator_free(&map->_allocator, block, size);
+    map->_memory.table_bytes -= size;
+}
+
+static char *separator_dup(JMAP *map, const char *key) {
+    char *copy = ordered_alloc(map, strlen(key) + 1);
+    if (copy) strcpy(copy, key);
+    return copy;
+}
+
+static void separator_free(JMAP *map, char *separator) {
+    ordered_free(map, separator, strlen(separator) + 1);
+}
+
+static ORDERED_LEAF *leaf_create(JMAP *map) {
+    ORDERED_LEAF *leaf = ordered_alloc(map, sizeof(ORDERED_LEAF));
+    if (!leaf) return NULL;
+    leaf->node.leaf = true;
+    leaf->node.count = 0;
+    leaf->prev = leaf->next = NULL;
+    return leaf;
+}
+
+static ORDERED_INNER *inner_create(JMAP *map) {
+    ORDERED_INNER *inner = ordered_alloc(map, sizeof(ORDERED_INNER));
+    if (!inner) return NULL;
+    inner->node.leaf = false;
+    inner->node.count = 0;
+    return inner;
+}
+
+// Frees the subtree of node, except the leaf keep
+static void node_free(JMAP *map, ORDERED_NODE *node, ORDERED_LEAF *keep) {
+    if (node->leaf) {
+        if (node != (ORDERED_NODE*)keep) ordered_free(map, node, sizeof(ORDERED_LEAF));
+        return;
+    }
+    ORDERED_INNER *inner = (ORDERED_INNER*)node;
+    for (unsigned i = 0; i < node->count; i++) {
+        if (i > 0) separator_free(map, inner->separators[i - 1]);
+        node_free(map, inner->children[i], keep);
+    }
+    ordered_free(map, inner, sizeof(ORDERED_INNER));
+}
+
+/* ---------- Search ---------- */
+
+// Child of inner to descend into for key: after every separator <= key
+static unsigned child_for(const ORDERED_INNER *inner, const char *key) {
+    unsigned lo = 0, hi = inner->node.count - 1;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (strcmp(inner->separators[mid], key) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Position of the first key >= key in leaf
+static unsigned lower_bound(const ORDERED_LEAF *leaf, const char *key) {
+    unsigned lo = 0, hi = leaf->node.count;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (strcmp(leaf->keys[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Leaf and position of the first key >= key, NULL if there is none
+static ORDERED_LEAF *seek(const JMAP_ORDERED_INDEX *index, const char *key, unsigned *pos) {
+    const ORDERED_NODE *node = index->root;
+    while (!node->leaf) {
+        const ORDERED_INNER *inner = (const ORDERED_INNER*)node;
+        node = inner->children[child_for(inner, key)];
+    }
+    ORDERED_LEAF *leaf = (ORDERED_LEAF*)node;
+    *pos = lower_bound(leaf, key);
+    // Keys >= key that are not in this leaf start the next non-empty one
+    while (leaf && *pos == leaf->node.count) {
+        leaf = leaf->next;
+        *pos = 0;
+    }
+    return leaf;
+}
+
+/* ---------- Insertion ---------- */
+
+// Splits the full child i of inner in two. Nothing changes if memory runs out.
+static bool split_child(JMAP *map, ORDERED_INNER *inner, unsigned i) {
+    ORDERED_NODE *child = inner->children[i];
+    unsigned half = ORDERED_FANOUT / 2;
+    ORDERED_NODE *right;
+    char *separator;
+    if (child->leaf) {
+        ORDERED_LEAF *left = (ORDERED_LEAF*)child;
+        ORDERED_LEAF *fresh = leaf_create(map);
+        separator = fresh ? separator_dup(map, left->keys[half]) : NULL;
+        if (!separator) {
+            if (fresh) ordered_free(map, fresh, sizeof(ORDERED_LEAF));
+            return false;
+        }
+        memcpy(fresh->keys, left->keys + half, (ORDERED_FANOUT - half) * sizeof(char*));
+        fresh->node.count = ORDERED_FANOUT - half;
+        left->node.count = half;
+        fresh->next = left->next;
+        fresh->prev = left;
+        if (left->next) left->next->prev = fresh;
+        left->next = fresh;
+        right = &fresh->node;
+    } else {
+        // The middle separator moves up, each half keeps half of the children
+        ORDERED_INNER *left = (ORDERED_INNER*)child;
+        ORDERED_INNER *fresh = inner_create(map);
+        if (!fresh) return false;
+        separator = left->separators[half - 1];
+        memcpy(fresh->children, left->children + half, (ORDERED_FANOUT - half) * sizeof(ORDERED_NODE*));
+        memcpy(fresh->separators, left->separators + half, (ORDERED_FANOUT - half - 1) * sizeof(char*));
+        fresh->node.count = ORDERED_FANOUT - half;
+        left->node.count = half;
+        right = &fresh->node;
+    }
+    unsigned count = inner->node.count;
+    memmove(inner->children + i + 2, inner->children + i + 1, (count - i - 1) * sizeof(ORDERED_NODE*));
+    memmove(inner->separators + i + 1, inner->separators + i, (count - i - 1) * sizeof(char*));
+    inner->children[i + 1] = right;
+    inner->separators[i] = separator;
+    inner->node.count = count + 1;
+    return true;
+}
+
+static inline bool node_full(const ORDERED_NODE *node) {
+    return node->count == ORDERED_FANOUT;
+}
+
+bool ordered_insert(JMAP *map, char *key) {
+    JMAP_ORDERED_INDEX *index = map->_ordered;
+    if (node_full(index->root)) {
+        ORDERED_INNER *root = inner_create(map);
+        if (!root) return false;
+        root->children[0] = index->root;
+        root->node.count = 1;
+        if (!split_child(map, root, 0)) {
+            ordered_free(map, root, sizeof(ORDERED_INNER));
+            return false;
+        }
+        index->root = &root->node;
+    }
+    ORDERED_NODE *node = index->root;
+    while (!node->leaf) {
+        ORDERED_INNER *inner = (ORDERED_INNER*)node;
+        unsigned i = child_for(inner, key);
+        if (node_full(inner->children[i])) {
+            if (!split_child(map, inner, i)) return false;
+            if (strcmp(inner->separators[i], key) <= 0) i++;
+        }
+        node = inner->children[i];
+    }
+    ORDERED_LEAF *leaf = (ORDERED_LEAF*)node;
+    unsigned pos = lower_bound(leaf, key);
+    memmove(leaf->keys + pos + 1, leaf->keys + pos, (leaf->node.count - pos) * sizeof(char*));
+    leaf->keys[pos] = key;
+    leaf->node.count++;
+    return true;
+}
+
+/* ---------- Removal ---------- */
+
+static void leaf_unlink(JMAP_ORDERED_INDEX *index, ORDERED_LEAF *leaf) {
+    if (leaf->prev) leaf->prev->next = leaf->next;
+    else index->first = leaf->next;
+    if (leaf->next) leaf->next->prev = leaf->prev;
+}
+
+// Removes child i of inner (already emptied or merged away) with the separator in front of it
+static void remove_child(JMAP *map, ORDERED_INNER *inner, unsigned i) {
+    unsigned count = inner->node.count;
+    // Child 0 has no separator in front of it: the one after it goes, child 1 takes its place
+    unsigned s = i > 0 ? i - 1 : 0;
+    if (count > 1) separator_free(map, inner->separators[s]);
+    memmove(inner->separators + s, inner->separators + s + 1, (count > 1 ? count - 2 - s : 0) * sizeof(char*));
+    memmove(inner->children + i, inner->children + i + 1, (count - i - 1) * sizeof(ORDERED_NODE*));
+    inner->node.count = count - 1;
+}
+
+// Merges leaf i of inner into a neighbour when both fit in half a leaf. Returns true if leaf i went away.
+static bool merge_leaf(JMAP *map, JMAP_ORDERED_INDEX *index, ORDERED_INNER *inner, unsigned i) {
+    ORDERED_LEAF *leaf = (ORDERED_LEAF*)inner->children[i];
+    if (leaf->node.count >= ORDERED_FANOUT / 4) return false;
+    for (int side = -1; side <= 1; side += 2) {
+        if ((side < 0 && i == 0) || (side > 0 && i + 1 >= inner->node.count)) continue;
+        unsigned l = side < 0 ? i - 1 : i, r = l + 1;
+        ORDERED_LEAF *left = (ORDERED_LEAF*)inner->children[l], *right = (ORDERED_LEAF*)inner->children[r];
+        if (left->node.count + right->node.count > ORDERED_FANOUT / 2) continue;
+        memcpy(left->keys + left->node.count, right->keys, right->node.count * sizeof(char*));
+        left->node.count += right->node.count;
+        leaf_unlink(index, right);
+        ordered_free(map, right, sizeof(ORDERED_LEAF));
+        remove_child(map, inner, r);
+        return true;
+    }
+    return false;
+}
+
+// Removes key from the subtree of node. Returns true if node is left empty.
+static bool remove_from(JMAP *map, JMAP_ORDERED_INDEX *index, ORDERED_NODE *node, const char *key) {
+    if (node->leaf) {
+        ORDERED_LEAF *leaf = (ORDERED_LEAF*)node;
+        unsigned pos = lower_bound(leaf, key);
+        if (pos == leaf->node.count || leaf->keys[pos] != key) return false;
+        memmove(leaf->keys + pos, leaf->keys + pos + 1, (leaf->node.count - pos - 1) * sizeof(char*));
+        leaf->node.count--;
+        // The last leaf of the tree stays, so that the index is never left without one
+        return leaf->node.count == 0 && (leaf->prev || leaf->next);
+    }
+    ORDERED_INNER *inner = (ORDERED_INNER*)node;
+    unsigned i = child_for(inner, key);
+    ORDERED_NODE *child = inner->children[i];
+    if (remove_from(map, index, child, key)) {
+        if (child->leaf) {
+            leaf_unlink(index, (ORDERED_LEAF*)child);
+            ordered_free(map, child, sizeof(ORDERED_LEAF));
+        } else {
+            ordered_free(map, child, sizeof(ORDERED_INNER));
+        }
+        remove_child(map, inner, i);
+    } else if (child->leaf) {
+        merge_leaf(map, index, inner, i);
+    }
+    return inner->node.count == 0;
+}
+
+void ordered_remove(JMAP *map, const char *key) {
+    JMAP_ORDERED_INDEX *index = map->_ordered;
+    remove_from(map, index, index->root, key);
+    // A root left with a single child hands over to it
+    while (!index->root->leaf && index->root->count == 1) {
+        ORDERED_INNER *inner = (ORDERED_INNER*)index->root;
+        index->root = inner->children[0];
+        ordered_free(map, inner, sizeof(ORDERED_INNER));
+    }
+}
+
+// Points the index at new_key instead of old_key, an equal string at another address
+void ordered_replace_key(JMAP *map, const char *old_key, char *new_key) {
+    unsigned pos;
+    ORDERED_LEAF *leaf = seek(map->_ordered, old_key, &pos);
+    if (leaf && leaf->keys[pos] == old_key) leaf->keys[pos] = new_key;
+}
+
+// Empties the index. The first leaf is kept, so that clearing never allocates.
+void ordered_clear(JMAP *map) {
+    JMAP_ORDERED_INDEX *index = map->_ordered;
+    ORDERED_LEAF *first = index->first;
+    node_free(map, index->root, first);
+    first->node.count = 0;
+    first->next = NULL;
+    index->root = &first->node;
+}
+
+void ordered_release(JMAP *map) {
+    JMAP_ORDERED_INDEX *index = map->_ordered;
+    if (!index) return;
+    node_free(map, index->root, NULL);
+    map->_ordered = NULL;
+    ordered_free(map, index, sizeof(JMAP_ORDERED_INDEX));
+}
+
+/* ---------- Interface ---------- */
+
+static void ordered_enable(JMAP *self) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_ordered)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Ordered index is already enabled");
+    JMAP_ORDERED_INDEX *index = ordered_alloc(self, sizeof(JMAP_ORDERED_INDEX));
+    ORDERED_LEAF *leaf = index ? leaf_create(self) : NULL;
+    if (!leaf) {
+        if (index) ordered_free(self, index, sizeof(JMAP_ORDERED_INDEX));
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for ordered index failed");
+    }
+    index->root = &leaf->node;
+    index->first = leaf;
+    self->_ordered = index;
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (self->keys[i] && !ordered_insert(self, self->keys[i])) {
+            ordered_release(self);
+            return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for ordered index failed");
+        }
+    }
+    reset_error_trace();
+}
+
+static void ordered_disable(JMAP *self) {
+    if (!self->_ordered)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Ordered index is not enabled");
+    ordered_release(self);
+    reset_error_trace();
+}
+
+static bool ordered_check(const JMAP *self) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return false;
+    }
+    if (!self->_ordered) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Ordered index is not enabled, see jmap_ordered.enable");
+        return false;
+    }
+    return true;
+}
+
+// Value of a key of the index, through the hash table. NULL if the entry has expired.
+static void *value_of(const JMAP *self, const char *key) {
+    size_t mask = self->_capacity - 1;
+    size_t idx = map_stored_key_index(self, key);
+    while (self->keys[idx] != key) idx = (idx + 1) & mask;
+    if (self->_ttl && ttl_is_expired(self->_ttl, idx)) return NULL;
+    return (char*)self->data + idx * self->_elem_size;
+}
+
+/*
+ * Calls callback for the keys from lo (inclusive, NULL for the first key) while they are below hi
+ * (exclusive, NULL for no bound) and start with prefix (NULL for any). Returns the number of calls.
+ */
+static size_t scan(const JMAP *self, const char *lo, const char *hi, const char *prefix,
+                   void (*callback)(const char *key, void *value, const void *ctx), const void *ctx) {
+    const JMAP_ORDERED_INDEX *index = self->_ordered;
+    size_t prefix_length = prefix ? strlen(prefix) : 0;
+    unsigned pos = 0;
+    ORDERED_LEAF *leaf = lo ? seek(index, lo, &pos) : index->first;
+    size_t calls = 0;
+    for (; leaf; leaf = leaf->next, pos = 0) {
+        for (; pos < leaf->node.count; pos++) {
+            const char *key = leaf->keys[pos];
+            if (hi && strcmp(key, hi) >= 0) return calls;
+            if (prefix && strncmp(key, prefix, prefix_length) != 0) return calls;
+            void *value = value_of(self, key);
+            if (!value) continue;
+            callback(key, value, ctx);
+            calls++;
+        }
+    }
+    return calls;
+}
+
+static void ordered_for_each(const JMAP *self, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx) {
+    if (!ordered_check(self)) return;
+    if (!callback) return create_return_error(self, JMAP_INVALID_ARGUMENT, "Callback cannot be NULL");
+    scan(self, NULL, NULL, NULL, callback, ctx);
+    reset_error_trace();
+}
+
+static size_t ordered_prefix_scan(const JMAP *self, const char *prefix, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx) {
+    if (!ordered_check(self)) return 0;
+    if (!prefix || !callback) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Prefix and callback cannot be NULL");
+        return 0;
+    }
+    size_t calls = scan(self, prefix, NULL, prefix, callback, ctx);
+    reset_error_trace();
+    return calls;
+}
+
+static size_t ordered_range_scan(const JMAP *self, const char *lo, const char *hi, void (*callback)(const char *key, void *value, const void *ctx), const void *ctx) {
+    if (!ordered_check(self)) return 0;
+    if (!callback) {
+        create_return_error(self, JMAP_INVALID_ARGUMENT, "Callback cannot be NULL");
+        return 0;
+    }
+    size_t calls = scan(self, lo, hi, NULL, callback, ctx);
+    reset_error_trace();
+    return calls;
+}
+
+JMAP_ORDERED_INTERFACE jmap_ordered = {
+    .enable = ordered_enable,
+    .disable = ordered_disable,
+    .for_each = ordered_for_each,
+    .prefix_scan = ordered_prefix_scan,
+    .range_scan = ordered_range_scan,
+};
@@ -0,0 +1,660 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Persistent map: a hash array mapped trie with compact (CHAMP) nodes.
+ *
+ * Each node consumes 5 bits of the 32-bit key hash. A node stores two bitmaps over its 32 branches:
+ * datamap for branches holding an entry, nodemap for branches holding a child node. Its slot array
+ * only has the branches in use, entries first then children, and the slot of a branch is the popcount
+ * of the bitmap below its bit. Keys whose 32 hash bits are all equal end up in a collision node.
+ *
+ * Nodes and entries are reference counted and never change once shared, so an update copies the path
+ * from the root to the key (O(log32 n) nodes) and shares everything else with the previous version.
+ * A transient stamps the nodes it creates with its own edit token and updates those in place.
+ * Memory comes from the C library, as versions are usually handed to other threads.
+ */
+
+#define HAMT_BITS 5
+#define HAMT_HASH_BITS 32
+
+typedef struct HAMT_ENTRY {
+    atomic_size_t refs;
+    uint32_t hash;
+    char *key;
+    _Alignas(max_align_t) unsigned char value[];
+} HAMT_ENTRY;
+
+typedef struct HAMT_NODE {
+    atomic_size_t refs;
+    uint64_t edit;            // Transient allowed to update the node in place, 0 if none
+    uint32_t datamap;         // Branches holding an entry. Collision node: number of entries.
+    uint32_t nodemap;         // Branches holding a child node
+    bool collision;
+    void *slots[];            // Entries (in branch order), then children (in branch order)
+} HAMT_NODE;
+
+// Value type of a map, shared by its versions and transients
+typedef struct HAMT_TYPE {
+    size_t elem_size;
+    JMAP_DATA_TYPE data_type;
+    JMAP_USER_CALLBACK_IMPLEMENTATION user_callbacks;
+} HAMT_TYPE;
+
+struct JMAP_PERSISTENT {
+    atomic_size_t refs;
+    HAMT_NODE *root;          // NULL when empty
+    size_t length;
+    HAMT_TYPE type;
+};
+
+struct JMAP_TRANSIENT {
+    HAMT_NODE *root;
+    size_t length;
+    HAMT_TYPE type;
+    uint64_t edit;
+};
+
+static atomic_uint_fast64_t next_edit = 1;
+
+static inline uint32_t branch_bit(uint32_t hash, unsigned shift) {
+    return (uint32_t)1 << ((hash >> shift) & 31);
+}
+
+static inline unsigned data_count(const HAMT_NODE *node) {
+    return node->collision ? node->datamap : (unsigned)__builtin_popcount(node->datamap);
+}
+
+static inline unsigned slot_count(const HAMT_NODE *node) {
+    return data_count(node) + (unsigned)__builtin_popcount(node->nodemap);
+}
+
+static inline unsigned data_index(const HAMT_NODE *node, uint32_t bit) {
+    return (unsigned)__builtin_popcount(node->datamap & (bit - 1));
+}
+
+static inline unsigned child_index(const HAMT_NODE *node, uint32_t bit) {
+    return data_count(node) + (unsigned)__builtin_popcount(node->nodemap & (bit - 1));
+}
+
+static inline bool node_editable(const HAMT_NODE *node, uint64_t edit) {
+    return edit && node->edit == edit;
+}
+
+/* ---------- Reference counting ---------- */
+
+static inline void *retain(void *object) {
+    // refs is the first member of both entries and nodes
+    atomic_fetch_add_explicit((atomic_size_t*)object, 1, memory_order_relaxed);
+    return object;
+}
+
+static inline bool drop_ref(void *object) {
+    if (atomic_fetch_sub_explicit((atomic_size_t*)object, 1, memory_order_release) != 1) return false;
+    atomic_thread_fence(memory_order_acquire);
+    return true;
+}
+
+static void entry_release(const HAMT_TYPE *type, HAMT_ENTRY *entry) {
+    if (!drop_ref(entry)) return;
+    free(entry->key);
+    void **value = (void**)entry->value;
+    if (type->data_type == JMAP_TYPE_POINTER && *value) free(*value);
+    free(entry);
+}
+
+static void node_release(const HAMT_TYPE *type, HAMT_NODE *node) {
+    if (!node || !drop_ref(node)) return;
+    unsigned entries = data_count(node), slots = slot_count(node);
+    for (unsigned i = 0; i < entries; i++) entry_release(type, node->slots[i]);
+    for (unsigned i = entries; i < slots; i++) node_release(type, node->slots[i]);
+    free(node);
+}
+
+/* ---------- Nodes ---------- */
+
+static HAMT_ENTRY *entry_create(const HAMT_TYPE *type, const char *key, uint32_t hash, const void *value) {
+    HAMT_ENTRY *entry = malloc(sizeof(HAMT_ENTRY) + type->elem_size);
+    if (!entry) return NULL;
+    if (!(entry->key = strdup(key))) {
+        free(entry);
+        return NULL;
+    }
+    JMAP layout = {0};
+    layout._elem_size = type->elem_size;
+    layout._data_type = type->data_type;
+    layout.user_callbacks = type->user_callbacks;
+    memcpy_elem(&layout, entry->value, value, 1);
+    atomic_init(&entry->refs, 1);
+    entry->hash = hash;
+    return entry;
+}
+
+static HAMT_NODE *node_alloc(unsigned slots, uint64_t edit) {
+    HAMT_NODE *node = malloc(sizeof(HAMT_NODE) + slots * sizeof(void*));
+    if (!node) return NULL;
+    atomic_init(&node->refs, 1);
+    node->edit = edit;
+    node->datamap = 0;
+    node->nodemap = 0;
+    node->collision = false;
+    return node;
+}
+
+/*
+ * Builds a node with the given bitmaps from node. The branch `bit` takes data_slot or node_slot
+ * (owned references), every other branch comes from node. The branches of node left out are dropped.
+ * An editable node hands its slots over and is emptied, a shared one is left as it is.
+ */
+static HAMT_NODE *node_rebuild(const HAMT_TYPE *type, HAMT_NODE *node, uint64_t edit, uint32_t datamap, uint32_t nodemap,
+                               uint32_t bit, HAMT_ENTRY *data_slot, HAMT_NODE *node_slot) {
+    HAMT_NODE *out = node_alloc((unsigned)(__builtin_popcount(datamap) + __builtin_popcount(nodemap)), edit);
+    if (!out) return NULL;
+    bool move = node_editable(node, edit);
+    out->datamap = datamap;
+    out->nodemap = nodemap;
+    unsigned n = 0;
+    for (uint32_t map = datamap; map; map &= map - 1) {
+        uint32_t b = map & -map;
+        if (b == bit && data_slot) out->slots[n++] = data_slot;
+        else out->slots[n++] = move ? node->slots[data_index(node, b)] : retain(node->slots[data_index(node, b)]);
+    }
+    for (uint32_t map = nodemap; map; map &= map - 1) {
+        uint32_t b = map & -map;
+        if (b == bit && node_slot) out->slots[n++] = node_slot;
+        else out->slots[n++] = move ? node->slots[child_index(node, b)] : retain(node->slots[child_index(node, b)]);
+    }
+    if (move) {
+        for (uint32_t map = node->datamap & ~datamap; map; map &= map - 1)
+            entry_release(type, node->slots[data_index(node, map & -map)]);
+        if (data_slot && (node->datamap & bit)) entry_release(type, node->slots[data_index(node, bit)]);
+        for (uint32_t map = node->nodemap & ~nodemap; map; map &= map - 1)
+            node_release(type, node->slots[child_index(node, map & -map)]);
+        if (node_slot && (node->nodemap & bit)) node_release(type, node->slots[child_index(node, bit)]);
+        node->datamap = 0;
+        node->nodemap = 0;
+    }
+    return out;
+}
+
+// Replaces the entry or child of branch bit, in place when the node is editable
+static HAMT_NODE *node_set(const HAMT_TYPE *type, HAMT_NODE *node, uint64_t edit, uint32_t bit, HAMT_ENTRY *data_slot, HAMT_NODE *node_slot) {
+    if (!node_editable(node, edit))
+        return node_rebuild(type, node, edit, node->datamap, node->nodemap, bit, data_slot, node_slot);
+    if (data_slot) {
+        unsigned i = data_index(node, bit);
+        entry_release(type, node->slots[i]);
+        node->slots[i] = data_slot;
+    } else {
+        unsigned i = child_index(node, bit);
+        node_release(type, node->slots[i]);
+        node->slots[i] = node_slot;
+    }
+    return node;
+}
+
+// Frees the nodes made by node_pair, leaving their entries to the caller
+static void pair_free(HAMT_NODE *node) {
+    if (node && node->nodemap) pair_free(node->slots[0]);
+    free(node);
+}
+
+// Node holding two entries whose hashes agree below shift
+static HAMT_NODE *node_pair(HAMT_ENTRY *a, HAMT_ENTRY *b, unsigned shift, uint64_t edit) {
+    if (shift >= HAMT_HASH_BITS) {
+        HAMT_NODE *node = node_alloc(2, edit);
+        if (!node) return NULL;
+        node->collision = true;
+        node->datamap = 2;
+        node->slots[0] = a;
+        node->slots[1] = b;
+        return node;
+    }
+    uint32_t bit_a = branch_bit(a->hash, shift), bit_b = branch_bit(b->hash, shift);
+    if (bit_a == bit_b) {
+        HAMT_NODE *child = node_pair(a, b, shift + HAMT_BITS, edit);
+        HAMT_NODE *node = child ? node_alloc(1, edit) : NULL;
+        if (!node) {
+            pair_free(child);
+            return NULL;
+        }
+        node->nodemap = bit_a;
+        node->slots[0] = child;
+        return node;
+    }
+    HAMT_NODE *node = node_alloc(2, edit);
+    if (!node) return NULL;
+    node->datamap = bit_a | bit_b;
+    node->slots[0] = bit_a < bit_b ? a : b;
+    node->slots[1] = bit_a < bit_b ? b : a;
+    return node;
+}
+
+/* ---------- Lookup ---------- */
+
+static HAMT_ENTRY *node_find(const HAMT_NODE *node, uint32_t hash, const char *key) {
+    for (unsigned shift = 0; node; shift += HAMT_BITS) {
+        if (node->collision) {
+            for (unsigned i = 0; i < node->datamap; i++) {
+                HAMT_ENTRY *entry = node->slots[i];
+                if (strcmp(entry->key, key) == 0) return entry;
+            }
+            return NULL;
+        }
+        uint32_t bit = branch_bit(hash, shift);
+        if (node->datamap & bit) {
+            HAMT_ENTRY *entry = node->slots[data_index(node, bit)];
+            return entry->hash == hash && strcmp(entry->key, key) == 0 ? entry : NULL;
+        }
+        if (!(node->nodemap & bit)) return NULL;
+        node = node->slots[child_index(node, bit)];
+    }
+    return NULL;
+}
+
+/* ---------- Update ---------- */
+
+/*
+ * node_put and node_remove return the node to store in place of node: node itself when it was updated
+ * in place (or left unchanged), otherwise a new owned reference. NULL means out of memory, with
+ * nothing changed that a version can see. node_put takes the reference to entry, even when it fails.
+ */
+
+static HAMT_NODE *collision_put(const HAMT_TYPE *type, HAMT_NODE *node, HAMT_ENTRY *entry, uint64_t edit, bool *added) {
+    unsigned count = node->datamap, found = count;
+    for (unsigned i = 0; i < count && found == count; i++) {
+        if (strcmp(((HAMT_ENTRY*)node->slots[i])->key, entry->key) == 0) found = i;
+    }
+    *added = found == count;
+    bool move = node_editable(node, edit);
+    if (!*added && move) {
+        entry_release(type, node->slots[found]);
+        node->slots[found] = entry;
+        return node;
+    }
+    HAMT_NODE *out = node_alloc(count + *added, edit);
+    if (!out) {
+        entry_release(type, entry);
+        return NULL;
+    }
+    out->collision = true;
+    out->datamap = count + *added;
+    for (unsigned i = 0; i < count; i++) {
+        if (i == found) out->slots[i] = entry;
+        else out->slots[i] = move ? node->slots[i] : retain(node->slots[i]);
+    }
+    if (*added) out->slots[count] = entry;
+    if (move) node->datamap = 0;
+    return out;
+}
+
+static HAMT_NODE *node_put(const HAMT_TYPE *type, HAMT_NODE *node, unsigned shift, HAMT_ENTRY *entry, uint64_t edit, bool *added) {
+    if (node->collision) return collision_put(type, node, entry, edit, added);
+    uint32_t bit = branch_bit(entry->hash, shift);
+    if (node->datamap & bit) {
+        HAMT_ENTRY *current = node->slots[data_index(node, bit)];
+        if (current->hash == entry->hash && strcmp(current->key, entry->key) == 0) {
+            *added = false;
+            HAMT_NODE *out = node_set(type, node, edit, bit, entry, NULL);
+            if (!out) entry_release(type, entry);
+            return out;
+        }
+        // Two keys on the same branch: push both one level down
+        *added = true;
+        HAMT_NODE *child = node_pair(retain(current), entry, shift + HAMT_BITS, edit);
+        HAMT_NODE *out = child ? node_rebuild(type, node, edit, node->datamap & ~bit, node->nodemap | bit, bit, NULL, child) : NULL;
+        if (!out) {
+            pair_free(child);
+            drop_ref(current);
+            entry_release(type, entry);
+        }
+        return out;
+    }
+    if (node->nodemap & bit) {
+        HAMT_NODE *child = node->slots[child_index(node, bit)];
+        HAMT_NODE *updated = node_put(type, child, shift + HAMT_BITS, entry, edit, added);
+        if (!updated || updated == child) return updated ? node : NULL;
+        // An editable node is updated in place, so updated is never a moved-out editable child here
+        HAMT_NODE *out = node_set(type, node, edit, bit, NULL, updated);
+        if (!out) node_release(type, updated);
+        return out;
+    }
+    *added = true;
+    HAMT_NODE *out = node_rebuild(type, node, edit, node->datamap | bit, node->nodemap, bit, entry, NULL);
+    if (!out) entry_release(type, entry);
+    return out;
+}
+
+static HAMT_NODE *collision_remove(const HAMT_TYPE *type, HAMT_NODE *node, const char *key, uint64_t edit, bool *removed) {
+    unsigned count = node->datamap, found = count;
+    for (unsigned i = 0; i < count && found == count; i++) {
+        if (strcmp(((HAMT_ENTRY*)node->slots[i])->key, key) == 0) found = i;
+    }
+    if (found == count) return node;
+    *removed = true;
+    bool move = node_editable(node, edit);
+    HAMT_NODE *out = node_alloc(count - 1, edit);
+    if (!out) return NULL;
+    out->collision = true;
+    out->datamap = count - 1;
+    for (unsigned i = 0, n = 0; i < count; i++) {
+        if (i != found) out->slots[n++] = move ? node->slots[i] : retain(node->slots[i]);
+    }
+    if (move) {
+        entry_release(type, node->slots[found]);
+        node->datamap = 0;
+    }
+    return out;
+}
+
+static HAMT_NODE *node_remove(const HAMT_TYPE *type, HAMT_NODE *node, unsigned shift, uint32_t hash, const char *key, uint64_t edit, bool *removed) {
+    if (node->collision) return collision_remove(type, node, key, edit, removed);
+    uint32_t bit = branch_bit(hash, shift);
+    if (node->datamap & bit) {
+        HAMT_ENTRY *current = node->slots[data_index(node, bit)];
+        if (current->hash != hash || strcmp(current->key, key) != 0) return node;
+        *removed = true;
+        return node_rebuild(type, node, edit, node->datamap & ~bit, node->nodemap, bit, NULL, NULL);
+    }
+    if (!(node->nodemap & bit)) return node;
+
+    HAMT_NODE *child = node->slots[child_index(node, bit)];
+    HAMT_NODE *updated = node_remove(type, child, shift + HAMT_BITS, hash, key, edit, removed);
+    if (!updated) return NULL;
+    // Updated in place: its slot count did not change, there is nothing to fold
+    if (!*removed || updated == child) return node;
+    HAMT_NODE *out = NULL;
+    if (slot_count(updated) == 0) {
+        out = node_rebuild(type, node, edit, node->datamap, node->nodemap & ~bit, bit, NULL, NULL);
+    } else if (data_count(updated) == 1 && updated->nodemap == 0) {
+        // A child left with a single entry is folded into this node
+        HAMT_ENTRY *last = retain(updated->slots[0]);
+        out = node_rebuild(type, node, edit, node->datamap | bit, node->nodemap & ~bit, bit, last, NULL);
+        if (!out) drop_ref(last);
+    }
+    if (out) {
+        node_release(type, updated);
+        return out;
+    }
+    // Also when folding ran out of memory: an editable child may have been moved into updated
+    out = node_set(type, node, edit, bit, NULL, updated);
+    if (!out) node_release(type, updated);
+    return out;
+}
+
+// node_put from the root, which is NULL in an empty map
+static HAMT_NODE *tree_put(const HAMT_TYPE *type, HAMT_NODE *root, HAMT_ENTRY *entry, uint64_t edit, bool *added) {
+    if (root) return node_put(type, root, 0, entry, edit, added);
+    if (!(root = node_alloc(1, edit))) {
+        entry_release(type, entry);
+        return NULL;
+    }
+    root->datamap = branch_bit(entry->hash, 0);
+    root->slots[0] = entry;
+    return root;
+}
+
+/* ---------- Versions ---------- */
+
+static void hamt_type_from(HAMT_TYPE *type, size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+    type->elem_size = elem_size;
+    type->data_type = data_type;
+    type->user_callbacks = imp;
+}
+
+static JMAP_PERSISTENT *version_create(const HAMT_TYPE *type, HAMT_NODE *root, size_t length) {
+    JMAP_PERSISTENT *version = malloc(sizeof(JMAP_PERSISTENT));
+    if (!version) return NULL;
+    atomic_init(&version->refs, 1);
+    version->root = root;
+    version->length = length;
+    version->type = *type;
+    return version;
+}
+
+static JMAP_PERSISTENT *persistent_empty(size_t elem_size, JMAP_DATA_TYPE data_type, JMAP_USER_CALLBACK_IMPLEMENTATION imp) {
+    if (elem_size == 0) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Element size cannot be 0");
+        return NULL;
+    }
+    if (data_type == JMAP_TYPE_POINTER && elem_size != sizeof(void*)) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Pointer elements must be %zu bytes", sizeof(void*));
+        return NULL;
+    }
+    HAMT_TYPE type;
+    hamt_type_from(&type, elem_size, data_type, imp);
+    JMAP_PERSISTENT *version = version_create(&type, NULL, 0);
+    if (!version) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for persistent map failed");
+        return NULL;
+    }
+    reset_error_trace();
+    return version;
+}
+
+static JMAP_PERSISTENT *persistent_empty_preset(JMAP_TYPE_PRESET preset) {
+    if (preset == JMAP_POOLED_STRING_PRESET) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Persistent maps do not support value pools, use JMAP_STRING_PRESET");
+        return NULL;
+    }
+    // The presets of jmap.init_preset, without their table
+    JMAP map = jmap.init_preset(preset);
+    if (jmap_last_error_trace.has_error) return NULL;
+    HAMT_TYPE type;
+    hamt_type_from(&type, map._elem_size, map._data_type, map.user_callbacks);
+    jmap.free(&map);
+    return persistent_empty(type.elem_size, type.data_type, type.user_callbacks);
+}
+
+static void persistent_release(JMAP_PERSISTENT *self) {
+    if (!self || !drop_ref(self)) return;
+    node_release(&self->type, self->root);
+    free(self);
+}
+
+static JMAP_PERSISTENT *persistent_retain(JMAP_PERSISTENT *self) {
+    return self ? retain(self) : NULL;
+}
+
+static const void *persistent_get(const JMAP_PERSISTENT *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version and key cannot be NULL");
+        return NULL;
+    }
+    HAMT_ENTRY *entry = node_find(self->root, key_hash(key), key);
+    if (!entry) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+        return NULL;
+    }
+    reset_error_trace();
+    return entry->value;
+}
+
+static bool persistent_contains_key(const JMAP_PERSISTENT *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version and key cannot be NULL");
+        return false;
+    }
+    bool found = node_find(self->root, key_hash(key), key) != NULL;
+    reset_error_trace();
+    return found;
+}
+
+static JMAP_PERSISTENT *persistent_put(const JMAP_PERSISTENT *self, const char *key, const void *value) {
+    if (!self || !key || !value) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version, key and value cannot be NULL");
+        return NULL;
+    }
+    HAMT_ENTRY *entry = entry_create(&self->type, key, key_hash(key), value);
+    bool added = true;
+    HAMT_NODE *root = entry ? tree_put(&self->type, self->root, entry, 0, &added) : NULL;
+    JMAP_PERSISTENT *version = root ? version_create(&self->type, root, self->length + added) : NULL;
+    if (!version) {
+        node_release(&self->type, root);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for new version failed");
+        return NULL;
+    }
+    reset_error_trace();
+    return version;
+}
+
+static JMAP_PERSISTENT *persistent_remove(const JMAP_PERSISTENT *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version and key cannot be NULL");
+        return NULL;
+    }
+    bool removed = false;
+    HAMT_NODE *root = self->root ? node_remove(&self->type, self->root, 0, key_hash(key), key, 0, &removed) : NULL;
+    if (self->root && !root) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for new version failed");
+        return NULL;
+    }
+    if (!removed) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+        return NULL;
+    }
+    if (slot_count(root) == 0) {
+        node_release(&self->type, root);
+        root = NULL;
+    }
+    JMAP_PERSISTENT *version = version_create(&self->type, root, self->length - 1);
+    if (!version) {
+        node_release(&self->type, root);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for new version failed");
+        return NULL;
+    }
+    reset_error_trace();
+    return version;
+}
+
+static size_t persistent_length(const JMAP_PERSISTENT *self) {
+    return self ? self->length : 0;
+}
+
+static void node_for_each(const HAMT_NODE *node, void (*callback)(const char *key, const void *value, void *ctx), void *ctx) {
+    unsigned entries = data_count(node), slots = slot_count(node);
+    for (unsigned i = 0; i < entries; i++) {
+        const HAMT_ENTRY *entry = node->slots[i];
+        callback(entry->key, entry->value, ctx);
+    }
+    for (unsigned i = entries; i < slots; i++) node_for_each(node->slots[i], callback, ctx);
+}
+
+static void persistent_for_each(const JMAP_PERSISTENT *self, void (*callback)(const char *key, const void *value, void *ctx), void *ctx) {
+    if (!self || !callback)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version and callback cannot be NULL");
+    if (self->root) node_for_each(self->root, callback, ctx);
+}
+
+/* ---------- Transients ---------- */
+
+static JMAP_TRANSIENT *persistent_transient(const JMAP_PERSISTENT *self) {
+    if (!self) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Version cannot be NULL");
+        return NULL;
+    }
+    JMAP_TRANSIENT *transient = malloc(sizeof(JMAP_TRANSIENT));
+    if (!transient) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for transient failed");
+        return NULL;
+    }
+    transient->root = self->root ? retain(self->root) : NULL;
+    transient->length = self->length;
+    transient->type = self->type;
+    transient->edit = atomic_fetch_add(&next_edit, 1);
+    reset_error_trace();
+    return transient;
+}
+
+// Stores the updated root of the transient, releasing the one it replaces
+static void transient_set_root(JMAP_TRANSIENT *self, HAMT_NODE *root) {
+    if (root == self->root) return;
+    node_release(&self->type, self->root);
+    self->root = root;
+}
+
+static void transient_put(JMAP_TRANSIENT *self, const char *key, const void *value) {
+    if (!self || !key || !value)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Transient, key and value cannot be NULL");
+    HAMT_ENTRY *entry = entry_create(&self->type, key, key_hash(key), value);
+    if (!entry) return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for entry failed");
+    bool added = true;
+    HAMT_NODE *root = tree_put(&self->type, self->root, entry, self->edit, &added);
+    if (!root) return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for node failed");
+    transient_set_root(self, root);
+    self->length += added;
+    reset_error_trace();
+}
+
+static void transient_remove(JMAP_TRANSIENT *self, const char *key) {
+    if (!self || !key)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Transient and key cannot be NULL");
+    bool removed = false;
+    HAMT_NODE *root = self->root ? node_remove(&self->type, self->root, 0, key_hash(key), key, self->edit, &removed) : NULL;
+    if (self->root && !root) return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for node failed");
+    if (!removed) return create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+    transient_set_root(self, root);
+    if (slot_count(self->root) == 0) {
+        node_release(&self->type, self->root);
+        self->root = NULL;
+    }
+    self->length--;
+    reset_error_trace();
+}
+
+static const void *transient_get(const JMAP_TRANSIENT *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Transient and key cannot be NULL");
+        return NULL;
+    }
+    HAMT_ENTRY *entry = node_find(self->root, key_hash(key), key);
+    if (!entry) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+        return NULL;
+    }
+    reset_error_trace();
+    return entry->value;
+}
+
+static JMAP_PERSISTENT *transient_persistent(JMAP_TRANSIENT *self) {
+    if (!self) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Transient cannot be NULL");
+        return NULL;
+    }
+    JMAP_PERSISTENT *version = version_create(&self->type, self->root, self->length);
+    if (!version) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for new version failed");
+        return NULL;
+    }
+    // Nodes keep the edit token, which is never handed out again: they are shared from now on
+    free(self);
+    reset_error_trace();
+    return version;
+}
+
+static void transient_free(JMAP_TRANSIENT *self) {
+    if (!self) return;
+    node_release(&self->type, self->root);
+    free(self);
+}
+
+JMAP_PERSISTENT_INTERFACE jmap_persistent = {
+    .empty = persistent_empty,
+    .empty_preset = persistent_empty_preset,
+    .get = persistent_get,
+    .contains_key = persistent_contains_key,
+    .put = persistent_put,
+    .remove = persistent_remove,
+    .length = persistent_length,
+    .for_each = persistent_for_each,
+    .retain = persistent_retain,
+    .release = persistent_release,
+    .transient = persistent_transient,
+    .transient_put = transient_put,
+    .transient_remove = transient_remove,
+    .transient_get = transient_get,
+    .persistent = transient_persistent,
+    .transient_free = transient_free,
+};
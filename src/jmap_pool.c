@@ -0,0 +1,171 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+
+/*
+ * Value pool: the blocks pointed to by the values of a JMAP_TYPE_POINTER map are carved out of
+ * large chunks owned by the map instead of being malloc'ed one by one. Blocks are rounded up to
+ * size classes; a freed block goes to the free list of its class and is reused by the next value
+ * of that class, otherwise the next block is bumped from the current chunk.
+ * Blocks larger than the biggest class are heap blocks kept in a list, so that destroying the pool
+ * frees everything without visiting the values.
+ */
+
+#define POOL_CHUNK_SIZE ((size_t)64 * 1024)
+#define POOL_GRANULE 16
+#define POOL_CLASSES 32                                  // Blocks of 16 to 512 bytes, header included
+#define POOL_LARGE POOL_CLASSES                          // Class of the blocks allocated on the heap
+#define POOL_HEADER_SIZE sizeof(size_t)                  // Holds the class of the block
+
+// Header of the blocks larger than the biggest class, followed by their class (POOL_LARGE)
+typedef struct POOL_LARGE_BLOCK {
+    struct POOL_LARGE_BLOCK *prev;
+    struct POOL_LARGE_BLOCK *next;
+    size_t size;
+} POOL_LARGE_BLOCK;
+
+typedef struct POOL_CHUNK {
+    struct POOL_CHUNK *next;
+    size_t pad;                                          // Keeps the blocks 8-byte aligned after their header
+} POOL_CHUNK;
+
+struct JMAP_POOL {
+    size_t (*value_size)(const void *value);
+    JMAP_ALLOCATOR allocator;
+    POOL_CHUNK *chunks;
+    POOL_LARGE_BLOCK *large;
+    char *bump;                                          // Next free byte of the current chunk
+    char *end;                                           // End of the current chunk
+    void *free_lists[POOL_CLASSES];
+};
+
+static inline size_t *block_header(const void *block) {
+    return (size_t*)block - 1;
+}
+
+static inline POOL_LARGE_BLOCK *large_block(const void *block) {
+    return (POOL_LARGE_BLOCK*)block_header(block) - 1;
+}
+
+// Usable bytes of a block returned by pool_alloc
+size_t pool_block_size(const void *block) {
+    size_t cls = *block_header(block);
+    if (cls == POOL_LARGE) return large_block(block)->size;
+    return (cls + 1) * POOL_GRANULE - POOL_HEADER_SIZE;
+}
+
+void *pool_alloc(JMAP_POOL *pool, size_t size) {
+    size_t cls = (size + POOL_HEADER_SIZE - 1) / POOL_GRANULE;
+    if (cls >= POOL_CLASSES) {
+        POOL_LARGE_BLOCK *large = allocator_alloc(&pool->allocator, sizeof(POOL_LARGE_BLOCK) + POOL_HEADER_SIZE + size);
+        if (!large) return NULL;
+        large->prev = NULL;
+        large->next = pool->large;
+        if (pool->large) pool->large->prev = large;
+        pool->large = large;
+        large->size = size;
+        size_t *header = (size_t*)(large + 1);
+        *header = POOL_LARGE;
+        return header + 1;
+    }
+
+    void *block = pool->free_lists[cls];
+    if (block) {
+        pool->free_lists[cls] = *(void**)block;
+        return block;
+    }
+
+    size_t block_size = (cls + 1) * POOL_GRANULE;
+    if ((size_t)(pool->end - pool->bump) < block_size) {
+        POOL_CHUNK *chunk = allocator_alloc(&pool->allocator, POOL_CHUNK_SIZE);
+        if (!chunk) return NULL;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        pool->bump = (char*)(chunk + 1);
+        pool->end = (char*)chunk + POOL_CHUNK_SIZE;
+    }
+    size_t *header = (size_t*)pool->bump;
+    *header = cls;
+    pool->bump += block_size;
+    return header + 1;
+}
+
+void pool_free(JMAP_POOL *pool, void *block) {
+    if (!block) return;
+    size_t cls = *block_header(block);
+    if (cls == POOL_LARGE) {
+        POOL_LARGE_BLOCK *large = large_block(block);
+        if (large->prev) large->prev->next = large->next;
+        else pool->large = large->next;
+        if (large->next) large->next->prev = large->prev;
+        allocator_free(&pool->allocator, large, sizeof(POOL_LARGE_BLOCK) + POOL_HEADER_SIZE + large->size);
+        return;
+    }
+    *(void**)block = pool->free_lists[cls];
+    pool->free_lists[cls] = block;
+}
+
+// Copies the block pointed to by the pointer value src into the pool and stores the copy in dest
+bool pool_copy(JMAP_POOL *pool, void *dest, const void *src) {
+    const void *ptr = *(void *const *)src;
+    if (!ptr) {
+        *(void**)dest = NULL;
+        return true;
+    }
+    size_t size = pool->value_size(src);
+    void *block = pool_alloc(pool, size);
+    if (!block) return false;
+    memcpy(block, ptr, size);
+    *(void**)dest = block;
+    return true;
+}
+
+// Same as pool_copy, but the copy is a heap block handed to the caller
+bool pool_copy_out(const JMAP_POOL *pool, void *dest, const void *src) {
+    const void *ptr = *(void *const *)src;
+    if (!ptr) {
+        *(void**)dest = NULL;
+        return true;
+    }
+    size_t size = pool->value_size(src);
+    void *copy = malloc(size);
+    if (!copy) return false;
+    memcpy(copy, ptr, size);
+    *(void**)dest = copy;
+    return true;
+}
+
+JMAP_POOL *pool_create(size_t (*value_size)(const void *value), JMAP_ALLOCATOR allocator) {
+    JMAP_POOL *pool = allocator_calloc(&allocator, 1, sizeof(JMAP_POOL));
+    if (!pool) return NULL;
+    pool->value_size = value_size;
+    pool->allocator = allocator;
+    return pool;
+}
+
+// New empty pool for the values of a clone
+JMAP_POOL *pool_create_like(const JMAP_POOL *pool) {
+    return pool_create(pool->value_size, pool->allocator);
+}
+
+// Frees every block still allocated at once
+void pool_destroy(JMAP_POOL *pool) {
+    JMAP_ALLOCATOR allocator = pool->allocator;
+    while (pool->large) {
+        POOL_LARGE_BLOCK *next = pool->large->next;
+        allocator_free(&allocator, pool->large, sizeof(POOL_LARGE_BLOCK) + POOL_HEADER_SIZE + pool->large->size);
+        pool->large = next;
+    }
+    while (pool->chunks) {
+        POOL_CHUNK *next = pool->chunks->next;
+        allocator_free(&allocator, pool->chunks, POOL_CHUNK_SIZE);
+        pool->chunks = next;
+    }
+    allocator_free(&allocator, pool, sizeof(JMAP_POOL));
+}
+
+void pool_release(JMAP *map) {
+    JMAP_POOL *pool = map->_pool;
+    if (!pool) return;
+    map->_pool = NULL;
+    pool_destroy(pool);
+}
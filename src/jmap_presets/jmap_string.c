@@ -45,4 +45,16 @@ JMAP create_map_string(void){
     imp.copy_elem_callback = copy_elem_override;
     jmap.init(&map, sizeof(char*), JMAP_TYPE_POINTER, imp);
     return map;
-}
\ No newline at end of file
+}
+
+static size_t string_value_size(const void *x){
+    char **str = (char**)x;
+    return strlen(*str) + 1;
+}
+
+// Value strings are copied into the map's value pool: a put costs one bump allocation
+JMAP create_map_pooled_string(void){
+    JMAP map = create_map_string();
+    if (map.data) jmap.use_value_pool(&map, string_value_size);
+    return map;
+}
@@ -0,0 +1,397 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdatomic.h>
+
+/*
+ * Hash set: the table of a JMAP (linear probing, backward shift deletion, same hash and load
+ * factor) without the value array. Each slot holds the key and its full 32-bit hash: probes compare
+ * the hashes before calling strcmp, and resizes and set operations never hash a stored key again,
+ * as every set uses the same hash function.
+ *
+ * Set operations look up every key of one set in the other, both read-only, split across threads
+ * for large sets, then apply the result on the calling thread, growing or shrinking the table once.
+ */
+
+#define SET_INITIAL_CAPACITY 16
+#define SET_LOAD_FACTOR 0.75
+#define SET_PARALLEL_MIN_ENTRIES ((size_t)1 << 16)
+
+struct JMAP_SET {
+    char **keys;                                 // NULL for empty slots
+    uint32_t *hashes;                            // Full hash of keys[i]
+    size_t capacity;
+    size_t length;
+};
+
+// Slot of key, or the empty slot where it would be inserted
+static size_t set_probe(const JMAP_SET *self, const char *key, uint32_t hash) {
+    size_t mask = self->capacity - 1;
+    size_t idx = hash & mask;
+    while (self->keys[idx] && (self->hashes[idx] != hash || strcmp(self->keys[idx], key) != 0)) idx = (idx + 1) & mask;
+    return idx;
+}
+
+static bool set_alloc_table(JMAP_SET *self, size_t capacity) {
+    char **keys = calloc(capacity, sizeof(char*));
+    uint32_t *hashes = malloc(capacity * sizeof(uint32_t));
+    if (!keys || !hashes) {
+        free(keys);
+        free(hashes);
+        return false;
+    }
+    self->keys = keys;
+    self->hashes = hashes;
+    self->capacity = capacity;
+    return true;
+}
+
+// Moves every key to a table of capacity slots
+static bool set_rehash(JMAP_SET *self, size_t capacity) {
+    char **old_keys = self->keys;
+    uint32_t *old_hashes = self->hashes;
+    size_t old_capacity = self->capacity;
+    if (!set_alloc_table(self, capacity)) return false;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old_keys[i]) continue;
+        size_t idx = old_hashes[i] & (capacity - 1);
+        while (self->keys[idx]) idx = (idx + 1) & (capacity - 1);
+        self->keys[idx] = old_keys[i];
+        self->hashes[idx] = old_hashes[i];
+    }
+    free(old_keys);
+    free(old_hashes);
+    return true;
+}
+
+// Room for `added` more keys, growing once if needed
+static bool set_reserve(JMAP_SET *self, size_t added) {
+    size_t capacity = self->capacity;
+    while (self->length + added > capacity * SET_LOAD_FACTOR) capacity *= 2;
+    return capacity == self->capacity || set_rehash(self, capacity);
+}
+
+// Same rule as the maps: halve while less than a quarter of the load factor is used. Failing to shrink is harmless.
+static void set_shrink_if_sparse(JMAP_SET *self) {
+    size_t capacity = self->capacity;
+    while (capacity > SET_INITIAL_CAPACITY && self->length < capacity * SET_LOAD_FACTOR / 4) capacity /= 2;
+    if (capacity != self->capacity) set_rehash(self, capacity);
+}
+
+// Stores a copy of key, known to be absent, in the first empty slot of its chain. Room must be reserved.
+static bool set_insert_new(JMAP_SET *self, const char *key, uint32_t hash) {
+    char *copy = strdup(key);
+    if (!copy) return false;
+    size_t idx = hash & (self->capacity - 1);
+    while (self->keys[idx]) idx = (idx + 1) & (self->capacity - 1);
+    self->keys[idx] = copy;
+    self->hashes[idx] = hash;
+    self->length++;
+    return true;
+}
+
+// Removes the key of slot idx, then shifts back the following keys of the cluster
+static void set_erase_at(JMAP_SET *self, size_t idx) {
+    free(self->keys[idx]);
+    self->keys[idx] = NULL;
+    self->length--;
+    size_t mask = self->capacity - 1;
+    size_t hole = idx;
+    for (size_t j = (idx + 1) & mask; self->keys[j]; j = (j + 1) & mask) {
+        size_t home = self->hashes[j] & mask;
+        if (((hole - home) & mask) < ((j - home) & mask)) {
+            self->keys[hole] = self->keys[j];
+            self->hashes[hole] = self->hashes[j];
+            self->keys[j] = NULL;
+            hole = j;
+        }
+    }
+}
+
+static bool set_check(const JMAP_SET *self, const char *key) {
+    if (!self || !key || key[0] == '\0') {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Set and key cannot be NULL, key cannot be empty");
+        return false;
+    }
+    return true;
+}
+
+static JMAP_SET *set_create(void) {
+    JMAP_SET *self = calloc(1, sizeof(JMAP_SET));
+    if (!self || !set_alloc_table(self, SET_INITIAL_CAPACITY)) {
+        free(self);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for set failed");
+        return NULL;
+    }
+    reset_error_trace();
+    return self;
+}
+
+static bool set_add(JMAP_SET *self, const char *key) {
+    if (!set_check(self, key)) return false;
+    uint32_t hash = key_hash(key);
+    if (self->keys[set_probe(self, key, hash)]) {
+        reset_error_trace();
+        return false;
+    }
+    if (!set_reserve(self, 1) || !set_insert_new(self, key, hash)) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for key \"%s\" failed", key);
+        return false;
+    }
+    reset_error_trace();
+    return true;
+}
+
+static bool set_contains(const JMAP_SET *self, const char *key) {
+    if (!set_check(self, key)) return false;
+    reset_error_trace();
+    return self->keys[set_probe(self, key, key_hash(key))] != NULL;
+}
+
+static bool set_remove(JMAP_SET *self, const char *key) {
+    if (!set_check(self, key)) return false;
+    size_t idx = set_probe(self, key, key_hash(key));
+    if (!self->keys[idx]) {
+        create_return_error(NULL, JMAP_ELEMENT_NOT_FOUND, "Key \"%s\" not found", key);
+        return false;
+    }
+    set_erase_at(self, idx);
+    set_shrink_if_sparse(self);
+    reset_error_trace();
+    return true;
+}
+
+static size_t set_length(const JMAP_SET *self) {
+    return self ? self->length : 0;
+}
+
+static void set_for_each(const JMAP_SET *self, void (*callback)(const char *key, void *ctx), void *ctx) {
+    if (!self || !callback)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Set and callback cannot be NULL");
+    for (size_t i = 0; i < self->capacity; i++) {
+        if (self->keys[i]) callback(self->keys[i], ctx);
+    }
+}
+
+static void set_clear(JMAP_SET *self) {
+    if (!self) return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Set cannot be NULL");
+    for (size_t i = 0; i < self->capacity; i++) {
+        free(self->keys[i]);
+        self->keys[i] = NULL;
+    }
+    self->length = 0;
+    set_shrink_if_sparse(self);
+    reset_error_trace();
+}
+
+static size_t set_memory_usage(const JMAP_SET *self) {
+    if (!self) return 0;
+    size_t bytes = sizeof(JMAP_SET) + self->capacity * (sizeof(char*) + sizeof(uint32_t));
+    for (size_t i = 0; i < self->capacity; i++) {
+        if (self->keys[i]) bytes += strlen(self->keys[i]) + 1;
+    }
+    return bytes;
+}
+
+static void set_free(JMAP_SET *self) {
+    if (!self) return;
+    for (size_t i = 0; i < self->capacity; i++) free(self->keys[i]);
+    free(self->keys);
+    free(self->hashes);
+    free(self);
+}
+
+/* ---------- Set operations ---------- */
+
+typedef struct SET_TASK {
+    const JMAP_SET *iterated;
+    const JMAP_SET *looked_up;
+    const size_t *slots;        // Occupied slots of iterated
+    size_t *found;              // Slot of the key in looked_up, SIZE_MAX if absent. NULL: stop at the first absent key.
+    atomic_bool *missing;       // Set once a key is absent, when found is NULL
+} SET_TASK;
+
+static void set_task(void *ctx, size_t begin, size_t end) {
+    SET_TASK *task = ctx;
+    const JMAP_SET *iterated = task->iterated;
+    for (size_t i = begin; i < end; i++) {
+        size_t slot = task->slots[i];
+        size_t idx = set_probe(task->looked_up, iterated->keys[slot], iterated->hashes[slot]);
+        if (task->found) {
+            task->found[i] = task->looked_up->keys[idx] ? idx : SIZE_MAX;
+        } else if (!task->looked_up->keys[idx]) {
+            atomic_store_explicit(task->missing, true, memory_order_relaxed);
+            return;
+        } else if ((i & 1023) == 0 && atomic_load_explicit(task->missing, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+// Looks up the keys of iterated (slots[0..count)) in looked_up
+static void set_lookup(const JMAP_SET *iterated, const JMAP_SET *looked_up, const size_t *slots, size_t count,
+                       size_t *found, atomic_bool *missing, unsigned threads) {
+    SET_TASK task = { iterated, looked_up, slots, found, missing };
+    parallel_for(count, count < SET_PARALLEL_MIN_ENTRIES ? 1 : threads, set_task, &task);
+}
+
+// Occupied slots of self, in slot order. NULL if out of memory.
+static size_t *set_slots(const JMAP_SET *self) {
+    size_t *slots = malloc((self->length ? self->length : 1) * sizeof(size_t));
+    if (!slots) return NULL;
+    size_t n = 0;
+    for (size_t i = 0; i < self->capacity; i++) {
+        if (self->keys[i]) slots[n++] = i;
+    }
+    return slots;
+}
+
+static bool set_bulk_check(const JMAP_SET *dst, const JMAP_SET *src) {
+    if (!dst || !src) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Sets cannot be NULL");
+        return false;
+    }
+    if (dst == src) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Source and destination must be different sets");
+        return false;
+    }
+    return true;
+}
+
+// Erases the keys listed in erased (dst's own key strings, which do not move when keys are shifted back), then shrinks once
+static void set_erase_keys(JMAP_SET *dst, char **erased, const uint32_t *hashes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        size_t idx = hashes[i] & (dst->capacity - 1);
+        while (dst->keys[idx] != erased[i]) idx = (idx + 1) & (dst->capacity - 1);
+        set_erase_at(dst, idx);
+    }
+    set_shrink_if_sparse(dst);
+}
+
+static void set_union(JMAP_SET *dst, const JMAP_SET *src, unsigned threads) {
+    if (!set_bulk_check(dst, src)) return;
+    size_t count = src->length;
+    if (count == 0) return reset_error_trace();
+    size_t *slots = set_slots(src);
+    size_t *found = malloc(count * sizeof(size_t));
+    if (!slots || !found) {
+        free(slots);
+        free(found);
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for union failed");
+    }
+    set_lookup(src, dst, slots, count, found, NULL, threads);
+
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) added += found[i] == SIZE_MAX;
+    bool reserved = set_reserve(dst, added);
+    for (size_t i = 0; reserved && i < count; i++) {
+        if (found[i] == SIZE_MAX && !set_insert_new(dst, src->keys[slots[i]], src->hashes[slots[i]])) reserved = false;
+    }
+    free(slots);
+    free(found);
+    if (!reserved) return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for union failed");
+    reset_error_trace();
+}
+
+static void set_intersect(JMAP_SET *dst, const JMAP_SET *src, unsigned threads) {
+    if (!set_bulk_check(dst, src)) return;
+    size_t count = dst->length;
+    if (count == 0) return reset_error_trace();
+    size_t *slots = set_slots(dst);
+    size_t *found = malloc(count * sizeof(size_t));
+    char **erased = malloc(count * sizeof(char*));
+    uint32_t *hashes = malloc(count * sizeof(uint32_t));
+    if (!slots || !found || !erased || !hashes) {
+        free(slots);
+        free(found);
+        free(erased);
+        free(hashes);
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for intersect failed");
+    }
+    set_lookup(dst, src, slots, count, found, NULL, threads);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (found[i] != SIZE_MAX) continue;
+        erased[n] = dst->keys[slots[i]];
+        hashes[n++] = dst->hashes[slots[i]];
+    }
+    set_erase_keys(dst, erased, hashes, n);
+    free(slots);
+    free(found);
+    free(erased);
+    free(hashes);
+    reset_error_trace();
+}
+
+static void set_difference(JMAP_SET *dst, const JMAP_SET *src, unsigned threads) {
+    if (!set_bulk_check(dst, src)) return;
+    size_t count = src->length;
+    if (count == 0 || dst->length == 0) return reset_error_trace();
+    size_t *slots = set_slots(src);
+    size_t *found = malloc(count * sizeof(size_t));
+    char **erased = malloc(count * sizeof(char*));
+    uint32_t *hashes = malloc(count * sizeof(uint32_t));
+    if (!slots || !found || !erased || !hashes) {
+        free(slots);
+        free(found);
+        free(erased);
+        free(hashes);
+        return create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for difference failed");
+    }
+    set_lookup(src, dst, slots, count, found, NULL, threads);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (found[i] == SIZE_MAX) continue;
+        erased[n] = dst->keys[found[i]];
+        hashes[n++] = dst->hashes[found[i]];
+    }
+    set_erase_keys(dst, erased, hashes, n);
+    free(slots);
+    free(found);
+    free(erased);
+    free(hashes);
+    reset_error_trace();
+}
+
+static bool set_is_subset(const JMAP_SET *self, const JMAP_SET *other, unsigned threads) {
+    if (!self || !other) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Sets cannot be NULL");
+        return false;
+    }
+    if (self == other || self->length == 0) {
+        reset_error_trace();
+        return true;
+    }
+    if (self->length > other->length) {
+        reset_error_trace();
+        return false;
+    }
+    size_t *slots = set_slots(self);
+    if (!slots) {
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for is_subset failed");
+        return false;
+    }
+    atomic_bool missing;
+    atomic_init(&missing, false);
+    set_lookup(self, other, slots, self->length, NULL, &missing, threads);
+    free(slots);
+    reset_error_trace();
+    return !atomic_load(&missing);
+}
+
+JMAP_SET_INTERFACE jmap_set = {
+    .create = set_create,
+    .add = set_add,
+    .contains = set_contains,
+    .remove = set_remove,
+    .length = set_length,
+    .for_each = set_for_each,
+    .clear = set_clear,
+    .memory_usage = set_memory_usage,
+    .free = set_free,
+    .union_into = set_union,
+    .intersect = set_intersect,
+    .difference = set_difference,
+    .is_subset = set_is_subset,
+};
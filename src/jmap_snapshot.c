@@ -0,0 +1,284 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Copy-on-write snapshots.
+ *
+ * The map keeps its flat table. A snapshot starts as an array of chunk pointers that are all NULL,
+ * meaning "read this chunk from the map". Before the map writes a slot of a chunk that a snapshot
+ * still reads from it, the chunk (keys and values) is copied into the snapshot, so memory only grows
+ * with the chunks written after the snapshot. Operations that rewrite the whole table (resize, clear,
+ * numeric apply) copy every chunk left, after which the snapshot no longer depends on the map.
+ *
+ * Readers take the snapshot lock per chunk, the map takes it only to copy a chunk: a chunk read from
+ * the map is never written while a reader holds the lock. Snapshot memory comes from the C library,
+ * as it can outlive the map and its allocator.
+ */
+
+#define SNAPSHOT_CHUNK_SHIFT 10
+
+struct JMAP_SNAPSHOT {
+    JMAP *map;                  // Map still holding some chunks, NULL once detached
+    JMAP_SNAPSHOT *next;        // Next snapshot of the same map
+    pthread_mutex_t lock;
+    atomic_bool released;       // Freed by its owner while attached, the map frees it
+    bool lost;                  // A chunk could not be copied, the snapshot is unusable
+    JMAP layout;                // Value type and callbacks of the map, for memcpy_elem
+    size_t length;
+    size_t chunk_shift;
+    size_t chunk_count;
+    char ***chunks;             // Keys of the copied chunks, followed by their values. NULL: read from the map.
+    JMAP_POOL *pool;            // Copies of pooled values
+};
+
+static inline size_t chunk_slots(const JMAP_SNAPSHOT *snap) {
+    return (size_t)1 << snap->chunk_shift;
+}
+
+static inline size_t chunk_bytes(const JMAP_SNAPSHOT *snap) {
+    return chunk_slots(snap) * (sizeof(char*) + snap->layout._elem_size);
+}
+
+// Keys and values of chunk c, copied or still in the map. Called with the lock held.
+static inline char **chunk_keys(const JMAP_SNAPSHOT *snap, size_t c) {
+    return snap->chunks[c] ? snap->chunks[c] : snap->map->keys + (c << snap->chunk_shift);
+}
+
+static inline char *chunk_data(const JMAP_SNAPSHOT *snap, size_t c) {
+    if (snap->chunks[c]) return (char*)(snap->chunks[c] + chunk_slots(snap));
+    return (char*)snap->map->data + (c << snap->chunk_shift) * snap->layout._elem_size;
+}
+
+static void chunk_free(JMAP_SNAPSHOT *snap, char **keys) {
+    if (!keys) return;
+    char *data = (char*)(keys + chunk_slots(snap));
+    for (size_t i = 0; i < chunk_slots(snap); i++) {
+        if (!keys[i]) continue;
+        free(keys[i]);
+        void **value = (void**)(data + i * snap->layout._elem_size);
+        if (snap->layout._data_type == JMAP_TYPE_POINTER && !snap->pool && *value) free(*value);
+    }
+    free(keys);
+}
+
+// Copies chunk c out of the map. Called with the lock held.
+static bool chunk_copy(JMAP_SNAPSHOT *snap, size_t c) {
+    const JMAP *map = snap->map;
+    size_t slots = chunk_slots(snap), elem_size = snap->layout._elem_size;
+    char **keys = calloc(1, chunk_bytes(snap));
+    if (!keys) return false;
+    if (map->_pool && !snap->pool && !(snap->pool = pool_create_like(map->_pool))) {
+        free(keys);
+        return false;
+    }
+    char *data = (char*)(keys + slots);
+    size_t first = c << snap->chunk_shift;
+    for (size_t i = 0; i < slots; i++) {
+        const char *key = map->keys[first + i];
+        if (!key) continue;
+        const char *value = (const char*)map->data + (first + i) * elem_size;
+        bool copied = (keys[i] = strdup(key)) != NULL;
+        if (copied && snap->pool) copied = pool_copy(snap->pool, data + i * elem_size, value);
+        else if (copied) memcpy_elem(&snap->layout, data + i * elem_size, value, 1);
+        if (!copied) {
+            free(keys[i]);
+            keys[i] = NULL;
+            chunk_free(snap, keys);
+            return false;
+        }
+    }
+    snap->chunks[c] = keys;
+    return true;
+}
+
+static void snapshot_destroy(JMAP_SNAPSHOT *snap) {
+    for (size_t c = 0; c < snap->chunk_count; c++) chunk_free(snap, snap->chunks[c]);
+    if (snap->pool) pool_destroy(snap->pool);
+    pthread_mutex_destroy(&snap->lock);
+    free(snap->chunks);
+    free(snap);
+}
+
+// Copies every chunk the snapshot still reads from the map, then lets go of the map. A released snapshot is freed instead.
+static void snapshot_detach(JMAP_SNAPSHOT *snap) {
+    pthread_mutex_lock(&snap->lock);
+    if (atomic_load(&snap->released)) {
+        pthread_mutex_unlock(&snap->lock);
+        snapshot_destroy(snap);
+        return;
+    }
+    for (size_t c = 0; c < snap->chunk_count && !snap->lost; c++) {
+        if (!snap->chunks[c] && !chunk_copy(snap, c)) snap->lost = true;
+    }
+    snap->map = NULL;
+    snap->next = NULL;
+    pthread_mutex_unlock(&snap->lock);
+}
+
+void snapshot_before_write(JMAP *map, size_t idx) {
+    JMAP_SNAPSHOT **link = &map->_snapshot;
+    while (*link) {
+        JMAP_SNAPSHOT *snap = *link;
+        if (atomic_load_explicit(&snap->released, memory_order_acquire)) {
+            *link = snap->next;
+            // Wait for the owner to leave jmap_snapshot.free
+            pthread_mutex_lock(&snap->lock);
+            pthread_mutex_unlock(&snap->lock);
+            snapshot_destroy(snap);
+            continue;
+        }
+        size_t c = idx >> snap->chunk_shift;
+        if (!snap->chunks[c]) {
+            pthread_mutex_lock(&snap->lock);
+            bool copied = chunk_copy(snap, c);
+            bool released = false;
+            if (!copied) {
+                // Out of memory: the snapshot cannot follow the map any more
+                snap->lost = true;
+                snap->map = NULL;
+                released = atomic_load(&snap->released);
+                *link = snap->next;
+            }
+            pthread_mutex_unlock(&snap->lock);
+            if (released) snapshot_destroy(snap);
+            if (!copied) continue;
+        }
+        link = &snap->next;
+    }
+}
+
+void snapshot_detach_all(JMAP *map) {
+    JMAP_SNAPSHOT *snap = map->_snapshot;
+    map->_snapshot = NULL;
+    while (snap) {
+        JMAP_SNAPSHOT *next = snap->next;
+        snapshot_detach(snap);
+        snap = next;
+    }
+}
+
+JMAP_SNAPSHOT *map_snapshot(JMAP *self) {
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return NULL;
+    }
+    JMAP_SNAPSHOT *snap = calloc(1, sizeof(JMAP_SNAPSHOT));
+    size_t shift = 0;
+    while (shift < SNAPSHOT_CHUNK_SHIFT && ((size_t)1 << (shift + 1)) <= self->_capacity) shift++;
+    size_t chunk_count = self->_capacity >> shift;
+    char ***chunks = calloc(chunk_count, sizeof(char**));
+    if (!snap || !chunks || pthread_mutex_init(&snap->lock, NULL) != 0) {
+        free(snap);
+        free(chunks);
+        create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for snapshot failed");
+        return NULL;
+    }
+    snap->map = self;
+    atomic_init(&snap->released, false);
+    snap->layout._elem_size = self->_elem_size;
+    snap->layout._data_type = self->_data_type;
+    snap->layout._capacity = self->_capacity;
+    snap->layout.user_callbacks = self->user_callbacks;
+    snap->length = self->_length;
+    snap->chunk_shift = shift;
+    snap->chunk_count = chunk_count;
+    snap->chunks = chunks;
+    snap->next = self->_snapshot;
+    self->_snapshot = snap;
+    reset_error_trace();
+    return snap;
+}
+
+// Fails once a chunk could not be copied. Called with the lock held, the map may drop the snapshot at any time.
+static bool snapshot_complete(const JMAP_SNAPSHOT *self) {
+    if (!self->lost) return true;
+    create_return_error(NULL, JMAP_UNINITIALIZED, "Snapshot is incomplete: copying a chunk ran out of memory");
+    return false;
+}
+
+// Slot of key in the snapshot (lock held and released by the caller), SIZE_MAX if absent
+static size_t snapshot_find(JMAP_SNAPSHOT *self, const char *key, size_t *chunk) {
+    uint32_t hash = key_hash(key);
+    size_t mask = self->layout._capacity - 1, slot_mask = chunk_slots(self) - 1;
+    for (size_t idx = hash & mask;; idx = (idx + 1) & mask) {
+        const char *slot_key = chunk_keys(self, idx >> self->chunk_shift)[idx & slot_mask];
+        if (!slot_key) return SIZE_MAX;
+        if (strcmp(slot_key, key) == 0) {
+            *chunk = idx >> self->chunk_shift;
+            return idx & slot_mask;
+        }
+    }
+}
+
+static bool snapshot_get(JMAP_SNAPSHOT *self, const char *key, void *out) {
+    if (!self || !key || !out) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Snapshot, key and out cannot be NULL");
+        return false;
+    }
+    // A probe may cross chunks: the lock is held for all of it
+    pthread_mutex_lock(&self->lock);
+    bool complete = snapshot_complete(self);
+    size_t chunk = 0;
+    size_t i = complete ? snapshot_find(self, key, &chunk) : SIZE_MAX;
+    if (i != SIZE_MAX) memcpy_elem(&self->layout, out, chunk_data(self, chunk) + i * self->layout._elem_size, 1);
+    pthread_mutex_unlock(&self->lock);
+    if (complete) reset_error_trace();
+    return i != SIZE_MAX;
+}
+
+static bool snapshot_contains_key(JMAP_SNAPSHOT *self, const char *key) {
+    if (!self || !key) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Snapshot and key cannot be NULL");
+        return false;
+    }
+    pthread_mutex_lock(&self->lock);
+    bool complete = snapshot_complete(self);
+    size_t chunk;
+    bool found = complete && snapshot_find(self, key, &chunk) != SIZE_MAX;
+    pthread_mutex_unlock(&self->lock);
+    if (complete) reset_error_trace();
+    return found;
+}
+
+static void snapshot_for_each(JMAP_SNAPSHOT *self, void (*callback)(const char *key, const void *value, void *ctx), void *ctx) {
+    if (!self || !callback)
+        return create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Snapshot and callback cannot be NULL");
+    for (size_t c = 0; c < self->chunk_count; c++) {
+        pthread_mutex_lock(&self->lock);
+        if (!snapshot_complete(self)) {
+            pthread_mutex_unlock(&self->lock);
+            return;
+        }
+        char **keys = chunk_keys(self, c);
+        const char *data = chunk_data(self, c);
+        for (size_t i = 0; i < chunk_slots(self); i++) {
+            if (keys[i]) callback(keys[i], data + i * self->layout._elem_size, ctx);
+        }
+        pthread_mutex_unlock(&self->lock);
+    }
+    reset_error_trace();
+}
+
+static size_t snapshot_length(const JMAP_SNAPSHOT *self) {
+    return self ? self->length : 0;
+}
+
+static void snapshot_free(JMAP_SNAPSHOT *self) {
+    if (!self) return;
+    pthread_mutex_lock(&self->lock);
+    bool attached = self->map != NULL;
+    // The map unlinks and frees an attached snapshot the next time it writes or detaches
+    if (attached) atomic_store_explicit(&self->released, true, memory_order_release);
+    pthread_mutex_unlock(&self->lock);
+    if (!attached) snapshot_destroy(self);
+}
+
+JMAP_SNAPSHOT_INTERFACE jmap_snapshot = {
+    .get = snapshot_get,
+    .contains_key = snapshot_contains_key,
+    .for_each = snapshot_for_each,
+    .length = snapshot_length,
+    .free = snapshot_free,
+};
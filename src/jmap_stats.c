@@ -0,0 +1,216 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Table diagnostics. The shape of the table (probe lengths, clusters) is recomputed on demand from
+ * the keys and the occupancy bitmap. Lookup and resize counters are only kept once enabled: jmap.c
+ * then takes a counting probe loop, the default loop is left as it is.
+ */
+
+struct JMAP_STATS_COUNTERS {
+    size_t lookups;
+    size_t hits;
+    size_t probed_slots;
+    size_t max_probe_length;
+    size_t key_comparisons;
+    size_t filter_rejected;
+    size_t filter_false_positives;
+    size_t resizes;
+    uint64_t resize_ns;
+    JMAP_ALLOCATOR allocator;
+};
+
+uint64_t stats_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// A lookup that made `compares` strcmp calls, the last one matching if found
+void stats_on_lookup(JMAP_STATS_COUNTERS *stats, size_t compares, bool found) {
+    size_t probe_length = found ? compares : compares + 1;
+    stats->lookups++;
+    stats->hits += found;
+    stats->probed_slots += probe_length;
+    stats->key_comparisons += compares;
+    if (probe_length > stats->max_probe_length) stats->max_probe_length = probe_length;
+}
+
+// A lookup that consulted the filter: rejected by it, or passed and then found or not
+void stats_on_filter(JMAP_STATS_COUNTERS *stats, bool passed, bool found) {
+    if (!passed) stats->filter_rejected++;
+    else if (!found) stats->filter_false_positives++;
+}
+
+void stats_on_resize(JMAP_STATS_COUNTERS *stats, uint64_t start_ns) {
+    stats->resizes++;
+    stats->resize_ns += stats_clock_ns() - start_ns;
+}
+
+void stats_release(JMAP *map) {
+    JMAP_STATS_COUNTERS *stats = map->_stats;
+    if (!stats) return;
+    map->_stats = NULL;
+    JMAP_ALLOCATOR allocator = stats->allocator;
+    allocator_free(&allocator, stats, sizeof(JMAP_STATS_COUNTERS));
+}
+
+static inline size_t histogram_bucket(size_t value) {
+    return value < JMAP_STATS_HISTOGRAM_SIZE ? value : JMAP_STATS_HISTOGRAM_SIZE - 1;
+}
+
+static inline size_t log2_bucket(size_t length) {
+    size_t bucket = 0;
+    while (length >>= 1) bucket++;
+    return histogram_bucket(bucket);
+}
+
+static inline bool slot_occupied(const JMAP *self, size_t idx) {
+    return (self->_occupied[idx / 64] >> (idx % 64)) & 1;
+}
+
+// Probe lengths of the entries, from the distance between their slot and their home slot
+static void collect_probe_lengths(const JMAP *self, JMAP_STATS *out) {
+    size_t total = 0;
+    for (size_t i = 0; i < self->_capacity; i++) {
+        if (!self->keys[i]) continue;
+        size_t probe_length = ((i - map_stored_key_index(self, self->keys[i])) & (self->_capacity - 1)) + 1;
+        total += probe_length;
+        if (probe_length > out->max_probe_length) out->max_probe_length = probe_length;
+        out->probe_histogram[histogram_bucket(probe_length - 1)]++;
+    }
+    out->avg_probe_length = self->_length ? (double)total / self->_length : 0;
+}
+
+// Runs of occupied slots. A run wrapping around the end of the table counts once.
+static void collect_clusters(const JMAP *self, JMAP_STATS *out) {
+    if (self->_length == 0) return;
+    size_t capacity = self->_capacity;
+    if (self->_length == capacity) {
+        out->clusters = 1;
+        out->max_cluster_length = capacity;
+        out->avg_cluster_length = (double)capacity;
+        out->cluster_histogram[log2_bucket(capacity)]++;
+        return;
+    }
+
+    // Start right after an empty slot so that no run is cut in two
+    size_t start = 0;
+    while (slot_occupied(self, start)) start++;
+    size_t run = 0;
+    for (size_t n = 1; n <= capacity; n++) {
+        size_t idx = (start + n) & (capacity - 1);
+        if (slot_occupied(self, idx)) {
+            run++;
+            continue;
+        }
+        if (run == 0) continue;
+        out->clusters++;
+        if (run > out->max_cluster_length) out->max_cluster_length = run;
+        out->cluster_histogram[log2_bucket(run)]++;
+        run = 0;
+    }
+    out->avg_cluster_length = (double)self->_length / out->clusters;
+}
+
+static void stats_enable(JMAP *self) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (self->_stats)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Statistics are already enabled");
+    self->_stats = allocator_calloc(&self->_allocator, 1, sizeof(JMAP_STATS_COUNTERS));
+    if (!self->_stats)
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for statistics failed");
+    self->_stats->allocator = self->_allocator;
+    reset_error_trace();
+}
+
+static void stats_disable(JMAP *self) {
+    if (!self->_stats)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Statistics are not enabled");
+    stats_release(self);
+    reset_error_trace();
+}
+
+static void stats_reset(JMAP *self) {
+    if (!self->_stats)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Statistics are not enabled");
+    JMAP_ALLOCATOR allocator = self->_stats->allocator;
+    memset(self->_stats, 0, sizeof(JMAP_STATS_COUNTERS));
+    self->_stats->allocator = allocator;
+    reset_error_trace();
+}
+
+static JMAP_STATS stats_collect(const JMAP *self) {
+    JMAP_STATS out = {0};
+    if (!self->data || !self->keys) {
+        create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+        return out;
+    }
+    out.entries = self->_length;
+    out.capacity = self->_capacity;
+    collect_probe_lengths(self, &out);
+    collect_clusters(self, &out);
+
+    const JMAP_STATS_COUNTERS *counters = self->_stats;
+    if (counters) {
+        out.lookups = counters->lookups;
+        out.hits = counters->hits;
+        out.misses = counters->lookups - counters->hits;
+        out.probed_slots = counters->probed_slots;
+        out.max_lookup_probe_length = counters->max_probe_length;
+        out.key_comparisons = counters->key_comparisons;
+        out.resizes = counters->resizes;
+        out.resize_ns = counters->resize_ns;
+        out.filter_rejected = counters->filter_rejected;
+        out.filter_false_positives = counters->filter_false_positives;
+        size_t absent = counters->filter_rejected + counters->filter_false_positives;
+        out.filter_fp_rate = absent ? (double)counters->filter_false_positives / absent : 0;
+    }
+    if (self->_filter) {
+        out.filter_bytes = jmap_filter.memory_usage(self->_filter);
+        out.filter_expected_fp_rate = jmap_filter.false_positive_rate(self->_filter);
+    }
+    reset_error_trace();
+    return out;
+}
+
+static void print_histogram(const char *title, const size_t *histogram, bool log2) {
+    printf("  %s:\n", title);
+    for (size_t i = 0; i < JMAP_STATS_HISTOGRAM_SIZE; i++) {
+        if (!histogram[i]) continue;
+        bool last = i == JMAP_STATS_HISTOGRAM_SIZE - 1;
+        if (log2) printf("    %8zu%s : %zu\n", (size_t)1 << i, last ? "+" : " ", histogram[i]);
+        else printf("    %8zu%s : %zu\n", i + 1, last ? "+" : " ", histogram[i]);
+    }
+}
+
+static void stats_print(const JMAP_STATS *stats) {
+    printf("JMAP stats [entries: %zu, capacity: %zu, load: %.2f]\n", stats->entries, stats->capacity,
+           stats->capacity ? (double)stats->entries / stats->capacity : 0);
+    printf("  probe length: avg %.2f, max %zu\n", stats->avg_probe_length, stats->max_probe_length);
+    print_histogram("probe lengths", stats->probe_histogram, false);
+    printf("  clusters: %zu, avg length %.2f, max length %zu\n", stats->clusters, stats->avg_cluster_length, stats->max_cluster_length);
+    print_histogram("cluster lengths (from)", stats->cluster_histogram, true);
+    printf("  lookups: %zu (%zu hits, %zu misses), %.2f slots and %.2f strcmp per lookup, max %zu slots\n",
+           stats->lookups, stats->hits, stats->misses,
+           stats->lookups ? (double)stats->probed_slots / stats->lookups : 0,
+           stats->lookups ? (double)stats->key_comparisons / stats->lookups : 0,
+           stats->max_lookup_probe_length);
+    printf("  resizes: %zu, %.3f ms\n", stats->resizes, stats->resize_ns / 1e6);
+    if (stats->filter_bytes) {
+        printf("  filter: %zu bytes, expected fp rate %.4f, %zu rejected, %zu false positives (fp rate %.4f)\n",
+               stats->filter_bytes, stats->filter_expected_fp_rate, stats->filter_rejected,
+               stats->filter_false_positives, stats->filter_fp_rate);
+    }
+}
+
+JMAP_STATS_INTERFACE jmap_stats = {
+    .enable = stats_enable,
+    .disable = stats_disable,
+    .reset = stats_reset,
+    .collect = stats_collect,
+    .print = stats_print,
+};
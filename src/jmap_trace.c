@@ -0,0 +1,286 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+ * Operation trace.
+ *
+ * Records are encoded into a memory buffer by the calling thread and written when it is full,
+ * so recording costs a hash, a clock read and a few bytes of copy per operation.
+ *
+ * File   : "JMAPTRC1" | u32 flags
+ * Record : u8 op | varint time delta (ns) | u32 key hash | varint key length | key (TRACE_FLAG_KEYS only)
+ *
+ * Integers are little endian, varints are LEB128.
+ */
+
+#define TRACE_MAGIC "JMAPTRC1"
+#define TRACE_HEADER_SIZE (8 + sizeof(uint32_t))
+#define TRACE_FLAG_KEYS 1u
+#define TRACE_DEFAULT_BUFFER ((size_t)64 * 1024)
+#define TRACE_MAX_RECORD 32                   // Record without its key
+#define TRACE_MAX_KEY_LENGTH (64u << 20)
+
+struct JMAP_TRACE {
+    int fd;
+    bool record_keys;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    uint64_t last_ns;
+    int io_errno;                             // First write error, the recording stops there
+};
+
+struct JMAP_TRACE_READER {
+    FILE *file;
+    bool has_keys;
+    uint64_t timestamp_ns;
+    char *key;
+    size_t key_capacity;
+};
+
+static uint64_t trace_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *ptr = data;
+    while (length > 0) {
+        ssize_t written = write(fd, ptr, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ptr += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static void trace_flush(JMAP_TRACE *trace) {
+    if (trace->length && !trace->io_errno && !write_all(trace->fd, trace->buffer, trace->length)) trace->io_errno = errno;
+    trace->length = 0;
+}
+
+static inline char *put_varint(char *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (char)value;
+    return out;
+}
+
+static inline char *put_u32(char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (char)(value >> (8 * i));
+    return out + 4;
+}
+
+void trace_log(JMAP_TRACE *trace, JMAP_TRACE_OP op, const char *key) {
+    if (trace->io_errno) return;
+    size_t key_length = strlen(key);
+    uint32_t hash = key_hash_length(key, key_length);
+    uint64_t now = trace_clock_ns();
+
+    size_t needed = TRACE_MAX_RECORD + (trace->record_keys ? key_length : 0);
+    if (trace->length + needed > trace->capacity) trace_flush(trace);
+    // A key larger than the buffer is written on its own
+    if (needed > trace->capacity) {
+        char head[TRACE_MAX_RECORD];
+        char *out = head;
+        *out++ = (char)op;
+        out = put_varint(out, now - trace->last_ns);
+        out = put_u32(out, hash);
+        out = put_varint(out, key_length);
+        if (!write_all(trace->fd, head, (size_t)(out - head)) || !write_all(trace->fd, key, key_length)) trace->io_errno = errno;
+        trace->last_ns = now;
+        return;
+    }
+
+    char *out = trace->buffer + trace->length;
+    *out++ = (char)op;
+    out = put_varint(out, now - trace->last_ns);
+    out = put_u32(out, hash);
+    out = put_varint(out, key_length);
+    if (trace->record_keys) {
+        memcpy(out, key, key_length);
+        out += key_length;
+    }
+    trace->length = (size_t)(out - trace->buffer);
+    trace->last_ns = now;
+}
+
+// Flushes and closes the recording, returns the first write error (0 if none)
+static int trace_close(JMAP_TRACE *trace) {
+    trace_flush(trace);
+    int err = trace->io_errno;
+    if (close(trace->fd) != 0 && !err) err = errno;
+    free(trace->buffer);
+    free(trace);
+    return err;
+}
+
+void trace_release(JMAP *map) {
+    JMAP_TRACE *trace = map->_trace;
+    if (!trace) return;
+    map->_trace = NULL;
+    trace_close(trace);
+}
+
+static void trace_start(JMAP *self, const char *path, JMAP_TRACE_CONFIG config) {
+    if (!self->data || !self->keys)
+        return create_return_error(self, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!path)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "Trace path cannot be NULL");
+    if (self->_trace)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "A trace is already being recorded");
+
+    JMAP_TRACE *trace = calloc(1, sizeof(JMAP_TRACE));
+    if (!trace) return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for trace failed");
+    trace->record_keys = config.record_keys;
+    trace->capacity = config.buffer_size > TRACE_MAX_RECORD ? config.buffer_size : TRACE_DEFAULT_BUFFER;
+    trace->buffer = malloc(trace->capacity);
+    if (!trace->buffer) {
+        free(trace);
+        return create_return_error(self, JMAP_UNINITIALIZED, "Memory allocation for trace buffer failed");
+    }
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace->fd < 0) {
+        int err = errno;
+        free(trace->buffer);
+        free(trace);
+        return create_return_error(self, JMAP_IO_ERROR, "Cannot open trace \"%s\": %s", path, strerror(err));
+    }
+
+    uint32_t flags = config.record_keys ? TRACE_FLAG_KEYS : 0;
+    memcpy(trace->buffer, TRACE_MAGIC, 8);
+    put_u32(trace->buffer + 8, flags);
+    trace->length = TRACE_HEADER_SIZE;
+    trace->last_ns = trace_clock_ns();
+    self->_trace = trace;
+    reset_error_trace();
+}
+
+static void trace_stop(JMAP *self) {
+    if (!self->_trace)
+        return create_return_error(self, JMAP_INVALID_ARGUMENT, "No trace is being recorded");
+    JMAP_TRACE *trace = self->_trace;
+    self->_trace = NULL;
+    int err = trace_close(trace);
+    if (err) return create_return_error(self, JMAP_IO_ERROR, "Writing the trace failed: %s", strerror(err));
+    reset_error_trace();
+}
+
+/* ---------- Reading ---------- */
+
+static bool get_varint(FILE *file, uint64_t *value) {
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if (c == EOF) return false;
+        result |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_u32(FILE *file, uint32_t *value) {
+    unsigned char bytes[4];
+    if (fread(bytes, 1, 4, file) != 4) return false;
+    *value = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    return true;
+}
+
+static JMAP_TRACE_READER *trace_open(const char *path) {
+    if (!path) {
+        create_return_error(NULL, JMAP_INVALID_ARGUMENT, "Trace path cannot be NULL");
+        return NULL;
+    }
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        create_return_error(NULL, JMAP_IO_ERROR, "Cannot open trace \"%s\": %s", path, strerror(errno));
+        return NULL;
+    }
+    char magic[8];
+    uint32_t flags;
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 || !get_u32(file, &flags)) {
+        fclose(file);
+        create_return_error(NULL, JMAP_IO_ERROR, "\"%s\" is not a jmap trace", path);
+        return NULL;
+    }
+    JMAP_TRACE_READER *reader = calloc(1, sizeof(JMAP_TRACE_READER));
+    if (!reader) {
+        fclose(file);
+        create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for trace reader failed");
+        return NULL;
+    }
+    reader->file = file;
+    reader->has_keys = flags & TRACE_FLAG_KEYS;
+    reset_error_trace();
+    return reader;
+}
+
+static bool trace_next(JMAP_TRACE_READER *reader, JMAP_TRACE_RECORD *record) {
+    int op = getc(reader->file);
+    if (op == EOF) {
+        reset_error_trace();
+        return false;
+    }
+    uint64_t delta, key_length;
+    uint32_t hash;
+    if (op < JMAP_TRACE_PUT || op > JMAP_TRACE_CONTAINS || !get_varint(reader->file, &delta)
+        || !get_u32(reader->file, &hash) || !get_varint(reader->file, &key_length) || key_length > TRACE_MAX_KEY_LENGTH) {
+        create_return_error(NULL, JMAP_IO_ERROR, "Truncated or corrupted trace record");
+        return false;
+    }
+
+    record->key = NULL;
+    if (reader->has_keys) {
+        if (key_length + 1 > reader->key_capacity) {
+            char *key = realloc(reader->key, key_length + 1);
+            if (!key) {
+                create_return_error(NULL, JMAP_UNINITIALIZED, "Memory allocation for trace key failed");
+                return false;
+            }
+            reader->key = key;
+            reader->key_capacity = key_length + 1;
+        }
+        if (fread(reader->key, 1, key_length, reader->file) != key_length) {
+            create_return_error(NULL, JMAP_IO_ERROR, "Truncated trace record");
+            return false;
+        }
+        reader->key[key_length] = '\0';
+        record->key = reader->key;
+    }
+    reader->timestamp_ns += delta;
+    record->op = (JMAP_TRACE_OP)op;
+    record->timestamp_ns = reader->timestamp_ns;
+    record->key_hash = hash;
+    record->key_length = (uint32_t)key_length;
+    reset_error_trace();
+    return true;
+}
+
+static void trace_reader_close(JMAP_TRACE_READER *reader) {
+    if (!reader) return;
+    fclose(reader->file);
+    free(reader->key);
+    free(reader);
+}
+
+JMAP_TRACE_INTERFACE jmap_trace = {
+    .start = trace_start,
+    .stop = trace_stop,
+    .open = trace_open,
+    .next = trace_next,
+    .close = trace_reader_close,
+};
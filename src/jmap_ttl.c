@@ -0,0 +1,308 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <time.h>
+
+/*
+ * Per-entry expiration.
+ * Slots carrying a TTL are chained in the buckets of a hierarchical timer wheel laid out like the
+ * Linux timer wheel: 64 buckets per level, each level 8 times coarser than the one below, 1 tick = 1 ms.
+ * Entries are never cascaded between levels. A bucket is only looked at once all of its entries are due,
+ * so an entry is reclaimed at most 1/8 of its TTL late. get and contains_key check the deadline
+ * themselves, lateness only delays the release of memory.
+ *
+ * Bucket lists are circular and doubly linked. The links live in side arrays indexed by slot, index
+ * capacity + b being the head of bucket b, so linking, unlinking and relocating an entry are O(1).
+ */
+
+#define TTL_LVL_BITS 6
+#define TTL_LVL_SIZE (1u << TTL_LVL_BITS)
+#define TTL_LVL_MASK (TTL_LVL_SIZE - 1)
+#define TTL_CLK_SHIFT 3
+#define TTL_CLK_MASK ((1u << TTL_CLK_SHIFT) - 1)
+#define TTL_LEVELS 8
+#define TTL_BUCKETS (TTL_LEVELS * TTL_LVL_SIZE)
+#define TTL_LVL_SHIFT(n) ((n) * TTL_CLK_SHIFT)
+#define TTL_LVL_GRAN(n) (1u << TTL_LVL_SHIFT(n))
+#define TTL_LVL_START(n) ((TTL_LVL_SIZE - 1) << (((n) - 1) * TTL_CLK_SHIFT))
+#define TTL_CUTOFF TTL_LVL_START(TTL_LEVELS)
+#define TTL_WHEEL_MAX (TTL_CUTOFF - TTL_LVL_GRAN(TTL_LEVELS - 1))
+#define TTL_NONE SIZE_MAX
+
+struct JMAP_TTL {
+    uint32_t *expire;           // Deadline of each slot, in ticks since `epoch_ms`
+    size_t *prev;               // capacity + TTL_BUCKETS links, TTL_NONE for slots without TTL
+    size_t *next;
+    size_t capacity;
+    uint64_t occupied[TTL_LEVELS]; // One bit per non-empty bucket
+    uint64_t epoch_ms;
+    uint32_t clk;               // Next tick to process
+    size_t count;               // Entries carrying a TTL
+    // Arrays reserved by ttl_reserve for the next ttl_on_resize
+    uint32_t *new_expire;
+    size_t *new_prev;
+    size_t *new_next;
+    size_t new_capacity;
+    JMAP_ALLOCATOR allocator;
+};
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static inline uint32_t ttl_now(const JMAP_TTL *ttl) {
+    return (uint32_t)(monotonic_ms() - ttl->epoch_ms);
+}
+
+static inline bool ttl_linked(const JMAP_TTL *ttl, size_t idx) {
+    return ttl->prev[idx] != TTL_NONE;
+}
+
+static unsigned ttl_index_at(uint32_t expires, unsigned lvl) {
+    expires = (expires + TTL_LVL_GRAN(lvl)) >> TTL_LVL_SHIFT(lvl);
+    return lvl * TTL_LVL_SIZE + (expires & TTL_LVL_MASK);
+}
+
+// Bucket of a deadline relative to the wheel clock, rounded up so that the bucket never fires early
+static unsigned ttl_bucket(const JMAP_TTL *ttl, uint32_t expires) {
+    uint32_t delta = expires - ttl->clk;
+    if ((int32_t)delta < 0) return ttl->clk & TTL_LVL_MASK;
+    for (unsigned lvl = 0; lvl < TTL_LEVELS - 1; lvl++) {
+        if (delta < TTL_LVL_START(lvl + 1)) return ttl_index_at(expires, lvl);
+    }
+    if (delta >= TTL_CUTOFF) expires = ttl->clk + TTL_WHEEL_MAX;
+    return ttl_index_at(expires, TTL_LEVELS - 1);
+}
+
+static void ttl_link(JMAP_TTL *ttl, size_t idx) {
+    unsigned bucket = ttl_bucket(ttl, ttl->expire[idx]);
+    size_t head = ttl->capacity + bucket;
+    ttl->prev[idx] = head;
+    ttl->next[idx] = ttl->next[head];
+    ttl->prev[ttl->next[head]] = idx;
+    ttl->next[head] = idx;
+    ttl->occupied[bucket / TTL_LVL_SIZE] |= (uint64_t)1 << (bucket % TTL_LVL_SIZE);
+}
+
+static void ttl_unlink(JMAP_TTL *ttl, size_t idx) {
+    size_t prev = ttl->prev[idx], next = ttl->next[idx];
+    ttl->next[prev] = next;
+    ttl->prev[next] = prev;
+    ttl->prev[idx] = ttl->next[idx] = TTL_NONE;
+    // prev == next only when a bucket head is left alone
+    if (prev == next && prev >= ttl->capacity) {
+        size_t bucket = prev - ttl->capacity;
+        ttl->occupied[bucket / TTL_LVL_SIZE] &= ~((uint64_t)1 << (bucket % TTL_LVL_SIZE));
+    }
+}
+
+static void ttl_init_links(size_t *prev, size_t *next, size_t capacity) {
+    for (size_t i = 0; i < capacity; i++) prev[i] = next[i] = TTL_NONE;
+    for (size_t b = capacity; b < capacity + TTL_BUCKETS; b++) prev[b] = next[b] = b;
+}
+
+// Frees the three arrays of a table of the given capacity
+static void ttl_free_arrays(const JMAP_TTL *ttl, uint32_t *expire, size_t *prev, size_t *next, size_t capacity) {
+    allocator_free(&ttl->allocator, expire, capacity * sizeof(uint32_t));
+    allocator_free(&ttl->allocator, prev, (capacity + TTL_BUCKETS) * sizeof(size_t));
+    allocator_free(&ttl->allocator, next, (capacity + TTL_BUCKETS) * sizeof(size_t));
+}
+
+JMAP_TTL *ttl_create(const JMAP *map) {
+    JMAP_TTL *ttl = allocator_calloc(&map->_allocator, 1, sizeof(JMAP_TTL));
+    if (!ttl) return NULL;
+    ttl->allocator = map->_allocator;
+    ttl->capacity = map->_capacity;
+    ttl->expire = allocator_alloc(&ttl->allocator, ttl->capacity * sizeof(uint32_t));
+    ttl->prev = allocator_alloc(&ttl->allocator, (ttl->capacity + TTL_BUCKETS) * sizeof(size_t));
+    ttl->next = allocator_alloc(&ttl->allocator, (ttl->capacity + TTL_BUCKETS) * sizeof(size_t));
+    if (!ttl->expire || !ttl->prev || !ttl->next) {
+        ttl_free_arrays(ttl, ttl->expire, ttl->prev, ttl->next, ttl->capacity);
+        allocator_free(&map->_allocator, ttl, sizeof(JMAP_TTL));
+        return NULL;
+    }
+    ttl_init_links(ttl->prev, ttl->next, ttl->capacity);
+    ttl->epoch_ms = monotonic_ms();
+    return ttl;
+}
+
+// Copy of the deadlines and wheel of ttl, for a clone laid out slot for slot like the map
+JMAP_TTL *ttl_clone(const JMAP_TTL *ttl) {
+    JMAP_TTL *copy = allocator_calloc(&ttl->allocator, 1, sizeof(JMAP_TTL));
+    if (!copy) return NULL;
+    *copy = *ttl;
+    copy->new_expire = NULL;
+    copy->new_prev = copy->new_next = NULL;
+    copy->new_capacity = 0;
+    copy->expire = allocator_alloc(&copy->allocator, copy->capacity * sizeof(uint32_t));
+    copy->prev = allocator_alloc(&copy->allocator, (copy->capacity + TTL_BUCKETS) * sizeof(size_t));
+    copy->next = allocator_alloc(&copy->allocator, (copy->capacity + TTL_BUCKETS) * sizeof(size_t));
+    if (!copy->expire || !copy->prev || !copy->next) {
+        ttl_free_arrays(copy, copy->expire, copy->prev, copy->next, copy->capacity);
+        allocator_free(&ttl->allocator, copy, sizeof(JMAP_TTL));
+        return NULL;
+    }
+    memcpy(copy->expire, ttl->expire, copy->capacity * sizeof(uint32_t));
+    memcpy(copy->prev, ttl->prev, (copy->capacity + TTL_BUCKETS) * sizeof(size_t));
+    memcpy(copy->next, ttl->next, (copy->capacity + TTL_BUCKETS) * sizeof(size_t));
+    return copy;
+}
+
+void ttl_release(JMAP *map) {
+    JMAP_TTL *ttl = map->_ttl;
+    if (!ttl) return;
+    map->_ttl = NULL;
+    ttl_free_arrays(ttl, ttl->expire, ttl->prev, ttl->next, ttl->capacity);
+    ttl_free_arrays(ttl, ttl->new_expire, ttl->new_prev, ttl->new_next, ttl->new_capacity);
+    JMAP_ALLOCATOR allocator = ttl->allocator;
+    allocator_free(&allocator, ttl, sizeof(JMAP_TTL));
+}
+
+size_t ttl_table_bytes(size_t capacity) {
+    return capacity * (sizeof(uint32_t) + 2 * sizeof(size_t)) + TTL_BUCKETS * 2 * sizeof(size_t);
+}
+
+void ttl_schedule(JMAP_TTL *ttl, size_t idx, uint32_t ttl_ms) {
+    if (ttl_linked(ttl, idx)) ttl_unlink(ttl, idx);
+    else ttl->count++;
+    ttl->expire[idx] = ttl_now(ttl) + ttl_ms;
+    ttl_link(ttl, idx);
+}
+
+// Milliseconds left before slot idx expires (at least 1 once due), 0 if it has no TTL
+uint64_t ttl_remaining_ms(const JMAP_TTL *ttl, size_t idx) {
+    if (!ttl_linked(ttl, idx)) return 0;
+    int32_t left = (int32_t)(ttl->expire[idx] - ttl_now(ttl));
+    return left > 0 ? (uint64_t)left : 1;
+}
+
+bool ttl_is_expired(const JMAP_TTL *ttl, size_t idx) {
+    return ttl_linked(ttl, idx) && (int32_t)(ttl->expire[idx] - ttl_now(ttl)) <= 0;
+}
+
+void ttl_on_erase(JMAP_TTL *ttl, size_t idx) {
+    if (!ttl_linked(ttl, idx)) return;
+    ttl_unlink(ttl, idx);
+    ttl->count--;
+}
+
+void ttl_on_move(JMAP_TTL *ttl, size_t from, size_t to) {
+    if (!ttl_linked(ttl, from)) return;
+    size_t prev = ttl->prev[from], next = ttl->next[from];
+    ttl->expire[to] = ttl->expire[from];
+    ttl->prev[to] = prev;
+    ttl->next[to] = next;
+    ttl->next[prev] = to;
+    ttl->prev[next] = to;
+    ttl->prev[from] = ttl->next[from] = TTL_NONE;
+}
+
+void ttl_on_clear(JMAP_TTL *ttl) {
+    ttl_init_links(ttl->prev, ttl->next, ttl->capacity);
+    memset(ttl->occupied, 0, sizeof(ttl->occupied));
+    ttl->count = 0;
+}
+
+// Allocates the arrays of the next resize up front, so that ttl_on_resize cannot fail halfway
+bool ttl_reserve(JMAP_TTL *ttl, size_t new_capacity) {
+    ttl_free_arrays(ttl, ttl->new_expire, ttl->new_prev, ttl->new_next, ttl->new_capacity);
+    ttl->new_capacity = new_capacity;
+    ttl->new_expire = allocator_alloc(&ttl->allocator, new_capacity * sizeof(uint32_t));
+    ttl->new_prev = allocator_alloc(&ttl->allocator, (new_capacity + TTL_BUCKETS) * sizeof(size_t));
+    ttl->new_next = allocator_alloc(&ttl->allocator, (new_capacity + TTL_BUCKETS) * sizeof(size_t));
+    if (!ttl->new_expire || !ttl->new_prev || !ttl->new_next) {
+        ttl_free_arrays(ttl, ttl->new_expire, ttl->new_prev, ttl->new_next, new_capacity);
+        ttl->new_expire = NULL;
+        ttl->new_prev = ttl->new_next = NULL;
+        return false;
+    }
+    return true;
+}
+
+static inline size_t ttl_remap(const JMAP_TTL *ttl, const size_t *remap, size_t link, size_t new_capacity) {
+    return link >= ttl->capacity ? link - ttl->capacity + new_capacity : remap[link];
+}
+
+// `remap[old_slot]` is the new slot of every occupied old slot. Bucket membership is kept as is.
+void ttl_on_resize(JMAP_TTL *ttl, const size_t *remap, size_t new_capacity) {
+    uint32_t *expire = ttl->new_expire;
+    size_t *prev = ttl->new_prev, *next = ttl->new_next;
+    for (size_t i = 0; i < new_capacity; i++) prev[i] = next[i] = TTL_NONE;
+
+    // Old slots are walked in order and their links translated, rather than following the lists
+    for (size_t old = 0; old < ttl->capacity; old++) {
+        if (!ttl_linked(ttl, old)) continue;
+        size_t idx = remap[old];
+        expire[idx] = ttl->expire[old];
+        prev[idx] = ttl_remap(ttl, remap, ttl->prev[old], new_capacity);
+        next[idx] = ttl_remap(ttl, remap, ttl->next[old], new_capacity);
+    }
+    for (size_t b = 0; b < TTL_BUCKETS; b++) {
+        size_t old_head = ttl->capacity + b;
+        prev[new_capacity + b] = ttl_remap(ttl, remap, ttl->prev[old_head], new_capacity);
+        next[new_capacity + b] = ttl_remap(ttl, remap, ttl->next[old_head], new_capacity);
+    }
+
+    ttl_free_arrays(ttl, ttl->expire, ttl->prev, ttl->next, ttl->capacity);
+    ttl->expire = expire;
+    ttl->prev = prev;
+    ttl->next = next;
+    ttl->capacity = new_capacity;
+    ttl->new_expire = NULL;
+    ttl->new_prev = ttl->new_next = NULL;
+}
+
+// Removes the due entries of one bucket. Returns false if the work budget ran out first.
+static bool ttl_fire(JMAP *self, unsigned bucket, size_t *removed, size_t max_work) {
+    JMAP_TTL *ttl = self->_ttl;
+    size_t head = ttl->capacity + bucket;
+    size_t idx = ttl->next[head];
+    while (idx != head) {
+        if (*removed >= max_work) return false;
+        if ((int32_t)(ttl->expire[idx] - ttl->clk) <= 0) {
+            map_erase_at(self, idx);
+            (*removed)++;
+            // The backward shift may have relocated entries of this bucket, start over from the head
+            idx = ttl->next[head];
+        } else {
+            // Deadline beyond the wheel range: put it back further away
+            size_t next = ttl->next[idx];
+            ttl_unlink(ttl, idx);
+            ttl_link(ttl, idx);
+            idx = next;
+        }
+    }
+    return true;
+}
+
+size_t ttl_expire(JMAP *self, size_t max_work) {
+    JMAP_TTL *ttl = self->_ttl;
+    size_t removed = 0;
+    uint32_t now = ttl_now(ttl);
+
+    while ((int32_t)(now - ttl->clk) >= 0) {
+        if (ttl->count == 0) {
+            ttl->clk = now + 1;
+            break;
+        }
+
+        uint32_t clk = ttl->clk;
+        for (unsigned lvl = 0; lvl < TTL_LEVELS; lvl++) {
+            unsigned bucket = lvl * TTL_LVL_SIZE + (clk & TTL_LVL_MASK);
+            if ((ttl->occupied[lvl] >> (bucket % TTL_LVL_SIZE)) & 1) {
+                if (!ttl_fire(self, bucket, &removed, max_work)) return removed;
+            }
+            if (clk & TTL_CLK_MASK) break;
+            clk >>= TTL_CLK_SHIFT;
+        }
+
+        // Levels below the first non-empty one are only looked at on multiples of its granularity
+        unsigned lvl = 0;
+        while (lvl < TTL_LEVELS - 1 && !ttl->occupied[lvl]) lvl++;
+        uint32_t step = TTL_LVL_GRAN(lvl);
+        uint32_t next = (ttl->clk | (step - 1)) + 1;
+        ttl->clk = (int32_t)(next - (now + 1)) > 0 ? now + 1 : next;
+    }
+    return removed;
+}
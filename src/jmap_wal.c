@@ -0,0 +1,571 @@
+#include "../inc/jmap.h"
+#include "jmap_internal.h"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "third_party/murmur3-master/murmur3.h"
+
+/*
+ * Write-ahead log.
+ *
+ * The caller thread only appends encoded records to an in-memory buffer. A writer thread
+ * wakes up when records are pending, waits for the group commit window, then writes the
+ * whole batch and issues a single fdatasync for it.
+ *
+ * Log file    : "JMAPWAL1" | u64 elem_size | records...
+ * Record      : u8 op | u32 key_len | key | value (PUT and PUT_TTL) | u64 deadline (PUT_TTL only) | u32 checksum
+ * Snapshot    : "JMAPSNP2" | u64 elem_size | u64 count | (u32 key_len | key | value | u64 deadline)... | u32 checksum
+ *
+ * Deadlines are wall clock times in ms since the epoch (0 = no TTL in snapshots), so that they survive a
+ * restart. Entries whose deadline has passed are dropped on replay. "JMAPSNP1" snapshots, written before
+ * deadlines were kept, are still loaded.
+ *
+ * Replay loads `<path>.snap` if present, then the log. A torn or corrupted tail left by a
+ * crash is cut off at the last valid record.
+ */
+
+#define WAL_MAGIC "JMAPWAL1"
+#define SNAPSHOT_MAGIC "JMAPSNP2"
+#define SNAPSHOT_MAGIC_NO_TTL "JMAPSNP1"
+#define WAL_HEADER_SIZE (8 + sizeof(uint64_t))
+#define WAL_CHECKSUM_SEED 0x57414c31u
+#define WAL_MAX_KEY_LENGTH (64u << 20)
+
+enum {
+    WAL_OP_PUT = 1,
+    WAL_OP_REMOVE = 2,
+    WAL_OP_CLEAR = 3,
+    WAL_OP_PUT_TTL = 4,
+};
+
+struct JMAP_WAL {
+    int fd;
+    char *path;
+    char *snapshot_path;
+    size_t elem_size;
+    JMAP_WAL_CONFIG config;
+
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // Signals the writer that records are pending
+    pthread_cond_t durable;     // Signals waiters after each fdatasync
+
+    char *buffer;               // Records appended by the caller
+    size_t buffer_length;
+    size_t buffer_capacity;
+    char *flushing;             // Records being written by the writer thread
+    size_t flushing_capacity;
+    bool flush_in_progress;
+
+    uint64_t appended_bytes;
+    uint64_t durable_bytes;
+    bool sync_requested;
+    bool stop;
+    int io_errno;
+};
+
+static uint32_t wal_checksum(const void *data, size_t length) {
+    uint32_t hash;
+    MurmurHash3_x86_32(data, (int)length, WAL_CHECKSUM_SEED, &hash);
+    return hash;
+}
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Deadline of an entry with ttl_ms left to live, 0 without TTL
+static inline uint64_t wal_deadline(uint64_t ttl_ms) {
+    return ttl_ms ? wall_clock_ms() + ttl_ms : 0;
+}
+
+// Puts key into map with the TTL left until deadline (0: none), or removes it if the deadline has passed
+static void wal_restore(JMAP *map, const char *key, const void *value, uint64_t deadline) {
+    uint64_t now = deadline ? wall_clock_ms() : 0;
+    if (!deadline) {
+        jmap.put(map, key, value);
+    } else if (deadline > now) {
+        uint64_t ttl_ms = deadline - now;
+        jmap.put_with_ttl(map, key, value, ttl_ms < INT32_MAX ? ttl_ms : INT32_MAX);
+    } else {
+        // An absent key is not an error here
+        jmap.remove(map, key);
+        reset_error_trace();
+    }
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *ptr = data;
+    while (length > 0) {
+        ssize_t written = write(fd, ptr, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ptr += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static void *wal_writer(void *arg) {
+    JMAP_WAL *wal = arg;
+
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        if (wal->buffer_length == 0) {
+            if (wal->stop) break;
+            pthread_cond_wait(&wal->wake, &wal->lock);
+            continue;
+        }
+
+        // Group commit: let more records join the batch unless someone is waiting for it
+        if (!wal->stop && !wal->sync_requested && wal->buffer_length < wal->config.buffer_size) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wal->config.group_commit_interval_ms / 1000;
+            deadline.tv_nsec += (long)(wal->config.group_commit_interval_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wal->wake, &wal->lock, &deadline);
+            if (wal->buffer_length == 0) continue;
+        }
+
+        char *batch = wal->buffer;
+        size_t batch_length = wal->buffer_length;
+        size_t batch_capacity = wal->buffer_capacity;
+        uint64_t target = wal->appended_bytes;
+        wal->buffer = wal->flushing;
+        wal->buffer_capacity = wal->flushing_capacity;
+        wal->buffer_length = 0;
+        wal->flushing = batch;
+        wal->flushing_capacity = batch_capacity;
+        wal->sync_requested = false;
+        wal->flush_in_progress = true;
+        pthread_mutex_unlock(&wal->lock);
+
+        int err = 0;
+        if (!write_all(wal->fd, batch, batch_length) || fdatasync(wal->fd) != 0) err = errno;
+
+        pthread_mutex_lock(&wal->lock);
+        if (err) wal->io_errno = err;
+        wal->flush_in_progress = false;
+        wal->durable_bytes = target;
+        pthread_cond_broadcast(&wal->durable);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+// Must be called with wal->lock held
+static char *wal_reserve(JMAP_WAL *wal, size_t length) {
+    if (wal->buffer_length + length > wal->buffer_capacity) {
+        size_t capacity = wal->buffer_capacity ? wal->buffer_capacity : 4096;
+        while (capacity < wal->buffer_length + length) capacity *= 2;
+        char *buffer = realloc(wal->buffer, capacity);
+        if (!buffer) return NULL;
+        wal->buffer = buffer;
+        wal->buffer_capacity = capacity;
+    }
+    return wal->buffer + wal->buffer_length;
+}
+
+static void wal_append(JMAP_WAL *wal, uint8_t op, const char *key, const void *value, uint64_t deadline) {
+    uint32_t key_length = key ? (uint32_t)strlen(key) : 0;
+    size_t value_length = op == WAL_OP_PUT || op == WAL_OP_PUT_TTL ? wal->elem_size : 0;
+    size_t deadline_length = op == WAL_OP_PUT_TTL ? sizeof(deadline) : 0;
+    size_t length = 1 + (op == WAL_OP_CLEAR ? 0 : sizeof(uint32_t) + key_length) + value_length + deadline_length + sizeof(uint32_t);
+
+    pthread_mutex_lock(&wal->lock);
+    char *record = wal_reserve(wal, length);
+    if (!record) {
+        wal->io_errno = ENOMEM;
+        pthread_mutex_unlock(&wal->lock);
+        return;
+    }
+    char *ptr = record;
+    *ptr++ = (char)op;
+    if (op != WAL_OP_CLEAR) {
+        memcpy(ptr, &key_length, sizeof(key_length));
+        ptr += sizeof(key_length);
+        memcpy(ptr, key, key_length);
+        ptr += key_length;
+    }
+    if (value_length) {
+        memcpy(ptr, value, value_length);
+        ptr += value_length;
+    }
+    if (deadline_length) {
+        memcpy(ptr, &deadline, deadline_length);
+        ptr += deadline_length;
+    }
+    uint32_t checksum = wal_checksum(record, (size_t)(ptr - record));
+    memcpy(ptr, &checksum, sizeof(checksum));
+
+    bool was_empty = wal->buffer_length == 0;
+    wal->buffer_length += length;
+    wal->appended_bytes += length;
+    if (was_empty || wal->buffer_length >= wal->config.buffer_size)
+        pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+// ttl_ms is the time the entry has left to live, 0 if it has no TTL
+void wal_log_put(JMAP_WAL *wal, const char *key, const void *value, uint64_t ttl_ms) {
+    if (ttl_ms) wal_append(wal, WAL_OP_PUT_TTL, key, value, wal_deadline(ttl_ms));
+    else wal_append(wal, WAL_OP_PUT, key, value, 0);
+}
+
+void wal_log_remove(JMAP_WAL *wal, const char *key) {
+    wal_append(wal, WAL_OP_REMOVE, key, NULL, 0);
+}
+
+void wal_log_clear(JMAP_WAL *wal) {
+    wal_append(wal, WAL_OP_CLEAR, NULL, NULL, 0);
+}
+
+// Blocks until every record appended so far is on disk. Returns the writer's errno, 0 on success.
+static int wal_wait_durable(JMAP_WAL *wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t target = wal->appended_bytes;
+    wal->sync_requested = true;
+    pthread_cond_signal(&wal->wake);
+    while (wal->durable_bytes < target && wal->io_errno == 0)
+        pthread_cond_wait(&wal->durable, &wal->lock);
+    int err = wal->io_errno;
+    pthread_mutex_unlock(&wal->lock);
+    return err;
+}
+
+static void wal_destroy(JMAP_WAL *wal) {
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->wake);
+    pthread_cond_destroy(&wal->durable);
+    if (wal->fd >= 0) close(wal->fd);
+    free(wal->buffer);
+    free(wal->flushing);
+    free(wal->path);
+    free(wal->snapshot_path);
+    free(wal);
+}
+
+void wal_release(JMAP *map) {
+    JMAP_WAL *wal = map->_wal;
+    if (!wal) return;
+    map->_wal = NULL;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = true;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->writer, NULL);
+    wal_destroy(wal);
+}
+
+static void fsync_parent_dir(const char *path) {
+    char *dir = strdup(path);
+    if (!dir) return;
+    char *slash = strrchr(dir, '/');
+    if (slash == dir) slash[1] = '\0';
+    else if (slash) *slash = '\0';
+    else strcpy(dir, ".");
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// Slots written by a snapshot: entries whose TTL has not run out
+static inline bool snapshot_keeps(const JMAP *map, size_t idx) {
+    return map->keys[idx] && !(map->_ttl && ttl_is_expired(map->_ttl, idx));
+}
+
+// Writes the entries of map to path atomically (temporary file, fsync, rename)
+bool wal_write_snapshot(const JMAP *map, const char *path) {
+    size_t tmp_length = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_length);
+    if (!tmp_path) return false;
+    snprintf(tmp_path, tmp_length, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(tmp_path);
+        return false;
+    }
+
+    // Expired entries not reclaimed yet are left out, the count in the header must match
+    uint64_t elem_size = map->_elem_size, count = 0;
+    for (size_t i = 0; i < map->_capacity; i++) count += snapshot_keeps(map, i);
+    uint32_t checksum = WAL_CHECKSUM_SEED;
+    bool ok = fwrite(SNAPSHOT_MAGIC, 1, 8, file) == 8
+        && fwrite(&elem_size, sizeof(elem_size), 1, file) == 1
+        && fwrite(&count, sizeof(count), 1, file) == 1;
+    for (size_t i = 0; ok && i < map->_capacity; i++) {
+        if (!snapshot_keeps(map, i)) continue;
+        uint32_t key_length = (uint32_t)strlen(map->keys[i]);
+        const char *value = (const char*)map->data + i * map->_elem_size;
+        uint64_t deadline = wal_deadline(map->_ttl ? ttl_remaining_ms(map->_ttl, i) : 0);
+        ok = fwrite(&key_length, sizeof(key_length), 1, file) == 1
+            && fwrite(map->keys[i], 1, key_length, file) == key_length
+            && fwrite(value, 1, map->_elem_size, file) == map->_elem_size
+            && fwrite(&deadline, sizeof(deadline), 1, file) == 1;
+        checksum ^= wal_checksum(map->keys[i], key_length) ^ wal_checksum(value, map->_elem_size)
+                  ^ wal_checksum(&deadline, sizeof(deadline));
+    }
+    ok = ok && fwrite(&checksum, sizeof(checksum), 1, file) == 1
+        && fflush(file) == 0
+        && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) unlink(tmp_path);
+    else fsync_parent_dir(path);
+    free(tmp_path);
+    return ok;
+}
+
+// Puts the entries of the snapshot at path into map. A missing file counts as an empty snapshot.
+bool wal_load_snapshot(JMAP *map, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return errno == ENOENT;
+
+    char magic[8];
+    uint64_t elem_size = 0, count = 0;
+    bool ok = fread(magic, 1, 8, file) == 8
+        && (memcmp(magic, SNAPSHOT_MAGIC, 8) == 0 || memcmp(magic, SNAPSHOT_MAGIC_NO_TTL, 8) == 0)
+        && fread(&elem_size, sizeof(elem_size), 1, file) == 1
+        && elem_size == map->_elem_size
+        && fread(&count, sizeof(count), 1, file) == 1;
+
+    bool has_deadlines = ok && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    char *key = NULL;
+    void *value = malloc(map->_elem_size ? map->_elem_size : 1);
+    uint32_t checksum = WAL_CHECKSUM_SEED, expected = 0;
+    ok = ok && value;
+    for (uint64_t i = 0; ok && i < count; i++) {
+        uint32_t key_length = 0;
+        ok = fread(&key_length, sizeof(key_length), 1, file) == 1 && key_length > 0 && key_length <= WAL_MAX_KEY_LENGTH;
+        if (!ok) break;
+        char *tmp = realloc(key, key_length + 1);
+        ok = tmp != NULL;
+        if (!ok) break;
+        key = tmp;
+        uint64_t deadline = 0;
+        ok = fread(key, 1, key_length, file) == key_length
+            && fread(value, 1, map->_elem_size, file) == map->_elem_size
+            && (!has_deadlines || fread(&deadline, sizeof(deadline), 1, file) == 1);
+        if (!ok) break;
+        key[key_length] = '\0';
+        checksum ^= wal_checksum(key, key_length) ^ wal_checksum(value, map->_elem_size);
+        if (has_deadlines) checksum ^= wal_checksum(&deadline, sizeof(deadline));
+        wal_restore(map, key, value, deadline);
+        ok = !jmap_last_error_trace.has_error;
+    }
+    ok = ok && fread(&expected, sizeof(expected), 1, file) == 1 && expected == checksum;
+
+    free(key);
+    free(value);
+    fclose(file);
+    return ok;
+}
+
+// Applies the log to the map and returns the offset of the end of the last valid record
+static off_t replay_log(JMAP *map, int fd) {
+    FILE *file = fdopen(dup(fd), "rb");
+    if (!file) return -1;
+
+    char header[WAL_HEADER_SIZE];
+    uint64_t elem_size;
+    // A missing or partially written header means the log was just created
+    if (fread(header, 1, WAL_HEADER_SIZE, file) != WAL_HEADER_SIZE) {
+        fclose(file);
+        return 0;
+    }
+    memcpy(&elem_size, header + 8, sizeof(elem_size));
+    if (memcmp(header, WAL_MAGIC, 8) != 0 || elem_size != map->_elem_size) {
+        fclose(file);
+        return -1;
+    }
+
+    off_t valid = WAL_HEADER_SIZE;
+    size_t record_capacity = 1 + sizeof(uint32_t) + map->_elem_size + sizeof(uint32_t) + 64;
+    char *record = malloc(record_capacity);
+    while (record) {
+        int op = fgetc(file);
+        if (op != WAL_OP_PUT && op != WAL_OP_REMOVE && op != WAL_OP_CLEAR && op != WAL_OP_PUT_TTL) break;
+
+        size_t length = 1;
+        uint32_t key_length = 0;
+        record[0] = (char)op;
+        if (op != WAL_OP_CLEAR) {
+            if (fread(&key_length, sizeof(key_length), 1, file) != 1 || key_length == 0 || key_length > WAL_MAX_KEY_LENGTH) break;
+            memcpy(record + 1, &key_length, sizeof(key_length));
+            length += sizeof(key_length);
+        }
+        size_t value_length = op == WAL_OP_PUT || op == WAL_OP_PUT_TTL ? map->_elem_size : 0;
+        size_t deadline_length = op == WAL_OP_PUT_TTL ? sizeof(uint64_t) : 0;
+        size_t needed = length + key_length + 1 + value_length + deadline_length + sizeof(uint32_t);
+        if (needed > record_capacity) {
+            char *tmp = realloc(record, needed);
+            if (!tmp) break;
+            record = tmp;
+            record_capacity = needed;
+        }
+        char *key = record + length;
+        if (fread(key, 1, key_length, file) != key_length) break;
+        length += key_length;
+        void *value = record + length;
+        if (fread(value, 1, value_length, file) != value_length) break;
+        length += value_length;
+        uint64_t deadline = 0;
+        if (fread(record + length, 1, deadline_length, file) != deadline_length) break;
+        memcpy(&deadline, record + length, deadline_length);
+        length += deadline_length;
+        uint32_t checksum;
+        if (fread(&checksum, sizeof(checksum), 1, file) != 1 || checksum != wal_checksum(record, length)) break;
+
+        // Keys are NUL-terminated in a copy so the checksum still covers the raw record
+        char *key_copy = malloc(key_length + 1);
+        if (!key_copy) break;
+        memcpy(key_copy, key, key_length);
+        key_copy[key_length] = '\0';
+        if (op == WAL_OP_PUT || op == WAL_OP_PUT_TTL) wal_restore(map, key_copy, value, deadline);
+        else if (op == WAL_OP_REMOVE) jmap.remove(map, key_copy);
+        else jmap.clear(map);
+        free(key_copy);
+
+        valid += (off_t)(length + sizeof(checksum));
+    }
+    free(record);
+    fclose(file);
+    return valid;
+}
+
+static void wal_open(JMAP *map, const char *path, JMAP_WAL_CONFIG config) {
+    if (!map->data || !map->keys)
+        return create_return_error(map, JMAP_UNINITIALIZED, "JMAP is uninitialized");
+    if (!path)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "Path cannot be NULL");
+    if (map->_data_type != JMAP_TYPE_VALUE)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "Only JMAP_TYPE_VALUE maps can be logged");
+    if (map->_wal)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "A write-ahead log is already attached");
+
+    JMAP_WAL *wal = calloc(1, sizeof(JMAP_WAL));
+    if (!wal)
+        return create_return_error(map, JMAP_UNINITIALIZED, "Memory allocation for write-ahead log failed");
+    wal->fd = -1;
+    wal->elem_size = map->_elem_size;
+    wal->config = config;
+    if (wal->config.buffer_size == 0) wal->config.buffer_size = JMAP_WAL_DEFAULT_CONFIG.buffer_size;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    pthread_cond_init(&wal->durable, NULL);
+
+    size_t snapshot_length = strlen(path) + 6;
+    wal->path = strdup(path);
+    wal->snapshot_path = malloc(snapshot_length);
+    if (!wal->path || !wal->snapshot_path) {
+        wal_destroy(wal);
+        return create_return_error(map, JMAP_UNINITIALIZED, "Memory allocation for write-ahead log failed");
+    }
+    snprintf(wal->snapshot_path, snapshot_length, "%s.snap", path);
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0) {
+        wal_destroy(wal);
+        return create_return_error(map, JMAP_IO_ERROR, "Cannot open \"%s\"", path);
+    }
+
+    if (!wal_load_snapshot(map, wal->snapshot_path)) {
+        wal_destroy(wal);
+        return create_return_error(map, JMAP_IO_ERROR, "Snapshot \"%s.snap\" is corrupted", path);
+    }
+    off_t valid = replay_log(map, wal->fd);
+    if (valid < 0) {
+        wal_destroy(wal);
+        return create_return_error(map, JMAP_IO_ERROR, "Cannot replay \"%s\"", path);
+    }
+
+    // Drop the torn tail (or write the header of a new log)
+    bool ok = true;
+    if (valid == 0) {
+        char header[WAL_HEADER_SIZE];
+        uint64_t elem_size = map->_elem_size;
+        memcpy(header, WAL_MAGIC, 8);
+        memcpy(header + 8, &elem_size, sizeof(elem_size));
+        ok = ftruncate(wal->fd, 0) == 0 && write_all(wal->fd, header, WAL_HEADER_SIZE) && fdatasync(wal->fd) == 0;
+    } else {
+        struct stat st;
+        ok = fstat(wal->fd, &st) == 0;
+        if (ok && st.st_size != valid)
+            ok = ftruncate(wal->fd, valid) == 0 && fdatasync(wal->fd) == 0;
+    }
+    if (!ok || pthread_create(&wal->writer, NULL, wal_writer, wal) != 0) {
+        wal_destroy(wal);
+        return create_return_error(map, JMAP_IO_ERROR, "Cannot start write-ahead log on \"%s\"", path);
+    }
+
+    map->_wal = wal;
+    reset_error_trace();
+}
+
+static void wal_sync(JMAP *map) {
+    if (!map->_wal)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "No write-ahead log attached");
+    int err = wal_wait_durable(map->_wal);
+    if (err)
+        return create_return_error(map, JMAP_IO_ERROR, "Write-ahead log failed: %s", strerror(err));
+    reset_error_trace();
+}
+
+static void wal_compact(JMAP *map) {
+    JMAP_WAL *wal = map->_wal;
+    if (!wal)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "No write-ahead log attached");
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->flush_in_progress)
+        pthread_cond_wait(&wal->durable, &wal->lock);
+
+    // Pending records are already applied to the map, the snapshot covers them
+    if (!wal_write_snapshot(map, wal->snapshot_path)) {
+        pthread_mutex_unlock(&wal->lock);
+        return create_return_error(map, JMAP_IO_ERROR, "Cannot write snapshot \"%s\"", wal->snapshot_path);
+    }
+    wal->buffer_length = 0;
+    wal->durable_bytes = wal->appended_bytes;
+    bool ok = ftruncate(wal->fd, WAL_HEADER_SIZE) == 0 && fdatasync(wal->fd) == 0;
+    pthread_cond_broadcast(&wal->durable);
+    pthread_mutex_unlock(&wal->lock);
+
+    if (!ok)
+        return create_return_error(map, JMAP_IO_ERROR, "Cannot truncate \"%s\"", wal->path);
+    reset_error_trace();
+}
+
+static void wal_close(JMAP *map) {
+    if (!map->_wal)
+        return create_return_error(map, JMAP_INVALID_ARGUMENT, "No write-ahead log attached");
+    int err = wal_wait_durable(map->_wal);
+    wal_release(map);
+    if (err)
+        return create_return_error(map, JMAP_IO_ERROR, "Write-ahead log failed: %s", strerror(err));
+    reset_error_trace();
+}
+
+JMAP_WAL_INTERFACE jmap_wal = {
+    .open = wal_open,
+    .sync = wal_sync,
+    .compact = wal_compact,
+    .close = wal_close,
+};
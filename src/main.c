@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include "third_party/murmur3-master/murmur3.h"
 
 void print_element_callback(const void *value) {
@@ -10,13 +11,6 @@ void print_element_callback(const void *value) {
     }
 }
 
-void divide_by_two_callback(const char *key, void *value, const void *ctx) {
-    (void)ctx; // Unused context pointer
-    (void)key; // Unused key pointer
-    int *int_value = (int*)value;
-    *int_value /= 2;
-}
-
 bool is_equal_callback(const void *a, const void *b) {
     return *(int*)a == *(int*)b;
 }
@@ -33,14 +27,11 @@ bool is_between(const char *key, const void *value, const void *ctx) {
 
 
 int main(void) {
-    JMAP map;
-
-    // Initialize the map with int values
-    JMAP_USER_CALLBACK_IMPLEMENTATION imp;
-    imp.print_element_callback = print_element_callback;
-    imp.is_equal_callback = is_equal_callback;
-    jmap.init(&map, sizeof(int), JMAP_TYPE_VALUE, imp);
+    // Initialize the map with int values (the preset makes the numeric functions available)
+    JMAP map = jmap.init_preset(JMAP_INT_PRESET);
     JMAP_CHECK_RET_RETURN;
+    map.user_callbacks.print_element_callback = print_element_callback;
+    map.user_callbacks.is_equal_callback = is_equal_callback;
 
     printf("Initial capacity: %zu\n", map._length);
 
@@ -130,11 +121,40 @@ int main(void) {
     free(values); // Free the values array
 
     printf("\n=== For each element, divide by two ===\n");
-    jmap.for_each(&map, divide_by_two_callback, NULL);
+    jmap_numeric.apply(&map, JMAP_APPLY_SCALE, 0.5, 0);
     JMAP_CHECK_RET_RETURN;
     jmap.print(&map);
     JMAP_CHECK_RET_RETURN;
 
+    printf("\n=== Long values beyond 2^53 keep their precision ===\n");
+    JMAP longs = jmap.init_preset(JMAP_LONG_PRESET);
+    JMAP_CHECK_RET_RETURN;
+    jmap.put(&longs, "big", JMAP_DIRECT_INPUT(long, 9007199254740993L));
+    JMAP_CHECK_RET_RETURN;
+    jmap_numeric.apply(&longs, JMAP_APPLY_CLAMP, 0, 1e19);
+    jmap_numeric.apply(&longs, JMAP_APPLY_SCALE, 1, 0);
+    jmap_numeric.apply(&longs, JMAP_APPLY_ADD, 1, 0);
+    long big = *(long*)jmap.get(&longs, "big");
+    size_t equal = jmap_numeric.count_if(&longs, JMAP_CMP_EQ, 9007199254740994.0);
+    printf("big -> %ld, count equal to 2^53 + 2 -> %zu\n", big, equal);
+    jmap.free(&longs);
+    if (big != 9007199254740994L || equal != 1) return EXIT_FAILURE;
+
+    printf("\n=== Increment saturates at the range of the type ===\n");
+    JMAP counters = jmap.init_preset(JMAP_INT_PRESET);
+    JMAP_CHECK_RET_RETURN;
+    jmap.put(&counters, "top", JMAP_DIRECT_INPUT(int, INT_MAX));
+    int top = *(int*)jmap.increment(&counters, "top", 1);
+    int bottom = *(int*)jmap.increment(&counters, "bottom", LLONG_MIN);
+    jmap.free(&counters);
+    counters = jmap.init_preset(JMAP_LONG_PRESET);
+    JMAP_CHECK_RET_RETURN;
+    jmap.put(&counters, "top", JMAP_DIRECT_INPUT(long, LONG_MAX));
+    long long_top = *(long*)jmap.increment(&counters, "top", LLONG_MAX);
+    jmap.free(&counters);
+    printf("INT_MAX + 1 -> %d, 0 + LLONG_MIN -> %d, LONG_MAX + LLONG_MAX -> %ld\n", top, bottom, long_top);
+    if (top != INT_MAX || bottom != INT_MIN || long_top != LONG_MAX) return EXIT_FAILURE;
+
     printf("\n=== Put if absent ===\n");
     jmap.put_if_absent(&map, "key5", JMAP_DIRECT_INPUT(int, 500));
     JMAP_CHECK_RET;
@@ -185,7 +205,7 @@ int main(void) {
     JMAP_CHECK_RET_RETURN;
 
     JMAP jmap_data;
-    jmap.init(&jmap_data, sizeof(int), JMAP_TYPE_VALUE, imp);
+    jmap.init(&jmap_data, sizeof(int), JMAP_TYPE_VALUE, map.user_callbacks);
     JMAP_CHECK_RET_RETURN;
 
     jmap.clear(&jmap_data);